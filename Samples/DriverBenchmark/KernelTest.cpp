@@ -0,0 +1,529 @@
+/**
+ * Cross-check of the pixel kernels of the virtual device driver.
+ *
+ * Every SIMD kernel in the kernel tables which the CPU supports runs on
+ * random rows of odd and even widths around the vector sizes, and the output
+ * is compared with the scalar kernel byte by byte, including the bytes after
+ * the row which must not be written. A variant which falls back to a
+ * kernel checked already is skipped.
+ *
+ * usage: KernelTest [-seed <n>] [-rows <n>]
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+// C Header
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL Header
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// OpenNI Header
+#include "OniCTypes.h"
+
+// Virtual Device Header
+#include "../../VirtualDevice/VirtualDevice.h"
+#include "../../VirtualDevice/PixelConverter.h"
+#include "../../VirtualDevice/PixelDepthFilter.h"
+#include "../../VirtualDevice/PixelMirror.h"
+#include "../../VirtualDevice/PixelPointCloud.h"
+#include "../../VirtualDevice/PixelRegistration.h"
+#include "../../VirtualDevice/PixelRemap.h"
+#include "../../VirtualDevice/PixelResize.h"
+#include "../../VirtualDevice/PixelRGBD.h"
+
+typedef std::vector<unsigned char> Buffer;
+
+/**
+ * The widths of rows, around the 8 / 16 / 32 / 64 bytes of vectors
+ */
+static const int	g_aWidth[]	= { 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100 };
+
+/**
+ * Bytes after the output rows, they are filled with the same value before
+ * both kernels run, so a write out of row is a difference
+ */
+static const size_t	GUARD_SIZE	= 64;
+
+#pragma region random input
+
+/**
+ * The random input of kernels, the same seed gives the same rows
+ */
+class RandomInput
+{
+public:
+	RandomInput( unsigned int uSeed ) : m_uState( uSeed == 0 ? 1 : uSeed )
+	{
+	}
+
+	unsigned int Next()
+	{
+		// xorshift32
+		m_uState ^= m_uState << 13;
+		m_uState ^= m_uState >> 17;
+		m_uState ^= m_uState << 5;
+		return m_uState;
+	}
+
+	int Range( int iMin, int iMax )
+	{
+		return iMin + int( Next() % unsigned( iMax - iMin + 1 ) );
+	}
+
+	float Range( float fMin, float fMax )
+	{
+		return fMin + ( fMax - fMin ) * ( Next() & 0xFFFF ) / 65535.0f;
+	}
+
+	/**
+	 * Random bytes, with the guard bytes after them
+	 */
+	Buffer Bytes( size_t uSize )
+	{
+		Buffer vData( uSize + GUARD_SIZE );
+		for( size_t i = 0; i < vData.size(); ++ i )
+			vData[i] = (unsigned char)( Next() >> 24 );
+		return vData;
+	}
+
+	/**
+	 * Depth of a scene in millimeter: a surface with noise, edges to far
+	 * pixels, and holes of 0
+	 */
+	Buffer Depth( size_t uPixels )
+	{
+		Buffer vData( uPixels * sizeof(OniDepthPixel) + GUARD_SIZE, 0 );
+		OniDepthPixel* pDepth = reinterpret_cast<OniDepthPixel*>( vData.data() );
+		int iBase = Range( 400, 4000 );
+		for( size_t i = 0; i < uPixels; ++ i )
+		{
+			int iKind = Range( 0, 15 );
+			if( iKind == 0 )
+				pDepth[i] = 0;
+			else if( iKind == 1 )
+				pDepth[i] = OniDepthPixel( Range( 0, 65535 ) );
+			else if( iKind == 2 )
+				pDepth[i] = OniDepthPixel( iBase + Range( 500, 3000 ) );
+			else
+				pDepth[i] = OniDepthPixel( iBase + Range( -40, 40 ) );
+		}
+		return vData;
+	}
+
+protected:
+	unsigned int	m_uState;
+};
+
+/**
+ * A target filled with the guard value
+ */
+inline Buffer Target( size_t uSize )
+{
+	return Buffer( uSize + GUARD_SIZE, 0xCD );
+}
+
+inline bool IsSame( const Buffer& rScalar, const Buffer& rResult )
+{
+	return rScalar.size() == rResult.size() && memcmp( rScalar.data(), rResult.data(), rScalar.size() ) == 0;
+}
+
+#pragma endregion
+
+#pragma region cross-check
+
+/**
+ * Run the kernels of a table and count the failures
+ */
+class KernelCheck
+{
+public:
+	KernelCheck( unsigned int uSeed, int iRows ) : m_Random( uSeed ), m_iRows( iRows ), m_iKernels( 0 ), m_iFailed( 0 )
+	{
+	}
+
+	/**
+	 * Compare all the variants of the kernel from funcGet( eVariant ) with
+	 * the scalar one; funcRun( funcScalar, func, iWidth ) runs both on the
+	 * same random row and returns if the outputs are the same.
+	 */
+	template<typename FUNC, typename GET, typename RUN>
+	void Check( const char* szKernel, GET funcGet, RUN funcRun )
+	{
+		FUNC funcScalar = funcGet( VIRTUAL_KERNEL_SCALAR );
+		if( funcScalar == NULL )
+			return;
+
+		std::vector<FUNC> vChecked( 1, funcScalar );
+
+		for( int i = VIRTUAL_KERNEL_SCALAR + 1; i < VIRTUAL_KERNEL_VARIANT_NUM; ++ i )
+		{
+			VirtualKernelVariant eVariant = VirtualKernelVariant( i );
+			if( !IsKernelVariantSupported( eVariant ) )
+				continue;
+
+			FUNC func = funcGet( eVariant );
+			if( func == NULL || std::find( vChecked.begin(), vChecked.end(), func ) != vChecked.end() )
+				continue;
+
+			vChecked.push_back( func );
+			++ m_iKernels;
+			int iFailedWidth = -1;
+			for( size_t w = 0; w < sizeof(g_aWidth) / sizeof(g_aWidth[0]) && iFailedWidth < 0; ++ w )
+			{
+				for( int r = 0; r < m_iRows; ++ r )
+				{
+					if( !funcRun( funcScalar, func, g_aWidth[w] ) )
+					{
+						iFailedWidth = g_aWidth[w];
+						break;
+					}
+				}
+			}
+
+			if( iFailedWidth < 0 )
+			{
+				printf( "%-32s %-8s ok\n", szKernel, GetKernelVariantName( eVariant ) );
+			}
+			else
+			{
+				printf( "%-32s %-8s FAILED at width %d\n", szKernel, GetKernelVariantName( eVariant ), iFailedWidth );
+				++ m_iFailed;
+			}
+		}
+	}
+
+	RandomInput& Random()
+	{
+		return m_Random;
+	}
+
+	int GetKernels() const	{ return m_iKernels; }
+	int GetFailed() const	{ return m_iFailed; }
+
+protected:
+	RandomInput	m_Random;
+	int			m_iRows;
+	int			m_iKernels;
+	int			m_iFailed;
+};
+
+struct FormatName
+{
+	OniPixelFormat	eFormat;
+	const char*		szName;
+};
+
+static const FormatName g_aFormat[] = {
+	{ ONI_PIXEL_FORMAT_DEPTH_1_MM,		"depth_1_mm" },
+	{ ONI_PIXEL_FORMAT_DEPTH_100_UM,	"depth_100_um" },
+	{ ONI_PIXEL_FORMAT_RGB888,			"rgb888" },
+	{ ONI_PIXEL_FORMAT_GRAY8,			"gray8" },
+	{ ONI_PIXEL_FORMAT_GRAY16,			"gray16" } };
+
+void CheckConverters( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+
+	const struct { VirtualInputFormat eInput; const char* szName; } aInput[] = {
+		{ VIRTUAL_INPUT_YUYV, "yuyv" }, { VIRTUAL_INPUT_UYVY, "uyvy" }, { VIRTUAL_INPUT_BGR, "bgr" }, { VIRTUAL_INPUT_BGRA, "bgra" } };
+	for( size_t i = 0; i < sizeof(aInput) / sizeof(aInput[0]); ++ i )
+	{
+		VirtualInputFormat eInput = aInput[i].eInput;
+		std::string sName = std::string( "convert " ) + aInput[i].szName;
+		rCheck.Check<PixelRowConverter>( sName.c_str(),
+			[&]( VirtualKernelVariant eVariant ) { return GetPixelConverter( eInput, ONI_PIXEL_FORMAT_RGB888, eVariant ); },
+			[&]( PixelRowConverter funcScalar, PixelRowConverter func, int iWidth ) {
+				Buffer vSource = rRandom.Bytes( GetInputPixelSize( eInput ) * iWidth );
+				Buffer vScalar = Target( iWidth * 3 ), vResult = Target( iWidth * 3 );
+				funcScalar( vSource.data(), vScalar.data(), iWidth );
+				func( vSource.data(), vResult.data(), iWidth );
+				return IsSame( vScalar, vResult );
+			} );
+	}
+
+	const OniPixelFormat aDepth[] = { ONI_PIXEL_FORMAT_DEPTH_100_UM, ONI_PIXEL_FORMAT_DEPTH_1_MM };
+	for( size_t i = 0; i < sizeof(aDepth) / sizeof(aDepth[0]); ++ i )
+	{
+		OniPixelFormat eOutput = aDepth[i];
+		rCheck.Check<DepthRowConverter>( eOutput == ONI_PIXEL_FORMAT_DEPTH_100_UM ? "convert depth to 100um" : "convert depth to 1mm",
+			[&]( VirtualKernelVariant eVariant ) { return GetDepthConverter( eOutput, eVariant ); },
+			[&]( DepthRowConverter funcScalar, DepthRowConverter func, int iWidth ) {
+				Buffer vSource = rRandom.Bytes( iWidth * sizeof(OniDepthPixel) );
+				Buffer vScalar = Target( iWidth * sizeof(OniDepthPixel) ), vResult = Target( iWidth * sizeof(OniDepthPixel) );
+				funcScalar( reinterpret_cast<const OniDepthPixel*>( vSource.data() ), reinterpret_cast<OniDepthPixel*>( vScalar.data() ), iWidth );
+				func( reinterpret_cast<const OniDepthPixel*>( vSource.data() ), reinterpret_cast<OniDepthPixel*>( vResult.data() ), iWidth );
+				return IsSame( vScalar, vResult );
+			} );
+	}
+}
+
+void CheckMirror( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	for( size_t i = 0; i < sizeof(g_aFormat) / sizeof(g_aFormat[0]); ++ i )
+	{
+		OniPixelFormat eFormat = g_aFormat[i].eFormat;
+		size_t uPixelSize = GetPixelSize( eFormat );
+		std::string sName = std::string( "mirror " ) + g_aFormat[i].szName;
+		rCheck.Check<PixelRowMirror>( sName.c_str(),
+			[&]( VirtualKernelVariant eVariant ) { return GetMirrorKernel( eFormat, eVariant ); },
+			[&]( PixelRowMirror funcScalar, PixelRowMirror func, int iWidth ) {
+				// to another row, and in place as the driver does
+				Buffer vSource = rRandom.Bytes( iWidth * uPixelSize );
+				Buffer vScalar = Target( iWidth * uPixelSize ), vResult = Target( iWidth * uPixelSize );
+				funcScalar( vSource.data(), vScalar.data(), iWidth );
+				func( vSource.data(), vResult.data(), iWidth );
+
+				Buffer vInPlaceScalar = vSource, vInPlace = vSource;
+				funcScalar( vInPlaceScalar.data(), vInPlaceScalar.data(), iWidth );
+				func( vInPlace.data(), vInPlace.data(), iWidth );
+				return IsSame( vScalar, vResult ) && IsSame( vInPlaceScalar, vInPlace );
+			} );
+	}
+}
+
+void CheckBlockReducers( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	const struct { VirtualDecimation eMode; const char* szName; } aMode[] = {
+		{ VIRTUAL_DECIMATION_NEAREST, "nearest" }, { VIRTUAL_DECIMATION_MIN, "min" },
+		{ VIRTUAL_DECIMATION_MEDIAN, "median" }, { VIRTUAL_DECIMATION_AVERAGE, "average" } };
+	for( size_t i = 0; i < sizeof(g_aFormat) / sizeof(g_aFormat[0]); ++ i )
+	{
+		for( size_t m = 0; m < sizeof(aMode) / sizeof(aMode[0]); ++ m )
+		{
+			for( int iFactor = 2; iFactor <= 4; iFactor += 2 )
+			{
+				OniPixelFormat eFormat = g_aFormat[i].eFormat;
+				VirtualDecimation eMode = aMode[m].eMode;
+				size_t uPixelSize = GetPixelSize( eFormat );
+				char szName[64];
+				sprintf( szName, "reduce %s %s %d", g_aFormat[i].szName, aMode[m].szName, iFactor );
+				rCheck.Check<PixelBlockReducer>( szName,
+					[&]( VirtualKernelVariant eVariant ) { return GetBlockReducer( eFormat, eMode, iFactor, eVariant ); },
+					[&]( PixelBlockReducer funcScalar, PixelBlockReducer func, int iWidth ) {
+						// the stride has some padding, as the frames of producer
+						size_t uStride = ( iWidth * iFactor + 3 ) * uPixelSize;
+						Buffer vSource = ( IsDepthFormat( eFormat ) ? rRandom.Depth( uStride / uPixelSize * iFactor ) : rRandom.Bytes( uStride * iFactor ) );
+						Buffer vScalar = Target( iWidth * uPixelSize ), vResult = Target( iWidth * uPixelSize );
+						funcScalar( vSource.data(), uStride, vScalar.data(), iWidth );
+						func( vSource.data(), uStride, vResult.data(), iWidth );
+						return IsSame( vScalar, vResult );
+					} );
+			}
+		}
+	}
+}
+
+void CheckRemap( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	for( size_t i = 0; i < sizeof(g_aFormat) / sizeof(g_aFormat[0]); ++ i )
+	{
+		OniPixelFormat eFormat = g_aFormat[i].eFormat;
+		size_t uPixelSize = GetPixelSize( eFormat );
+		std::string sName = std::string( "remap " ) + g_aFormat[i].szName;
+		rCheck.Check<PixelRemapRow>( sName.c_str(),
+			[&]( VirtualKernelVariant eVariant ) { return GetRemapKernel( eFormat, eVariant ); },
+			[&]( PixelRemapRow funcScalar, PixelRemapRow func, int iWidth ) {
+				// a table of a few rows, barrel or pincushion
+				const int iHeight = 6;
+				VirtualLensDistortion mDistortion;
+				memset( &mDistortion, 0, sizeof(mDistortion) );
+				mDistortion.mIntrinsics.iWidth	= iWidth;
+				mDistortion.mIntrinsics.iHeight	= iHeight;
+				mDistortion.mIntrinsics.fFx		= rRandom.Range( 0.5f, 1.5f ) * iWidth;
+				mDistortion.mIntrinsics.fFy		= mDistortion.mIntrinsics.fFx;
+				mDistortion.mIntrinsics.fCx		= rRandom.Range( 0.3f, 0.7f ) * iWidth;
+				mDistortion.mIntrinsics.fCy		= rRandom.Range( 0.3f, 0.7f ) * iHeight;
+				mDistortion.fK1					= rRandom.Range( -0.3f, 0.3f );
+				mDistortion.fP1					= rRandom.Range( -0.01f, 0.01f );
+
+				RemapTable mTable;
+				BuildRemapTable( mDistortion, iWidth, iHeight, !IsDepthFormat( eFormat ), mTable );
+
+				size_t uStride = ( iWidth + 2 ) * uPixelSize;
+				Buffer vSource = ( IsDepthFormat( eFormat ) ? rRandom.Depth( uStride / uPixelSize * iHeight ) : rRandom.Bytes( uStride * iHeight ) );
+				size_t uRow = size_t( rRandom.Range( 0, iHeight - 1 ) ) * iWidth;
+
+				// the whole frame, and a cropped window of it
+				int iOriginX = iWidth / 4, iOriginY = 1;
+				Buffer vScalar = Target( iWidth * uPixelSize ), vResult = Target( iWidth * uPixelSize );
+				Buffer vCropScalar = Target( iWidth * uPixelSize ), vCrop = Target( iWidth * uPixelSize );
+				funcScalar( vSource.data(), uStride, iWidth, iHeight, 0, 0, &mTable.vX[uRow], &mTable.vY[uRow], &mTable.vFraction[uRow], vScalar.data(), iWidth );
+				func( vSource.data(), uStride, iWidth, iHeight, 0, 0, &mTable.vX[uRow], &mTable.vY[uRow], &mTable.vFraction[uRow], vResult.data(), iWidth );
+				funcScalar( vSource.data(), uStride, iWidth - iOriginX, iHeight - iOriginY, iOriginX, iOriginY, &mTable.vX[uRow], &mTable.vY[uRow], &mTable.vFraction[uRow], vCropScalar.data(), iWidth );
+				func( vSource.data(), uStride, iWidth - iOriginX, iHeight - iOriginY, iOriginX, iOriginY, &mTable.vX[uRow], &mTable.vY[uRow], &mTable.vFraction[uRow], vCrop.data(), iWidth );
+				return IsSame( vScalar, vResult ) && IsSame( vCropScalar, vCrop );
+			} );
+	}
+}
+
+void CheckDepthFilters( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	const struct { DepthNeighborhoodRow (*funcGet)( VirtualKernelVariant ); const char* szName; } aFilter[] = {
+		{ []( VirtualKernelVariant eVariant ) { return GetFlyingPixelFilter( eVariant ); }, "flying pixel filter" },
+		{ []( VirtualKernelVariant eVariant ) { return GetSpatialFilter( eVariant ); }, "spatial filter" },
+		{ []( VirtualKernelVariant eVariant ) { return GetHoleFillFilter( true, eVariant ); }, "hole fill filter farthest" },
+		{ []( VirtualKernelVariant eVariant ) { return GetHoleFillFilter( false, eVariant ); }, "hole fill filter nearest" } };
+	for( size_t i = 0; i < sizeof(aFilter) / sizeof(aFilter[0]); ++ i )
+	{
+		rCheck.Check<DepthNeighborhoodRow>( aFilter[i].szName, aFilter[i].funcGet,
+			[&]( DepthNeighborhoodRow funcScalar, DepthNeighborhoodRow func, int iWidth ) {
+				// the rows at the border of frame are 0
+				Buffer vAbove = ( rRandom.Range( 0, 3 ) == 0 ? Buffer( iWidth * sizeof(OniDepthPixel) + GUARD_SIZE, 0 ) : rRandom.Depth( iWidth ) );
+				Buffer vRow = rRandom.Depth( iWidth ), vBelow = rRandom.Depth( iWidth );
+				int iDelta = rRandom.Range( 10, 300 ), iCount = rRandom.Range( 1, 8 );
+				Buffer vScalar = Target( iWidth * sizeof(OniDepthPixel) ), vResult = Target( iWidth * sizeof(OniDepthPixel) );
+				funcScalar( reinterpret_cast<const OniDepthPixel*>( vAbove.data() ), reinterpret_cast<const OniDepthPixel*>( vRow.data() ), reinterpret_cast<const OniDepthPixel*>( vBelow.data() ),
+							reinterpret_cast<OniDepthPixel*>( vScalar.data() ), iWidth, iDelta, iCount );
+				func( reinterpret_cast<const OniDepthPixel*>( vAbove.data() ), reinterpret_cast<const OniDepthPixel*>( vRow.data() ), reinterpret_cast<const OniDepthPixel*>( vBelow.data() ),
+					  reinterpret_cast<OniDepthPixel*>( vResult.data() ), iWidth, iDelta, iCount );
+				return IsSame( vScalar, vResult );
+			} );
+	}
+
+	rCheck.Check<DepthTemporalRow>( "temporal filter",
+		[]( VirtualKernelVariant eVariant ) { return GetTemporalFilter( eVariant ); },
+		[&]( DepthTemporalRow funcScalar, DepthTemporalRow func, int iWidth ) {
+			// the history is updated, so it's compared too
+			Buffer vRow = rRandom.Depth( iWidth ), vHistory = rRandom.Depth( iWidth );
+			std::vector<float> vState( iWidth + GUARD_SIZE, 0.0f );
+			Buffer vAge( iWidth + GUARD_SIZE, 0 );
+			const OniDepthPixel* pHistory = reinterpret_cast<const OniDepthPixel*>( vHistory.data() );
+			for( int x = 0; x < iWidth; ++ x )
+			{
+				vState[x]	= pHistory[x] + rRandom.Range( -0.5f, 0.5f ) * ( pHistory[x] > 0 ? 1 : 0 );
+				vAge[x]		= (unsigned char)( rRandom.Range( 0, 6 ) );
+			}
+			float fAlpha = rRandom.Range( 0.1f, 0.9f );
+			int iDelta = rRandom.Range( 10, 300 ), iPersistence = rRandom.Range( 0, 5 );
+
+			std::vector<float> vStateScalar = vState;
+			Buffer vAgeScalar = vAge;
+			Buffer vScalar = Target( iWidth * sizeof(OniDepthPixel) ), vResult = Target( iWidth * sizeof(OniDepthPixel) );
+			funcScalar( reinterpret_cast<const OniDepthPixel*>( vRow.data() ), vStateScalar.data(), vAgeScalar.data(), reinterpret_cast<OniDepthPixel*>( vScalar.data() ), iWidth, fAlpha, iDelta, iPersistence );
+			func( reinterpret_cast<const OniDepthPixel*>( vRow.data() ), vState.data(), vAge.data(), reinterpret_cast<OniDepthPixel*>( vResult.data() ), iWidth, fAlpha, iDelta, iPersistence );
+			return	IsSame( vScalar, vResult ) && IsSame( vAgeScalar, vAge ) &&
+					memcmp( vStateScalar.data(), vState.data(), vState.size() * sizeof(float) ) == 0;
+		} );
+}
+
+void CheckPointCloud( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	const struct { OniPixelFormat eFormat; const char* szName; } aPoint[] = {
+		{ OniPixelFormat( VIRTUAL_PIXEL_FORMAT_POINT_XYZ ), "point xyz" }, { OniPixelFormat( VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB ), "point xyzrgb" } };
+	for( size_t i = 0; i < sizeof(aPoint) / sizeof(aPoint[0]); ++ i )
+	{
+		OniPixelFormat eFormat = aPoint[i].eFormat;
+		size_t uPointSize = GetPointSize( eFormat );
+		rCheck.Check<PointRowProjector>( aPoint[i].szName,
+			[&]( VirtualKernelVariant eVariant ) { return GetPointProjector( eFormat, eVariant ); },
+			[&]( PointRowProjector funcScalar, PointRowProjector func, int iWidth ) {
+				PointRayTable mRays;
+				BuildPointRays( iWidth, 8, 1.0226f, 0.7966f, mRays );
+				float fRayY = mRays.vRayY[ rRandom.Range( 0, 7 ) ];
+				float fScale = ( rRandom.Range( 0, 1 ) == 0 ? 1.0f : 0.1f );
+				Buffer vDepth = rRandom.Depth( iWidth ), vColor = rRandom.Bytes( iWidth * sizeof(OniRGB888Pixel) );
+				const OniRGB888Pixel* pColor = ( eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB ? reinterpret_cast<const OniRGB888Pixel*>( vColor.data() ) : NULL );
+
+				// the SIMD kernels may write the padding after the points, only the points are compared
+				bool bSame = true;
+				for( int iCompact = 0; iCompact < 2 && bSame; ++ iCompact )
+				{
+					Buffer vScalar = Target( iWidth * uPointSize + POINT_ROW_PADDING ), vResult = Target( iWidth * uPointSize + POINT_ROW_PADDING );
+					int iScalar = funcScalar( reinterpret_cast<const OniDepthPixel*>( vDepth.data() ), pColor, mRays.vRayX.data(), fRayY, fScale, vScalar.data(), iWidth, iCompact != 0 );
+					int iResult = func( reinterpret_cast<const OniDepthPixel*>( vDepth.data() ), pColor, mRays.vRayX.data(), fRayY, fScale, vResult.data(), iWidth, iCompact != 0 );
+					bSame = ( iScalar == iResult && memcmp( vScalar.data(), vResult.data(), iScalar * uPointSize ) == 0 );
+				}
+				return bSame;
+			} );
+	}
+}
+
+void CheckRGBD( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	rCheck.Check<RGBDRowInterleaver>( "rgbd interleave",
+		[]( VirtualKernelVariant eVariant ) { return GetRGBDInterleaver( eVariant ); },
+		[&]( RGBDRowInterleaver funcScalar, RGBDRowInterleaver func, int iWidth ) {
+			Buffer vDepth = rRandom.Depth( iWidth ), vColor = rRandom.Bytes( iWidth * sizeof(OniRGB888Pixel) );
+			Buffer vScalar = Target( iWidth * sizeof(VirtualRGBDPixel) ), vResult = Target( iWidth * sizeof(VirtualRGBDPixel) );
+			funcScalar( reinterpret_cast<const OniDepthPixel*>( vDepth.data() ), reinterpret_cast<const OniRGB888Pixel*>( vColor.data() ), reinterpret_cast<VirtualRGBDPixel*>( vScalar.data() ), iWidth );
+			func( reinterpret_cast<const OniDepthPixel*>( vDepth.data() ), reinterpret_cast<const OniRGB888Pixel*>( vColor.data() ), reinterpret_cast<VirtualRGBDPixel*>( vResult.data() ), iWidth );
+			return IsSame( vScalar, vResult );
+		} );
+}
+
+void CheckRegistration( KernelCheck& rCheck )
+{
+	RandomInput& rRandom = rCheck.Random();
+	rCheck.Check<RegistrationRowProjector>( "registration",
+		[]( VirtualKernelVariant eVariant ) { return GetRegistrationProjector( eVariant ); },
+		[&]( RegistrationRowProjector funcScalar, RegistrationRowProjector func, int iWidth ) {
+			// a color camera beside the depth one, with a small rotation
+			const int iHeight = 8;
+			VirtualCameraIntrinsics mDepth = { iWidth, iHeight, 0.9f * iWidth, 0.9f * iWidth, iWidth / 2.0f, iHeight / 2.0f };
+			VirtualCameraIntrinsics mColor = { iWidth, iHeight, 0.95f * iWidth, 0.95f * iWidth, iWidth / 2.0f + 0.3f, iHeight / 2.0f - 0.2f };
+			float fAngle = rRandom.Range( -0.02f, 0.02f );
+			VirtualCameraExtrinsics mExtrinsics = { { 1, -fAngle, 0, fAngle, 1, 0, 0, 0, 1 }, { rRandom.Range( -50.0f, 50.0f ), rRandom.Range( -5.0f, 5.0f ), 0 } };
+			RegistrationTable mTable;
+			BuildRegistrationTable( mDepth, mColor, mExtrinsics, iWidth, iHeight, 0, 0, iWidth, iHeight, rRandom.Range( 0, 1 ) == 1, mTable );
+
+			Buffer vDepth = rRandom.Depth( iWidth );
+			const float* pRow = &mTable.vRow[ 3 * rRandom.Range( 0, iHeight - 1 ) ];
+			Buffer vIndexScalar = Target( iWidth * sizeof(int) ), vIndex = Target( iWidth * sizeof(int) );
+			Buffer vScalar = Target( iWidth * sizeof(int) ), vResult = Target( iWidth * sizeof(int) );
+			funcScalar( reinterpret_cast<const OniDepthPixel*>( vDepth.data() ), mTable.vColumnX.data(), mTable.vColumnY.data(), mTable.vColumnZ.data(), pRow, mTable.aOffset,
+						iWidth, iWidth, iHeight, reinterpret_cast<int*>( vIndexScalar.data() ), reinterpret_cast<int*>( vScalar.data() ) );
+			func( reinterpret_cast<const OniDepthPixel*>( vDepth.data() ), mTable.vColumnX.data(), mTable.vColumnY.data(), mTable.vColumnZ.data(), pRow, mTable.aOffset,
+				  iWidth, iWidth, iHeight, reinterpret_cast<int*>( vIndex.data() ), reinterpret_cast<int*>( vResult.data() ) );
+			return IsSame( vIndexScalar, vIndex ) && IsSame( vScalar, vResult );
+		} );
+}
+
+#pragma endregion
+
+int main( int argc, char** argv )
+{
+	unsigned int uSeed = 1;
+	int iRows = 32;
+	for( int i = 1; i < argc; ++ i )
+	{
+		if( strcmp( argv[i], "-seed" ) == 0 && i + 1 < argc )
+		{
+			uSeed = unsigned( strtoul( argv[++ i], NULL, 10 ) );
+		}
+		else if( strcmp( argv[i], "-rows" ) == 0 && i + 1 < argc )
+		{
+			iRows = atoi( argv[++ i] );
+		}
+		else
+		{
+			fprintf( stderr, "usage: %s [-seed <n>] [-rows <n>]\n", argv[0] );
+			return -1;
+		}
+	}
+
+	printf( "kernel variant of this CPU: %s, seed %u\n", GetKernelVariantName( GetKernelVariant() ), uSeed );
+
+	KernelCheck mCheck( uSeed, iRows );
+	CheckConverters( mCheck );
+	CheckMirror( mCheck );
+	CheckBlockReducers( mCheck );
+	CheckRemap( mCheck );
+	CheckDepthFilters( mCheck );
+	CheckPointCloud( mCheck );
+	CheckRGBD( mCheck );
+	CheckRegistration( mCheck );
+
+	printf( "%d kernels checked, %d failed\n", mCheck.GetKernels(), mCheck.GetFailed() );
+	return ( mCheck.GetFailed() == 0 ? 0 : 1 );
+}
@@ -0,0 +1,1481 @@
+/**
+ * Headless benchmark of the virtual device driver.
+ *
+ * It loads the driver module directly, the same way OpenNI does, and gives it
+ * a stand-in OniDriverServices / OniStreamServices (frame allocation,
+ * reference counting, new frame callback and logging). No OpenNI runtime,
+ * hardware or display is required.
+ *
+ * For every combination of resolution, pixel format, stream count and
+ * listener count, it measures the GET / SET round trip of the virtual stream
+ * and writes the result as JSON, so different releases can be compared.
+ * The formats include the input formats which are converted by the driver
+ * (YUYV, UYVY, BGR and BGRA to RGB888, and the other depth unit), and
+ * GRAY8 / GRAY16 of IR sensor.
+ * With -reconfig, another thread keeps changing the video mode (fps),
+ * cropping and timestamp mode of the streams while frames flow.
+ * Every frame sent by the streams of the matrix is checked against the
+ * video mode and cropping window which may be set; a frame whose size or
+ * format doesn't match, which is mixed from two configurations, fails the
+ * case and is counted as "mismatched".
+ * The "point_cloud" section compares the point cloud stream of the driver
+ * with calling CoordinateConverter::convertDepthToWorld() for each pixel.
+ * The "registration" section measures the SET of depth frames with the depth
+ * to color registration of device.
+ * The "rgbd" section measures SET_VIRTUAL_DEVICE_FRAME_SET of depth and
+ * color frames without and with the RGB-D stream.
+ * The "undistortion" section measures the SET of depth and color frames
+ * without and with VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION.
+ * The "depth_filter" section measures the SET of depth frames without and
+ * with all the depth filters, on the SET thread only and with extra threads.
+ *
+ * usage: DriverBenchmark [-driver <file>] [-frames <n>] [-out <file>]
+ *                        [-allocator] [-async] [-nofill] [-reconfig] [-quiet]
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+// C Header
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// STL Header
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// OpenNI Header
+#include "OniCTypes.h"
+
+// XnLib in OpenNI Source Code, use for threading and module loading
+#include "XnLib.h"
+
+// Virtual Device Header
+#include "../../VirtualDevice/VirtualDevice.h"
+
+#ifdef _WIN32
+	#define DEFAULT_DRIVER_FILE	"VirtualDevice.dll"
+#else
+	#define DEFAULT_DRIVER_FILE	"./libVirtualDevice.so"
+#endif
+
+#pragma region C interface of driver module
+
+typedef void (ONI_CALLBACK_TYPE* DeviceConnectedCallback)( const OniDeviceInfo*, void* );
+typedef void (ONI_CALLBACK_TYPE* DeviceDisconnectedCallback)( const OniDeviceInfo*, void* );
+typedef void (ONI_CALLBACK_TYPE* DeviceStateChangedCallback)( const OniDeviceInfo*, int, void* );
+typedef void (ONI_CALLBACK_TYPE* NewFrameCallback)( void*, OniFrame*, void* );
+
+/**
+ * The functions exported by ONI_EXPORT_DRIVER which are used in this benchmark
+ */
+struct DriverModule
+{
+	void		(*funcCreate)( OniDriverServices* );
+	void		(*funcDestroy)();
+	OniStatus	(*funcInitialize)( DeviceConnectedCallback, DeviceDisconnectedCallback, DeviceStateChangedCallback, void* );
+	OniStatus	(*funcTryDevice)( const char* );
+	void*		(*funcDeviceOpen)( const char*, const char* );
+	void		(*funcDeviceClose)( void* );
+	OniStatus	(*funcDeviceGetProperty)( void*, int, void*, int* );
+	OniStatus	(*funcDeviceSetProperty)( void*, int, const void*, int );
+	OniStatus	(*funcDeviceInvoke)( void*, int, void*, int );
+	void*		(*funcDeviceCreateStream)( void*, OniSensorType );
+	void		(*funcDeviceDestroyStream)( void*, void* );
+	void		(*funcStreamSetServices)( void*, OniStreamServices* );
+	OniStatus	(*funcStreamSetProperty)( void*, int, const void*, int );
+	OniStatus	(*funcStreamGetProperty)( void*, int, void*, int* );
+	OniStatus	(*funcStreamInvoke)( void*, int, void*, int );
+	int			(*funcStreamGetRequiredFrameSize)( void* );
+	OniStatus	(*funcStreamStart)( void* );
+	void		(*funcStreamStop)( void* );
+	void		(*funcStreamSetNewFrameCallback)( void*, NewFrameCallback, void* );
+
+	XN_LIB_HANDLE	m_hLibrary;
+
+	bool Load( const char* szFile )
+	{
+		if( xnOSLoadLibrary( szFile, &m_hLibrary ) != XN_STATUS_OK )
+		{
+			fprintf( stderr, "Can't load driver module '%s'\n", szFile );
+			return false;
+		}
+
+		bool bOK = true;
+		bOK &= GetFunction( "oniDriverCreate",						funcCreate );
+		bOK &= GetFunction( "oniDriverDestroy",						funcDestroy );
+		bOK &= GetFunction( "oniDriverInitialize",					funcInitialize );
+		bOK &= GetFunction( "oniDriverTryDevice",					funcTryDevice );
+		bOK &= GetFunction( "oniDriverDeviceOpen",					funcDeviceOpen );
+		bOK &= GetFunction( "oniDriverDeviceClose",					funcDeviceClose );
+		bOK &= GetFunction( "oniDriverDeviceGetProperty",			funcDeviceGetProperty );
+		bOK &= GetFunction( "oniDriverDeviceSetProperty",			funcDeviceSetProperty );
+		bOK &= GetFunction( "oniDriverDeviceInvoke",				funcDeviceInvoke );
+		bOK &= GetFunction( "oniDriverDeviceCreateStream",			funcDeviceCreateStream );
+		bOK &= GetFunction( "oniDriverDeviceDestroyStream",			funcDeviceDestroyStream );
+		bOK &= GetFunction( "oniDriverStreamSetServices",			funcStreamSetServices );
+		bOK &= GetFunction( "oniDriverStreamSetProperty",			funcStreamSetProperty );
+		bOK &= GetFunction( "oniDriverStreamGetProperty",			funcStreamGetProperty );
+		bOK &= GetFunction( "oniDriverStreamInvoke",				funcStreamInvoke );
+		bOK &= GetFunction( "oniDriverStreamGetRequiredFrameSize",	funcStreamGetRequiredFrameSize );
+		bOK &= GetFunction( "oniDriverStreamStart",					funcStreamStart );
+		bOK &= GetFunction( "oniDriverStreamStop",					funcStreamStop );
+		bOK &= GetFunction( "oniDriverStreamSetNewFrameCallback",	funcStreamSetNewFrameCallback );
+		return bOK;
+	}
+
+	void Unload()
+	{
+		xnOSFreeLibrary( m_hLibrary );
+	}
+
+protected:
+	template<typename TFunc>
+	bool GetFunction( const char* szName, TFunc& rFunc )
+	{
+		if( xnOSGetProcAddress( m_hLibrary, szName, (XnFarProc*)&rFunc ) != XN_STATUS_OK )
+		{
+			fprintf( stderr, "Can't find function '%s' in driver module\n", szName );
+			return false;
+		}
+		return true;
+	}
+};
+
+DriverModule g_Driver;
+
+#pragma endregion
+
+#pragma region Stand-in OniDriverServices
+
+bool g_bQuiet = false;
+
+void ONI_CALLBACK_TYPE ErrorLoggerAppend( void* /*pCookie*/, const char* szFormat, va_list args )
+{
+	if( !g_bQuiet )
+	{
+		fprintf( stderr, "[driver] " );
+		vfprintf( stderr, szFormat, args );
+		fprintf( stderr, "\n" );
+	}
+}
+
+void ONI_CALLBACK_TYPE ErrorLoggerClear( void* /*pCookie*/ )
+{
+}
+
+void ONI_CALLBACK_TYPE Log( void* /*pCookie*/, int /*iSeverity*/, const char* /*szFile*/, int /*iLine*/, const char* szMask, const char* szMessage )
+{
+	if( !g_bQuiet )
+		fprintf( stderr, "[%s] %s\n", szMask, szMessage );
+}
+
+void ONI_CALLBACK_TYPE DeviceConnected( const OniDeviceInfo*, void* ){}
+void ONI_CALLBACK_TYPE DeviceDisconnected( const OniDeviceInfo*, void* ){}
+void ONI_CALLBACK_TYPE DeviceStateChanged( const OniDeviceInfo*, int, void* ){}
+
+#pragma endregion
+
+#pragma region Stand-in OniStreamServices
+
+/**
+ * Timestamp in nanoseconds; xnOSGetHighResTimeStamp() is too coarse for a single GET / SET
+ */
+inline uint64_t GetTimestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+inline int GetBytesPerPixel( OniPixelFormat eFormat, VirtualInputFormat eInput )
+{
+	switch( eInput )
+	{
+	case VIRTUAL_INPUT_YUYV:
+	case VIRTUAL_INPUT_UYVY:
+		return 2;
+
+	case VIRTUAL_INPUT_BGR:
+		return 3;
+
+	case VIRTUAL_INPUT_BGRA:
+		return 4;
+
+	default:
+		break;
+	}
+
+	switch( eFormat )
+	{
+	case ONI_PIXEL_FORMAT_RGB888:
+		return 3;
+
+	case ONI_PIXEL_FORMAT_GRAY8:
+		return 1;
+
+	default:
+		return 2;
+	}
+}
+
+/**
+ * A stream of the driver, with the frame management of OpenNI
+ */
+class BenchStream
+{
+public:
+	BenchStream( void* hDevice, OniSensorType eType ) : m_hDevice( hDevice ), m_uAllocations( 0 )
+	{
+		m_mServices.streamServices				= this;
+		m_mServices.getDefaultRequiredFrameSize	= GetDefaultRequiredFrameSize;
+		m_mServices.acquireFrame				= AcquireFrame;
+		m_mServices.addFrameRef					= AddFrameRef;
+		m_mServices.releaseFrame				= ReleaseFrame;
+
+		m_mAllocator.funcAlloc	= NULL;
+		m_mAllocator.funcFree	= NULL;
+		m_mAllocator.pCookie	= NULL;
+
+		m_eFrameFormat	= ONI_PIXEL_FORMAT_DEPTH_1_MM;
+		m_iListeners	= 0;
+		m_iFrameSize	= 0;
+		m_uChecksum		= 0;
+		m_bCheckFrames	= false;
+		m_uMismatched	= 0;
+
+		m_hStream = g_Driver.funcDeviceCreateStream( hDevice, eType );
+		if( m_hStream != NULL )
+		{
+			g_Driver.funcStreamSetServices( m_hStream, &m_mServices );
+			g_Driver.funcStreamSetNewFrameCallback( m_hStream, NewFrame, this );
+		}
+	}
+
+	~BenchStream()
+	{
+		if( m_hStream != NULL )
+			g_Driver.funcDeviceDestroyStream( m_hDevice, m_hStream );
+	}
+
+	bool IsValid() const
+	{
+		return m_hStream != NULL;
+	}
+
+	void* GetHandle() const
+	{
+		return m_hStream;
+	}
+
+	void ClearTimes()
+	{
+		m_vGetTime.clear();
+		m_vFillTime.clear();
+		m_vSetTime.clear();
+		m_vRaiseTime.clear();
+	}
+
+	bool Setup( OniPixelFormat eFormat, OniPixelFormat eFrameFormat, VirtualInputFormat eInput, bool bMirror, int iWidth, int iHeight, int iListeners, bool bAllocator, bool bAsync, int iFrames )
+	{
+		m_eFrameFormat = eFrameFormat;
+
+		OniVideoMode& mMode = m_mVideoMode;
+		mMode.pixelFormat	= eFormat;
+		mMode.resolutionX	= iWidth;
+		mMode.resolutionY	= iHeight;
+		mMode.fps			= 30;
+		if( g_Driver.funcStreamSetProperty( m_hStream, ONI_STREAM_PROPERTY_VIDEO_MODE, &mMode, sizeof(mMode) ) != ONI_STATUS_OK )
+			return false;
+
+		int iInputFormat = eInput;
+		if( g_Driver.funcStreamSetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_INPUT_FORMAT, &iInputFormat, sizeof(iInputFormat) ) != ONI_STATUS_OK )
+			return false;
+
+		OniBool bMirroring = ( bMirror ? TRUE : FALSE );
+		if( g_Driver.funcStreamSetProperty( m_hStream, ONI_STREAM_PROPERTY_MIRRORING, &bMirroring, sizeof(bMirroring) ) != ONI_STATUS_OK )
+			return false;
+
+		// as OpenNI, use the frame size required by driver
+		m_iFrameSize = g_Driver.funcStreamGetRequiredFrameSize( m_hStream );
+
+		// use the frame allocator of driver, as the application does for zero-copy
+		m_mAllocator.funcAlloc	= NULL;
+		m_mAllocator.funcFree	= NULL;
+		m_mAllocator.pCookie	= NULL;
+		if( bAllocator )
+		{
+			int iSize = sizeof(m_mAllocator);
+			if( g_Driver.funcStreamGetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_FRAME_ALLOCATOR, &m_mAllocator, &iSize ) != ONI_STATUS_OK )
+				return false;
+		}
+
+		OniBool bAsyncDispatch = bAsync ? TRUE : FALSE;
+		if( g_Driver.funcStreamSetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_ASYNC_DISPATCH, &bAsyncDispatch, sizeof(bAsyncDispatch) ) != ONI_STATUS_OK )
+			return false;
+
+		// the producer runs much faster than real sensor, wait for free slot instead of dropping frames
+		int iDropPolicy = VIRTUAL_DROP_BLOCK;
+		if( bAsync && g_Driver.funcStreamSetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_DISPATCH_DROP_POLICY, &iDropPolicy, sizeof(iDropPolicy) ) != ONI_STATUS_OK )
+			return false;
+
+		m_iListeners = iListeners;
+		m_uAllocations = 0;
+		m_bCheckFrames = true;
+		m_uMismatched = 0;
+		m_vGetTime.clear();
+		m_vFillTime.clear();
+		m_vSetTime.clear();
+		m_vRaiseTime.clear();
+		m_vGetTime.reserve( iFrames );
+		m_vFillTime.reserve( iFrames );
+		m_vSetTime.reserve( iFrames );
+		m_vRaiseTime.reserve( iFrames );
+		return true;
+	}
+
+	bool Start()
+	{
+		return g_Driver.funcStreamStart( m_hStream ) == ONI_STATUS_OK;
+	}
+
+	void Stop()
+	{
+		g_Driver.funcStreamStop( m_hStream );
+	}
+
+	/**
+	 * Setup the stream built from the frames of depth stream, the video mode
+	 * follows the depth stream
+	 */
+	bool SetupDerived( OniPixelFormat eFormat, int iFrames )
+	{
+		OniVideoMode& mMode = m_mVideoMode;
+		mMode.pixelFormat	= eFormat;
+		mMode.resolutionX	= 0;
+		mMode.resolutionY	= 0;
+		mMode.fps			= 30;
+		if( g_Driver.funcStreamSetProperty( m_hStream, ONI_STREAM_PROPERTY_VIDEO_MODE, &mMode, sizeof(mMode) ) != ONI_STATUS_OK )
+			return false;
+
+		m_iFrameSize = g_Driver.funcStreamGetRequiredFrameSize( m_hStream );
+		m_iListeners = 0;
+		m_vRaiseTime.clear();
+		m_vRaiseTime.reserve( iFrames );
+		return true;
+	}
+
+	/**
+	 * Setup the point cloud stream
+	 */
+	bool SetupPoints( OniPixelFormat eFormat, bool bCompact, int iFrames )
+	{
+		OniBool bCompactPoints = ( bCompact ? TRUE : FALSE );
+		return	g_Driver.funcStreamSetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_POINT_COMPACT, &bCompactPoints, sizeof(bCompactPoints) ) == ONI_STATUS_OK &&
+				SetupDerived( eFormat, iFrames );
+	}
+
+	/**
+	 * Producer loop: GET, fill and SET the given number of frames; the frames
+	 * are copied from pSource if it's given
+	 */
+	void Produce( int iFrames, bool bFill, const void* pSource = NULL )
+	{
+		for( int i = 0; i < iFrames; ++ i )
+		{
+			uint64_t uT0 = GetTimestamp();
+			OniFrame* pFrame = NULL;
+			if( g_Driver.funcStreamInvoke( m_hStream, GET_VIRTUAL_STREAM_IMAGE, &pFrame, sizeof(pFrame) ) != ONI_STATUS_OK )
+				continue;
+
+			uint64_t uT1 = GetTimestamp();
+			if( pSource != NULL )
+				memcpy( pFrame->data, pSource, pFrame->dataSize );
+			else if( bFill )
+				memset( pFrame->data, i & 0xFF, pFrame->dataSize );
+			pFrame->videoMode.pixelFormat = m_eFrameFormat;
+
+			uint64_t uT2 = GetTimestamp();
+			m_aSubmitTime[ unsigned( pFrame->frameIndex ) % SUBMIT_RING ].store( uT2 );
+			g_Driver.funcStreamInvoke( m_hStream, SET_VIRTUAL_STREAM_IMAGE, &pFrame, sizeof(pFrame) );
+
+			uint64_t uT3 = GetTimestamp();
+			m_vGetTime.push_back( uT1 - uT0 );
+			m_vFillTime.push_back( uT2 - uT1 );
+			m_vSetTime.push_back( uT3 - uT2 );
+		}
+	}
+
+	/**
+	 * Producer loop of frame sets: GET the frames of this (depth) stream and
+	 * the color stream, copy the sources and SET them as a set by device
+	 */
+	void ProduceSet( BenchStream& rColor, int iFrames, const void* pDepth, const void* pColor )
+	{
+		for( int i = 0; i < iFrames; ++ i )
+		{
+			VirtualFrameSet mSet = { NULL, NULL, 0 };
+			if( g_Driver.funcStreamInvoke( m_hStream, GET_VIRTUAL_STREAM_IMAGE, &mSet.pDepth, sizeof(mSet.pDepth) ) != ONI_STATUS_OK )
+				continue;
+			if( g_Driver.funcStreamInvoke( rColor.m_hStream, GET_VIRTUAL_STREAM_IMAGE, &mSet.pColor, sizeof(mSet.pColor) ) != ONI_STATUS_OK )
+			{
+				g_Driver.funcStreamInvoke( m_hStream, SET_VIRTUAL_STREAM_IMAGE, &mSet.pDepth, sizeof(mSet.pDepth) );
+				continue;
+			}
+			memcpy( mSet.pDepth->data, pDepth, mSet.pDepth->dataSize );
+			memcpy( mSet.pColor->data, pColor, mSet.pColor->dataSize );
+
+			uint64_t uT0 = GetTimestamp();
+			g_Driver.funcDeviceInvoke( m_hDevice, SET_VIRTUAL_DEVICE_FRAME_SET, &mSet, sizeof(mSet) );
+			m_vSetTime.push_back( GetTimestamp() - uT0 );
+		}
+	}
+
+	/**
+	 * Change the configuration of running stream; the frame size is not changed
+	 */
+	bool Reconfigure( int iStep )
+	{
+		OniVideoMode mMode = m_mVideoMode;
+		mMode.fps = ( iStep % 2 == 0 ? 60 : 30 );
+
+		OniCropping mCropping;
+		mCropping.enabled	= ( iStep % 3 == 0 );
+		mCropping.originX	= mMode.resolutionX / 4;
+		mCropping.originY	= mMode.resolutionY / 4;
+		mCropping.width		= mMode.resolutionX / 2;
+		mCropping.height	= mMode.resolutionY / 2;
+
+		int iTimestampMode = ( iStep % 5 == 0 ? VIRTUAL_TIMESTAMP_PRODUCER : VIRTUAL_TIMESTAMP_HOST );
+
+		return	g_Driver.funcStreamSetProperty( m_hStream, ONI_STREAM_PROPERTY_VIDEO_MODE, &mMode, sizeof(mMode) ) == ONI_STATUS_OK &&
+				g_Driver.funcStreamSetProperty( m_hStream, ONI_STREAM_PROPERTY_CROPPING, &mCropping, sizeof(mCropping) ) == ONI_STATUS_OK &&
+				g_Driver.funcStreamSetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MODE, &iTimestampMode, sizeof(iTimestampMode) ) == ONI_STATUS_OK;
+	}
+
+	/**
+	 * The number of frames sent with a size or format which doesn't match the configuration
+	 */
+	uint64_t GetMismatched() const
+	{
+		return m_uMismatched;
+	}
+
+	/**
+	 * Heap allocations of frame buffer; the pool misses when the allocator of driver is used
+	 */
+	uint64_t GetAllocations() const
+	{
+		if( m_mAllocator.funcAlloc != NULL )
+		{
+			VirtualFramePoolStats mStats;
+			int iSize = sizeof(mStats);
+			if( g_Driver.funcStreamGetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_FRAME_POOL_STATS, &mStats, &iSize ) == ONI_STATUS_OK )
+				return mStats.uMisses;
+		}
+		return m_uAllocations;
+	}
+
+	bool GetStatistics( VirtualStreamStatistics& rStats ) const
+	{
+		int iSize = sizeof(rStats);
+		return g_Driver.funcStreamGetProperty( m_hStream, VIRTUAL_STREAM_PROPERTY_STATISTICS, &rStats, &iSize ) == ONI_STATUS_OK;
+	}
+
+	const std::vector<uint64_t>& GetTimeOfGet() const	{ return m_vGetTime; }
+	const std::vector<uint64_t>& GetTimeOfFill() const	{ return m_vFillTime; }
+	const std::vector<uint64_t>& GetTimeOfSet() const	{ return m_vSetTime; }
+	const std::vector<uint64_t>& GetTimeOfRaise() const	{ return m_vRaiseTime; }
+
+protected:
+	/**
+	 * Frame with reference count, as OniFrameInternal of OpenNI
+	 */
+	struct BenchFrame
+	{
+		OniFrame			mFrame;
+		std::atomic<int>	iRefCount;
+	};
+
+	static int ONI_CALLBACK_TYPE GetDefaultRequiredFrameSize( void* pCookie )
+	{
+		return static_cast<BenchStream*>( pCookie )->m_iFrameSize;
+	}
+
+	static OniFrame* ONI_CALLBACK_TYPE AcquireFrame( void* pCookie )
+	{
+		BenchStream* pStream = static_cast<BenchStream*>( pCookie );
+
+		BenchFrame* pFrame = new BenchFrame();
+		memset( &pFrame->mFrame, 0, sizeof(OniFrame) );
+		pFrame->iRefCount = 1;
+		pFrame->mFrame.dataSize = pStream->m_iFrameSize;
+
+		if( pStream->m_mAllocator.funcAlloc != NULL )
+		{
+			pFrame->mFrame.data = pStream->m_mAllocator.funcAlloc( pFrame->mFrame.dataSize, pStream->m_mAllocator.pCookie );
+		}
+		else
+		{
+			pFrame->mFrame.data = xnOSMallocAligned( pFrame->mFrame.dataSize, XN_DEFAULT_MEM_ALIGN );
+			++ pStream->m_uAllocations;
+		}
+
+		if( pFrame->mFrame.data == NULL )
+		{
+			delete pFrame;
+			return NULL;
+		}
+		return &pFrame->mFrame;
+	}
+
+	static void ONI_CALLBACK_TYPE AddFrameRef( void* /*pCookie*/, OniFrame* pFrame )
+	{
+		++ reinterpret_cast<BenchFrame*>( pFrame )->iRefCount;
+	}
+
+	static void ONI_CALLBACK_TYPE ReleaseFrame( void* pCookie, OniFrame* pFrame )
+	{
+		BenchFrame* pBenchFrame = reinterpret_cast<BenchFrame*>( pFrame );
+		if( -- pBenchFrame->iRefCount == 0 )
+		{
+			BenchStream* pStream = static_cast<BenchStream*>( pCookie );
+			if( pStream->m_mAllocator.funcFree != NULL )
+				pStream->m_mAllocator.funcFree( pFrame->data, pStream->m_mAllocator.pCookie );
+			else
+				xnOSFreeAligned( pFrame->data );
+			delete pBenchFrame;
+		}
+	}
+
+	/**
+	 * New frame callback: every listener takes a reference and reads the frame
+	 */
+	static void ONI_CALLBACK_TYPE NewFrame( void* /*hStream*/, OniFrame* pFrame, void* pCookie )
+	{
+		BenchStream* pStream = static_cast<BenchStream*>( pCookie );
+		pStream->m_vRaiseTime.push_back( GetTimestamp() - pStream->m_aSubmitTime[ unsigned( pFrame->frameIndex ) % SUBMIT_RING ].load() );
+		if( pStream->m_bCheckFrames && !pStream->IsFrameConsistent( pFrame ) )
+			++ pStream->m_uMismatched;
+
+		for( int i = 0; i < pStream->m_iListeners; ++ i )
+		{
+			AddFrameRef( pStream, pFrame );
+			pStream->m_uChecksum += static_cast<const volatile unsigned char*>( pFrame->data )[ pFrame->dataSize / 2 ];
+			ReleaseFrame( pStream, pFrame );
+		}
+	}
+
+	/**
+	 * Check the frame against the video mode of Setup(), and the cropping
+	 * window of Reconfigure() if it's cropped; only the fps is changed while
+	 * the stream is running, so the size never changes.
+	 */
+	bool IsFrameConsistent( const OniFrame* pFrame ) const
+	{
+		const OniVideoMode& rMode = m_mVideoMode;
+		if( pFrame->videoMode.pixelFormat != rMode.pixelFormat ||
+			pFrame->videoMode.resolutionX != rMode.resolutionX ||
+			pFrame->videoMode.resolutionY != rMode.resolutionY )
+			return false;
+
+		if( pFrame->croppingEnabled )
+		{
+			if( pFrame->cropOriginX != rMode.resolutionX / 4 || pFrame->cropOriginY != rMode.resolutionY / 4 ||
+				pFrame->width != rMode.resolutionX / 2 || pFrame->height != rMode.resolutionY / 2 )
+				return false;
+		}
+		else if( pFrame->width != rMode.resolutionX || pFrame->height != rMode.resolutionY )
+		{
+			return false;
+		}
+
+		// the rows must be in the buffer
+		int iRowSize = pFrame->width * GetBytesPerPixel( rMode.pixelFormat, VIRTUAL_INPUT_NATIVE );
+		return	pFrame->height > 0 && pFrame->stride >= iRowSize &&
+				pFrame->stride * ( pFrame->height - 1 ) + iRowSize <= pFrame->dataSize;
+	}
+
+protected:
+	static const int	SUBMIT_RING = 256;
+
+	void*						m_hDevice;
+	void*						m_hStream;
+	OniStreamServices			m_mServices;
+	OniVideoMode				m_mVideoMode;
+	OniPixelFormat				m_eFrameFormat;		// pixel format of the frames set, may be the other depth unit
+	VirtualFrameAllocator		m_mAllocator;
+	int							m_iFrameSize;
+	int							m_iListeners;
+	std::atomic<uint64_t>		m_uAllocations;
+	std::atomic<uint64_t>		m_aSubmitTime[SUBMIT_RING];
+	unsigned int				m_uChecksum;
+	bool						m_bCheckFrames;		// only the streams of Setup() are checked
+	std::atomic<uint64_t>		m_uMismatched;
+	std::vector<uint64_t>		m_vGetTime;
+	std::vector<uint64_t>		m_vFillTime;
+	std::vector<uint64_t>		m_vSetTime;
+	std::vector<uint64_t>		m_vRaiseTime;
+
+private:
+	BenchStream( const BenchStream& );
+	BenchStream& operator=( const BenchStream& );
+};
+
+#pragma endregion
+
+#pragma region Benchmark
+
+struct Resolution
+{
+	const char*	szName;
+	int			iWidth;
+	int			iHeight;
+};
+
+struct PixelFormat
+{
+	const char*			szName;
+	OniPixelFormat		eFormat;
+	OniPixelFormat		eFrameFormat;	// written to the frames before set
+	VirtualInputFormat	eInput;
+	bool				bMirror;
+	OniSensorType		eSensor;
+};
+
+struct Options
+{
+	std::string	sDriverFile;
+	std::string	sOutputFile;
+	int			iFrames;
+	bool		bAllocator;
+	bool		bAsync;
+	bool		bFill;
+	bool		bReconfig;
+};
+
+/**
+ * Parameter of the thread which reconfigure streams until the producers finish
+ */
+struct ReconfigParam
+{
+	std::vector<BenchStream*>*	pStreams;
+	std::atomic<bool>			bStop;
+	uint64_t					uReconfigs;
+	uint64_t					uFailed;
+};
+
+XN_THREAD_PROC ProducerThread( XN_THREAD_PARAM pThreadParam )
+{
+	std::pair<BenchStream*,const Options*>* pParam = static_cast<std::pair<BenchStream*,const Options*>*>( pThreadParam );
+	pParam->first->Produce( pParam->second->iFrames, pParam->second->bFill );
+	XN_THREAD_PROC_RETURN( XN_STATUS_OK );
+}
+
+XN_THREAD_PROC ReconfigThread( XN_THREAD_PARAM pThreadParam )
+{
+	ReconfigParam* pParam = static_cast<ReconfigParam*>( pThreadParam );
+	for( int iStep = 0; !pParam->bStop; ++ iStep )
+	{
+		for( auto itStream = pParam->pStreams->begin(); itStream != pParam->pStreams->end(); ++ itStream )
+		{
+			if( (*itStream)->Reconfigure( iStep ) )
+				++ pParam->uReconfigs;
+			else
+				++ pParam->uFailed;
+		}
+		xnOSSleep( 1 );
+	}
+	XN_THREAD_PROC_RETURN( XN_STATUS_OK );
+}
+
+/**
+ * Write percentiles of the given samples (in nanoseconds)
+ */
+void WritePercentiles( FILE* pFile, const char* szName, std::vector<uint64_t>& vSamples )
+{
+	std::sort( vSamples.begin(), vSamples.end() );
+
+	uint64_t aValue[4] = { 0, 0, 0, 0 };
+	if( !vSamples.empty() )
+	{
+		size_t uLast = vSamples.size() - 1;
+		aValue[0] = vSamples[ uLast * 50 / 100 ];
+		aValue[1] = vSamples[ uLast * 90 / 100 ];
+		aValue[2] = vSamples[ uLast * 99 / 100 ];
+		aValue[3] = vSamples[ uLast ];
+	}
+	fprintf( pFile, "\"%s\": { \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu }", szName,
+		(unsigned long long)aValue[0], (unsigned long long)aValue[1], (unsigned long long)aValue[2], (unsigned long long)aValue[3] );
+}
+
+/**
+ * Run one case of the matrix on the given devices, and write it as a JSON object
+ */
+bool RunCase( FILE* pFile, bool& rFirst, const Options& rOptions, std::vector<void*>& vDevices, const Resolution& rRes, const PixelFormat& rFormat, int iListeners )
+{
+	std::vector<BenchStream*> vStreams;
+	bool bOK = true;
+	for( auto itDevice = vDevices.begin(); itDevice != vDevices.end() && bOK; ++ itDevice )
+	{
+		BenchStream* pStream = new BenchStream( *itDevice, rFormat.eSensor );
+		vStreams.push_back( pStream );
+		bOK = pStream->IsValid()
+			&& pStream->Setup( rFormat.eFormat, rFormat.eFrameFormat, rFormat.eInput, rFormat.bMirror, rRes.iWidth, rRes.iHeight, iListeners, rOptions.bAllocator, rOptions.bAsync, rOptions.iFrames )
+			&& pStream->Start();
+	}
+
+	if( bOK )
+	{
+		// one producer thread per stream
+		std::vector< std::pair<BenchStream*,const Options*> > vParam;
+		std::vector<XN_THREAD_HANDLE> vThreads( vStreams.size() );
+		for( auto itStream = vStreams.begin(); itStream != vStreams.end(); ++ itStream )
+			vParam.push_back( std::make_pair( *itStream, &rOptions ) );
+
+		ReconfigParam mReconfig;
+		mReconfig.pStreams		= &vStreams;
+		mReconfig.bStop			= false;
+		mReconfig.uReconfigs	= 0;
+		mReconfig.uFailed		= 0;
+		XN_THREAD_HANDLE hReconfig = NULL;
+
+		uint64_t uBegin = GetTimestamp();
+		for( size_t i = 0; i < vStreams.size(); ++ i )
+			xnOSCreateThread( ProducerThread, &vParam[i], &vThreads[i] );
+		if( rOptions.bReconfig )
+			xnOSCreateThread( ReconfigThread, &mReconfig, &hReconfig );
+		for( size_t i = 0; i < vStreams.size(); ++ i )
+		{
+			xnOSWaitForThreadExit( vThreads[i], XN_WAIT_INFINITE );
+			xnOSCloseThread( &vThreads[i] );
+		}
+		if( hReconfig != NULL )
+		{
+			mReconfig.bStop = true;
+			xnOSWaitForThreadExit( hReconfig, XN_WAIT_INFINITE );
+			xnOSCloseThread( &hReconfig );
+			if( mReconfig.uFailed > 0 )
+				bOK = false;
+		}
+
+		// stop to flush the dispatch queue before reading the results
+		for( auto itStream = vStreams.begin(); itStream != vStreams.end(); ++ itStream )
+			(*itStream)->Stop();
+		uint64_t uElapsed = GetTimestamp() - uBegin;
+
+		// collect results
+		std::vector<uint64_t> vGet, vFill, vSet, vRaise;
+		uint64_t uAllocations = 0, uRaised = 0, uDropped = 0, uMismatched = 0;
+		for( auto itStream = vStreams.begin(); itStream != vStreams.end(); ++ itStream )
+		{
+			BenchStream& rStream = **itStream;
+			vGet.insert( vGet.end(), rStream.GetTimeOfGet().begin(), rStream.GetTimeOfGet().end() );
+			vFill.insert( vFill.end(), rStream.GetTimeOfFill().begin(), rStream.GetTimeOfFill().end() );
+			vSet.insert( vSet.end(), rStream.GetTimeOfSet().begin(), rStream.GetTimeOfSet().end() );
+			vRaise.insert( vRaise.end(), rStream.GetTimeOfRaise().begin(), rStream.GetTimeOfRaise().end() );
+			uAllocations += rStream.GetAllocations();
+			uMismatched += rStream.GetMismatched();
+
+			VirtualStreamStatistics mStats;
+			if( rStream.GetStatistics( mStats ) )
+			{
+				uRaised		+= mStats.uRaised;
+				uDropped	+= mStats.uDropped + mStats.uRejected;
+			}
+		}
+
+		if( uMismatched > 0 )
+		{
+			fprintf( stderr, "%llu frames of %s %s don't match the configuration\n", (unsigned long long)uMismatched, rRes.szName, rFormat.szName );
+			bOK = false;
+		}
+
+		uint64_t uFrames = vSet.size();
+		double dSeconds = uElapsed > 0 ? uElapsed / 1e9 : 1e-9;
+		int iFrameSize = rRes.iWidth * rRes.iHeight * GetBytesPerPixel( rFormat.eFormat, rFormat.eInput );
+
+		if( !rFirst )
+			fprintf( pFile, ",\n" );
+		rFirst = false;
+
+		fprintf( pFile, "\t\t{ \"resolution\": \"%s\", \"width\": %d, \"height\": %d, \"format\": \"%s\", \"streams\": %d, \"listeners\": %d,\n",
+			rRes.szName, rRes.iWidth, rRes.iHeight, rFormat.szName, int( vStreams.size() ), iListeners );
+		fprintf( pFile, "\t\t  \"frames\": %llu, \"raised\": %llu, \"dropped\": %llu, \"fps\": %.1f, \"mb_per_s\": %.1f, \"allocations_per_frame\": %.3f,\n",
+			(unsigned long long)uFrames, (unsigned long long)uRaised, (unsigned long long)uDropped,
+			uFrames / dSeconds, uFrames * double( iFrameSize ) / ( 1024 * 1024 ) / dSeconds,
+			uFrames > 0 ? double( uAllocations ) / uFrames : 0.0 );
+		if( rOptions.bReconfig )
+			fprintf( pFile, "\t\t  \"reconfigs\": %llu, \"reconfig_failed\": %llu, \"mismatched\": %llu,\n", (unsigned long long)mReconfig.uReconfigs, (unsigned long long)mReconfig.uFailed, (unsigned long long)uMismatched );
+		fprintf( pFile, "\t\t  " );
+		WritePercentiles( pFile, "get_ns", vGet );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "fill_ns", vFill );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "set_ns", vSet );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "raise_ns", vRaise );
+		fprintf( pFile, " }" );
+	}
+	else
+	{
+		fprintf( stderr, "Can't setup streams for %s %s\n", rRes.szName, rFormat.szName );
+	}
+
+	for( auto itStream = vStreams.begin(); itStream != vStreams.end(); ++ itStream )
+		delete *itStream;
+	return bOK;
+}
+
+/**
+ * The cache of CoordinateConverter in OpenNI
+ */
+struct WorldConvertCache
+{
+	float	fXZFactor;
+	float	fYZFactor;
+	float	fResolutionX;
+	float	fResolutionY;
+};
+
+/**
+ * VideoStream::convertDepthToWorldCoordinates() of OpenNI
+ */
+OniStatus ConvertDepthToWorld( const WorldConvertCache& rCache, float fDepthX, float fDepthY, float fDepthZ, float* pWorldX, float* pWorldY, float* pWorldZ )
+{
+	float fNormalizedX = fDepthX / rCache.fResolutionX - .5f;
+	float fNormalizedY = .5f - fDepthY / rCache.fResolutionY;
+
+	*pWorldX = fNormalizedX * fDepthZ * rCache.fXZFactor;
+	*pWorldY = fNormalizedY * fDepthZ * rCache.fYZFactor;
+	*pWorldZ = fDepthZ;
+	return ONI_STATUS_OK;
+}
+
+/**
+ * Run the point cloud case of a resolution: the SET of depth stream without
+ * and with the point cloud stream (the points are built in SET with sync
+ * dispatch), and the per-pixel converter on the same depth
+ */
+bool RunPointCloudCase( FILE* pFile, bool& rFirst, const Options& rOptions, void* hDevice, const Resolution& rRes )
+{
+	const float fHorizontalFOV = 1.0225f, fVerticalFOV = 0.7959f;
+
+	// depth of 0.5m - 4.5m, 1/8 of pixels are invalid
+	std::vector<OniDepthPixel> vDepth( rRes.iWidth * rRes.iHeight );
+	unsigned int uSeed = 1;
+	for( auto itPixel = vDepth.begin(); itPixel != vDepth.end(); ++ itPixel )
+	{
+		uSeed = uSeed * 1103515245 + 12345;
+		unsigned int uValue = ( uSeed >> 16 ) & 0x7FFF;
+		*itPixel = OniDepthPixel( uValue % 8 == 0 ? 0 : 500 + uValue % 4000 );
+	}
+
+	std::vector<uint64_t> vDepthOnly, vOrganized, vCompact, vConverter;
+	bool bOK = false;
+	{
+		BenchStream mDepth( hDevice, ONI_SENSOR_DEPTH );
+		bOK = mDepth.IsValid()
+			&& mDepth.Setup( ONI_PIXEL_FORMAT_DEPTH_1_MM, ONI_PIXEL_FORMAT_DEPTH_1_MM, VIRTUAL_INPUT_NATIVE, false, rRes.iWidth, rRes.iHeight, 0, false, false, rOptions.iFrames )
+			&& g_Driver.funcStreamSetProperty( mDepth.GetHandle(), ONI_STREAM_PROPERTY_HORIZONTAL_FOV, &fHorizontalFOV, sizeof(fHorizontalFOV) ) == ONI_STATUS_OK
+			&& g_Driver.funcStreamSetProperty( mDepth.GetHandle(), ONI_STREAM_PROPERTY_VERTICAL_FOV, &fVerticalFOV, sizeof(fVerticalFOV) ) == ONI_STATUS_OK
+			&& mDepth.Start();
+		if( bOK )
+		{
+			mDepth.Produce( rOptions.iFrames, true, vDepth.data() );
+			vDepthOnly = mDepth.GetTimeOfSet();
+
+			for( int iCompact = 0; iCompact < 2 && bOK; ++ iCompact )
+			{
+				BenchStream mPoints( hDevice, VIRTUAL_SENSOR_POINT_CLOUD );
+				bOK = mPoints.IsValid() && mPoints.SetupPoints( VIRTUAL_PIXEL_FORMAT_POINT_XYZ, iCompact == 1, rOptions.iFrames ) && mPoints.Start();
+				if( bOK )
+				{
+					mDepth.ClearTimes();
+					mDepth.Produce( rOptions.iFrames, true, vDepth.data() );
+					( iCompact == 1 ? vCompact : vOrganized ) = mDepth.GetTimeOfSet();
+					mPoints.Stop();
+				}
+			}
+			mDepth.Stop();
+		}
+	}
+
+	if( bOK )
+	{
+		// as an application, call the converter for each valid pixel
+		OniStatus (*volatile funcConvert)( const WorldConvertCache&, float, float, float, float*, float*, float* ) = ConvertDepthToWorld;
+		WorldConvertCache mCache = { 2 * tanf( fHorizontalFOV / 2 ), 2 * tanf( fVerticalFOV / 2 ), float( rRes.iWidth ), float( rRes.iHeight ) };
+		std::vector<VirtualPointXYZ> vPoints( vDepth.size() );
+		float fChecksum = 0;
+		for( int i = 0; i < rOptions.iFrames; ++ i )
+		{
+			uint64_t uT0 = GetTimestamp();
+			VirtualPointXYZ* pPoint = vPoints.data();
+			for( int y = 0; y < rRes.iHeight; ++ y )
+			{
+				const OniDepthPixel* pRow = vDepth.data() + y * rRes.iWidth;
+				for( int x = 0; x < rRes.iWidth; ++ x )
+				{
+					if( pRow[x] == 0 )
+						continue;
+					funcConvert( mCache, float( x ), float( y ), float( pRow[x] ), &pPoint->fX, &pPoint->fY, &pPoint->fZ );
+					++ pPoint;
+				}
+			}
+			vConverter.push_back( GetTimestamp() - uT0 );
+			fChecksum += vPoints[ vPoints.size() / 2 ].fX;
+		}
+
+		if( !rFirst )
+			fprintf( pFile, ",\n" );
+		rFirst = false;
+
+		fprintf( pFile, "\t\t{ \"resolution\": \"%s\", \"width\": %d, \"height\": %d, \"format\": \"POINT_XYZ\", \"frames\": %d, \"checksum\": %.1f,\n",
+			rRes.szName, rRes.iWidth, rRes.iHeight, rOptions.iFrames, fChecksum );
+		fprintf( pFile, "\t\t  " );
+		WritePercentiles( pFile, "depth_set_ns", vDepthOnly );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "organized_set_ns", vOrganized );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "compact_set_ns", vCompact );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "converter_ns", vConverter );
+		fprintf( pFile, " }" );
+	}
+	else
+	{
+		fprintf( stderr, "Can't setup point cloud stream for %s\n", rRes.szName );
+	}
+	return bOK;
+}
+
+/**
+ * Run the registration case of a resolution: the SET of depth stream without
+ * and with ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION
+ */
+bool RunRegistrationCase( FILE* pFile, bool& rFirst, const Options& rOptions, void* hDevice, const Resolution& rRes )
+{
+	// calibration of a Kinect-like device at VGA, slightly rotated
+	const VirtualCameraIntrinsics mDepth = { 640, 480, 570.3f, 570.3f, 319.5f, 239.5f };
+	const VirtualCameraIntrinsics mColor = { 640, 480, 525.0f, 525.0f, 319.5f, 239.5f };
+	const VirtualCameraExtrinsics mExtrinsics = {
+		{ 0.9998f, 0.0100f, -0.0150f, -0.0101f, 0.9999f, -0.0050f, 0.0150f, 0.0052f, 0.9998f },
+		{ 25.0f, 0.5f, -1.0f } };
+
+	std::vector<OniDepthPixel> vDepth( rRes.iWidth * rRes.iHeight );
+	unsigned int uSeed = 1;
+	for( auto itPixel = vDepth.begin(); itPixel != vDepth.end(); ++ itPixel )
+	{
+		uSeed = uSeed * 1103515245 + 12345;
+		unsigned int uValue = ( uSeed >> 16 ) & 0x7FFF;
+		*itPixel = OniDepthPixel( uValue % 8 == 0 ? 0 : 500 + uValue % 4000 );
+	}
+
+	std::vector<uint64_t> vOff, vRegistered;
+	bool bOK = false;
+	{
+		int iOff = ONI_IMAGE_REGISTRATION_OFF, iOn = ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR;
+		BenchStream mStream( hDevice, ONI_SENSOR_DEPTH );
+		bOK = mStream.IsValid()
+			&& mStream.Setup( ONI_PIXEL_FORMAT_DEPTH_1_MM, ONI_PIXEL_FORMAT_DEPTH_1_MM, VIRTUAL_INPUT_NATIVE, false, rRes.iWidth, rRes.iHeight, 0, false, false, rOptions.iFrames )
+			&& g_Driver.funcDeviceSetProperty( hDevice, VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS, &mDepth, sizeof(mDepth) ) == ONI_STATUS_OK
+			&& g_Driver.funcDeviceSetProperty( hDevice, VIRTUAL_DEVICE_PROPERTY_COLOR_INTRINSICS, &mColor, sizeof(mColor) ) == ONI_STATUS_OK
+			&& g_Driver.funcDeviceSetProperty( hDevice, VIRTUAL_DEVICE_PROPERTY_DEPTH_TO_COLOR, &mExtrinsics, sizeof(mExtrinsics) ) == ONI_STATUS_OK
+			&& mStream.Start();
+		if( bOK )
+		{
+			mStream.Produce( rOptions.iFrames, true, vDepth.data() );
+			vOff = mStream.GetTimeOfSet();
+
+			bOK = g_Driver.funcDeviceSetProperty( hDevice, ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION, &iOn, sizeof(iOn) ) == ONI_STATUS_OK;
+			if( bOK )
+			{
+				mStream.ClearTimes();
+				mStream.Produce( rOptions.iFrames, true, vDepth.data() );
+				vRegistered = mStream.GetTimeOfSet();
+				g_Driver.funcDeviceSetProperty( hDevice, ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION, &iOff, sizeof(iOff) );
+			}
+			mStream.Stop();
+		}
+	}
+
+	if( bOK )
+	{
+		if( !rFirst )
+			fprintf( pFile, ",\n" );
+		rFirst = false;
+
+		fprintf( pFile, "\t\t{ \"resolution\": \"%s\", \"width\": %d, \"height\": %d, \"format\": \"DEPTH_1_MM\", \"frames\": %d,\n",
+			rRes.szName, rRes.iWidth, rRes.iHeight, rOptions.iFrames );
+		fprintf( pFile, "\t\t  " );
+		WritePercentiles( pFile, "set_ns", vOff );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "registered_set_ns", vRegistered );
+		fprintf( pFile, " }" );
+	}
+	else
+	{
+		fprintf( stderr, "Can't setup registration for %s\n", rRes.szName );
+	}
+	return bOK;
+}
+
+/**
+ * Run the RGB-D case of a resolution: the SET of depth and color frame sets
+ * without and with the RGB-D stream, which interleaves them in SET
+ */
+bool RunRGBDCase( FILE* pFile, bool& rFirst, const Options& rOptions, void* hDevice, const Resolution& rRes )
+{
+	std::vector<OniDepthPixel> vDepth( rRes.iWidth * rRes.iHeight );
+	std::vector<OniRGB888Pixel> vColor( rRes.iWidth * rRes.iHeight );
+	unsigned int uSeed = 1;
+	for( size_t i = 0; i < vDepth.size(); ++ i )
+	{
+		uSeed = uSeed * 1103515245 + 12345;
+		unsigned int uValue = ( uSeed >> 16 ) & 0x7FFF;
+		vDepth[i] = OniDepthPixel( uValue % 8 == 0 ? 0 : 500 + uValue % 4000 );
+		vColor[i].r = (unsigned char)( uValue );
+		vColor[i].g = (unsigned char)( uValue >> 4 );
+		vColor[i].b = (unsigned char)( uValue >> 8 );
+	}
+
+	std::vector<uint64_t> vPlanar, vInterleaved;
+	bool bOK = false;
+	{
+		BenchStream mDepth( hDevice, ONI_SENSOR_DEPTH ), mColor( hDevice, ONI_SENSOR_COLOR );
+		bOK = mDepth.IsValid() && mColor.IsValid()
+			&& mDepth.Setup( ONI_PIXEL_FORMAT_DEPTH_1_MM, ONI_PIXEL_FORMAT_DEPTH_1_MM, VIRTUAL_INPUT_NATIVE, false, rRes.iWidth, rRes.iHeight, 0, false, false, rOptions.iFrames )
+			&& mColor.Setup( ONI_PIXEL_FORMAT_RGB888, ONI_PIXEL_FORMAT_RGB888, VIRTUAL_INPUT_NATIVE, false, rRes.iWidth, rRes.iHeight, 0, false, false, rOptions.iFrames )
+			&& mDepth.Start() && mColor.Start();
+		if( bOK )
+		{
+			mDepth.ProduceSet( mColor, rOptions.iFrames, vDepth.data(), vColor.data() );
+			vPlanar = mDepth.GetTimeOfSet();
+
+			BenchStream mRGBD( hDevice, VIRTUAL_SENSOR_RGBD );
+			bOK = mRGBD.IsValid() && mRGBD.SetupDerived( VIRTUAL_PIXEL_FORMAT_RGBD, rOptions.iFrames ) && mRGBD.Start();
+			if( bOK )
+			{
+				mDepth.ClearTimes();
+				mDepth.ProduceSet( mColor, rOptions.iFrames, vDepth.data(), vColor.data() );
+				vInterleaved = mDepth.GetTimeOfSet();
+				mRGBD.Stop();
+			}
+		}
+		mColor.Stop();
+		mDepth.Stop();
+	}
+
+	if( bOK )
+	{
+		if( !rFirst )
+			fprintf( pFile, ",\n" );
+		rFirst = false;
+
+		fprintf( pFile, "\t\t{ \"resolution\": \"%s\", \"width\": %d, \"height\": %d, \"format\": \"RGBD\", \"frames\": %d,\n",
+			rRes.szName, rRes.iWidth, rRes.iHeight, rOptions.iFrames );
+		fprintf( pFile, "\t\t  " );
+		WritePercentiles( pFile, "set_ns", vPlanar );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "rgbd_set_ns", vInterleaved );
+		fprintf( pFile, " }" );
+	}
+	else
+	{
+		fprintf( stderr, "Can't setup RGB-D stream for %s\n", rRes.szName );
+	}
+	return bOK;
+}
+
+/**
+ * Run the undistortion case of a resolution and format: the SET without and
+ * with the lens distortion of stream
+ */
+bool RunUndistortionCase( FILE* pFile, bool& rFirst, const Options& rOptions, void* hDevice, const Resolution& rRes, const PixelFormat& rFormat )
+{
+	// a wide lens at VGA, with barrel distortion
+	const VirtualLensDistortion mDistortion = { { 640, 480, 525.0f, 525.0f, 319.5f, 239.5f }, -0.28f, 0.09f, 0.001f, -0.0005f, -0.01f };
+	VirtualLensDistortion mNone;
+	memset( &mNone, 0, sizeof(mNone) );
+
+	std::vector<unsigned char> vSource( rRes.iWidth * rRes.iHeight * 3 );
+	unsigned int uSeed = 1;
+	for( size_t i = 0; i + 1 < vSource.size(); i += 2 )
+	{
+		uSeed = uSeed * 1103515245 + 12345;
+		unsigned int uValue = 500 + ( ( uSeed >> 16 ) & 0x7FFF ) % 4000;
+		vSource[i]		= (unsigned char)( uValue );
+		vSource[i + 1]	= (unsigned char)( uValue >> 8 );
+	}
+
+	std::vector<uint64_t> vOff, vUndistorted;
+	bool bOK = false;
+	{
+		BenchStream mStream( hDevice, rFormat.eSensor );
+		bOK = mStream.IsValid()
+			&& mStream.Setup( rFormat.eFormat, rFormat.eFrameFormat, rFormat.eInput, rFormat.bMirror, rRes.iWidth, rRes.iHeight, 0, false, false, rOptions.iFrames )
+			&& mStream.Start();
+		if( bOK )
+		{
+			mStream.Produce( rOptions.iFrames, true, vSource.data() );
+			vOff = mStream.GetTimeOfSet();
+
+			bOK = g_Driver.funcStreamSetProperty( mStream.GetHandle(), VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION, &mDistortion, sizeof(mDistortion) ) == ONI_STATUS_OK;
+			if( bOK )
+			{
+				mStream.ClearTimes();
+				mStream.Produce( rOptions.iFrames, true, vSource.data() );
+				vUndistorted = mStream.GetTimeOfSet();
+				g_Driver.funcStreamSetProperty( mStream.GetHandle(), VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION, &mNone, sizeof(mNone) );
+			}
+			mStream.Stop();
+		}
+	}
+
+	if( bOK )
+	{
+		if( !rFirst )
+			fprintf( pFile, ",\n" );
+		rFirst = false;
+
+		fprintf( pFile, "\t\t{ \"resolution\": \"%s\", \"width\": %d, \"height\": %d, \"format\": \"%s\", \"frames\": %d,\n",
+			rRes.szName, rRes.iWidth, rRes.iHeight, rFormat.szName, rOptions.iFrames );
+		fprintf( pFile, "\t\t  " );
+		WritePercentiles( pFile, "set_ns", vOff );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "undistorted_set_ns", vUndistorted );
+		fprintf( pFile, " }" );
+	}
+	else
+	{
+		fprintf( stderr, "Can't setup undistortion for %s %s\n", rRes.szName, rFormat.szName );
+	}
+	return bOK;
+}
+
+/**
+ * Run the depth filter case of a resolution: the SET without filters, and
+ * with all of them by iThreads extra threads
+ */
+bool RunDepthFilterCase( FILE* pFile, bool& rFirst, const Options& rOptions, void* hDevice, const Resolution& rRes, int iThreads )
+{
+	const VirtualFlyingPixelFilter	mFlyingPixel	= { 50, 4 };
+	const VirtualSpatialFilter		mSpatial		= { 2, 20 };
+	const VirtualTemporalFilter		mTemporal		= { 0.4f, 20, 3 };
+	const VirtualHoleFillFilter		mHoleFill		= { VIRTUAL_HOLE_FILL_FARTHEST, 2 };
+	VirtualFlyingPixelFilter	mNoFlyingPixel	= mFlyingPixel;
+	VirtualSpatialFilter		mNoSpatial		= mSpatial;
+	VirtualTemporalFilter		mNoTemporal		= mTemporal;
+	VirtualHoleFillFilter		mNoHoleFill		= mHoleFill;
+	mNoFlyingPixel.iThreshold	= 0;
+	mNoSpatial.iIterations		= 0;
+	mNoTemporal.fAlpha			= 0;
+	mNoHoleFill.iMode			= VIRTUAL_HOLE_FILL_OFF;
+
+	// noisy depth with about 1/8 holes
+	std::vector<OniDepthPixel> vSource( rRes.iWidth * rRes.iHeight );
+	unsigned int uSeed = 1;
+	for( size_t i = 0; i < vSource.size(); ++ i )
+	{
+		uSeed = uSeed * 1103515245 + 12345;
+		unsigned int uValue = ( uSeed >> 16 ) & 0x7FFF;
+		vSource[i] = OniDepthPixel( uValue % 8 == 0 ? 0 : 1000 + uValue % 64 );
+	}
+
+	std::vector<uint64_t> vOff, vFiltered;
+	VirtualStreamStatistics mStats;
+	memset( &mStats, 0, sizeof(mStats) );
+	bool bOK = false;
+	{
+		BenchStream mStream( hDevice, ONI_SENSOR_DEPTH );
+		void* hStream = mStream.GetHandle();
+		bOK = mStream.IsValid()
+			&& mStream.Setup( ONI_PIXEL_FORMAT_DEPTH_1_MM, ONI_PIXEL_FORMAT_DEPTH_1_MM, VIRTUAL_INPUT_NATIVE, false, rRes.iWidth, rRes.iHeight, 0, false, false, rOptions.iFrames )
+			&& g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_FILTER_THREADS, &iThreads, sizeof(iThreads) ) == ONI_STATUS_OK
+			&& mStream.Start();
+		if( bOK )
+		{
+			mStream.Produce( rOptions.iFrames, true, vSource.data() );
+			vOff = mStream.GetTimeOfSet();
+
+			bOK = g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER, &mFlyingPixel, sizeof(mFlyingPixel) ) == ONI_STATUS_OK
+				&& g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_SPATIAL_FILTER, &mSpatial, sizeof(mSpatial) ) == ONI_STATUS_OK
+				&& g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_TEMPORAL_FILTER, &mTemporal, sizeof(mTemporal) ) == ONI_STATUS_OK
+				&& g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_HOLE_FILL_FILTER, &mHoleFill, sizeof(mHoleFill) ) == ONI_STATUS_OK;
+			if( bOK )
+			{
+				mStream.ClearTimes();
+				mStream.Produce( rOptions.iFrames, true, vSource.data() );
+				vFiltered = mStream.GetTimeOfSet();
+				bOK = mStream.GetStatistics( mStats );
+			}
+			g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER, &mNoFlyingPixel, sizeof(mNoFlyingPixel) );
+			g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_SPATIAL_FILTER, &mNoSpatial, sizeof(mNoSpatial) );
+			g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_TEMPORAL_FILTER, &mNoTemporal, sizeof(mNoTemporal) );
+			g_Driver.funcStreamSetProperty( hStream, VIRTUAL_STREAM_PROPERTY_HOLE_FILL_FILTER, &mNoHoleFill, sizeof(mNoHoleFill) );
+			mStream.Stop();
+		}
+	}
+
+	if( bOK )
+	{
+		if( !rFirst )
+			fprintf( pFile, ",\n" );
+		rFirst = false;
+
+		// the mean time of each filter, in the order of VirtualDepthFilter
+		double aMean[VIRTUAL_DEPTH_FILTER_NUM];
+		for( int i = 0; i < VIRTUAL_DEPTH_FILTER_NUM; ++ i )
+			aMean[i] = ( mStats.uFiltered > 0 ? double( mStats.aFilterTimeTotal[i] ) / mStats.uFiltered : 0.0 );
+
+		fprintf( pFile, "\t\t{ \"resolution\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, \"frames\": %d,\n",
+			rRes.szName, rRes.iWidth, rRes.iHeight, iThreads, rOptions.iFrames );
+		fprintf( pFile, "\t\t  \"filter_mean_us\": { \"flying_pixel\": %.1f, \"spatial\": %.1f, \"temporal\": %.1f, \"hole_fill\": %.1f },\n",
+			aMean[VIRTUAL_DEPTH_FILTER_FLYING_PIXEL], aMean[VIRTUAL_DEPTH_FILTER_SPATIAL], aMean[VIRTUAL_DEPTH_FILTER_TEMPORAL], aMean[VIRTUAL_DEPTH_FILTER_HOLE_FILL] );
+		fprintf( pFile, "\t\t  " );
+		WritePercentiles( pFile, "set_ns", vOff );
+		fprintf( pFile, ",\n\t\t  " );
+		WritePercentiles( pFile, "filtered_set_ns", vFiltered );
+		fprintf( pFile, " }" );
+	}
+	else
+	{
+		fprintf( stderr, "Can't setup depth filters for %s with %d threads\n", rRes.szName, iThreads );
+	}
+	return bOK;
+}
+
+bool ParseOptions( int argc, char** argv, Options& rOptions )
+{
+	rOptions.sDriverFile	= DEFAULT_DRIVER_FILE;
+	rOptions.iFrames		= 200;
+	rOptions.bAllocator		= false;
+	rOptions.bAsync			= false;
+	rOptions.bFill			= true;
+	rOptions.bReconfig		= false;
+
+	for( int i = 1; i < argc; ++ i )
+	{
+		std::string sArg = argv[i];
+		if( sArg == "-driver" && i + 1 < argc )
+			rOptions.sDriverFile = argv[++i];
+		else if( sArg == "-out" && i + 1 < argc )
+			rOptions.sOutputFile = argv[++i];
+		else if( sArg == "-frames" && i + 1 < argc )
+			rOptions.iFrames = atoi( argv[++i] );
+		else if( sArg == "-allocator" )
+			rOptions.bAllocator = true;
+		else if( sArg == "-async" )
+			rOptions.bAsync = true;
+		else if( sArg == "-nofill" )
+			rOptions.bFill = false;
+		else if( sArg == "-reconfig" )
+			rOptions.bReconfig = true;
+		else if( sArg == "-quiet" )
+			g_bQuiet = true;
+		else
+		{
+			fprintf( stderr, "usage: %s [-driver <file>] [-frames <n>] [-out <file>] [-allocator] [-async] [-nofill] [-reconfig] [-quiet]\n", argv[0] );
+			return false;
+		}
+	}
+	return rOptions.iFrames > 0;
+}
+
+#pragma endregion
+
+int main( int argc, char** argv )
+{
+	Options mOptions;
+	if( !ParseOptions( argc, argv, mOptions ) )
+		return -1;
+
+	if( !g_Driver.Load( mOptions.sDriverFile.c_str() ) )
+		return -1;
+
+	// create driver with stand-in services
+	OniDriverServices mServices;
+	mServices.driverServices	= NULL;
+	mServices.errorLoggerAppend	= ErrorLoggerAppend;
+	mServices.errorLoggerClear	= ErrorLoggerClear;
+	mServices.log				= Log;
+	g_Driver.funcCreate( &mServices );
+	g_Driver.funcInitialize( DeviceConnected, DeviceDisconnected, DeviceStateChanged, NULL );
+
+	// one virtual device for each stream
+	const int iMaxStreams = 4;
+	std::vector<void*> vDevices;
+	for( int i = 0; i < iMaxStreams; ++ i )
+	{
+		char szUri[64];
+		sprintf( szUri, "\\OpenNI2\\VirtualDevice\\Bench%d", i );
+		void* hDevice = NULL;
+		if( g_Driver.funcTryDevice( szUri ) == ONI_STATUS_OK )
+			hDevice = g_Driver.funcDeviceOpen( szUri, NULL );
+		if( hDevice == NULL )
+		{
+			fprintf( stderr, "Can't open device '%s'\n", szUri );
+			return -1;
+		}
+		vDevices.push_back( hDevice );
+	}
+
+	FILE* pFile = stdout;
+	if( !mOptions.sOutputFile.empty() )
+	{
+		pFile = fopen( mOptions.sOutputFile.c_str(), "w" );
+		if( pFile == NULL )
+		{
+			fprintf( stderr, "Can't open output file '%s'\n", mOptions.sOutputFile.c_str() );
+			return -1;
+		}
+	}
+
+	OniVersion mVersion = { 0, 0, 0, 0 };
+	int iSize = sizeof(mVersion);
+	g_Driver.funcDeviceGetProperty( vDevices[0], ONI_DEVICE_PROPERTY_DRIVER_VERSION, &mVersion, &iSize );
+
+	// pixel kernels chosen by the driver, VIRTUAL_DEVICE_KERNEL can limit it
+	const char* aKernelName[] = { "scalar", "ssse3", "avx2", "avx512", "neon" };
+	int iKernel = -1;
+	iSize = sizeof(iKernel);
+	if( g_Driver.funcDeviceGetProperty( vDevices[0], VIRTUAL_DEVICE_PROPERTY_KERNEL_VARIANT, &iKernel, &iSize ) != ONI_STATUS_OK
+		|| iKernel < 0 || iKernel >= int( sizeof(aKernelName) / sizeof(aKernelName[0]) ) )
+		iKernel = -1;
+
+	fprintf( pFile, "{\n" );
+	fprintf( pFile, "\t\"driver\": \"%s\",\n", mOptions.sDriverFile.c_str() );
+	fprintf( pFile, "\t\"driver_version\": \"%d.%d.%d.%d\",\n", mVersion.major, mVersion.minor, mVersion.maintenance, mVersion.build );
+	fprintf( pFile, "\t\"kernel\": \"%s\",\n", iKernel >= 0 ? aKernelName[iKernel] : "unknown" );
+	fprintf( pFile, "\t\"frames_per_stream\": %d, \"allocator\": %s, \"async\": %s, \"fill\": %s, \"reconfig\": %s,\n", mOptions.iFrames,
+		mOptions.bAllocator ? "true" : "false", mOptions.bAsync ? "true" : "false", mOptions.bFill ? "true" : "false", mOptions.bReconfig ? "true" : "false" );
+	fprintf( pFile, "\t\"results\": [\n" );
+
+	// test matrix
+	const Resolution aResolution[] = {
+		{ "QVGA",	320,	240 },
+		{ "VGA",	640,	480 },
+		{ "720p",	1280,	720 },
+		{ "1080p",	1920,	1080 },
+		{ "4K",		3840,	2160 }
+	};
+	const PixelFormat aFormat[] = {
+		{ "DEPTH_1_MM",			ONI_PIXEL_FORMAT_DEPTH_1_MM,	ONI_PIXEL_FORMAT_DEPTH_1_MM,	VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_DEPTH },
+		{ "DEPTH_1_MM/mirror",	ONI_PIXEL_FORMAT_DEPTH_1_MM,	ONI_PIXEL_FORMAT_DEPTH_1_MM,	VIRTUAL_INPUT_NATIVE,	true,	ONI_SENSOR_DEPTH },
+		{ "DEPTH_100_UM>1_MM",	ONI_PIXEL_FORMAT_DEPTH_1_MM,	ONI_PIXEL_FORMAT_DEPTH_100_UM,	VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_DEPTH },
+		{ "DEPTH_1_MM>100_UM",	ONI_PIXEL_FORMAT_DEPTH_100_UM,	ONI_PIXEL_FORMAT_DEPTH_1_MM,	VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_DEPTH },
+		{ "RGB888",				ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_COLOR },
+		{ "RGB888/mirror",		ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_NATIVE,	true,	ONI_SENSOR_COLOR },
+		{ "YUYV>RGB888",		ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_YUYV,		false,	ONI_SENSOR_COLOR },
+		{ "UYVY>RGB888",		ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_UYVY,		false,	ONI_SENSOR_COLOR },
+		{ "BGR>RGB888",			ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_BGR,		false,	ONI_SENSOR_COLOR },
+		{ "BGRA>RGB888",		ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_BGRA,		false,	ONI_SENSOR_COLOR },
+		{ "GRAY8",				ONI_PIXEL_FORMAT_GRAY8,			ONI_PIXEL_FORMAT_GRAY8,			VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_IR },
+		{ "GRAY16",				ONI_PIXEL_FORMAT_GRAY16,		ONI_PIXEL_FORMAT_GRAY16,		VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_IR }
+	};
+
+	const int aStreams[]	= { 1, 2, 4 };
+	const int aListeners[]	= { 0, 1, 4 };
+
+	bool bFirst = true;
+	int iFailed = 0;
+	for( size_t uRes = 0; uRes < sizeof(aResolution) / sizeof(aResolution[0]); ++ uRes )
+	{
+		for( size_t uFormat = 0; uFormat < sizeof(aFormat) / sizeof(aFormat[0]); ++ uFormat )
+		{
+			for( size_t uStreams = 0; uStreams < sizeof(aStreams) / sizeof(aStreams[0]); ++ uStreams )
+			{
+				for( size_t uListeners = 0; uListeners < sizeof(aListeners) / sizeof(aListeners[0]); ++ uListeners )
+				{
+					fprintf( stderr, "%s %s streams=%d listeners=%d\n", aResolution[uRes].szName, aFormat[uFormat].szName, aStreams[uStreams], aListeners[uListeners] );
+
+					std::vector<void*> vCaseDevices( vDevices.begin(), vDevices.begin() + aStreams[uStreams] );
+					if( !RunCase( pFile, bFirst, mOptions, vCaseDevices, aResolution[uRes], aFormat[uFormat], aListeners[uListeners] ) )
+						++ iFailed;
+				}
+			}
+		}
+	}
+
+	// point cloud stream vs. per-pixel converter
+	fprintf( pFile, "\n\t],\n" );
+	fprintf( pFile, "\t\"point_cloud\": [\n" );
+	bFirst = true;
+	for( size_t uRes = 0; uRes < sizeof(aResolution) / sizeof(aResolution[0]); ++ uRes )
+	{
+		fprintf( stderr, "%s point cloud\n", aResolution[uRes].szName );
+		if( !RunPointCloudCase( pFile, bFirst, mOptions, vDevices[0], aResolution[uRes] ) )
+			++ iFailed;
+	}
+
+	// depth to color registration
+	fprintf( pFile, "\n\t],\n" );
+	fprintf( pFile, "\t\"registration\": [\n" );
+	bFirst = true;
+	for( size_t uRes = 0; uRes < sizeof(aResolution) / sizeof(aResolution[0]); ++ uRes )
+	{
+		fprintf( stderr, "%s registration\n", aResolution[uRes].szName );
+		if( !RunRegistrationCase( pFile, bFirst, mOptions, vDevices[0], aResolution[uRes] ) )
+			++ iFailed;
+	}
+
+	// interleaved RGB-D stream
+	fprintf( pFile, "\n\t],\n" );
+	fprintf( pFile, "\t\"rgbd\": [\n" );
+	bFirst = true;
+	for( size_t uRes = 0; uRes < sizeof(aResolution) / sizeof(aResolution[0]); ++ uRes )
+	{
+		fprintf( stderr, "%s rgbd\n", aResolution[uRes].szName );
+		if( !RunRGBDCase( pFile, bFirst, mOptions, vDevices[0], aResolution[uRes] ) )
+			++ iFailed;
+	}
+
+	// lens undistortion
+	const PixelFormat aUndistortionFormat[] = {
+		{ "DEPTH_1_MM",			ONI_PIXEL_FORMAT_DEPTH_1_MM,	ONI_PIXEL_FORMAT_DEPTH_1_MM,	VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_DEPTH },
+		{ "RGB888",				ONI_PIXEL_FORMAT_RGB888,		ONI_PIXEL_FORMAT_RGB888,		VIRTUAL_INPUT_NATIVE,	false,	ONI_SENSOR_COLOR }
+	};
+	fprintf( pFile, "\n\t],\n" );
+	fprintf( pFile, "\t\"undistortion\": [\n" );
+	bFirst = true;
+	for( size_t uRes = 0; uRes < sizeof(aResolution) / sizeof(aResolution[0]); ++ uRes )
+	{
+		for( size_t uFormat = 0; uFormat < sizeof(aUndistortionFormat) / sizeof(aUndistortionFormat[0]); ++ uFormat )
+		{
+			fprintf( stderr, "%s %s undistortion\n", aResolution[uRes].szName, aUndistortionFormat[uFormat].szName );
+			if( !RunUndistortionCase( pFile, bFirst, mOptions, vDevices[0], aResolution[uRes], aUndistortionFormat[uFormat] ) )
+				++ iFailed;
+		}
+	}
+
+	// depth filters, on the SET thread only and with 3 extra threads
+	const int aFilterThreads[] = { 0, 3 };
+	fprintf( pFile, "\n\t],\n" );
+	fprintf( pFile, "\t\"depth_filter\": [\n" );
+	bFirst = true;
+	for( size_t uRes = 0; uRes < sizeof(aResolution) / sizeof(aResolution[0]); ++ uRes )
+	{
+		for( size_t uThreads = 0; uThreads < sizeof(aFilterThreads) / sizeof(aFilterThreads[0]); ++ uThreads )
+		{
+			fprintf( stderr, "%s depth filter, %d threads\n", aResolution[uRes].szName, aFilterThreads[uThreads] );
+			if( !RunDepthFilterCase( pFile, bFirst, mOptions, vDevices[0], aResolution[uRes], aFilterThreads[uThreads] ) )
+				++ iFailed;
+		}
+	}
+
+	fprintf( pFile, "\n\t]\n}\n" );
+	if( pFile != stdout )
+		fclose( pFile );
+
+	// release
+	for( auto itDevice = vDevices.begin(); itDevice != vDevices.end(); ++ itDevice )
+		g_Driver.funcDeviceClose( *itDevice );
+	g_Driver.funcDestroy();
+	g_Driver.Unload();
+
+	return iFailed == 0 ? 0 : 1;
+}
@@ -57,6 +57,9 @@ openni::VideoStream* CreateVirtualStream( openni::Device& rVDevice, openni::Vide
 			pStream->setProperty( ONI_STREAM_PROPERTY_VERTICAL_FOV,		rStream.getVerticalFieldOfView() );
 			pStream->setProperty( ONI_STREAM_PROPERTY_HORIZONTAL_FOV,	rStream.getHorizontalFieldOfView() );
 			pStream->setProperty( ONI_STREAM_PROPERTY_MIRRORING,			rStream.getMirroringEnabled() );
+
+			// the virtual stream flip the frame, so read unmirrored data from the real one
+			rStream.setMirroringEnabled( false );
 			
 			if( rInfo.getSensorType() == openni::SENSOR_DEPTH )
 			{
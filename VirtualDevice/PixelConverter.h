@@ -0,0 +1,678 @@
+/**
+ * Pixel format converters of the virtual device driver.
+ *
+ * The producer may set frames in a pixel layout other than the video mode
+ * (VIRTUAL_STREAM_PROPERTY_INPUT_FORMAT); they are converted row by row when
+ * they are set. Every converter has a scalar version, and SIMD versions
+ * selected by PixelKernel.h; all of them give the same result.
+ *
+ * YUV is converted with BT.601 (16-235) in 6-bit fixed point, Y is scaled by
+ * 74.5; all the values fit in 16-bit lanes.
+ *
+ * Depth frames of the other depth unit are converted in place: 1 mm to
+ * 100 um saturates at the max value, 100 um to 1 mm is rounded.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Convert one row of iWidth pixels from pSource to pTarget
+ */
+typedef void (*PixelRowConverter)( const unsigned char* pSource, unsigned char* pTarget, int iWidth );
+
+/**
+ * Convert the unit of one row of depth, pSource may be pTarget
+ */
+typedef void (*DepthRowConverter)( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth );
+
+#pragma region scalar converters
+
+inline unsigned char ClampToByte( int iValue )
+{
+	return static_cast<unsigned char>( iValue < 0 ? 0 : ( iValue > 255 ? 255 : iValue ) );
+}
+
+inline void ConvertYUVToRGB( int iY, int iU, int iV, unsigned char* pRGB )
+{
+	int iC = ( iY - 16 ) * 74 + ( ( iY - 16 ) >> 1 ) + 32;
+	int iD = iU - 128;
+	int iE = iV - 128;
+	pRGB[0] = ClampToByte( ( iC + 102 * iE ) >> 6 );
+	pRGB[1] = ClampToByte( ( iC - 25 * iD - 52 * iE ) >> 6 );
+	pRGB[2] = ClampToByte( ( iC + 129 * iD ) >> 6 );
+}
+
+/**
+ * YUV 4:2:2, every two pixels share U and V; the offsets are of Y0, U and V
+ * in the 4 bytes of a pixel pair.
+ */
+template<int Y_OFFSET, int U_OFFSET, int V_OFFSET>
+void ConvertRowYUV422ToRGB( const unsigned char* pSource, unsigned char* pTarget, int iWidth, int iBegin = 0 )
+{
+	for( int x = iBegin; x < iWidth; ++ x )
+	{
+		const unsigned char* pPair = pSource + ( x & ~1 ) * 2;
+		ConvertYUVToRGB( pPair[ Y_OFFSET + ( x & 1 ) * 2 ], pPair[U_OFFSET], pPair[V_OFFSET], pTarget + x * 3 );
+	}
+}
+
+inline void ConvertRowYUYVToRGB( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB<0,1,3>( pSource, pTarget, iWidth );
+}
+
+inline void ConvertRowUYVYToRGB( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB<1,0,2>( pSource, pTarget, iWidth );
+}
+
+/**
+ * Swap the first and third bytes of every pixel, and drop the others
+ */
+template<int PIXEL_SIZE>
+void ConvertRowBGRToRGB( const unsigned char* pSource, unsigned char* pTarget, int iWidth, int iBegin = 0 )
+{
+	for( int x = iBegin; x < iWidth; ++ x )
+	{
+		const unsigned char* pPixel = pSource + x * PIXEL_SIZE;
+		pTarget[ x * 3 ]		= pPixel[2];
+		pTarget[ x * 3 + 1 ]	= pPixel[1];
+		pTarget[ x * 3 + 2 ]	= pPixel[0];
+	}
+}
+
+inline void ConvertRowBGR24ToRGB( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowBGRToRGB<3>( pSource, pTarget, iWidth );
+}
+
+inline void ConvertRowBGRAToRGB( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowBGRToRGB<4>( pSource, pTarget, iWidth );
+}
+
+/**
+ * Convert the depth unit of pixels [iBegin, iEnd)
+ */
+inline void ConvertDepthMMTo100UM( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iBegin, int iEnd )
+{
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		unsigned int uValue = pSource[x] * 10u;
+		pTarget[x] = OniDepthPixel( uValue > 0xFFFF ? 0xFFFF : uValue );
+	}
+}
+
+inline void ConvertDepth100UMToMM( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iBegin, int iEnd )
+{
+	for( int x = iBegin; x < iEnd; ++ x )
+		pTarget[x] = OniDepthPixel( ( pSource[x] + 5u ) / 10u );
+}
+
+inline void ConvertRowDepthMMTo100UM( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	ConvertDepthMMTo100UM( pSource, pTarget, 0, iWidth );
+}
+
+inline void ConvertRowDepth100UMToMM( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	ConvertDepth100UMToMM( pSource, pTarget, 0, iWidth );
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 converters
+
+/**
+ * Shuffle masks of YUV 4:2:2 to RGB; the first three pick Y, U and V of 8
+ * pixels (16 bytes) as 16-bit values, the others interleave R, G (in one
+ * register) and B of 8 pixels to 24 bytes.
+ */
+template<int Y_OFFSET, int U_OFFSET, int V_OFFSET>
+struct YUV422ShuffleMask
+{
+	enum { Z = -1 };
+
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i Y()
+	{
+		return _mm_setr_epi8( Y_OFFSET, Z, Y_OFFSET + 2, Z, Y_OFFSET + 4, Z, Y_OFFSET + 6, Z, Y_OFFSET + 8, Z, Y_OFFSET + 10, Z, Y_OFFSET + 12, Z, Y_OFFSET + 14, Z );
+	}
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i U()
+	{
+		return _mm_setr_epi8( U_OFFSET, Z, U_OFFSET, Z, U_OFFSET + 4, Z, U_OFFSET + 4, Z, U_OFFSET + 8, Z, U_OFFSET + 8, Z, U_OFFSET + 12, Z, U_OFFSET + 12, Z );
+	}
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i V()
+	{
+		return _mm_setr_epi8( V_OFFSET, Z, V_OFFSET, Z, V_OFFSET + 4, Z, V_OFFSET + 4, Z, V_OFFSET + 8, Z, V_OFFSET + 8, Z, V_OFFSET + 12, Z, V_OFFSET + 12, Z );
+	}
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i RG0()	{ return _mm_setr_epi8( 0, 8, Z, 1, 9, Z, 2, 10, Z, 3, 11, Z, 4, 12, Z, 5 ); }
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i B0()		{ return _mm_setr_epi8( Z, Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z ); }
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i RG1()	{ return _mm_setr_epi8( 13, Z, 6, 14, Z, 7, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z ); }
+	VIRTUAL_DEVICE_TARGET_SSSE3 static __m128i B1()		{ return _mm_setr_epi8( Z, 5, Z, Z, 6, Z, Z, 7, Z, Z, Z, Z, Z, Z, Z, Z ); }
+};
+
+/**
+ * 8 pixels (16 bytes) per loop
+ */
+template<int Y_OFFSET, int U_OFFSET, int V_OFFSET>
+VIRTUAL_DEVICE_TARGET_SSSE3 void ConvertRowYUV422ToRGB_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	typedef YUV422ShuffleMask<Y_OFFSET,U_OFFSET,V_OFFSET> Mask;
+	const __m128i mMaskY	= Mask::Y();
+	const __m128i mMaskU	= Mask::U();
+	const __m128i mMaskV	= Mask::V();
+	const __m128i mMaskRG0	= Mask::RG0();
+	const __m128i mMaskB0	= Mask::B0();
+	const __m128i mMaskRG1	= Mask::RG1();
+	const __m128i mMaskB1	= Mask::B1();
+
+	const __m128i m16	= _mm_set1_epi16( 16 );
+	const __m128i m128	= _mm_set1_epi16( 128 );
+	const __m128i m32	= _mm_set1_epi16( 32 );
+	const __m128i mCY	= _mm_set1_epi16( 74 );
+	const __m128i mCRV	= _mm_set1_epi16( 102 );
+	const __m128i mCGU	= _mm_set1_epi16( 25 );
+	const __m128i mCGV	= _mm_set1_epi16( 52 );
+	const __m128i mCBU	= _mm_set1_epi16( 129 );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i mSource = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x * 2 ) );
+		__m128i mY = _mm_sub_epi16( _mm_shuffle_epi8( mSource, mMaskY ), m16 );
+		__m128i mC = _mm_add_epi16( _mm_add_epi16( _mm_mullo_epi16( mY, mCY ), _mm_srai_epi16( mY, 1 ) ), m32 );
+		__m128i mD = _mm_sub_epi16( _mm_shuffle_epi8( mSource, mMaskU ), m128 );
+		__m128i mE = _mm_sub_epi16( _mm_shuffle_epi8( mSource, mMaskV ), m128 );
+
+		__m128i mR = _mm_srai_epi16( _mm_adds_epi16( mC, _mm_mullo_epi16( mE, mCRV ) ), 6 );
+		__m128i mG = _mm_srai_epi16( _mm_subs_epi16( _mm_subs_epi16( mC, _mm_mullo_epi16( mD, mCGU ) ), _mm_mullo_epi16( mE, mCGV ) ), 6 );
+		__m128i mB = _mm_srai_epi16( _mm_adds_epi16( mC, _mm_mullo_epi16( mD, mCBU ) ), 6 );
+
+		__m128i mRG = _mm_packus_epi16( mR, mG );
+		__m128i mBB = _mm_packus_epi16( mB, mB );
+		unsigned char* pOut = pTarget + x * 3;
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut ), _mm_or_si128( _mm_shuffle_epi8( mRG, mMaskRG0 ), _mm_shuffle_epi8( mBB, mMaskB0 ) ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 16 ), _mm_or_si128( _mm_shuffle_epi8( mRG, mMaskRG1 ), _mm_shuffle_epi8( mBB, mMaskB1 ) ) );
+	}
+	ConvertRowYUV422ToRGB<Y_OFFSET,U_OFFSET,V_OFFSET>( pSource, pTarget, iWidth, x );
+}
+
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ConvertRowYUYVToRGB_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_SSSE3<0,1,3>( pSource, pTarget, iWidth );
+}
+
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ConvertRowUYVYToRGB_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_SSSE3<1,0,2>( pSource, pTarget, iWidth );
+}
+
+/**
+ * 5 pixels per loop; 16 bytes are stored, the last one is overwritten by the next loop
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ConvertRowBGR24ToRGB_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const __m128i mMask = _mm_setr_epi8( 2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15 );
+
+	int x = 0;
+	for( ; x + 6 <= iWidth; x += 5 )
+	{
+		__m128i mSource = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x * 3 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 3 ), _mm_shuffle_epi8( mSource, mMask ) );
+	}
+	ConvertRowBGRToRGB<3>( pSource, pTarget, iWidth, x );
+}
+
+/**
+ * 4 pixels per loop; 16 bytes are stored, the last 4 are overwritten by the next loop
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ConvertRowBGRAToRGB_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const char Z = -1;
+	const __m128i mMask = _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, Z, Z, Z, Z );
+
+	int x = 0;
+	for( ; x + 6 <= iWidth; x += 4 )
+	{
+		__m128i mSource = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x * 4 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 3 ), _mm_shuffle_epi8( mSource, mMask ) );
+	}
+	ConvertRowBGRToRGB<4>( pSource, pTarget, iWidth, x );
+}
+
+/**
+ * 8 pixels per loop; x * 10 = x * 8 + x * 2 with saturated add
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ConvertRowDepthMMTo100UM_SSSE3( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i mValue	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x ) );
+		__m128i mValue2	= _mm_adds_epu16( mValue, mValue );
+		__m128i mValue8	= _mm_adds_epu16( _mm_adds_epu16( mValue2, mValue2 ), _mm_adds_epu16( mValue2, mValue2 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), _mm_adds_epu16( mValue8, mValue2 ) );
+	}
+	ConvertDepthMMTo100UM( pSource, pTarget, x, iWidth );
+}
+
+/**
+ * 8 pixels per loop; x / 10 = ( x * 52429 ) >> 19 for 16-bit x, then round
+ * up if the remainder is larger than 4
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ConvertRowDepth100UMToMM_SSSE3( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	const __m128i mMagic	= _mm_set1_epi16( short( 52429 ) );
+	const __m128i m10		= _mm_set1_epi16( 10 );
+	const __m128i m4		= _mm_set1_epi16( 4 );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i mValue		= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x ) );
+		__m128i mQuotient	= _mm_srli_epi16( _mm_mulhi_epu16( mValue, mMagic ), 3 );
+		__m128i mRemainder	= _mm_sub_epi16( mValue, _mm_mullo_epi16( mQuotient, m10 ) );
+		mQuotient = _mm_sub_epi16( mQuotient, _mm_cmpgt_epi16( mRemainder, m4 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), mQuotient );
+	}
+	ConvertDepth100UMToMM( pSource, pTarget, x, iWidth );
+}
+
+#pragma endregion
+
+#pragma region AVX2 / AVX-512 converters
+
+/**
+ * 16 pixels per loop, each 128-bit lane is the SSSE3 version of 8 pixels
+ */
+template<int Y_OFFSET, int U_OFFSET, int V_OFFSET>
+VIRTUAL_DEVICE_TARGET_AVX2 void ConvertRowYUV422ToRGB_AVX2( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	typedef YUV422ShuffleMask<Y_OFFSET,U_OFFSET,V_OFFSET> Mask;
+	const __m256i mMaskY	= _mm256_broadcastsi128_si256( Mask::Y() );
+	const __m256i mMaskU	= _mm256_broadcastsi128_si256( Mask::U() );
+	const __m256i mMaskV	= _mm256_broadcastsi128_si256( Mask::V() );
+	const __m256i mMaskRG0	= _mm256_broadcastsi128_si256( Mask::RG0() );
+	const __m256i mMaskB0	= _mm256_broadcastsi128_si256( Mask::B0() );
+	const __m256i mMaskRG1	= _mm256_broadcastsi128_si256( Mask::RG1() );
+	const __m256i mMaskB1	= _mm256_broadcastsi128_si256( Mask::B1() );
+
+	const __m256i m16	= _mm256_set1_epi16( 16 );
+	const __m256i m128	= _mm256_set1_epi16( 128 );
+	const __m256i m32	= _mm256_set1_epi16( 32 );
+	const __m256i mCY	= _mm256_set1_epi16( 74 );
+	const __m256i mCRV	= _mm256_set1_epi16( 102 );
+	const __m256i mCGU	= _mm256_set1_epi16( 25 );
+	const __m256i mCGV	= _mm256_set1_epi16( 52 );
+	const __m256i mCBU	= _mm256_set1_epi16( 129 );
+
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		__m256i mSource = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSource + x * 2 ) );
+		__m256i mY = _mm256_sub_epi16( _mm256_shuffle_epi8( mSource, mMaskY ), m16 );
+		__m256i mC = _mm256_add_epi16( _mm256_add_epi16( _mm256_mullo_epi16( mY, mCY ), _mm256_srai_epi16( mY, 1 ) ), m32 );
+		__m256i mD = _mm256_sub_epi16( _mm256_shuffle_epi8( mSource, mMaskU ), m128 );
+		__m256i mE = _mm256_sub_epi16( _mm256_shuffle_epi8( mSource, mMaskV ), m128 );
+
+		__m256i mR = _mm256_srai_epi16( _mm256_adds_epi16( mC, _mm256_mullo_epi16( mE, mCRV ) ), 6 );
+		__m256i mG = _mm256_srai_epi16( _mm256_subs_epi16( _mm256_subs_epi16( mC, _mm256_mullo_epi16( mD, mCGU ) ), _mm256_mullo_epi16( mE, mCGV ) ), 6 );
+		__m256i mB = _mm256_srai_epi16( _mm256_adds_epi16( mC, _mm256_mullo_epi16( mD, mCBU ) ), 6 );
+
+		__m256i mRG = _mm256_packus_epi16( mR, mG );
+		__m256i mBB = _mm256_packus_epi16( mB, mB );
+		__m256i mOut0 = _mm256_or_si256( _mm256_shuffle_epi8( mRG, mMaskRG0 ), _mm256_shuffle_epi8( mBB, mMaskB0 ) );
+		__m256i mOut1 = _mm256_or_si256( _mm256_shuffle_epi8( mRG, mMaskRG1 ), _mm256_shuffle_epi8( mBB, mMaskB1 ) );
+
+		unsigned char* pOut = pTarget + x * 3;
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut ), _mm256_castsi256_si128( mOut0 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 16 ), _mm256_castsi256_si128( mOut1 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + 24 ), _mm256_extracti128_si256( mOut0, 1 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 40 ), _mm256_extracti128_si256( mOut1, 1 ) );
+	}
+	ConvertRowYUV422ToRGB<Y_OFFSET,U_OFFSET,V_OFFSET>( pSource, pTarget, iWidth, x );
+}
+
+VIRTUAL_DEVICE_TARGET_AVX2 inline void ConvertRowYUYVToRGB_AVX2( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_AVX2<0,1,3>( pSource, pTarget, iWidth );
+}
+
+VIRTUAL_DEVICE_TARGET_AVX2 inline void ConvertRowUYVYToRGB_AVX2( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_AVX2<1,0,2>( pSource, pTarget, iWidth );
+}
+
+/**
+ * 16 pixels per loop, see the SSSE3 version
+ */
+VIRTUAL_DEVICE_TARGET_AVX2 inline void ConvertRowDepthMMTo100UM_AVX2( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		__m256i mValue	= _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSource + x ) );
+		__m256i mValue2	= _mm256_adds_epu16( mValue, mValue );
+		__m256i mValue8	= _mm256_adds_epu16( _mm256_adds_epu16( mValue2, mValue2 ), _mm256_adds_epu16( mValue2, mValue2 ) );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( pTarget + x ), _mm256_adds_epu16( mValue8, mValue2 ) );
+	}
+	ConvertDepthMMTo100UM( pSource, pTarget, x, iWidth );
+}
+
+VIRTUAL_DEVICE_TARGET_AVX2 inline void ConvertRowDepth100UMToMM_AVX2( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	const __m256i mMagic	= _mm256_set1_epi16( short( 52429 ) );
+	const __m256i m10		= _mm256_set1_epi16( 10 );
+	const __m256i m4		= _mm256_set1_epi16( 4 );
+
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		__m256i mValue		= _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSource + x ) );
+		__m256i mQuotient	= _mm256_srli_epi16( _mm256_mulhi_epu16( mValue, mMagic ), 3 );
+		__m256i mRemainder	= _mm256_sub_epi16( mValue, _mm256_mullo_epi16( mQuotient, m10 ) );
+		mQuotient = _mm256_sub_epi16( mQuotient, _mm256_cmpgt_epi16( mRemainder, m4 ) );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( pTarget + x ), mQuotient );
+	}
+	ConvertDepth100UMToMM( pSource, pTarget, x, iWidth );
+}
+
+/**
+ * 32 pixels per loop, each 128-bit lane is the SSSE3 version of 8 pixels
+ */
+template<int Y_OFFSET, int U_OFFSET, int V_OFFSET>
+VIRTUAL_DEVICE_TARGET_AVX512 void ConvertRowYUV422ToRGB_AVX512( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	typedef YUV422ShuffleMask<Y_OFFSET,U_OFFSET,V_OFFSET> Mask;
+	const __m512i mMaskY	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::Y() );
+	const __m512i mMaskU	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::U() );
+	const __m512i mMaskV	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::V() );
+	const __m512i mMaskRG0	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::RG0() );
+	const __m512i mMaskB0	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::B0() );
+	const __m512i mMaskRG1	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::RG1() );
+	const __m512i mMaskB1	= _mm512_maskz_broadcast_i32x4( 0xFFFF, Mask::B1() );
+
+	const __m512i m16	= _mm512_set1_epi16( 16 );
+	const __m512i m128	= _mm512_set1_epi16( 128 );
+	const __m512i m32	= _mm512_set1_epi16( 32 );
+	const __m512i mCY	= _mm512_set1_epi16( 74 );
+	const __m512i mCRV	= _mm512_set1_epi16( 102 );
+	const __m512i mCGU	= _mm512_set1_epi16( 25 );
+	const __m512i mCGV	= _mm512_set1_epi16( 52 );
+	const __m512i mCBU	= _mm512_set1_epi16( 129 );
+
+	int x = 0;
+	for( ; x + 32 <= iWidth; x += 32 )
+	{
+		__m512i mSource = _mm512_loadu_si512( pSource + x * 2 );
+		__m512i mY = _mm512_sub_epi16( _mm512_shuffle_epi8( mSource, mMaskY ), m16 );
+		__m512i mC = _mm512_add_epi16( _mm512_add_epi16( _mm512_mullo_epi16( mY, mCY ), _mm512_srai_epi16( mY, 1 ) ), m32 );
+		__m512i mD = _mm512_sub_epi16( _mm512_shuffle_epi8( mSource, mMaskU ), m128 );
+		__m512i mE = _mm512_sub_epi16( _mm512_shuffle_epi8( mSource, mMaskV ), m128 );
+
+		__m512i mR = _mm512_srai_epi16( _mm512_adds_epi16( mC, _mm512_mullo_epi16( mE, mCRV ) ), 6 );
+		__m512i mG = _mm512_srai_epi16( _mm512_subs_epi16( _mm512_subs_epi16( mC, _mm512_mullo_epi16( mD, mCGU ) ), _mm512_mullo_epi16( mE, mCGV ) ), 6 );
+		__m512i mB = _mm512_srai_epi16( _mm512_adds_epi16( mC, _mm512_mullo_epi16( mD, mCBU ) ), 6 );
+
+		__m512i mRG = _mm512_packus_epi16( mR, mG );
+		__m512i mBB = _mm512_packus_epi16( mB, mB );
+		__m512i mOut0 = _mm512_or_si512( _mm512_shuffle_epi8( mRG, mMaskRG0 ), _mm512_shuffle_epi8( mBB, mMaskB0 ) );
+		__m512i mOut1 = _mm512_or_si512( _mm512_shuffle_epi8( mRG, mMaskRG1 ), _mm512_shuffle_epi8( mBB, mMaskB1 ) );
+
+		unsigned char* pOut = pTarget + x * 3;
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut ),		_mm512_maskz_extracti32x4_epi32( 0xF, mOut0, 0 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 16 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut1, 0 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + 24 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut0, 1 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 40 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut1, 1 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + 48 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut0, 2 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 64 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut1, 2 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + 72 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut0, 3 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 88 ),	_mm512_maskz_extracti32x4_epi32( 0xF, mOut1, 3 ) );
+	}
+	ConvertRowYUV422ToRGB<Y_OFFSET,U_OFFSET,V_OFFSET>( pSource, pTarget, iWidth, x );
+}
+
+VIRTUAL_DEVICE_TARGET_AVX512 inline void ConvertRowYUYVToRGB_AVX512( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_AVX512<0,1,3>( pSource, pTarget, iWidth );
+}
+
+VIRTUAL_DEVICE_TARGET_AVX512 inline void ConvertRowUYVYToRGB_AVX512( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_AVX512<1,0,2>( pSource, pTarget, iWidth );
+}
+
+#pragma endregion
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+#pragma region NEON converters
+
+/**
+ * 16 pixels per loop; vld4 split the pixel pairs to Y0, U, Y1 and V (in the order of layout)
+ */
+template<int Y_OFFSET, int U_OFFSET, int V_OFFSET>
+void ConvertRowYUV422ToRGB_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const int16x8_t m16		= vdupq_n_s16( 16 );
+	const int16x8_t m128	= vdupq_n_s16( 128 );
+	const int16x8_t m32		= vdupq_n_s16( 32 );
+
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		uint8x8x4_t mSource = vld4_u8( pSource + x * 2 );
+		int16x8_t mD = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( mSource.val[U_OFFSET] ) ), m128 );
+		int16x8_t mE = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( mSource.val[V_OFFSET] ) ), m128 );
+		int16x8_t mRV = vmulq_n_s16( mE, 102 );
+		int16x8_t mGU = vmulq_n_s16( mD, 25 );
+		int16x8_t mGV = vmulq_n_s16( mE, 52 );
+		int16x8_t mBU = vmulq_n_s16( mD, 129 );
+
+		// the even and odd pixels
+		uint8x8_t aR[2], aG[2], aB[2];
+		for( int i = 0; i < 2; ++ i )
+		{
+			int16x8_t mY = vsubq_s16( vreinterpretq_s16_u16( vmovl_u8( mSource.val[ Y_OFFSET + i * 2 ] ) ), m16 );
+			int16x8_t mC = vaddq_s16( vaddq_s16( vmulq_n_s16( mY, 74 ), vshrq_n_s16( mY, 1 ) ), m32 );
+			aR[i] = vqmovun_s16( vshrq_n_s16( vqaddq_s16( mC, mRV ), 6 ) );
+			aG[i] = vqmovun_s16( vshrq_n_s16( vqsubq_s16( vqsubq_s16( mC, mGU ), mGV ), 6 ) );
+			aB[i] = vqmovun_s16( vshrq_n_s16( vqaddq_s16( mC, mBU ), 6 ) );
+		}
+
+		uint8x8x2_t mR = vzip_u8( aR[0], aR[1] );
+		uint8x8x2_t mG = vzip_u8( aG[0], aG[1] );
+		uint8x8x2_t mB = vzip_u8( aB[0], aB[1] );
+		uint8x16x3_t mRGB;
+		mRGB.val[0] = vcombine_u8( mR.val[0], mR.val[1] );
+		mRGB.val[1] = vcombine_u8( mG.val[0], mG.val[1] );
+		mRGB.val[2] = vcombine_u8( mB.val[0], mB.val[1] );
+		vst3q_u8( pTarget + x * 3, mRGB );
+	}
+	ConvertRowYUV422ToRGB<Y_OFFSET,U_OFFSET,V_OFFSET>( pSource, pTarget, iWidth, x );
+}
+
+inline void ConvertRowYUYVToRGB_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_NEON<0,1,3>( pSource, pTarget, iWidth );
+}
+
+inline void ConvertRowUYVYToRGB_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	ConvertRowYUV422ToRGB_NEON<1,0,2>( pSource, pTarget, iWidth );
+}
+
+/**
+ * 16 pixels per loop, vld3 / vld4 split the channels
+ */
+inline void ConvertRowBGR24ToRGB_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		uint8x16x3_t mPixel = vld3q_u8( pSource + x * 3 );
+		uint8x16_t mBlue = mPixel.val[0];
+		mPixel.val[0] = mPixel.val[2];
+		mPixel.val[2] = mBlue;
+		vst3q_u8( pTarget + x * 3, mPixel );
+	}
+	ConvertRowBGRToRGB<3>( pSource, pTarget, iWidth, x );
+}
+
+inline void ConvertRowBGRAToRGB_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		uint8x16x4_t mSource = vld4q_u8( pSource + x * 4 );
+		uint8x16x3_t mPixel;
+		mPixel.val[0] = mSource.val[2];
+		mPixel.val[1] = mSource.val[1];
+		mPixel.val[2] = mSource.val[0];
+		vst3q_u8( pTarget + x * 3, mPixel );
+	}
+	ConvertRowBGRToRGB<4>( pSource, pTarget, iWidth, x );
+}
+
+/**
+ * 8 pixels per loop, see the SSSE3 version
+ */
+inline void ConvertRowDepthMMTo100UM_NEON( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		uint16x8_t mValue	= vld1q_u16( pSource + x );
+		uint16x8_t mValue2	= vqaddq_u16( mValue, mValue );
+		uint16x8_t mValue8	= vqaddq_u16( vqaddq_u16( mValue2, mValue2 ), vqaddq_u16( mValue2, mValue2 ) );
+		vst1q_u16( pTarget + x, vqaddq_u16( mValue8, mValue2 ) );
+	}
+	ConvertDepthMMTo100UM( pSource, pTarget, x, iWidth );
+}
+
+inline void ConvertRowDepth100UMToMM_NEON( const OniDepthPixel* pSource, OniDepthPixel* pTarget, int iWidth )
+{
+	const uint16x4_t mMagic = vdup_n_u16( 52429 );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		uint16x8_t mValue = vld1q_u16( pSource + x );
+		uint16x8_t mQuotient = vcombine_u16(
+			vshrn_n_u32( vmull_u16( vget_low_u16( mValue ), mMagic ), 16 ),
+			vshrn_n_u32( vmull_u16( vget_high_u16( mValue ), mMagic ), 16 ) );
+		mQuotient = vshrq_n_u16( mQuotient, 3 );
+		uint16x8_t mRemainder = vmlsq_n_u16( mValue, mQuotient, 10 );
+		mQuotient = vsubq_u16( mQuotient, vcgtq_u16( mRemainder, vdupq_n_u16( 4 ) ) );
+		vst1q_u16( pTarget + x, mQuotient );
+	}
+	ConvertDepth100UMToMM( pSource, pTarget, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the size of pixel of input format in bytes, 0 for the native format
+ */
+inline size_t GetInputPixelSize( VirtualInputFormat eInput )
+{
+	switch( eInput )
+	{
+	case VIRTUAL_INPUT_YUYV:
+	case VIRTUAL_INPUT_UYVY:
+		return 2;
+
+	case VIRTUAL_INPUT_BGR:
+		return 3;
+
+	case VIRTUAL_INPUT_BGRA:
+		return 4;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Get the converter from input format to the pixel format of video mode, NULL
+ * if not supported; eVariant is for cross-checking with the scalar reference.
+ */
+inline PixelRowConverter GetPixelConverter( VirtualInputFormat eInput, OniPixelFormat eOutput, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	if( eOutput != ONI_PIXEL_FORMAT_RGB888 )
+		return NULL;
+
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const PixelRowConverter s_aYUYV[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ConvertRowYUYVToRGB,
+		VIRTUAL_KERNEL_X86( ConvertRowYUYVToRGB_SSSE3 ),
+		VIRTUAL_KERNEL_X86( ConvertRowYUYVToRGB_AVX2 ),
+		VIRTUAL_KERNEL_X86( ConvertRowYUYVToRGB_AVX512 ),
+		VIRTUAL_KERNEL_NEON( ConvertRowYUYVToRGB_NEON ) };
+	static const PixelRowConverter s_aUYVY[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ConvertRowUYVYToRGB,
+		VIRTUAL_KERNEL_X86( ConvertRowUYVYToRGB_SSSE3 ),
+		VIRTUAL_KERNEL_X86( ConvertRowUYVYToRGB_AVX2 ),
+		VIRTUAL_KERNEL_X86( ConvertRowUYVYToRGB_AVX512 ),
+		VIRTUAL_KERNEL_NEON( ConvertRowUYVYToRGB_NEON ) };
+	static const PixelRowConverter s_aBGR[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ConvertRowBGR24ToRGB,
+		VIRTUAL_KERNEL_X86( ConvertRowBGR24ToRGB_SSSE3 ),
+		NULL,
+		NULL,
+		VIRTUAL_KERNEL_NEON( ConvertRowBGR24ToRGB_NEON ) };
+	static const PixelRowConverter s_aBGRA[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ConvertRowBGRAToRGB,
+		VIRTUAL_KERNEL_X86( ConvertRowBGRAToRGB_SSSE3 ),
+		NULL,
+		NULL,
+		VIRTUAL_KERNEL_NEON( ConvertRowBGRAToRGB_NEON ) };
+
+	switch( eInput )
+	{
+	case VIRTUAL_INPUT_YUYV:	return SelectKernel( s_aYUYV, eVariant );
+	case VIRTUAL_INPUT_UYVY:	return SelectKernel( s_aUYVY, eVariant );
+	case VIRTUAL_INPUT_BGR:		return SelectKernel( s_aBGR, eVariant );
+	case VIRTUAL_INPUT_BGRA:	return SelectKernel( s_aBGRA, eVariant );
+	default:					return NULL;
+	}
+}
+
+inline bool IsDepthFormat( OniPixelFormat eFormat )
+{
+	return eFormat == ONI_PIXEL_FORMAT_DEPTH_1_MM || eFormat == ONI_PIXEL_FORMAT_DEPTH_100_UM;
+}
+
+/**
+ * Get the converter from the other depth unit to eOutput, NULL if eOutput is not depth
+ */
+inline DepthRowConverter GetDepthConverter( OniPixelFormat eOutput, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const DepthRowConverter s_aTo100UM[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ConvertRowDepthMMTo100UM,
+		VIRTUAL_KERNEL_X86( ConvertRowDepthMMTo100UM_SSSE3 ),
+		VIRTUAL_KERNEL_X86( ConvertRowDepthMMTo100UM_AVX2 ),
+		NULL,
+		VIRTUAL_KERNEL_NEON( ConvertRowDepthMMTo100UM_NEON ) };
+	static const DepthRowConverter s_aToMM[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ConvertRowDepth100UMToMM,
+		VIRTUAL_KERNEL_X86( ConvertRowDepth100UMToMM_SSSE3 ),
+		VIRTUAL_KERNEL_X86( ConvertRowDepth100UMToMM_AVX2 ),
+		NULL,
+		VIRTUAL_KERNEL_NEON( ConvertRowDepth100UMToMM_NEON ) };
+
+	switch( eOutput )
+	{
+	case ONI_PIXEL_FORMAT_DEPTH_100_UM:	return SelectKernel( s_aTo100UM, eVariant );
+	case ONI_PIXEL_FORMAT_DEPTH_1_MM:	return SelectKernel( s_aToMM, eVariant );
+	default:							return NULL;
+	}
+}
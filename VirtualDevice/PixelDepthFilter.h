@@ -0,0 +1,579 @@
+/**
+ * Depth post-processing kernels of the virtual device driver.
+ *
+ * The neighborhood filters read the 3x3 pixels around each one from three
+ * rows, and write a new row, so the frame can be split into bands of rows
+ * and filtered in parallel. The neighbors out of frame and the 0 depths are
+ * invalid; a 0 center stays 0, except for hole filling.
+ * - flying pixel: remove the pixel which is far from at least N of its
+ *   valid neighbors, which is between the foreground and background
+ * - spatial: average the center and the valid neighbors within delta of it,
+ *   so the edges are kept
+ * - hole fill: take the farthest (or nearest) valid neighbor of 0 depth
+ * The temporal filter smooths each pixel with its history, see
+ * DepthTemporalPixels().
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// C Header
+#include <math.h>
+#include <stdlib.h>
+
+// STL Header
+#include <algorithm>
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Filter iWidth pixels of pRow to pTarget by the 3x3 neighborhood; pAbove
+ * and pBelow are the rows around it, or a row of 0 at the border. The use
+ * of iDelta and iCount depends on the filter.
+ */
+typedef void (*DepthNeighborhoodRow)( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int iCount );
+
+/**
+ * Filter iWidth pixels of pRow to pTarget with the history of each pixel
+ * in pState and pAge, which are updated
+ */
+typedef void (*DepthTemporalRow)( const OniDepthPixel* pRow, float* pState, unsigned char* pAge, OniDepthPixel* pTarget, int iWidth, float fAlpha, int iDelta, int iPersistence );
+
+#pragma region scalar depth filter
+
+/**
+ * The 8 neighbors of pixel x, 0 if out of row
+ */
+inline void GetDepthNeighbors( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, int x, int iWidth, int aNeighbor[8] )
+{
+	bool bLeft = ( x > 0 ), bRight = ( x + 1 < iWidth );
+	aNeighbor[0] = bLeft ? pAbove[x - 1] : 0;
+	aNeighbor[1] = pAbove[x];
+	aNeighbor[2] = bRight ? pAbove[x + 1] : 0;
+	aNeighbor[3] = bLeft ? pRow[x - 1] : 0;
+	aNeighbor[4] = bRight ? pRow[x + 1] : 0;
+	aNeighbor[5] = bLeft ? pBelow[x - 1] : 0;
+	aNeighbor[6] = pBelow[x];
+	aNeighbor[7] = bRight ? pBelow[x + 1] : 0;
+}
+
+/**
+ * The pixels [iBegin, iEnd) of flying pixel removal, iDelta is the depth
+ * threshold and iCount is the number of far neighbors to remove the pixel
+ */
+inline void RemoveFlyingPixels( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int iCount, int iBegin, int iEnd )
+{
+	int aNeighbor[8];
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		int iCenter = pRow[x], iFar = 0;
+		GetDepthNeighbors( pAbove, pRow, pBelow, x, iWidth, aNeighbor );
+		for( int i = 0; i < 8; ++ i )
+			iFar += ( aNeighbor[i] != 0 && abs( aNeighbor[i] - iCenter ) > iDelta );
+		pTarget[x] = OniDepthPixel( iFar >= iCount ? 0 : iCenter );
+	}
+}
+
+/**
+ * The pixels [iBegin, iEnd) of spatial filter, iDelta is the max difference
+ * of the neighbors to average
+ */
+inline void SpatialFilterPixels( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int iBegin, int iEnd )
+{
+	int aNeighbor[8];
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		int iCenter = pRow[x];
+		if( iCenter == 0 )
+		{
+			pTarget[x] = 0;
+			continue;
+		}
+
+		int iSum = iCenter, iNum = 1;
+		GetDepthNeighbors( pAbove, pRow, pBelow, x, iWidth, aNeighbor );
+		for( int i = 0; i < 8; ++ i )
+		{
+			if( aNeighbor[i] != 0 && abs( aNeighbor[i] - iCenter ) <= iDelta )
+			{
+				iSum += aNeighbor[i];
+				++ iNum;
+			}
+		}
+		pTarget[x] = OniDepthPixel( ( iSum + iNum / 2 ) / iNum );
+	}
+}
+
+/**
+ * The pixels [iBegin, iEnd) of hole filling
+ */
+template<bool FARTHEST>
+inline void FillHolePixels( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iBegin, int iEnd )
+{
+	int aNeighbor[8];
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		int iDepth = pRow[x];
+		if( iDepth == 0 )
+		{
+			GetDepthNeighbors( pAbove, pRow, pBelow, x, iWidth, aNeighbor );
+			for( int i = 0; i < 8; ++ i )
+			{
+				if( aNeighbor[i] != 0 && ( iDepth == 0 || ( FARTHEST ? aNeighbor[i] > iDepth : aNeighbor[i] < iDepth ) ) )
+					iDepth = aNeighbor[i];
+			}
+		}
+		pTarget[x] = OniDepthPixel( iDepth );
+	}
+}
+
+/**
+ * The pixels [iBegin, iEnd) of temporal filter. A valid depth close to the
+ * smoothed one (within iDelta) is blended by fAlpha, otherwise it restarts
+ * the history. A 0 depth keeps the smoothed one if the pixel has been
+ * invalid for at most iPersistence frames.
+ */
+inline void DepthTemporalPixels( const OniDepthPixel* pRow, float* pState, unsigned char* pAge, OniDepthPixel* pTarget, float fAlpha, int iDelta, int iPersistence, int iBegin, int iEnd )
+{
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		float fState = pState[x];
+		if( pRow[x] != 0 )
+		{
+			float fDepth = float( pRow[x] ), fDiff = fDepth - fState;
+			if( fState != 0 && fabsf( fDiff ) <= float( iDelta ) )
+				fState = fState + fAlpha * fDiff;
+			else
+				fState = fDepth;
+			pAge[x] = 0;
+		}
+		else
+		{
+			if( pAge[x] < 255 )
+				++ pAge[x];
+			if( pAge[x] > iPersistence )
+				fState = 0;
+		}
+		pState[x]	= fState;
+		pTarget[x]	= OniDepthPixel( int( fState + 0.5f ) );
+	}
+}
+
+inline void RemoveFlyingPixelRow( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int iCount )
+{
+	RemoveFlyingPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, iCount, 0, iWidth );
+}
+
+inline void SpatialFilterRow( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int )
+{
+	SpatialFilterPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, 0, iWidth );
+}
+
+template<bool FARTHEST>
+inline void FillHoleRow( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int, int )
+{
+	FillHolePixels<FARTHEST>( pAbove, pRow, pBelow, pTarget, iWidth, 0, iWidth );
+}
+
+inline void DepthTemporalRowScalar( const OniDepthPixel* pRow, float* pState, unsigned char* pAge, OniDepthPixel* pTarget, int iWidth, float fAlpha, int iDelta, int iPersistence )
+{
+	DepthTemporalPixels( pRow, pState, pAge, pTarget, fAlpha, iDelta, iPersistence, 0, iWidth );
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 depth filter
+
+/**
+ * The 8 neighbors of pixels [x, x + 8), which must be inside the row
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void LoadDepthNeighbors_SSSE3( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, int x, __m128i aNeighbor[8] )
+{
+	aNeighbor[0] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pAbove + x - 1 ) );
+	aNeighbor[1] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pAbove + x ) );
+	aNeighbor[2] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pAbove + x + 1 ) );
+	aNeighbor[3] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x - 1 ) );
+	aNeighbor[4] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x + 1 ) );
+	aNeighbor[5] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pBelow + x - 1 ) );
+	aNeighbor[6] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pBelow + x ) );
+	aNeighbor[7] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pBelow + x + 1 ) );
+}
+
+/**
+ * All bits set in the lanes of |a - b| <= delta, they are unsigned
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i IsNear_SSSE3( __m128i mA, __m128i mB, __m128i mDelta )
+{
+	__m128i mDiff = _mm_or_si128( _mm_subs_epu16( mA, mB ), _mm_subs_epu16( mB, mA ) );
+	return _mm_cmpeq_epi16( _mm_subs_epu16( mDiff, mDelta ), _mm_setzero_si128() );
+}
+
+/**
+ * Pack 8 int32 in [0, 65535] to uint16, without SSE4.1
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i PackDepth_SSSE3( __m128i mLow, __m128i mHigh )
+{
+	const __m128i mBias32 = _mm_set1_epi32( 32768 );
+	const __m128i mBias16 = _mm_set1_epi16( -32768 );
+	return _mm_xor_si128( _mm_packs_epi32( _mm_sub_epi32( mLow, mBias32 ), _mm_sub_epi32( mHigh, mBias32 ) ), mBias16 );
+}
+
+/**
+ * 8 pixels per block, the first and last pixels of row are done by scalar
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void RemoveFlyingPixelRow_SSSE3( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int iCount )
+{
+	const __m128i mDelta	= _mm_set1_epi16( short( std::min( iDelta, 65535 ) ) );
+	const __m128i mCount	= _mm_set1_epi16( short( iCount - 1 ) );
+	const __m128i mZero		= _mm_setzero_si128();
+	const __m128i mOnes		= _mm_set1_epi16( -1 );
+
+	RemoveFlyingPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, iCount, 0, std::min( 1, iWidth ) );
+	int x = 1;
+	__m128i aNeighbor[8];
+	for( ; x + 8 < iWidth; x += 8 )
+	{
+		__m128i mCenter = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x ) );
+		LoadDepthNeighbors_SSSE3( pAbove, pRow, pBelow, x, aNeighbor );
+
+		__m128i mFar = _mm_setzero_si128();
+		for( int i = 0; i < 8; ++ i )
+			mFar = _mm_sub_epi16( mFar, _mm_andnot_si128( _mm_or_si128( _mm_cmpeq_epi16( aNeighbor[i], mZero ), IsNear_SSSE3( aNeighbor[i], mCenter, mDelta ) ), mOnes ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), _mm_andnot_si128( _mm_cmpgt_epi16( mFar, mCount ), mCenter ) );
+	}
+	RemoveFlyingPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, iCount, x, iWidth );
+}
+
+/**
+ * 8 pixels per block: the sums are in 32 bits, and divided in float, which
+ * is exact for the integers of depth
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void SpatialFilterRow_SSSE3( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int )
+{
+	const __m128i mDelta	= _mm_set1_epi16( short( std::min( iDelta, 65535 ) ) );
+	const __m128i mZero		= _mm_setzero_si128();
+	const __m128i mOne		= _mm_set1_epi16( 1 );
+
+	SpatialFilterPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, 0, std::min( 1, iWidth ) );
+	int x = 1;
+	__m128i aNeighbor[8];
+	for( ; x + 8 < iWidth; x += 8 )
+	{
+		__m128i mCenter = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x ) );
+		LoadDepthNeighbors_SSSE3( pAbove, pRow, pBelow, x, aNeighbor );
+
+		__m128i mSumLow = _mm_unpacklo_epi16( mCenter, mZero ), mSumHigh = _mm_unpackhi_epi16( mCenter, mZero );
+		__m128i mNum = mOne;
+		for( int i = 0; i < 8; ++ i )
+		{
+			__m128i mUse = _mm_andnot_si128( _mm_cmpeq_epi16( aNeighbor[i], mZero ), IsNear_SSSE3( aNeighbor[i], mCenter, mDelta ) );
+			__m128i mValue = _mm_and_si128( aNeighbor[i], mUse );
+			mSumLow		= _mm_add_epi32( mSumLow, _mm_unpacklo_epi16( mValue, mZero ) );
+			mSumHigh	= _mm_add_epi32( mSumHigh, _mm_unpackhi_epi16( mValue, mZero ) );
+			mNum		= _mm_sub_epi16( mNum, mUse );
+		}
+
+		// ( sum + num / 2 ) / num
+		__m128i mHalf = _mm_srli_epi16( mNum, 1 );
+		__m128 fNumLow = _mm_cvtepi32_ps( _mm_unpacklo_epi16( mNum, mZero ) ), fNumHigh = _mm_cvtepi32_ps( _mm_unpackhi_epi16( mNum, mZero ) );
+		__m128i mLow	= _mm_cvttps_epi32( _mm_div_ps( _mm_cvtepi32_ps( _mm_add_epi32( mSumLow, _mm_unpacklo_epi16( mHalf, mZero ) ) ), fNumLow ) );
+		__m128i mHigh	= _mm_cvttps_epi32( _mm_div_ps( _mm_cvtepi32_ps( _mm_add_epi32( mSumHigh, _mm_unpackhi_epi16( mHalf, mZero ) ) ), fNumHigh ) );
+		__m128i mResult	= _mm_andnot_si128( _mm_cmpeq_epi16( mCenter, mZero ), PackDepth_SSSE3( mLow, mHigh ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), mResult );
+	}
+	SpatialFilterPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, x, iWidth );
+}
+
+/**
+ * 8 pixels per block; the nearest one is the min of depth - 1, which moves
+ * the invalid 0 to the max
+ */
+template<bool FARTHEST>
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void FillHoleRow_SSSE3( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int, int )
+{
+	const __m128i mZero	= _mm_setzero_si128();
+	const __m128i mOne	= _mm_set1_epi16( 1 );
+
+	FillHolePixels<FARTHEST>( pAbove, pRow, pBelow, pTarget, iWidth, 0, std::min( 1, iWidth ) );
+	int x = 1;
+	__m128i aNeighbor[8];
+	for( ; x + 8 < iWidth; x += 8 )
+	{
+		__m128i mCenter = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x ) );
+		LoadDepthNeighbors_SSSE3( pAbove, pRow, pBelow, x, aNeighbor );
+
+		__m128i mFill;
+		if( FARTHEST )
+		{
+			// max( a, b ) = ( a -sat b ) + b
+			mFill = aNeighbor[0];
+			for( int i = 1; i < 8; ++ i )
+				mFill = _mm_add_epi16( _mm_subs_epu16( mFill, aNeighbor[i] ), aNeighbor[i] );
+		}
+		else
+		{
+			// min( a, b ) = a - ( a -sat b )
+			mFill = _mm_sub_epi16( aNeighbor[0], mOne );
+			for( int i = 1; i < 8; ++ i )
+			{
+				__m128i mNeighbor = _mm_sub_epi16( aNeighbor[i], mOne );
+				mFill = _mm_sub_epi16( mFill, _mm_subs_epu16( mFill, mNeighbor ) );
+			}
+			mFill = _mm_add_epi16( mFill, mOne );
+		}
+		__m128i mResult = _mm_or_si128( mCenter, _mm_and_si128( _mm_cmpeq_epi16( mCenter, mZero ), mFill ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), mResult );
+	}
+	FillHolePixels<FARTHEST>( pAbove, pRow, pBelow, pTarget, iWidth, x, iWidth );
+}
+
+/**
+ * 4 pixels of temporal filter, mValid and mKeep are the masks of the valid
+ * depths and the invalid ones which keep the history
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i DepthTemporal4_SSSE3( __m128i mDepth, float* pState, __m128 fAlpha, __m128 fDelta, __m128i mValid, __m128i mKeep )
+{
+	const __m128 fAbs	= _mm_castsi128_ps( _mm_set1_epi32( 0x7FFFFFFF ) );
+	const __m128 fHalf	= _mm_set1_ps( 0.5f );
+
+	__m128 fState = _mm_loadu_ps( pState ), fDepth = _mm_cvtepi32_ps( mDepth );
+	__m128 fDiff = _mm_sub_ps( fDepth, fState );
+	__m128 fSmooth = _mm_and_ps( _mm_cmpneq_ps( fState, _mm_setzero_ps() ), _mm_cmple_ps( _mm_and_ps( fDiff, fAbs ), fDelta ) );
+	__m128 fNew = _mm_or_ps( _mm_and_ps( fSmooth, _mm_add_ps( fState, _mm_mul_ps( fAlpha, fDiff ) ) ), _mm_andnot_ps( fSmooth, fDepth ) );
+	fNew = _mm_or_ps( _mm_and_ps( _mm_castsi128_ps( mValid ), fNew ), _mm_and_ps( _mm_castsi128_ps( mKeep ), fState ) );
+	_mm_storeu_ps( pState, fNew );
+	return _mm_cvttps_epi32( _mm_add_ps( fNew, fHalf ) );
+}
+
+/**
+ * 8 pixels per block, the ages are in 8 bits
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void DepthTemporalRow_SSSE3( const OniDepthPixel* pRow, float* pState, unsigned char* pAge, OniDepthPixel* pTarget, int iWidth, float fAlpha, int iDelta, int iPersistence )
+{
+	const __m128 fAlpha4		= _mm_set1_ps( fAlpha );
+	const __m128 fDelta4		= _mm_set1_ps( float( iDelta ) );
+	const __m128i mPersistence	= _mm_set1_epi8( char( std::min( iPersistence, 255 ) ) );
+	const __m128i mZero			= _mm_setzero_si128();
+	const __m128i mOne			= _mm_set1_epi8( 1 );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i mDepth = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x ) );
+		__m128i mInvalid16 = _mm_cmpeq_epi16( mDepth, mZero );
+		__m128i mInvalid8 = _mm_packs_epi16( mInvalid16, mInvalid16 );
+
+		// age + 1 for invalid depth, 0 for valid
+		__m128i mAge = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pAge + x ) );
+		mAge = _mm_and_si128( _mm_adds_epu8( mAge, mOne ), mInvalid8 );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pAge + x ), mAge );
+		__m128i mKeep8 = _mm_and_si128( mInvalid8, _mm_cmpeq_epi8( _mm_subs_epu8( mAge, mPersistence ), mZero ) );
+		__m128i mKeep16 = _mm_unpacklo_epi8( mKeep8, mKeep8 );
+		__m128i mValid16 = _mm_xor_si128( mInvalid16, _mm_set1_epi16( -1 ) );
+
+		__m128i mLow = DepthTemporal4_SSSE3( _mm_unpacklo_epi16( mDepth, mZero ), pState + x, fAlpha4, fDelta4,
+											_mm_unpacklo_epi16( mValid16, mValid16 ), _mm_unpacklo_epi16( mKeep16, mKeep16 ) );
+		__m128i mHigh = DepthTemporal4_SSSE3( _mm_unpackhi_epi16( mDepth, mZero ), pState + x + 4, fAlpha4, fDelta4,
+											_mm_unpackhi_epi16( mValid16, mValid16 ), _mm_unpackhi_epi16( mKeep16, mKeep16 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), PackDepth_SSSE3( mLow, mHigh ) );
+	}
+	DepthTemporalPixels( pRow, pState, pAge, pTarget, fAlpha, iDelta, iPersistence, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+#pragma region NEON depth filter
+
+inline void LoadDepthNeighbors_NEON( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, int x, uint16x8_t aNeighbor[8] )
+{
+	aNeighbor[0] = vld1q_u16( pAbove + x - 1 );
+	aNeighbor[1] = vld1q_u16( pAbove + x );
+	aNeighbor[2] = vld1q_u16( pAbove + x + 1 );
+	aNeighbor[3] = vld1q_u16( pRow + x - 1 );
+	aNeighbor[4] = vld1q_u16( pRow + x + 1 );
+	aNeighbor[5] = vld1q_u16( pBelow + x - 1 );
+	aNeighbor[6] = vld1q_u16( pBelow + x );
+	aNeighbor[7] = vld1q_u16( pBelow + x + 1 );
+}
+
+inline void RemoveFlyingPixelRow_NEON( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int iCount )
+{
+	const uint16x8_t mDelta = vdupq_n_u16( uint16_t( std::min( iDelta, 65535 ) ) );
+	const uint16x8_t mCount = vdupq_n_u16( uint16_t( iCount ) );
+
+	RemoveFlyingPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, iCount, 0, std::min( 1, iWidth ) );
+	int x = 1;
+	uint16x8_t aNeighbor[8];
+	for( ; x + 8 < iWidth; x += 8 )
+	{
+		uint16x8_t mCenter = vld1q_u16( pRow + x );
+		LoadDepthNeighbors_NEON( pAbove, pRow, pBelow, x, aNeighbor );
+
+		uint16x8_t mFar = vdupq_n_u16( 0 );
+		for( int i = 0; i < 8; ++ i )
+			mFar = vsubq_u16( mFar, vandq_u16( vtstq_u16( aNeighbor[i], aNeighbor[i] ), vcgtq_u16( vabdq_u16( aNeighbor[i], mCenter ), mDelta ) ) );
+		vst1q_u16( pTarget + x, vbicq_u16( mCenter, vcgeq_u16( mFar, mCount ) ) );
+	}
+	RemoveFlyingPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, iCount, x, iWidth );
+}
+
+/**
+ * ( sum + num / 2 ) / num of 4 pixels by the reciprocal, then corrected to
+ * the exact quotient; ARMv7 has no vector division
+ */
+inline uint32x4_t DivideDepthSum_NEON( uint32x4_t mSum, uint32x4_t mNum )
+{
+	uint32x4_t mDividend = vaddq_u32( mSum, vshrq_n_u32( mNum, 1 ) );
+	float32x4_t fNum = vcvtq_f32_u32( mNum );
+	float32x4_t fReciprocal = vrecpeq_f32( fNum );
+	fReciprocal = vmulq_f32( vrecpsq_f32( fNum, fReciprocal ), fReciprocal );
+	fReciprocal = vmulq_f32( vrecpsq_f32( fNum, fReciprocal ), fReciprocal );
+	uint32x4_t mQuotient = vcvtq_u32_f32( vmulq_f32( vcvtq_f32_u32( mDividend ), fReciprocal ) );
+	uint32x4_t mRemain = vmlsq_u32( mDividend, mQuotient, mNum );
+	return vsubq_u32( mQuotient, vcgeq_u32( mRemain, mNum ) );
+}
+
+inline void SpatialFilterRow_NEON( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int iDelta, int )
+{
+	const uint16x8_t mDelta = vdupq_n_u16( uint16_t( std::min( iDelta, 65535 ) ) );
+
+	SpatialFilterPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, 0, std::min( 1, iWidth ) );
+	int x = 1;
+	uint16x8_t aNeighbor[8];
+	for( ; x + 8 < iWidth; x += 8 )
+	{
+		uint16x8_t mCenter = vld1q_u16( pRow + x );
+		LoadDepthNeighbors_NEON( pAbove, pRow, pBelow, x, aNeighbor );
+
+		uint32x4_t mSumLow = vmovl_u16( vget_low_u16( mCenter ) ), mSumHigh = vmovl_u16( vget_high_u16( mCenter ) );
+		uint16x8_t mNum = vdupq_n_u16( 1 );
+		for( int i = 0; i < 8; ++ i )
+		{
+			uint16x8_t mUse = vandq_u16( vtstq_u16( aNeighbor[i], aNeighbor[i] ), vcleq_u16( vabdq_u16( aNeighbor[i], mCenter ), mDelta ) );
+			uint16x8_t mValue = vandq_u16( aNeighbor[i], mUse );
+			mSumLow		= vaddw_u16( mSumLow, vget_low_u16( mValue ) );
+			mSumHigh	= vaddw_u16( mSumHigh, vget_high_u16( mValue ) );
+			mNum		= vsubq_u16( mNum, mUse );
+		}
+
+		uint32x4_t mLow = DivideDepthSum_NEON( mSumLow, vmovl_u16( vget_low_u16( mNum ) ) );
+		uint32x4_t mHigh = DivideDepthSum_NEON( mSumHigh, vmovl_u16( vget_high_u16( mNum ) ) );
+		uint16x8_t mResult = vcombine_u16( vmovn_u32( mLow ), vmovn_u32( mHigh ) );
+		vst1q_u16( pTarget + x, vandq_u16( mResult, vtstq_u16( mCenter, mCenter ) ) );
+	}
+	SpatialFilterPixels( pAbove, pRow, pBelow, pTarget, iWidth, iDelta, x, iWidth );
+}
+
+template<bool FARTHEST>
+inline void FillHoleRow_NEON( const OniDepthPixel* pAbove, const OniDepthPixel* pRow, const OniDepthPixel* pBelow, OniDepthPixel* pTarget, int iWidth, int, int )
+{
+	const uint16x8_t mOne = vdupq_n_u16( 1 );
+
+	FillHolePixels<FARTHEST>( pAbove, pRow, pBelow, pTarget, iWidth, 0, std::min( 1, iWidth ) );
+	int x = 1;
+	uint16x8_t aNeighbor[8];
+	for( ; x + 8 < iWidth; x += 8 )
+	{
+		uint16x8_t mCenter = vld1q_u16( pRow + x );
+		LoadDepthNeighbors_NEON( pAbove, pRow, pBelow, x, aNeighbor );
+
+		uint16x8_t mFill;
+		if( FARTHEST )
+		{
+			mFill = aNeighbor[0];
+			for( int i = 1; i < 8; ++ i )
+				mFill = vmaxq_u16( mFill, aNeighbor[i] );
+		}
+		else
+		{
+			mFill = vsubq_u16( aNeighbor[0], mOne );
+			for( int i = 1; i < 8; ++ i )
+				mFill = vminq_u16( mFill, vsubq_u16( aNeighbor[i], mOne ) );
+			mFill = vaddq_u16( mFill, mOne );
+		}
+		vst1q_u16( pTarget + x, vorrq_u16( mCenter, vbicq_u16( mFill, vtstq_u16( mCenter, mCenter ) ) ) );
+	}
+	FillHolePixels<FARTHEST>( pAbove, pRow, pBelow, pTarget, iWidth, x, iWidth );
+}
+
+inline uint32x4_t DepthTemporal4_NEON( uint32x4_t mDepth, float* pState, float32x4_t fAlpha, float32x4_t fDelta, uint32x4_t mValid, uint32x4_t mKeep )
+{
+	float32x4_t fState = vld1q_f32( pState ), fDepth = vcvtq_f32_u32( mDepth );
+	float32x4_t fDiff = vsubq_f32( fDepth, fState );
+	uint32x4_t mSmooth = vandq_u32( vmvnq_u32( vceqq_f32( fState, vdupq_n_f32( 0 ) ) ), vcleq_f32( vabsq_f32( fDiff ), fDelta ) );
+	float32x4_t fNew = vbslq_f32( mSmooth, vaddq_f32( fState, vmulq_f32( fAlpha, fDiff ) ), fDepth );
+	fNew = vbslq_f32( mValid, fNew, vreinterpretq_f32_u32( vandq_u32( mKeep, vreinterpretq_u32_f32( fState ) ) ) );
+	vst1q_f32( pState, fNew );
+	return vcvtq_u32_f32( vaddq_f32( fNew, vdupq_n_f32( 0.5f ) ) );
+}
+
+inline void DepthTemporalRow_NEON( const OniDepthPixel* pRow, float* pState, unsigned char* pAge, OniDepthPixel* pTarget, int iWidth, float fAlpha, int iDelta, int iPersistence )
+{
+	const float32x4_t fAlpha4		= vdupq_n_f32( fAlpha );
+	const float32x4_t fDelta4		= vdupq_n_f32( float( iDelta ) );
+	const uint8x8_t mPersistence	= vdup_n_u8( uint8_t( std::min( iPersistence, 255 ) ) );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		uint16x8_t mDepth = vld1q_u16( pRow + x );
+		uint16x8_t mValid16 = vtstq_u16( mDepth, mDepth );
+		uint8x8_t mValid8 = vmovn_u16( mValid16 );
+
+		uint8x8_t mAge = vbic_u8( vqadd_u8( vld1_u8( pAge + x ), vdup_n_u8( 1 ) ), mValid8 );
+		vst1_u8( pAge + x, mAge );
+		uint16x8_t mKeep16 = vmovl_u8( vbic_u8( vcle_u8( mAge, mPersistence ), mValid8 ) );
+		mKeep16 = vorrq_u16( mKeep16, vshlq_n_u16( mKeep16, 8 ) );
+
+		uint32x4_t mLow = DepthTemporal4_NEON( vmovl_u16( vget_low_u16( mDepth ) ), pState + x, fAlpha4, fDelta4,
+											vreinterpretq_u32_s32( vmovl_s16( vreinterpret_s16_u16( vget_low_u16( mValid16 ) ) ) ),
+											vreinterpretq_u32_s32( vmovl_s16( vreinterpret_s16_u16( vget_low_u16( mKeep16 ) ) ) ) );
+		uint32x4_t mHigh = DepthTemporal4_NEON( vmovl_u16( vget_high_u16( mDepth ) ), pState + x + 4, fAlpha4, fDelta4,
+											vreinterpretq_u32_s32( vmovl_s16( vreinterpret_s16_u16( vget_high_u16( mValid16 ) ) ) ),
+											vreinterpretq_u32_s32( vmovl_s16( vreinterpret_s16_u16( vget_high_u16( mKeep16 ) ) ) ) );
+		vst1q_u16( pTarget + x, vcombine_u16( vmovn_u32( mLow ), vmovn_u32( mHigh ) ) );
+	}
+	DepthTemporalPixels( pRow, pState, pAge, pTarget, fAlpha, iDelta, iPersistence, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the kernels of depth filters
+ */
+inline DepthNeighborhoodRow GetFlyingPixelFilter( VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const DepthNeighborhoodRow s_aFilter[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		RemoveFlyingPixelRow, VIRTUAL_KERNEL_X86( RemoveFlyingPixelRow_SSSE3 ), NULL, NULL, VIRTUAL_KERNEL_NEON( RemoveFlyingPixelRow_NEON ) };
+	return SelectKernel( s_aFilter, eVariant );
+}
+
+inline DepthNeighborhoodRow GetSpatialFilter( VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	static const DepthNeighborhoodRow s_aFilter[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		SpatialFilterRow, VIRTUAL_KERNEL_X86( SpatialFilterRow_SSSE3 ), NULL, NULL, VIRTUAL_KERNEL_NEON( SpatialFilterRow_NEON ) };
+	return SelectKernel( s_aFilter, eVariant );
+}
+
+inline DepthNeighborhoodRow GetHoleFillFilter( bool bFarthest, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	static const DepthNeighborhoodRow s_aFarthest[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		FillHoleRow<true>, VIRTUAL_KERNEL_X86( FillHoleRow_SSSE3<true> ), NULL, NULL, VIRTUAL_KERNEL_NEON( FillHoleRow_NEON<true> ) };
+	static const DepthNeighborhoodRow s_aNearest[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		FillHoleRow<false>, VIRTUAL_KERNEL_X86( FillHoleRow_SSSE3<false> ), NULL, NULL, VIRTUAL_KERNEL_NEON( FillHoleRow_NEON<false> ) };
+	return SelectKernel( bFarthest ? s_aFarthest : s_aNearest, eVariant );
+}
+
+inline DepthTemporalRow GetTemporalFilter( VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	static const DepthTemporalRow s_aFilter[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		DepthTemporalRowScalar, VIRTUAL_KERNEL_X86( DepthTemporalRow_SSSE3 ), NULL, NULL, VIRTUAL_KERNEL_NEON( DepthTemporalRow_NEON ) };
+	return SelectKernel( s_aFilter, eVariant );
+}
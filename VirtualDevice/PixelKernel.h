@@ -0,0 +1,272 @@
+/**
+ * Kernel dispatch of the virtual device driver.
+ *
+ * The pixel kernels have a scalar version, which is the reference, and may
+ * have SIMD versions for some instruction sets. The best variant the CPU
+ * supports is chosen once; each kernel is selected from a table indexed by
+ * VirtualKernelVariant, falling back to the next variant it implements.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// C Header
+#include <stddef.h>
+#include <string.h>
+
+// OpenNI Header
+#include "XnLib.h"
+
+// VirtualDevice command
+#include "VirtualDevice.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define VIRTUAL_DEVICE_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define VIRTUAL_DEVICE_TARGET_SSSE3
+		#define VIRTUAL_DEVICE_TARGET_AVX2
+		#define VIRTUAL_DEVICE_TARGET_AVX512
+	#else
+		#include <cpuid.h>
+		#define VIRTUAL_DEVICE_TARGET_SSSE3		__attribute__((target("ssse3")))
+		#define VIRTUAL_DEVICE_TARGET_AVX2		__attribute__((target("avx2")))
+		#define VIRTUAL_DEVICE_TARGET_AVX512	__attribute__((target("avx512f,avx512bw")))
+	#endif
+	#define VIRTUAL_KERNEL_X86( func )		func
+	#define VIRTUAL_KERNEL_NEON( func )		NULL
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	#define VIRTUAL_DEVICE_NEON
+	#include <arm_neon.h>
+	#define VIRTUAL_KERNEL_X86( func )		NULL
+	#define VIRTUAL_KERNEL_NEON( func )		func
+#else
+	#define VIRTUAL_KERNEL_X86( func )		NULL
+	#define VIRTUAL_KERNEL_NEON( func )		NULL
+#endif
+
+#define VIRTUAL_KERNEL_VARIANT_NUM	5
+
+#pragma region pixel format traits
+
+/**
+ * Compile time information of OpenNI pixel formats; Pixel is the type in
+ * frame data, which may hold more than one pixel (PIXELS_PER_UNIT).
+ */
+template<OniPixelFormat FORMAT>
+struct PixelFormatTraits;
+
+template<typename PIXEL, typename CHANNEL, int CHANNELS, int PIXELS_PER_UNIT_ = 1>
+struct PixelTraitsBase
+{
+	typedef PIXEL	Pixel;
+	typedef CHANNEL	Channel;
+
+	static const int	CHANNEL_NUM		= CHANNELS;
+	static const int	PIXELS_PER_UNIT	= PIXELS_PER_UNIT_;
+	static const size_t	PIXEL_SIZE		= sizeof( PIXEL ) / PIXELS_PER_UNIT_;
+};
+
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_DEPTH_1_MM>	: PixelTraitsBase<OniDepthPixel, OniDepthPixel, 1> {};
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_DEPTH_100_UM>	: PixelTraitsBase<OniDepthPixel, OniDepthPixel, 1> {};
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_RGB888>		: PixelTraitsBase<OniRGB888Pixel, uint8_t, 3> {};
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_GRAY8>			: PixelTraitsBase<OniGrayscale8Pixel, OniGrayscale8Pixel, 1> {};
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_GRAY16>		: PixelTraitsBase<OniGrayscale16Pixel, OniGrayscale16Pixel, 1> {};
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_YUV422>		: PixelTraitsBase<OniYUV422DoublePixel, uint8_t, 2, 2> {};
+template<> struct PixelFormatTraits<ONI_PIXEL_FORMAT_YUYV>			: PixelTraitsBase<OniYUV422DoublePixel, uint8_t, 2, 2> {};
+
+/**
+ * Get the size of pixel in bytes, 0 for unsupported format
+ */
+inline size_t GetPixelSize( OniPixelFormat eFormat )
+{
+	switch( eFormat )
+	{
+	case ONI_PIXEL_FORMAT_DEPTH_1_MM:	return PixelFormatTraits<ONI_PIXEL_FORMAT_DEPTH_1_MM>::PIXEL_SIZE;
+	case ONI_PIXEL_FORMAT_DEPTH_100_UM:	return PixelFormatTraits<ONI_PIXEL_FORMAT_DEPTH_100_UM>::PIXEL_SIZE;
+	case ONI_PIXEL_FORMAT_RGB888:		return PixelFormatTraits<ONI_PIXEL_FORMAT_RGB888>::PIXEL_SIZE;
+	case ONI_PIXEL_FORMAT_GRAY8:		return PixelFormatTraits<ONI_PIXEL_FORMAT_GRAY8>::PIXEL_SIZE;
+	case ONI_PIXEL_FORMAT_GRAY16:		return PixelFormatTraits<ONI_PIXEL_FORMAT_GRAY16>::PIXEL_SIZE;
+	case ONI_PIXEL_FORMAT_YUV422:		return PixelFormatTraits<ONI_PIXEL_FORMAT_YUV422>::PIXEL_SIZE;
+	case ONI_PIXEL_FORMAT_YUYV:			return PixelFormatTraits<ONI_PIXEL_FORMAT_YUYV>::PIXEL_SIZE;
+	default:							return 0;
+	}
+}
+
+#pragma endregion
+
+#pragma region kernel variant
+
+inline const char* GetKernelVariantName( VirtualKernelVariant eVariant )
+{
+	switch( eVariant )
+	{
+	case VIRTUAL_KERNEL_SCALAR:	return "scalar";
+	case VIRTUAL_KERNEL_SSSE3:	return "ssse3";
+	case VIRTUAL_KERNEL_AVX2:	return "avx2";
+	case VIRTUAL_KERNEL_AVX512:	return "avx512";
+	case VIRTUAL_KERNEL_NEON:	return "neon";
+	default:					return "unknown";
+	}
+}
+
+/**
+ * The variant to use when a kernel doesn't implement eVariant
+ */
+inline VirtualKernelVariant GetFallbackVariant( VirtualKernelVariant eVariant )
+{
+	switch( eVariant )
+	{
+	case VIRTUAL_KERNEL_AVX512:	return VIRTUAL_KERNEL_AVX2;
+	case VIRTUAL_KERNEL_AVX2:	return VIRTUAL_KERNEL_SSSE3;
+	default:					return VIRTUAL_KERNEL_SCALAR;
+	}
+}
+
+#ifdef VIRTUAL_DEVICE_X86
+/**
+ * Get registers of cpuid, all 0 if the leaf is not supported
+ */
+inline void GetCPUID( unsigned int uLeaf, unsigned int aRegister[4] )
+{
+#ifdef _MSC_VER
+	int aInfo[4];
+	__cpuid( aInfo, 0 );
+	if( static_cast<unsigned int>( aInfo[0] ) >= uLeaf )
+	{
+		__cpuidex( aInfo, int( uLeaf ), 0 );
+		for( int i = 0; i < 4; ++ i )
+			aRegister[i] = static_cast<unsigned int>( aInfo[i] );
+		return;
+	}
+#else
+	if( __get_cpuid_max( 0, NULL ) >= uLeaf )
+	{
+		__cpuid_count( uLeaf, 0, aRegister[0], aRegister[1], aRegister[2], aRegister[3] );
+		return;
+	}
+#endif
+	memset( aRegister, 0, sizeof(unsigned int) * 4 );
+}
+
+/**
+ * The register states the OS saves on context switch (XCR0)
+ */
+inline unsigned long long GetEnabledXState()
+{
+	unsigned int aLeaf1[4];
+	GetCPUID( 1, aLeaf1 );
+	if( ( aLeaf1[2] & ( 1u << 27 ) ) == 0 )	// OSXSAVE
+		return 0;
+
+#ifdef _MSC_VER
+	return _xgetbv( 0 );
+#else
+	unsigned int uLow, uHigh;
+	__asm__ __volatile__( "xgetbv" : "=a"( uLow ), "=d"( uHigh ) : "c"( 0 ) );
+	return ( static_cast<unsigned long long>( uHigh ) << 32 ) | uLow;
+#endif
+}
+#endif
+
+inline bool IsKernelVariantSupported( VirtualKernelVariant eVariant )
+{
+	switch( eVariant )
+	{
+	case VIRTUAL_KERNEL_SCALAR:
+		return true;
+
+#ifdef VIRTUAL_DEVICE_X86
+	case VIRTUAL_KERNEL_SSSE3:
+		{
+			unsigned int aLeaf1[4];
+			GetCPUID( 1, aLeaf1 );
+			return ( aLeaf1[2] & ( 1u << 9 ) ) != 0;
+		}
+
+	case VIRTUAL_KERNEL_AVX2:
+		{
+			// YMM state must be enabled by OS
+			unsigned int aLeaf7[4];
+			GetCPUID( 7, aLeaf7 );
+			return ( aLeaf7[1] & ( 1u << 5 ) ) != 0 && ( GetEnabledXState() & 0x06 ) == 0x06
+				&& IsKernelVariantSupported( VIRTUAL_KERNEL_SSSE3 );
+		}
+
+	case VIRTUAL_KERNEL_AVX512:
+		{
+			// AVX-512 F and BW, with opmask and ZMM state enabled by OS
+			unsigned int aLeaf7[4];
+			GetCPUID( 7, aLeaf7 );
+			return ( aLeaf7[1] & ( 1u << 16 ) ) != 0 && ( aLeaf7[1] & ( 1u << 30 ) ) != 0
+				&& ( GetEnabledXState() & 0xE6 ) == 0xE6 && IsKernelVariantSupported( VIRTUAL_KERNEL_AVX2 );
+		}
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+	case VIRTUAL_KERNEL_NEON:
+		return true;
+#endif
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * The best variant of CPU, limited by environment variable VIRTUAL_DEVICE_KERNEL
+ */
+inline VirtualKernelVariant DetectKernelVariant()
+{
+	const VirtualKernelVariant aOrder[] = { VIRTUAL_KERNEL_AVX512, VIRTUAL_KERNEL_AVX2, VIRTUAL_KERNEL_SSSE3, VIRTUAL_KERNEL_NEON };
+
+	VirtualKernelVariant eBest = VIRTUAL_KERNEL_SCALAR;
+	for( size_t i = 0; i < sizeof(aOrder) / sizeof(aOrder[0]); ++ i )
+	{
+		if( IsKernelVariantSupported( aOrder[i] ) )
+		{
+			eBest = aOrder[i];
+			break;
+		}
+	}
+
+	XnChar szName[32];
+	if( xnOSGetEnvironmentVariable( "VIRTUAL_DEVICE_KERNEL", szName, sizeof(szName) ) == XN_STATUS_OK )
+	{
+		// only a variant the CPU supports, and on the fallback path of the best one
+		for( VirtualKernelVariant eVariant = eBest; ; eVariant = GetFallbackVariant( eVariant ) )
+		{
+			if( strcmp( szName, GetKernelVariantName( eVariant ) ) == 0 )
+				return eVariant;
+			if( eVariant == VIRTUAL_KERNEL_SCALAR )
+				break;
+		}
+	}
+	return eBest;
+}
+
+/**
+ * The variant chosen for this process, detected on the first call
+ */
+inline VirtualKernelVariant GetKernelVariant()
+{
+	static const VirtualKernelVariant s_eVariant = DetectKernelVariant();
+	return s_eVariant;
+}
+
+/**
+ * Select the implementation of eVariant from the kernel table, or the
+ * nearest fallback; the table is indexed by VirtualKernelVariant, and NULL
+ * means the variant is not implemented.
+ */
+template<typename FUNC>
+FUNC SelectKernel( FUNC const (&aKernel)[VIRTUAL_KERNEL_VARIANT_NUM], VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	while( aKernel[eVariant] == NULL && eVariant != VIRTUAL_KERNEL_SCALAR )
+		eVariant = GetFallbackVariant( eVariant );
+	return aKernel[eVariant];
+}
+
+#pragma endregion
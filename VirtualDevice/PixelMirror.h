@@ -0,0 +1,280 @@
+/**
+ * Horizontal mirror kernels of the virtual device driver.
+ *
+ * ONI_STREAM_PROPERTY_MIRRORING flips the rows when the frame is set. The
+ * kernels read a block from both ends of the row before write them back
+ * swapped, so the row can be mirrored in place, or copied mirrored to
+ * another buffer which doesn't overlap it.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Mirror one row of iWidth pixels from pSource to pTarget; pSource may be pTarget
+ */
+typedef void (*PixelRowMirror)( const unsigned char* pSource, unsigned char* pTarget, int iWidth );
+
+#pragma region scalar mirror
+
+/**
+ * Mirror the pixels [iBegin, iWidth - iBegin), the rest is done by SIMD
+ */
+template<typename PIXEL>
+void MirrorPixels( const PIXEL* pSource, PIXEL* pTarget, int iWidth, int iBegin )
+{
+	int iLeft = iBegin, iRight = iWidth - 1 - iBegin;
+	for( ; iLeft < iRight; ++ iLeft, -- iRight )
+	{
+		PIXEL mLeft		= pSource[iLeft];
+		PIXEL mRight	= pSource[iRight];
+		pTarget[iLeft]	= mRight;
+		pTarget[iRight]	= mLeft;
+	}
+	if( iLeft == iRight )
+		pTarget[iLeft] = pSource[iLeft];
+}
+
+template<typename PIXEL>
+void MirrorRow( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	MirrorPixels( reinterpret_cast<const PIXEL*>( pSource ), reinterpret_cast<PIXEL*>( pTarget ), iWidth, 0 );
+}
+
+/**
+ * YUV 4:2:2 mirror the pixel pairs, and swap Y0 and Y1 in each pair
+ */
+template<int Y_OFFSET>
+void MirrorRowYUV422( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const OniYUV422DoublePixel* pSourcePair = reinterpret_cast<const OniYUV422DoublePixel*>( pSource );
+	OniYUV422DoublePixel* pTargetPair = reinterpret_cast<OniYUV422DoublePixel*>( pTarget );
+
+	int iPairs = iWidth / 2;
+	MirrorPixels( pSourcePair, pTargetPair, iPairs, 0 );
+	for( int i = 0; i < iPairs; ++ i )
+	{
+		unsigned char* pPair = reinterpret_cast<unsigned char*>( pTargetPair + i );
+		unsigned char uY0 = pPair[Y_OFFSET];
+		pPair[Y_OFFSET]		= pPair[ Y_OFFSET + 2 ];
+		pPair[ Y_OFFSET + 2 ]	= uY0;
+	}
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 / AVX2 mirror
+
+/**
+ * 16 pixels per block
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void MirrorRow8_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const __m128i mMask = _mm_setr_epi8( 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0 );
+
+	int x = 0;
+	for( ; 2 * x + 32 <= iWidth; x += 16 )
+	{
+		int iRight = iWidth - x - 16;
+		__m128i mLeft	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x ) );
+		__m128i mRight	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + iRight ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ),		_mm_shuffle_epi8( mRight, mMask ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + iRight ),	_mm_shuffle_epi8( mLeft, mMask ) );
+	}
+	MirrorPixels( pSource, pTarget, iWidth, x );
+}
+
+/**
+ * 8 pixels per block
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void MirrorRow16_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const __m128i mMask = _mm_setr_epi8( 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+
+	int x = 0;
+	for( ; 2 * x + 16 <= iWidth; x += 8 )
+	{
+		int iRight = ( iWidth - x - 8 ) * 2;
+		__m128i mLeft	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x * 2 ) );
+		__m128i mRight	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + iRight ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 2 ),	_mm_shuffle_epi8( mRight, mMask ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + iRight ),	_mm_shuffle_epi8( mLeft, mMask ) );
+	}
+	MirrorPixels( reinterpret_cast<const uint16_t*>( pSource ), reinterpret_cast<uint16_t*>( pTarget ), iWidth, x );
+}
+
+/**
+ * 4 pixels (12 bytes) per block; the left block is loaded from its begin
+ * and the right one from its end, so the loads stay in the row, and only
+ * the 12 bytes are stored.
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void MirrorRow24_SSSE3( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const char Z = -1;
+	const __m128i mMaskLeft		= _mm_setr_epi8( 9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2, Z, Z, Z, Z );
+	const __m128i mMaskRight	= _mm_setr_epi8( 13, 14, 15, 10, 11, 12, 7, 8, 9, 4, 5, 6, Z, Z, Z, Z );
+
+	int x = 0;
+	for( ; 2 * x + 8 <= iWidth && iWidth >= 6; x += 4 )
+	{
+		int iRightEnd = ( iWidth - x ) * 3;
+		__m128i mLeft	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + x * 3 ) );
+		__m128i mRight	= _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource + iRightEnd - 16 ) );
+		__m128i mToLeft		= _mm_shuffle_epi8( mRight, mMaskRight );
+		__m128i mToRight	= _mm_shuffle_epi8( mLeft, mMaskLeft );
+
+		int iTail = _mm_cvtsi128_si32( _mm_srli_si128( mToLeft, 8 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pTarget + x * 3 ), mToLeft );
+		memcpy( pTarget + x * 3 + 8, &iTail, 4 );
+
+		iTail = _mm_cvtsi128_si32( _mm_srli_si128( mToRight, 8 ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pTarget + iRightEnd - 12 ), mToRight );
+		memcpy( pTarget + iRightEnd - 4, &iTail, 4 );
+	}
+	MirrorPixels( reinterpret_cast<const OniRGB888Pixel*>( pSource ), reinterpret_cast<OniRGB888Pixel*>( pTarget ), iWidth, x );
+}
+
+/**
+ * 16 pixels per block; reverse in 128-bit lanes, then swap the lanes
+ */
+VIRTUAL_DEVICE_TARGET_AVX2 inline void MirrorRow16_AVX2( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const __m256i mMask = _mm256_setr_epi8(
+		14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+		14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1 );
+
+	int x = 0;
+	for( ; 2 * x + 32 <= iWidth; x += 16 )
+	{
+		int iRight = ( iWidth - x - 16 ) * 2;
+		__m256i mLeft	= _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSource + x * 2 ) );
+		__m256i mRight	= _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pSource + iRight ) );
+		mLeft	= _mm256_permute4x64_epi64( _mm256_shuffle_epi8( mLeft, mMask ), 0x4E );
+		mRight	= _mm256_permute4x64_epi64( _mm256_shuffle_epi8( mRight, mMask ), 0x4E );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( pTarget + x * 2 ),	mRight );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( pTarget + iRight ),	mLeft );
+	}
+	MirrorRow16_SSSE3( pSource + x * 2, pTarget + x * 2, iWidth - 2 * x );
+}
+
+#pragma endregion
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+#pragma region NEON mirror
+
+/**
+ * 16 pixels per block; vrev64 reverse the halves, then swap them
+ */
+inline void MirrorRow8_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; 2 * x + 32 <= iWidth; x += 16 )
+	{
+		int iRight = iWidth - x - 16;
+		uint8x16_t mLeft	= vrev64q_u8( vld1q_u8( pSource + x ) );
+		uint8x16_t mRight	= vrev64q_u8( vld1q_u8( pSource + iRight ) );
+		vst1q_u8( pTarget + x,		vcombine_u8( vget_high_u8( mRight ), vget_low_u8( mRight ) ) );
+		vst1q_u8( pTarget + iRight,	vcombine_u8( vget_high_u8( mLeft ), vget_low_u8( mLeft ) ) );
+	}
+	MirrorPixels( pSource, pTarget, iWidth, x );
+}
+
+/**
+ * 8 pixels per block
+ */
+inline void MirrorRow16_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	const uint16_t* pSource16 = reinterpret_cast<const uint16_t*>( pSource );
+	uint16_t* pTarget16 = reinterpret_cast<uint16_t*>( pTarget );
+
+	int x = 0;
+	for( ; 2 * x + 16 <= iWidth; x += 8 )
+	{
+		int iRight = iWidth - x - 8;
+		uint16x8_t mLeft	= vrev64q_u16( vld1q_u16( pSource16 + x ) );
+		uint16x8_t mRight	= vrev64q_u16( vld1q_u16( pSource16 + iRight ) );
+		vst1q_u16( pTarget16 + x,		vcombine_u16( vget_high_u16( mRight ), vget_low_u16( mRight ) ) );
+		vst1q_u16( pTarget16 + iRight,	vcombine_u16( vget_high_u16( mLeft ), vget_low_u16( mLeft ) ) );
+	}
+	MirrorPixels( pSource16, pTarget16, iWidth, x );
+}
+
+/**
+ * 8 pixels per block; vld3 split the channels
+ */
+inline void MirrorRow24_NEON( const unsigned char* pSource, unsigned char* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; 2 * x + 16 <= iWidth; x += 8 )
+	{
+		int iRight = ( iWidth - x - 8 ) * 3;
+		uint8x8x3_t mLeft	= vld3_u8( pSource + x * 3 );
+		uint8x8x3_t mRight	= vld3_u8( pSource + iRight );
+		for( int c = 0; c < 3; ++ c )
+		{
+			mLeft.val[c]	= vrev64_u8( mLeft.val[c] );
+			mRight.val[c]	= vrev64_u8( mRight.val[c] );
+		}
+		vst3_u8( pTarget + x * 3, mRight );
+		vst3_u8( pTarget + iRight, mLeft );
+	}
+	MirrorPixels( reinterpret_cast<const OniRGB888Pixel*>( pSource ), reinterpret_cast<OniRGB888Pixel*>( pTarget ), iWidth, x );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the mirror kernel of pixel format, NULL if not supported
+ */
+inline PixelRowMirror GetMirrorKernel( OniPixelFormat eFormat, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const PixelRowMirror s_aMirror8[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		MirrorRow<OniGrayscale8Pixel>,
+		VIRTUAL_KERNEL_X86( MirrorRow8_SSSE3 ),
+		NULL,
+		NULL,
+		VIRTUAL_KERNEL_NEON( MirrorRow8_NEON ) };
+	static const PixelRowMirror s_aMirror16[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		MirrorRow<OniDepthPixel>,
+		VIRTUAL_KERNEL_X86( MirrorRow16_SSSE3 ),
+		VIRTUAL_KERNEL_X86( MirrorRow16_AVX2 ),
+		NULL,
+		VIRTUAL_KERNEL_NEON( MirrorRow16_NEON ) };
+	static const PixelRowMirror s_aMirror24[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		MirrorRow<OniRGB888Pixel>,
+		VIRTUAL_KERNEL_X86( MirrorRow24_SSSE3 ),
+		NULL,
+		NULL,
+		VIRTUAL_KERNEL_NEON( MirrorRow24_NEON ) };
+
+	switch( eFormat )
+	{
+	case ONI_PIXEL_FORMAT_GRAY8:
+		return SelectKernel( s_aMirror8, eVariant );
+
+	case ONI_PIXEL_FORMAT_DEPTH_1_MM:
+	case ONI_PIXEL_FORMAT_DEPTH_100_UM:
+	case ONI_PIXEL_FORMAT_GRAY16:
+		return SelectKernel( s_aMirror16, eVariant );
+
+	case ONI_PIXEL_FORMAT_RGB888:
+		return SelectKernel( s_aMirror24, eVariant );
+
+	case ONI_PIXEL_FORMAT_YUV422:	// U Y0 V Y1
+		return MirrorRowYUV422<1>;
+
+	case ONI_PIXEL_FORMAT_YUYV:		// Y0 U Y1 V
+		return MirrorRowYUV422<0>;
+
+	default:
+		return NULL;
+	}
+}
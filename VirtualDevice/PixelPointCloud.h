@@ -0,0 +1,249 @@
+/**
+ * Point cloud kernels of the virtual device driver.
+ *
+ * The point of a depth pixel is the depth times the ray of the pixel, as
+ * CoordinateConverter::convertDepthToWorld() of OpenNI:
+ *   X = Z * ( x / W - 0.5 ) * 2 tan( hFOV / 2 )
+ *   Y = Z * ( 0.5 - y / H ) * 2 tan( vFOV / 2 )
+ * The ray is separable, so the table keeps one factor per column and one
+ * per row, and a row is only multiplies. With compaction, the points of
+ * invalid (0) depth are skipped and the rest are packed.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// C Header
+#include <math.h>
+
+// STL Header
+#include <vector>
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Project a row of iWidth depth pixels to points in pTarget; pRayX is the
+ * rays of the columns, fRayY of the row, and fScale convert depth to
+ * millimeter. pColor is the RGB888 row of XYZRGB, NULL for no color.
+ * Return the number of points; the SIMD kernels may write up to
+ * POINT_ROW_PADDING bytes after them.
+ */
+typedef int (*PointRowProjector)( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, const float* pRayX, float fRayY, float fScale, unsigned char* pTarget, int iWidth, bool bCompact );
+
+const int POINT_ROW_PADDING = 16;
+
+/**
+ * The rays of the pixels of a video mode, see BuildPointRays()
+ */
+struct PointRayTable
+{
+	std::vector<float>	vRayX;		// for each column
+	std::vector<float>	vRayY;		// for each row
+};
+
+/**
+ * Build the rays of the resolution and FOV (in radian)
+ */
+inline void BuildPointRays( int iWidth, int iHeight, float fHorizontalFOV, float fVerticalFOV, PointRayTable& rTable )
+{
+	float fXZ = 2 * tanf( fHorizontalFOV / 2 );
+	float fYZ = 2 * tanf( fVerticalFOV / 2 );
+
+	rTable.vRayX.resize( iWidth );
+	for( int x = 0; x < iWidth; ++ x )
+		rTable.vRayX[x] = ( float( x ) / iWidth - 0.5f ) * fXZ;
+
+	rTable.vRayY.resize( iHeight );
+	for( int y = 0; y < iHeight; ++ y )
+		rTable.vRayY[y] = ( 0.5f - float( y ) / iHeight ) * fYZ;
+}
+
+/**
+ * Size of the point of pixel format, 0 if it's not a point format; they are
+ * not in OniPixelFormat, so not in switch
+ */
+inline size_t GetPointSize( OniPixelFormat eFormat )
+{
+	if( eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZ )
+		return sizeof( VirtualPointXYZ );
+	if( eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB )
+		return sizeof( VirtualPointXYZRGB );
+	return 0;
+}
+
+#pragma region scalar point cloud
+
+inline void SetPointColor( VirtualPointXYZ&, const OniRGB888Pixel*, int )
+{
+}
+
+inline void SetPointColor( VirtualPointXYZRGB& rPoint, const OniRGB888Pixel* pColor, int x )
+{
+	if( pColor != NULL )
+	{
+		rPoint.mColor = pColor[x];
+	}
+	else
+	{
+		rPoint.mColor.r = rPoint.mColor.g = rPoint.mColor.b = 0;
+	}
+	rPoint.uReserved = 0;
+}
+
+/**
+ * The points of pixels [iBegin, iWidth), the rest is done by SIMD
+ */
+template<typename POINT>
+inline int ProjectPoints( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, const float* pRayX, float fRayY, float fScale, POINT* pTarget, int iBegin, int iWidth, bool bCompact )
+{
+	int iCount = 0;
+	for( int x = iBegin; x < iWidth; ++ x )
+	{
+		if( bCompact && pDepth[x] == 0 )
+			continue;
+
+		float fZ = pDepth[x] * fScale;
+		POINT& rPoint = pTarget[iCount++];
+		rPoint.fX = fZ * pRayX[x];
+		rPoint.fY = fZ * fRayY;
+		rPoint.fZ = fZ;
+		SetPointColor( rPoint, pColor, x );
+	}
+	return iCount;
+}
+
+template<typename POINT>
+inline int ProjectRow( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, const float* pRayX, float fRayY, float fScale, unsigned char* pTarget, int iWidth, bool bCompact )
+{
+	return ProjectPoints( pDepth, pColor, pRayX, fRayY, fScale, reinterpret_cast<POINT*>( pTarget ), 0, iWidth, bCompact );
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 point cloud
+
+/**
+ * 4 pixels per block: X, Y, Z of 4 points (and the colors as the 4th row)
+ * are transposed to 4 points. A compacted point is always stored, and the
+ * target only moves if it's valid.
+ */
+template<typename POINT>
+VIRTUAL_DEVICE_TARGET_SSSE3 int ProjectRow_SSSE3( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, const float* pRayX, float fRayY, float fScale, unsigned char* pTarget, int iWidth, bool bCompact )
+{
+	const bool bColor = ( sizeof( POINT ) == sizeof( VirtualPointXYZRGB ) );
+	const int iStep = int( sizeof( POINT ) );
+	const char Z = -1;
+	const __m128i mColorShuffle = _mm_setr_epi8( 0, 1, 2, Z, 3, 4, 5, Z, 6, 7, 8, Z, 9, 10, 11, Z );
+	const __m128i mZero = _mm_setzero_si128();
+	const __m128 mScale = _mm_set1_ps( fScale );
+	const __m128 mRayY = _mm_set1_ps( fRayY );
+
+	unsigned char* pOut = pTarget;
+	int x = 0;
+	for( ; x + 4 <= iWidth; x += 4 )
+	{
+		__m128i mDepth = _mm_unpacklo_epi16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pDepth + x ) ), mZero );
+		__m128 mPointZ = _mm_mul_ps( _mm_cvtepi32_ps( mDepth ), mScale );
+		__m128 mPointX = _mm_mul_ps( mPointZ, _mm_loadu_ps( pRayX + x ) );
+		__m128 mPointY = _mm_mul_ps( mPointZ, mRayY );
+		__m128 mPointW = _mm_setzero_ps();
+		if( bColor && pColor != NULL )
+		{
+			const unsigned char* pRGB = reinterpret_cast<const unsigned char*>( pColor + x );
+			int iLast;
+			memcpy( &iLast, pRGB + 8, sizeof( iLast ) );
+			__m128i mRGB = _mm_unpacklo_epi64( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pRGB ) ), _mm_cvtsi32_si128( iLast ) );
+			mPointW = _mm_castsi128_ps( _mm_shuffle_epi8( mRGB, mColorShuffle ) );
+		}
+		_MM_TRANSPOSE4_PS( mPointX, mPointY, mPointZ, mPointW );
+
+		int iValid = ( bCompact ? _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( mDepth, mZero ) ) ) : 0x0F );
+		_mm_storeu_ps( reinterpret_cast<float*>( pOut ), mPointX );
+		pOut += iStep * ( iValid & 1 );
+		_mm_storeu_ps( reinterpret_cast<float*>( pOut ), mPointY );
+		pOut += iStep * ( ( iValid >> 1 ) & 1 );
+		_mm_storeu_ps( reinterpret_cast<float*>( pOut ), mPointZ );
+		pOut += iStep * ( ( iValid >> 2 ) & 1 );
+		_mm_storeu_ps( reinterpret_cast<float*>( pOut ), mPointW );
+		pOut += iStep * ( ( iValid >> 3 ) & 1 );
+	}
+
+	int iCount = int( ( pOut - pTarget ) / iStep );
+	return iCount + ProjectPoints( pDepth, pColor, pRayX, fRayY, fScale, reinterpret_cast<POINT*>( pOut ), x, iWidth, bCompact );
+}
+
+#pragma endregion
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+#pragma region NEON point cloud
+
+/**
+ * 4 pixels per block, as ProjectRow_SSSE3()
+ */
+template<typename POINT>
+int ProjectRow_NEON( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, const float* pRayX, float fRayY, float fScale, unsigned char* pTarget, int iWidth, bool bCompact )
+{
+	const bool bColor = ( sizeof( POINT ) == sizeof( VirtualPointXYZRGB ) );
+	const int iStep = int( sizeof( POINT ) );
+
+	unsigned char* pOut = pTarget;
+	int x = 0;
+	for( ; x + 4 <= iWidth; x += 4 )
+	{
+		uint32x4_t mDepth = vmovl_u16( vld1_u16( pDepth + x ) );
+		float32x4_t mPointZ = vmulq_n_f32( vcvtq_f32_u32( mDepth ), fScale );
+		float32x4_t mPointX = vmulq_f32( mPointZ, vld1q_f32( pRayX + x ) );
+		float32x4_t mPointY = vmulq_n_f32( mPointZ, fRayY );
+		float32x4_t mPointW = vdupq_n_f32( 0 );
+		if( bColor && pColor != NULL )
+		{
+			uint32_t aRGB[4];
+			for( int i = 0; i < 4; ++ i )
+				aRGB[i] = pColor[x + i].r | ( pColor[x + i].g << 8 ) | ( pColor[x + i].b << 16 );
+			mPointW = vreinterpretq_f32_u32( vld1q_u32( aRGB ) );
+		}
+
+		float32x4x2_t mXY = vtrnq_f32( mPointX, mPointY );
+		float32x4x2_t mZW = vtrnq_f32( mPointZ, mPointW );
+		float32x4_t aPoint[4] = {
+			vcombine_f32( vget_low_f32( mXY.val[0] ), vget_low_f32( mZW.val[0] ) ),
+			vcombine_f32( vget_low_f32( mXY.val[1] ), vget_low_f32( mZW.val[1] ) ),
+			vcombine_f32( vget_high_f32( mXY.val[0] ), vget_high_f32( mZW.val[0] ) ),
+			vcombine_f32( vget_high_f32( mXY.val[1] ), vget_high_f32( mZW.val[1] ) ) };
+
+		for( int i = 0; i < 4; ++ i )
+		{
+			vst1q_f32( reinterpret_cast<float*>( pOut ), aPoint[i] );
+			if( !bCompact || pDepth[x + i] != 0 )
+				pOut += iStep;
+		}
+	}
+
+	int iCount = int( ( pOut - pTarget ) / iStep );
+	return iCount + ProjectPoints( pDepth, pColor, pRayX, fRayY, fScale, reinterpret_cast<POINT*>( pOut ), x, iWidth, bCompact );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the row projector of point pixel format; NULL if not supported
+ */
+inline PointRowProjector GetPointProjector( OniPixelFormat eFormat, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const PointRowProjector s_aXYZ[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ProjectRow<VirtualPointXYZ>, VIRTUAL_KERNEL_X86( ProjectRow_SSSE3<VirtualPointXYZ> ), NULL, NULL, VIRTUAL_KERNEL_NEON( ProjectRow_NEON<VirtualPointXYZ> ) };
+	static const PointRowProjector s_aXYZRGB[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ProjectRow<VirtualPointXYZRGB>, VIRTUAL_KERNEL_X86( ProjectRow_SSSE3<VirtualPointXYZRGB> ), NULL, NULL, VIRTUAL_KERNEL_NEON( ProjectRow_NEON<VirtualPointXYZRGB> ) };
+
+	if( eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZ )
+		return SelectKernel( s_aXYZ, eVariant );
+	if( eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB )
+		return SelectKernel( s_aXYZRGB, eVariant );
+	return NULL;
+}
@@ -0,0 +1,115 @@
+/**
+ * RGB-D interleaving kernels of the virtual device driver.
+ *
+ * A row of depth pixels and a row of RGB888 pixels of the same size are
+ * merged to VirtualRGBDPixel, so a consumer reads the color and depth of a
+ * pixel from one cache line instead of two frames.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Interleave iWidth pixels of pDepth and pColor to pTarget
+ */
+typedef void (*RGBDRowInterleaver)( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, VirtualRGBDPixel* pTarget, int iWidth );
+
+#pragma region scalar RGB-D
+
+/**
+ * The pixels [iBegin, iWidth), the rest is done by SIMD
+ */
+inline void InterleavePixels( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, VirtualRGBDPixel* pTarget, int iBegin, int iWidth )
+{
+	for( int x = iBegin; x < iWidth; ++ x )
+	{
+		pTarget[x].mColor		= pColor[x];
+		pTarget[x].uReserved	= 0;
+		pTarget[x].uDepth		= pDepth[x];
+	}
+}
+
+inline void InterleaveRGBD( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, VirtualRGBDPixel* pTarget, int iWidth )
+{
+	InterleavePixels( pDepth, pColor, pTarget, 0, iWidth );
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 RGB-D
+
+/**
+ * 8 pixels per block: 24 bytes of color and 16 bytes of depth are shuffled
+ * to 3 vectors of 48 bytes of output.
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void InterleaveRGBD_SSSE3( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, VirtualRGBDPixel* pTarget, int iWidth )
+{
+	const char Z = -1;
+	const __m128i mColor0 = _mm_setr_epi8( 0, 1, 2, Z, Z, Z, 3, 4, 5, Z, Z, Z, 6, 7, 8, Z );
+	const __m128i mDepth0 = _mm_setr_epi8( Z, Z, Z, Z, 0, 1, Z, Z, Z, Z, 2, 3, Z, Z, Z, Z );
+	const __m128i mColor1 = _mm_setr_epi8( Z, Z, 1, 2, 3, Z, Z, Z, 4, 5, 6, Z, Z, Z, 7, 8 );
+	const __m128i mDepth1 = _mm_setr_epi8( 4, 5, Z, Z, Z, Z, 6, 7, Z, Z, Z, Z, 8, 9, Z, Z );
+	const __m128i mColor2 = _mm_setr_epi8( 1, Z, Z, Z, 2, 3, 4, Z, Z, Z, 5, 6, 7, Z, Z, Z );
+	const __m128i mDepth2 = _mm_setr_epi8( Z, Z, 10, 11, Z, Z, Z, Z, 12, 13, Z, Z, Z, Z, 14, 15 );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		const unsigned char* pRGB = reinterpret_cast<const unsigned char*>( pColor + x );
+		__m128i mRGB0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRGB ) );
+		__m128i mRGB1 = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pRGB + 16 ) );
+		__m128i mRGB01 = _mm_alignr_epi8( mRGB1, mRGB0, 8 );
+		__m128i mDepth = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + x ) );
+
+		__m128i* pOut = reinterpret_cast<__m128i*>( pTarget + x );
+		_mm_storeu_si128( pOut + 0, _mm_or_si128( _mm_shuffle_epi8( mRGB0, mColor0 ), _mm_shuffle_epi8( mDepth, mDepth0 ) ) );
+		_mm_storeu_si128( pOut + 1, _mm_or_si128( _mm_shuffle_epi8( mRGB01, mColor1 ), _mm_shuffle_epi8( mDepth, mDepth1 ) ) );
+		_mm_storeu_si128( pOut + 2, _mm_or_si128( _mm_shuffle_epi8( mRGB1, mColor2 ), _mm_shuffle_epi8( mDepth, mDepth2 ) ) );
+	}
+	InterleavePixels( pDepth, pColor, pTarget, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+#pragma region NEON RGB-D
+
+/**
+ * 8 pixels per block: a pixel is 3 u16 of RG, B0 and depth, stored by vst3q
+ */
+inline void InterleaveRGBD_NEON( const OniDepthPixel* pDepth, const OniRGB888Pixel* pColor, VirtualRGBDPixel* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		uint8x8x3_t mRGB = vld3_u8( reinterpret_cast<const uint8_t*>( pColor + x ) );
+		uint8x8x2_t mRG = vzip_u8( mRGB.val[0], mRGB.val[1] );
+
+		uint16x8x3_t mOut;
+		mOut.val[0] = vreinterpretq_u16_u8( vcombine_u8( mRG.val[0], mRG.val[1] ) );
+		mOut.val[1] = vmovl_u8( mRGB.val[2] );
+		mOut.val[2] = vld1q_u16( pDepth + x );
+		vst3q_u16( reinterpret_cast<uint16_t*>( pTarget + x ), mOut );
+	}
+	InterleavePixels( pDepth, pColor, pTarget, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the RGB-D row interleaver
+ */
+inline RGBDRowInterleaver GetRGBDInterleaver( VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const RGBDRowInterleaver s_aInterleave[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		InterleaveRGBD, VIRTUAL_KERNEL_X86( InterleaveRGBD_SSSE3 ), NULL, NULL, VIRTUAL_KERNEL_NEON( InterleaveRGBD_NEON ) };
+	return SelectKernel( s_aInterleave, eVariant );
+}
@@ -0,0 +1,222 @@
+/**
+ * Depth to color registration kernels of the virtual device driver.
+ *
+ * The depth pixel (u, v) with depth z is moved to the color camera:
+ *   P = R * z * Kd^-1 * ( u, v, 1 ) + t
+ *   q = Kc * P, target pixel = ( q.x / q.z, q.y / q.z ), target depth = q.z
+ * Kd^-1 * ( u, v, 1 ) is separable, so M = Kc * R is folded into one table
+ * of each column and one of each row, and q = z * ( column + row ) + Kc * t.
+ * The mirroring and the cropping window of both sides are folded into the
+ * tables too, so the kernels only see the pixels of the frame.
+ * The rows are projected by SIMD, then scattered to the target with a
+ * z-buffer test, so the nearest depth wins.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// STL Header
+#include <vector>
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Project a row of iWidth depth pixels to the target frame of iTargetWidth
+ * x iTargetHeight; pIndex is the index of target pixel, and pTarget is the
+ * depth in target. If the depth is invalid or it's out of the target, the
+ * index is iTargetWidth * iTargetHeight, a dummy pixel after the target, so
+ * the scatter has no branch. pRow and pOffset are the 3 components of the
+ * row and translation.
+ */
+typedef void (*RegistrationRowProjector)( const OniDepthPixel* pDepth, const float* pColumnX, const float* pColumnY, const float* pColumnZ, const float* pRow, const float* pOffset, int iWidth, int iTargetWidth, int iTargetHeight, int* pIndex, int* pTarget );
+
+/**
+ * The table of a frame window, see BuildRegistrationTable()
+ */
+struct RegistrationTable
+{
+	std::vector<float>	vColumnX;	// for each column
+	std::vector<float>	vColumnY;
+	std::vector<float>	vColumnZ;
+	std::vector<float>	vRow;		// 3 for each row
+	float				aOffset[3];	// Kc * t in millimeter
+};
+
+/**
+ * Build the table of the window ( iOriginX, iOriginY, iWidth, iHeight ) of
+ * the iFullWidth x iFullHeight frames; the intrinsics are scaled to the full
+ * size. If bMirror is set, both the depth and target are mirrored images.
+ */
+inline void BuildRegistrationTable( const VirtualCameraIntrinsics& rDepth, const VirtualCameraIntrinsics& rColor, const VirtualCameraExtrinsics& rExtrinsics,
+									int iFullWidth, int iFullHeight, int iOriginX, int iOriginY, int iWidth, int iHeight, bool bMirror, RegistrationTable& rTable )
+{
+	float fDepthScaleX = float( iFullWidth ) / rDepth.iWidth, fDepthScaleY = float( iFullHeight ) / rDepth.iHeight;
+	float fColorScaleX = float( iFullWidth ) / rColor.iWidth, fColorScaleY = float( iFullHeight ) / rColor.iHeight;
+	float fDepthFx = rDepth.fFx * fDepthScaleX, fDepthCx = rDepth.fCx * fDepthScaleX;
+	float fDepthFy = rDepth.fFy * fDepthScaleY, fDepthCy = rDepth.fCy * fDepthScaleY;
+
+	// Kc of target window; mirrored x is ( full width - 1 - x )
+	float fSign = ( bMirror ? -1.0f : 1.0f );
+	float aK[3][3] = {
+		{ fSign * rColor.fFx * fColorScaleX, 0, fSign * rColor.fCx * fColorScaleX + ( bMirror ? iFullWidth - 1 : 0 ) - iOriginX },
+		{ 0, rColor.fFy * fColorScaleY, rColor.fCy * fColorScaleY - iOriginY },
+		{ 0, 0, 1 } };
+
+	// M = Kc * R
+	const float* R = rExtrinsics.aRotation;
+	float aM[3][3];
+	for( int i = 0; i < 3; ++ i )
+		for( int j = 0; j < 3; ++ j )
+			aM[i][j] = aK[i][0] * R[j] + aK[i][1] * R[3 + j] + aK[i][2] * R[6 + j];
+
+	rTable.vColumnX.resize( iWidth );
+	rTable.vColumnY.resize( iWidth );
+	rTable.vColumnZ.resize( iWidth );
+	for( int x = 0; x < iWidth; ++ x )
+	{
+		int u = ( bMirror ? iFullWidth - 1 - ( iOriginX + x ) : iOriginX + x );
+		float fRayX = ( u - fDepthCx ) / fDepthFx;
+		rTable.vColumnX[x] = aM[0][0] * fRayX;
+		rTable.vColumnY[x] = aM[1][0] * fRayX;
+		rTable.vColumnZ[x] = aM[2][0] * fRayX;
+	}
+
+	rTable.vRow.resize( 3 * iHeight );
+	for( int y = 0; y < iHeight; ++ y )
+	{
+		float fRayY = ( iOriginY + y - fDepthCy ) / fDepthFy;
+		for( int i = 0; i < 3; ++ i )
+			rTable.vRow[3 * y + i] = aM[i][1] * fRayY + aM[i][2];
+	}
+
+	const float* t = rExtrinsics.aTranslation;
+	for( int i = 0; i < 3; ++ i )
+		rTable.aOffset[i] = aK[i][0] * t[0] + aK[i][1] * t[1] + aK[i][2] * t[2];
+}
+
+/**
+ * Write the projected row to target frame, which has the dummy pixel; keep
+ * the nearest depth, 0 of target is always replaced
+ */
+inline void ScatterRegistration( const int* pIndex, const int* pDepth, int iWidth, OniDepthPixel* pTarget )
+{
+	for( int x = 0; x < iWidth; ++ x )
+	{
+		unsigned int uDepth = unsigned( pDepth[x] );
+		OniDepthPixel& rTarget = pTarget[pIndex[x]];
+		unsigned int uTarget = rTarget;
+		rTarget = OniDepthPixel( uTarget - 1 < uDepth - 1 ? uTarget : uDepth );
+	}
+}
+
+#pragma region scalar registration
+
+/**
+ * The pixels [iBegin, iWidth), the rest is done by SIMD
+ */
+inline void ProjectRegistrationPixels( const OniDepthPixel* pDepth, const float* pColumnX, const float* pColumnY, const float* pColumnZ, const float* pRow, const float* pOffset, int iBegin, int iWidth, int iTargetWidth, int iTargetHeight, int* pIndex, int* pTarget )
+{
+	float fMaxX = iTargetWidth - 0.5f, fMaxY = iTargetHeight - 0.5f;
+	int iInvalid = iTargetWidth * iTargetHeight;
+	for( int x = iBegin; x < iWidth; ++ x )
+	{
+		float fZ = pDepth[x];
+		float fX = fZ * ( pColumnX[x] + pRow[0] ) + pOffset[0];
+		float fY = fZ * ( pColumnY[x] + pRow[1] ) + pOffset[1];
+		fZ = fZ * ( pColumnZ[x] + pRow[2] ) + pOffset[2];
+
+		pIndex[x]	= iInvalid;
+		pTarget[x]	= 0;
+		if( pDepth[x] == 0 || !( fZ >= 0.5f && fZ < 65535.5f ) )
+			continue;
+
+		float fInverse = 1.0f / fZ;
+		float fU = fX * fInverse, fV = fY * fInverse;
+		if( fU >= -0.5f && fU < fMaxX && fV >= -0.5f && fV < fMaxY )
+		{
+			pIndex[x]	= int( float( int( fV + 0.5f ) ) * iTargetWidth + float( int( fU + 0.5f ) ) );
+			pTarget[x]	= int( fZ + 0.5f );
+		}
+	}
+}
+
+inline void ProjectRegistration( const OniDepthPixel* pDepth, const float* pColumnX, const float* pColumnY, const float* pColumnZ, const float* pRow, const float* pOffset, int iWidth, int iTargetWidth, int iTargetHeight, int* pIndex, int* pTarget )
+{
+	ProjectRegistrationPixels( pDepth, pColumnX, pColumnY, pColumnZ, pRow, pOffset, 0, iWidth, iTargetWidth, iTargetHeight, pIndex, pTarget );
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 registration
+
+/**
+ * 4 pixels per block, the same operations as the scalar one
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ProjectRegistration_SSSE3( const OniDepthPixel* pDepth, const float* pColumnX, const float* pColumnY, const float* pColumnZ, const float* pRow, const float* pOffset, int iWidth, int iTargetWidth, int iTargetHeight, int* pIndex, int* pTarget )
+{
+	const __m128i mZero		= _mm_setzero_si128();
+	const __m128i mInvalid	= _mm_set1_epi32( iTargetWidth * iTargetHeight );
+	const __m128 mRowX		= _mm_set1_ps( pRow[0] );
+	const __m128 mRowY		= _mm_set1_ps( pRow[1] );
+	const __m128 mRowZ		= _mm_set1_ps( pRow[2] );
+	const __m128 mOffsetX	= _mm_set1_ps( pOffset[0] );
+	const __m128 mOffsetY	= _mm_set1_ps( pOffset[1] );
+	const __m128 mOffsetZ	= _mm_set1_ps( pOffset[2] );
+	const __m128 mOne		= _mm_set1_ps( 1.0f );
+	const __m128 mHalf		= _mm_set1_ps( 0.5f );
+	const __m128 mMinusHalf	= _mm_set1_ps( -0.5f );
+	const __m128 mMaxX		= _mm_set1_ps( iTargetWidth - 0.5f );
+	const __m128 mMaxY		= _mm_set1_ps( iTargetHeight - 0.5f );
+	const __m128 mMaxZ		= _mm_set1_ps( 65535.5f );
+	const __m128 mWidth		= _mm_set1_ps( float( iTargetWidth ) );
+
+	int x = 0;
+	for( ; x + 4 <= iWidth; x += 4 )
+	{
+		__m128i mDepth = _mm_unpacklo_epi16( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pDepth + x ) ), mZero );
+		__m128 mZ = _mm_cvtepi32_ps( mDepth );
+		__m128 mX = _mm_add_ps( _mm_mul_ps( mZ, _mm_add_ps( _mm_loadu_ps( pColumnX + x ), mRowX ) ), mOffsetX );
+		__m128 mY = _mm_add_ps( _mm_mul_ps( mZ, _mm_add_ps( _mm_loadu_ps( pColumnY + x ), mRowY ) ), mOffsetY );
+		mZ = _mm_add_ps( _mm_mul_ps( mZ, _mm_add_ps( _mm_loadu_ps( pColumnZ + x ), mRowZ ) ), mOffsetZ );
+
+		__m128 mInverse = _mm_div_ps( mOne, mZ );
+		__m128 mU = _mm_mul_ps( mX, mInverse );
+		__m128 mV = _mm_mul_ps( mY, mInverse );
+
+		__m128 mValid = _mm_castsi128_ps( _mm_cmpgt_epi32( mDepth, mZero ) );
+		mValid = _mm_and_ps( mValid, _mm_and_ps( _mm_cmpge_ps( mZ, mHalf ), _mm_cmplt_ps( mZ, mMaxZ ) ) );
+		mValid = _mm_and_ps( mValid, _mm_and_ps( _mm_cmpge_ps( mU, mMinusHalf ), _mm_cmplt_ps( mU, mMaxX ) ) );
+		mValid = _mm_and_ps( mValid, _mm_and_ps( _mm_cmpge_ps( mV, mMinusHalf ), _mm_cmplt_ps( mV, mMaxY ) ) );
+
+		// the index is exact in float for the frames smaller than 2^24 pixels
+		__m128 mColumn = _mm_cvtepi32_ps( _mm_cvttps_epi32( _mm_add_ps( mU, mHalf ) ) );
+		__m128 mLine = _mm_cvtepi32_ps( _mm_cvttps_epi32( _mm_add_ps( mV, mHalf ) ) );
+		__m128i mIndex = _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( mLine, mWidth ), mColumn ) );
+		__m128i mTarget = _mm_cvttps_epi32( _mm_add_ps( mZ, mHalf ) );
+
+		__m128i mMask = _mm_castps_si128( mValid );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pIndex + x ), _mm_or_si128( _mm_and_si128( mMask, mIndex ), _mm_andnot_si128( mMask, mInvalid ) ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), _mm_and_si128( mMask, mTarget ) );
+	}
+
+	ProjectRegistrationPixels( pDepth, pColumnX, pColumnY, pColumnZ, pRow, pOffset, x, iWidth, iTargetWidth, iTargetHeight, pIndex, pTarget );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the row projector of registration; NEON has no division on ARMv7, so
+ * the scalar one is used there
+ */
+inline RegistrationRowProjector GetRegistrationProjector( VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const RegistrationRowProjector s_aProjector[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		ProjectRegistration, VIRTUAL_KERNEL_X86( ProjectRegistration_SSSE3 ), NULL, NULL, NULL };
+
+	return SelectKernel( s_aProjector, eVariant );
+}
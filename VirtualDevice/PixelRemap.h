@@ -0,0 +1,362 @@
+/**
+ * Lens undistortion kernels of the virtual device driver.
+ *
+ * The undistorted pixel (u, v) takes the source pixel which the lens model
+ * of OpenCV moves it to, with the same camera matrix:
+ *   x = ( u - cx ) / fx, y = ( v - cy ) / fy, r2 = x^2 + y^2
+ *   x' = x ( 1 + k1 r2 + k2 r2^2 + k3 r2^3 ) + 2 p1 x y + p2 ( r2 + 2 x^2 )
+ *   y' = y ( 1 + k1 r2 + k2 r2^2 + k3 r2^3 ) + p1 ( r2 + 2 y^2 ) + 2 p2 x y
+ *   source = ( fx x' + cx, fy y' + cy )
+ * The source positions are computed once into a fixed-point table, the
+ * integer pixel and a 7-bit fraction of each axis. Depth takes the nearest
+ * pixel, so the depths of different surfaces are never mixed; the other
+ * formats are interpolated bilinearly. The pixels out of source are 0.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// STL Header
+#include <algorithm>
+#include <vector>
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+const int REMAP_FRACTION_BITS	= 7;
+const int REMAP_FRACTION_ONE	= 1 << REMAP_FRACTION_BITS;
+
+/**
+ * The source positions of the pixels of a resolution, see BuildRemapTable()
+ */
+struct RemapTable
+{
+	int								iWidth;
+	int								iHeight;
+	bool							bBilinear;
+	VirtualLensDistortion			mDistortion;	// the table is built for
+	std::vector<short>				vX;				// source pixel, -1 if out of source
+	std::vector<short>				vY;
+	std::vector<unsigned short>		vFraction;		// x fraction | y fraction << 8, 0 for nearest
+};
+
+/**
+ * Remap iWidth pixels of a row from the source frame of iSourceWidth x
+ * iSourceHeight; pX, pY and pFraction are the entries of the row in table,
+ * and the source frame is the window at (iOriginX, iOriginY) of the table
+ * if it's cropped.
+ */
+typedef void (*PixelRemapRow)( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, const unsigned short* pFraction, unsigned char* pTarget, int iWidth );
+
+/**
+ * If the distortion does anything; all 0 coefficients disable it
+ */
+inline bool IsDistortionEnabled( const VirtualLensDistortion& rDistortion )
+{
+	return	rDistortion.fK1 != 0 || rDistortion.fK2 != 0 || rDistortion.fK3 != 0 ||
+			rDistortion.fP1 != 0 || rDistortion.fP2 != 0;
+}
+
+/**
+ * If the table is built for the distortion and resolution
+ */
+inline bool IsRemapTableOf( const RemapTable& rTable, const VirtualLensDistortion& rDistortion, int iWidth, int iHeight, bool bBilinear )
+{
+	return	rTable.iWidth == iWidth && rTable.iHeight == iHeight && rTable.bBilinear == bBilinear &&
+			memcmp( &rTable.mDistortion, &rDistortion, sizeof( rDistortion ) ) == 0;
+}
+
+/**
+ * Build the table of the distortion for the resolution; the intrinsics are
+ * scaled to it
+ */
+inline void BuildRemapTable( const VirtualLensDistortion& rDistortion, int iWidth, int iHeight, bool bBilinear, RemapTable& rTable )
+{
+	const VirtualCameraIntrinsics& rCamera = rDistortion.mIntrinsics;
+	float fScaleX = float( iWidth ) / rCamera.iWidth, fScaleY = float( iHeight ) / rCamera.iHeight;
+	float fFx = rCamera.fFx * fScaleX, fCx = rCamera.fCx * fScaleX;
+	float fFy = rCamera.fFy * fScaleY, fCy = rCamera.fCy * fScaleY;
+
+	rTable.iWidth		= iWidth;
+	rTable.iHeight		= iHeight;
+	rTable.bBilinear	= bBilinear;
+	rTable.mDistortion	= rDistortion;
+
+	size_t uSize = size_t( iWidth ) * iHeight;
+	rTable.vX.resize( uSize );
+	rTable.vY.resize( uSize );
+	rTable.vFraction.resize( uSize );
+
+	// bilinear reads the next pixel, so the last one is the next one of its previous with full weight
+	float fMaxX = float( bBilinear ? iWidth - 1 : iWidth ), fMaxY = float( bBilinear ? iHeight - 1 : iHeight );
+	size_t i = 0;
+	for( int v = 0; v < iHeight; ++ v )
+	{
+		float fY = ( v - fCy ) / fFy;
+		for( int u = 0; u < iWidth; ++ u, ++ i )
+		{
+			float fX = ( u - fCx ) / fFx;
+			float fR2 = fX * fX + fY * fY;
+			float fRadial = 1 + fR2 * ( rDistortion.fK1 + fR2 * ( rDistortion.fK2 + fR2 * rDistortion.fK3 ) );
+			float fSourceX = fFx * ( fX * fRadial + 2 * rDistortion.fP1 * fX * fY + rDistortion.fP2 * ( fR2 + 2 * fX * fX ) ) + fCx;
+			float fSourceY = fFy * ( fY * fRadial + rDistortion.fP1 * ( fR2 + 2 * fY * fY ) + 2 * rDistortion.fP2 * fX * fY ) + fCy;
+
+			rTable.vX[i]		= -1;
+			rTable.vY[i]		= -1;
+			rTable.vFraction[i]	= 0;
+			if( bBilinear )
+			{
+				if( iWidth < 2 || iHeight < 2 || !( fSourceX >= 0 && fSourceX <= fMaxX && fSourceY >= 0 && fSourceY <= fMaxY ) )
+					continue;
+
+				int iFixedX = int( fSourceX * REMAP_FRACTION_ONE + 0.5f ), iFixedY = int( fSourceY * REMAP_FRACTION_ONE + 0.5f );
+				int iX = std::min( iFixedX >> REMAP_FRACTION_BITS, iWidth - 2 ), iY = std::min( iFixedY >> REMAP_FRACTION_BITS, iHeight - 2 );
+				rTable.vX[i]		= short( iX );
+				rTable.vY[i]		= short( iY );
+				rTable.vFraction[i]	= (unsigned short)( ( iFixedX - iX * REMAP_FRACTION_ONE ) | ( ( iFixedY - iY * REMAP_FRACTION_ONE ) << 8 ) );
+			}
+			else
+			{
+				if( !( fSourceX >= -0.5f && fSourceX < fMaxX - 0.5f && fSourceY >= -0.5f && fSourceY < fMaxY - 0.5f ) )
+					continue;
+
+				rTable.vX[i] = short( std::min( int( fSourceX + 0.5f ), iWidth - 1 ) );
+				rTable.vY[i] = short( std::min( int( fSourceY + 0.5f ), iHeight - 1 ) );
+			}
+		}
+	}
+}
+
+#pragma region scalar remap
+
+/**
+ * a + ( b - a ) * f, f is REMAP_FRACTION_BITS fixed point
+ */
+inline int LerpFixed( int a, int b, int f )
+{
+	return a + ( ( ( b - a ) * f + REMAP_FRACTION_ONE / 2 ) >> REMAP_FRACTION_BITS );
+}
+
+/**
+ * The pixels [iBegin, iEnd) of nearest remap, the rest is done by SIMD
+ */
+template<typename PIXEL>
+inline void RemapNearestPixels( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, PIXEL* pTarget, int iBegin, int iEnd )
+{
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		int iX = pX[x] - iOriginX, iY = pY[x] - iOriginY;
+		if( unsigned( iX ) < unsigned( iSourceWidth ) && unsigned( iY ) < unsigned( iSourceHeight ) )
+			pTarget[x] = reinterpret_cast<const PIXEL*>( pSource + iY * uStride )[iX];
+		else
+			pTarget[x] = 0;
+	}
+}
+
+/**
+ * The pixels [iBegin, iEnd) of bilinear remap, the rest is done by SIMD
+ */
+template<typename CHANNEL, int CHANNELS>
+inline void RemapBilinearPixels( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, const unsigned short* pFraction, CHANNEL* pTarget, int iBegin, int iEnd )
+{
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		CHANNEL* pPixel = pTarget + x * CHANNELS;
+		int iX = pX[x] - iOriginX, iY = pY[x] - iOriginY;
+		if( unsigned( iX ) < unsigned( iSourceWidth - 1 ) && unsigned( iY ) < unsigned( iSourceHeight - 1 ) )
+		{
+			const CHANNEL* pTop		= reinterpret_cast<const CHANNEL*>( pSource + iY * uStride ) + iX * CHANNELS;
+			const CHANNEL* pBottom	= reinterpret_cast<const CHANNEL*>( pSource + ( iY + 1 ) * uStride ) + iX * CHANNELS;
+			int iFx = pFraction[x] & 0xFF, iFy = pFraction[x] >> 8;
+			for( int c = 0; c < CHANNELS; ++ c )
+			{
+				int iTop	= LerpFixed( pTop[c], pTop[c + CHANNELS], iFx );
+				int iBottom	= LerpFixed( pBottom[c], pBottom[c + CHANNELS], iFx );
+				pPixel[c] = CHANNEL( LerpFixed( iTop, iBottom, iFy ) );
+			}
+		}
+		else
+		{
+			for( int c = 0; c < CHANNELS; ++ c )
+				pPixel[c] = 0;
+		}
+	}
+}
+
+template<typename PIXEL>
+inline void RemapNearest( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, const unsigned short*, unsigned char* pTarget, int iWidth )
+{
+	RemapNearestPixels( pSource, uStride, iSourceWidth, iSourceHeight, iOriginX, iOriginY, pX, pY, reinterpret_cast<PIXEL*>( pTarget ), 0, iWidth );
+}
+
+template<typename CHANNEL, int CHANNELS>
+inline void RemapBilinear( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, const unsigned short* pFraction, unsigned char* pTarget, int iWidth )
+{
+	RemapBilinearPixels<CHANNEL, CHANNELS>( pSource, uStride, iSourceWidth, iSourceHeight, iOriginX, iOriginY, pX, pY, pFraction, reinterpret_cast<CHANNEL*>( pTarget ), 0, iWidth );
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region AVX2 remap
+
+/**
+ * The source positions of 8 pixels relative to the frame, and if they are in
+ * [0, iMaxX) x [0, iMaxY)
+ */
+VIRTUAL_DEVICE_TARGET_AVX2 inline __m256i LoadRemapPositions_AVX2( const short* pX, const short* pY, __m256i mOriginX, __m256i mOriginY, __m256i mMaxX, __m256i mMaxY, __m256i& rX, __m256i& rY )
+{
+	const __m256i mNegative = _mm256_set1_epi32( -1 );
+	rX = _mm256_sub_epi32( _mm256_cvtepi16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pX ) ) ), mOriginX );
+	rY = _mm256_sub_epi32( _mm256_cvtepi16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pY ) ) ), mOriginY );
+	return _mm256_and_si256(
+		_mm256_and_si256( _mm256_cmpgt_epi32( rX, mNegative ), _mm256_cmpgt_epi32( mMaxX, rX ) ),
+		_mm256_and_si256( _mm256_cmpgt_epi32( rY, mNegative ), _mm256_cmpgt_epi32( mMaxY, rY ) ) );
+}
+
+/**
+ * 8 pixels per block, gathered as 32 bits at the byte offset of each pixel;
+ * the block which reads the last pixel of source is done by scalar, since
+ * the 2 bytes after it may be out of the buffer.
+ */
+VIRTUAL_DEVICE_TARGET_AVX2 inline void RemapNearest16_AVX2( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, const unsigned short*, unsigned char* pTarget, int iWidth )
+{
+	const __m256i mOriginX	= _mm256_set1_epi32( iOriginX );
+	const __m256i mOriginY	= _mm256_set1_epi32( iOriginY );
+	const __m256i mWidth	= _mm256_set1_epi32( iSourceWidth );
+	const __m256i mHeight	= _mm256_set1_epi32( iSourceHeight );
+	const __m256i mStride	= _mm256_set1_epi32( int( uStride ) );
+	const __m256i mLast		= _mm256_set1_epi32( int( uStride ) * ( iSourceHeight - 1 ) + ( iSourceWidth - 1 ) * 2 );
+	const __m256i mLow		= _mm256_set1_epi32( 0xFFFF );
+	const int* pBase = reinterpret_cast<const int*>( pSource );
+	OniDepthPixel* pOut = reinterpret_cast<OniDepthPixel*>( pTarget );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m256i mX, mY;
+		__m256i mValid = LoadRemapPositions_AVX2( pX + x, pY + x, mOriginX, mOriginY, mWidth, mHeight, mX, mY );
+		__m256i mOffset = _mm256_add_epi32( _mm256_mullo_epi32( mY, mStride ), _mm256_add_epi32( mX, mX ) );
+		if( _mm256_movemask_epi8( _mm256_and_si256( mValid, _mm256_cmpeq_epi32( mOffset, mLast ) ) ) != 0 )
+		{
+			RemapNearestPixels( pSource, uStride, iSourceWidth, iSourceHeight, iOriginX, iOriginY, pX, pY, pOut, x, x + 8 );
+			continue;
+		}
+
+		__m256i mPixel = _mm256_and_si256( _mm256_mask_i32gather_epi32( _mm256_setzero_si256(), pBase, mOffset, mValid, 1 ), mLow );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + x ), _mm_packus_epi32( _mm256_castsi256_si128( mPixel ), _mm256_extracti128_si256( mPixel, 1 ) ) );
+	}
+	RemapNearestPixels( pSource, uStride, iSourceWidth, iSourceHeight, iOriginX, iOriginY, pX, pY, pOut, x, iWidth );
+}
+
+/**
+ * LerpFixed() of 16 channels
+ */
+VIRTUAL_DEVICE_TARGET_AVX2 inline __m256i LerpFixed_AVX2( __m256i mA, __m256i mB, __m256i mFraction )
+{
+	const __m256i mRound = _mm256_set1_epi16( REMAP_FRACTION_ONE / 2 );
+	return _mm256_add_epi16( mA, _mm256_srai_epi16( _mm256_add_epi16( _mm256_mullo_epi16( _mm256_sub_epi16( mB, mA ), mFraction ), mRound ), REMAP_FRACTION_BITS ) );
+}
+
+/**
+ * 8 pixels per block: the 4 neighbours are gathered as 32 bits (RGB and a
+ * byte of the next pixel), interpolated in 16 bits and packed back to RGB.
+ * The block which reads after the last row of source is done by scalar.
+ */
+VIRTUAL_DEVICE_TARGET_AVX2 inline void RemapBilinearRGB_AVX2( const unsigned char* pSource, size_t uStride, int iSourceWidth, int iSourceHeight, int iOriginX, int iOriginY, const short* pX, const short* pY, const unsigned short* pFraction, unsigned char* pTarget, int iWidth )
+{
+	const int iStride = int( uStride );
+	const __m256i mOriginX	= _mm256_set1_epi32( iOriginX );
+	const __m256i mOriginY	= _mm256_set1_epi32( iOriginY );
+	const __m256i mWidth	= _mm256_set1_epi32( iSourceWidth - 1 );
+	const __m256i mHeight	= _mm256_set1_epi32( iSourceHeight - 1 );
+	const __m256i mStride	= _mm256_set1_epi32( iStride );
+	const __m256i mRight	= _mm256_set1_epi32( 3 );
+	const __m256i mBelow	= _mm256_set1_epi32( iStride );
+	const __m256i mLimit	= _mm256_set1_epi32( iStride * ( iSourceHeight - 1 ) + iSourceWidth * 3 - 4 - iStride - 3 );
+	const __m256i mByte		= _mm256_set1_epi32( 0xFF );
+	const __m256i mZero		= _mm256_setzero_si256();
+	const char Z = -1;
+	const __m256i mPack		= _mm256_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z, Z, Z, Z, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, Z, Z, Z, Z );
+	const int* pBase = reinterpret_cast<const int*>( pSource );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m256i mX, mY;
+		__m256i mValid = LoadRemapPositions_AVX2( pX + x, pY + x, mOriginX, mOriginY, mWidth, mHeight, mX, mY );
+		__m256i mOffset = _mm256_add_epi32( _mm256_mullo_epi32( mY, mStride ), _mm256_add_epi32( mX, _mm256_add_epi32( mX, mX ) ) );
+		if( _mm256_movemask_epi8( _mm256_and_si256( mValid, _mm256_cmpgt_epi32( mOffset, mLimit ) ) ) != 0 )
+		{
+			RemapBilinearPixels<unsigned char, 3>( pSource, uStride, iSourceWidth, iSourceHeight, iOriginX, iOriginY, pX, pY, pFraction, pTarget, x, x + 8 );
+			continue;
+		}
+
+		__m256i m00 = _mm256_mask_i32gather_epi32( mZero, pBase, mOffset, mValid, 1 );
+		__m256i m01 = _mm256_mask_i32gather_epi32( mZero, pBase, _mm256_add_epi32( mOffset, mRight ), mValid, 1 );
+		__m256i mOffsetBelow = _mm256_add_epi32( mOffset, mBelow );
+		__m256i m10 = _mm256_mask_i32gather_epi32( mZero, pBase, mOffsetBelow, mValid, 1 );
+		__m256i m11 = _mm256_mask_i32gather_epi32( mZero, pBase, _mm256_add_epi32( mOffsetBelow, mRight ), mValid, 1 );
+
+		// the fractions of each pixel for its 4 channels in 16 bits
+		__m256i mFraction = _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pFraction + x ) ) );
+		__m256i mFx = _mm256_and_si256( mFraction, mByte ), mFy = _mm256_srli_epi32( mFraction, 8 );
+		mFx = _mm256_or_si256( mFx, _mm256_slli_epi32( mFx, 16 ) );
+		mFy = _mm256_or_si256( mFy, _mm256_slli_epi32( mFy, 16 ) );
+
+		__m256i mLow = LerpFixed_AVX2(
+			LerpFixed_AVX2( _mm256_unpacklo_epi8( m00, mZero ), _mm256_unpacklo_epi8( m01, mZero ), _mm256_unpacklo_epi32( mFx, mFx ) ),
+			LerpFixed_AVX2( _mm256_unpacklo_epi8( m10, mZero ), _mm256_unpacklo_epi8( m11, mZero ), _mm256_unpacklo_epi32( mFx, mFx ) ),
+			_mm256_unpacklo_epi32( mFy, mFy ) );
+		__m256i mHigh = LerpFixed_AVX2(
+			LerpFixed_AVX2( _mm256_unpackhi_epi8( m00, mZero ), _mm256_unpackhi_epi8( m01, mZero ), _mm256_unpackhi_epi32( mFx, mFx ) ),
+			LerpFixed_AVX2( _mm256_unpackhi_epi8( m10, mZero ), _mm256_unpackhi_epi8( m11, mZero ), _mm256_unpackhi_epi32( mFx, mFx ) ),
+			_mm256_unpackhi_epi32( mFy, mFy ) );
+		__m256i mPixel = _mm256_shuffle_epi8( _mm256_packus_epi16( mLow, mHigh ), mPack );
+
+		// 12 bytes of each half
+		unsigned char* pOut = pTarget + x * 3;
+		__m128i mSecond = _mm256_extracti128_si256( mPixel, 1 );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut ), _mm256_castsi256_si128( mPixel ) );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pOut + 12 ), mSecond );
+		int iLast = _mm_extract_epi32( mSecond, 2 );
+		memcpy( pOut + 20, &iLast, sizeof( iLast ) );
+	}
+	RemapBilinearPixels<unsigned char, 3>( pSource, uStride, iSourceWidth, iSourceHeight, iOriginX, iOriginY, pX, pY, pFraction, pTarget, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the remap kernel of pixel format, nearest for depth and bilinear for
+ * the others; NULL if not supported
+ */
+inline PixelRemapRow GetRemapKernel( OniPixelFormat eFormat, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const PixelRemapRow s_aDepth[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		RemapNearest<OniDepthPixel>, NULL, VIRTUAL_KERNEL_X86( RemapNearest16_AVX2 ), NULL, NULL };
+	static const PixelRemapRow s_aRGB[VIRTUAL_KERNEL_VARIANT_NUM] = {
+		RemapBilinear<unsigned char, 3>, NULL, VIRTUAL_KERNEL_X86( RemapBilinearRGB_AVX2 ), NULL, NULL };
+
+	switch( eFormat )
+	{
+	case ONI_PIXEL_FORMAT_DEPTH_1_MM:
+	case ONI_PIXEL_FORMAT_DEPTH_100_UM:
+		return SelectKernel( s_aDepth, eVariant );
+
+	case ONI_PIXEL_FORMAT_RGB888:
+		return SelectKernel( s_aRGB, eVariant );
+
+	case ONI_PIXEL_FORMAT_GRAY8:
+		return RemapBilinear<unsigned char, 1>;
+
+	case ONI_PIXEL_FORMAT_GRAY16:
+		return RemapBilinear<unsigned short, 1>;
+
+	default:
+		return NULL;
+	}
+}
@@ -0,0 +1,613 @@
+/**
+ * Resolution adaptation kernels of the virtual device driver.
+ *
+ * With VIRTUAL_STREAM_PROPERTY_SOURCE_RESOLUTION, the producer set frames
+ * larger than the video mode, and they are reduced when they are set. The
+ * block kernels reduce each FxF block (F is 2 or 4) to one pixel; the depth
+ * kernels ignore the zero (invalid) pixels, so no depth is made up on the
+ * edge of objects. Bilinear works for any ratio, but only for color and gray.
+ *
+ * http://viml.nchc.org.tw/home/
+ */
+
+#pragma once
+
+// STL Header
+#include <vector>
+
+// VirtualDevice kernel dispatch
+#include "PixelKernel.h"
+
+/**
+ * Reduce the blocks of F rows from pSource to one row of iWidth pixels
+ */
+typedef void (*PixelBlockReducer)( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth );
+
+/**
+ * For each target column (or row), the two source pixels to interpolate,
+ * and the weight of the second one in 1/256
+ */
+struct BilinearTable
+{
+	std::vector<int>	vFirst;
+	std::vector<int>	vSecond;
+	std::vector<int>	vWeight;
+};
+
+/**
+ * Interpolate one row of iWidth pixels from two source rows
+ */
+typedef void (*PixelBilinearRow)( const unsigned char* pRow0, const unsigned char* pRow1, int iWeight, const BilinearTable& rColumns, unsigned char* pTarget, int iWidth );
+
+/**
+ * The block size to reduce iSource to iTarget, 0 if there is no block kernel for it
+ */
+inline int GetDecimationFactor( int iSource, int iTarget )
+{
+	if( iTarget <= 0 || iSource % iTarget != 0 )
+		return 0;
+	int iFactor = iSource / iTarget;
+	return ( iFactor == 2 || iFactor == 4 ? iFactor : 0 );
+}
+
+/**
+ * Build the table of pixel centers for iTarget pixels from iSource pixels
+ */
+inline void BuildBilinearTable( int iSource, int iTarget, BilinearTable& rTable )
+{
+	rTable.vFirst.resize( iTarget );
+	rTable.vSecond.resize( iTarget );
+	rTable.vWeight.resize( iTarget );
+	for( int i = 0; i < iTarget; ++ i )
+	{
+		double dPos = ( i + 0.5 ) * iSource / iTarget - 0.5;
+		if( dPos < 0 )
+			dPos = 0;
+		int iFirst = int( dPos );
+		if( iFirst > iSource - 1 )
+			iFirst = iSource - 1;
+		int iWeight = int( ( dPos - iFirst ) * 256 + 0.5 );
+
+		rTable.vFirst[i]	= iFirst;
+		rTable.vSecond[i]	= ( iFirst + 1 < iSource ? iFirst + 1 : iFirst );
+		rTable.vWeight[i]	= iWeight;
+	}
+}
+
+#pragma region scalar resize
+
+/**
+ * The reducers of pixels [iBegin, iEnd), the rest is done by SIMD
+ */
+template<int F>
+void ReduceDepthMin( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iBegin, int iEnd )
+{
+	OniDepthPixel* pTarget16 = reinterpret_cast<OniDepthPixel*>( pTarget );
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		unsigned int uMin = 0x10000;
+		for( int r = 0; r < F; ++ r )
+		{
+			const OniDepthPixel* pBlock = reinterpret_cast<const OniDepthPixel*>( pSource + r * uStride ) + x * F;
+			for( int c = 0; c < F; ++ c )
+			{
+				if( pBlock[c] != 0 && pBlock[c] < uMin )
+					uMin = pBlock[c];
+			}
+		}
+		pTarget16[x] = OniDepthPixel( uMin & 0xFFFF );
+	}
+}
+
+template<int F>
+void ReduceDepthMedian( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iBegin, int iEnd )
+{
+	OniDepthPixel* pTarget16 = reinterpret_cast<OniDepthPixel*>( pTarget );
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		// insertion sort of the valid depths
+		OniDepthPixel aValid[ F * F ];
+		int iValid = 0;
+		for( int r = 0; r < F; ++ r )
+		{
+			const OniDepthPixel* pBlock = reinterpret_cast<const OniDepthPixel*>( pSource + r * uStride ) + x * F;
+			for( int c = 0; c < F; ++ c )
+			{
+				OniDepthPixel uDepth = pBlock[c];
+				if( uDepth == 0 )
+					continue;
+
+				int i = iValid ++;
+				for( ; i > 0 && aValid[ i - 1 ] > uDepth; -- i )
+					aValid[i] = aValid[ i - 1 ];
+				aValid[i] = uDepth;
+			}
+		}
+		pTarget16[x] = ( iValid > 0 ? aValid[ ( iValid - 1 ) / 2 ] : 0 );
+	}
+}
+
+template<int F>
+void ReduceDepthAverage( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iBegin, int iEnd )
+{
+	OniDepthPixel* pTarget16 = reinterpret_cast<OniDepthPixel*>( pTarget );
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		unsigned int uSum = 0, uValid = 0;
+		for( int r = 0; r < F; ++ r )
+		{
+			const OniDepthPixel* pBlock = reinterpret_cast<const OniDepthPixel*>( pSource + r * uStride ) + x * F;
+			for( int c = 0; c < F; ++ c )
+			{
+				uSum	+= pBlock[c];
+				uValid	+= ( pBlock[c] != 0 );
+			}
+		}
+		pTarget16[x] = OniDepthPixel( uValid > 0 ? ( 2 * uSum + uValid ) / ( 2 * uValid ) : 0 );
+	}
+}
+
+template<typename CHANNEL, int CHANNELS, int F>
+void ReduceBox( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iBegin, int iEnd )
+{
+	CHANNEL* pTargetChannel = reinterpret_cast<CHANNEL*>( pTarget );
+	for( int x = iBegin; x < iEnd; ++ x )
+	{
+		for( int i = 0; i < CHANNELS; ++ i )
+		{
+			unsigned int uSum = F * F / 2;
+			for( int r = 0; r < F; ++ r )
+			{
+				const CHANNEL* pBlock = reinterpret_cast<const CHANNEL*>( pSource + r * uStride ) + x * F * CHANNELS + i;
+				for( int c = 0; c < F; ++ c )
+					uSum += pBlock[ c * CHANNELS ];
+			}
+			pTargetChannel[ x * CHANNELS + i ] = CHANNEL( uSum / ( F * F ) );
+		}
+	}
+}
+
+template<int F>
+void ReduceRowDepthMin( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	ReduceDepthMin<F>( pSource, uStride, pTarget, 0, iWidth );
+}
+
+template<int F>
+void ReduceRowDepthMedian( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	ReduceDepthMedian<F>( pSource, uStride, pTarget, 0, iWidth );
+}
+
+template<int F>
+void ReduceRowDepthAverage( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	ReduceDepthAverage<F>( pSource, uStride, pTarget, 0, iWidth );
+}
+
+template<typename CHANNEL, int CHANNELS, int F>
+void ReduceRowBox( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	ReduceBox<CHANNEL, CHANNELS, F>( pSource, uStride, pTarget, 0, iWidth );
+}
+
+/**
+ * The top-left pixel of block
+ */
+template<typename PIXEL, int F>
+void ReduceRowNearest( const unsigned char* pSource, size_t, unsigned char* pTarget, int iWidth )
+{
+	const PIXEL* pSourcePixel = reinterpret_cast<const PIXEL*>( pSource );
+	PIXEL* pTargetPixel = reinterpret_cast<PIXEL*>( pTarget );
+	for( int x = 0; x < iWidth; ++ x )
+		pTargetPixel[x] = pSourcePixel[ x * F ];
+}
+
+/**
+ * Bilinear interpolation in fixed point, 8 bits for each direction
+ */
+template<typename CHANNEL, int CHANNELS>
+void ResizeRowBilinear( const unsigned char* pRow0, const unsigned char* pRow1, int iWeight, const BilinearTable& rColumns, unsigned char* pTarget, int iWidth )
+{
+	const CHANNEL* pTop		= reinterpret_cast<const CHANNEL*>( pRow0 );
+	const CHANNEL* pBottom	= reinterpret_cast<const CHANNEL*>( pRow1 );
+	CHANNEL* pTargetChannel	= reinterpret_cast<CHANNEL*>( pTarget );
+
+	const unsigned int uWeightY = static_cast<unsigned int>( iWeight );
+	for( int x = 0; x < iWidth; ++ x )
+	{
+		const unsigned int uWeightX = static_cast<unsigned int>( rColumns.vWeight[x] );
+		const int iFirst	= rColumns.vFirst[x] * CHANNELS;
+		const int iSecond	= rColumns.vSecond[x] * CHANNELS;
+		for( int i = 0; i < CHANNELS; ++ i )
+		{
+			unsigned int uTop		= pTop[ iFirst + i ] * ( 256 - uWeightX ) + pTop[ iSecond + i ] * uWeightX;
+			unsigned int uBottom	= pBottom[ iFirst + i ] * ( 256 - uWeightX ) + pBottom[ iSecond + i ] * uWeightX;
+			pTargetChannel[ x * CHANNELS + i ] = CHANNEL( ( uTop * ( 256 - uWeightY ) + uBottom * uWeightY + 32768 ) >> 16 );
+		}
+	}
+}
+
+#pragma endregion
+
+#ifdef VIRTUAL_DEVICE_X86
+#pragma region SSSE3 resize
+
+/**
+ * Unsigned 16 bits min / max, which need SSE4.1
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i MinU16_SSSE3( __m128i mA, __m128i mB )
+{
+	return _mm_sub_epi16( mA, _mm_subs_epu16( mA, mB ) );
+}
+
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i MaxU16_SSSE3( __m128i mA, __m128i mB )
+{
+	return _mm_add_epi16( mB, _mm_subs_epu16( mA, mB ) );
+}
+
+/**
+ * The valid depths minus 1, so the invalid 0 become the largest
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i LoadDepthMinusOne_SSSE3( const unsigned char* pSource )
+{
+	return _mm_sub_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pSource ) ), _mm_set1_epi16( 1 ) );
+}
+
+/**
+ * 8 pixels per block; vertical min of F rows, then horizontal min of F
+ * columns by shifting in 32 / 64 bits lanes.
+ */
+template<int F>
+VIRTUAL_DEVICE_TARGET_SSSE3 void ReduceRowDepthMin_SSSE3( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	const char Z = -1;
+	const __m128i mGather = ( F == 2 ?	_mm_setr_epi8( 0, 1, 4, 5, 8, 9, 12, 13, Z, Z, Z, Z, Z, Z, Z, Z ) :
+										_mm_setr_epi8( 0, 1, 8, 9, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z ) );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i aPart[4];
+		for( int i = 0; i < F; ++ i )
+		{
+			const unsigned char* pBlock = pSource + ( x * F + i * 8 ) * 2;
+			__m128i mMin = LoadDepthMinusOne_SSSE3( pBlock );
+			for( int r = 1; r < F; ++ r )
+				mMin = MinU16_SSSE3( mMin, LoadDepthMinusOne_SSSE3( pBlock + r * uStride ) );
+
+			mMin = MinU16_SSSE3( mMin, _mm_srli_epi32( mMin, 16 ) );
+			if( F == 4 )
+				mMin = MinU16_SSSE3( mMin, _mm_srli_epi64( mMin, 32 ) );
+			aPart[i] = _mm_shuffle_epi8( mMin, mGather );
+		}
+
+		__m128i mResult;
+		if( F == 2 )
+			mResult = _mm_unpacklo_epi64( aPart[0], aPart[1] );
+		else
+			mResult = _mm_unpacklo_epi64( _mm_unpacklo_epi32( aPart[0], aPart[1] ), _mm_unpacklo_epi32( aPart[2], aPart[3] ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 2 ), _mm_add_epi16( mResult, _mm_set1_epi16( 1 ) ) );
+	}
+	ReduceDepthMin<F>( pSource, uStride, pTarget, x, iWidth );
+}
+
+/**
+ * (sum + count / 2) / count in float, which is exact for these ranges; 0 if count is 0
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline __m128i DivideRound_SSSE3( __m128i mSum, __m128i mCount )
+{
+	__m128 fCount = _mm_cvtepi32_ps( mCount );
+	__m128 fQuotient = _mm_div_ps( _mm_add_ps( _mm_cvtepi32_ps( mSum ), _mm_mul_ps( fCount, _mm_set1_ps( 0.5f ) ) ), fCount );
+	return _mm_and_si128( _mm_cvttps_epi32( fQuotient ), _mm_cmpgt_epi32( mCount, _mm_setzero_si128() ) );
+}
+
+/**
+ * 8 pixels per block; sums in 32 bits and counts of valid depth in 16 bits,
+ * horizontal add for F columns.
+ */
+template<int F>
+VIRTUAL_DEVICE_TARGET_SSSE3 void ReduceRowDepthAverage_SSSE3( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	const __m128i mZero = _mm_setzero_si128();
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i aSum[4], aCount[4];
+		for( int i = 0; i < F; ++ i )
+		{
+			const unsigned char* pBlock = pSource + ( x * F + i * 8 ) * 2;
+			__m128i mLow = mZero, mHigh = mZero, mCount = _mm_set1_epi16( F );
+			for( int r = 0; r < F; ++ r )
+			{
+				__m128i mDepth = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pBlock + r * uStride ) );
+				mLow	= _mm_add_epi32( mLow, _mm_unpacklo_epi16( mDepth, mZero ) );
+				mHigh	= _mm_add_epi32( mHigh, _mm_unpackhi_epi16( mDepth, mZero ) );
+				mCount	= _mm_add_epi16( mCount, _mm_cmpeq_epi16( mDepth, mZero ) );
+			}
+			aSum[i]		= _mm_hadd_epi32( mLow, mHigh );
+			aCount[i]	= mCount;
+		}
+
+		__m128i mSum0, mSum1, mCount;
+		if( F == 2 )
+		{
+			mSum0	= aSum[0];
+			mSum1	= aSum[1];
+			mCount	= _mm_hadd_epi16( aCount[0], aCount[1] );
+		}
+		else
+		{
+			mSum0	= _mm_hadd_epi32( aSum[0], aSum[1] );
+			mSum1	= _mm_hadd_epi32( aSum[2], aSum[3] );
+			mCount	= _mm_hadd_epi16( _mm_hadd_epi16( aCount[0], aCount[1] ), _mm_hadd_epi16( aCount[2], aCount[3] ) );
+		}
+
+		__m128i mAverage0 = DivideRound_SSSE3( mSum0, _mm_unpacklo_epi16( mCount, mZero ) );
+		__m128i mAverage1 = DivideRound_SSSE3( mSum1, _mm_unpackhi_epi16( mCount, mZero ) );
+
+		// unsigned pack without SSE4.1
+		const __m128i mBias = _mm_set1_epi32( 0x8000 );
+		__m128i mResult = _mm_packs_epi32( _mm_sub_epi32( mAverage0, mBias ), _mm_sub_epi32( mAverage1, mBias ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 2 ), _mm_xor_si128( mResult, _mm_set1_epi16( -32768 ) ) );
+	}
+	ReduceDepthAverage<F>( pSource, uStride, pTarget, x, iWidth );
+}
+
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void SortU16_SSSE3( __m128i& rA, __m128i& rB )
+{
+	__m128i mMin = MinU16_SSSE3( rA, rB );
+	rB = MaxU16_SSSE3( rA, rB );
+	rA = mMin;
+}
+
+/**
+ * 8 pixels per block; split even and odd columns, then a sorting network
+ * of the 4 depths. Invalid depths are sorted to the end, so the median is
+ * the 2nd if 3 or 4 are valid, otherwise the 1st.
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ReduceRowDepthMedian2_SSSE3( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	const __m128i mSplit = _mm_setr_epi8( 0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15 );
+	const __m128i mInvalid = _mm_set1_epi16( -1 );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		__m128i aDepth[4];
+		for( int r = 0; r < 2; ++ r )
+		{
+			const unsigned char* pRow = pSource + r * uStride + x * 4;
+			__m128i mA = _mm_shuffle_epi8( LoadDepthMinusOne_SSSE3( pRow ), mSplit );
+			__m128i mB = _mm_shuffle_epi8( LoadDepthMinusOne_SSSE3( pRow + 16 ), mSplit );
+			aDepth[ r * 2 ]		= _mm_unpacklo_epi64( mA, mB );
+			aDepth[ r * 2 + 1 ]	= _mm_unpackhi_epi64( mA, mB );
+		}
+
+		SortU16_SSSE3( aDepth[0], aDepth[1] );
+		SortU16_SSSE3( aDepth[2], aDepth[3] );
+		SortU16_SSSE3( aDepth[0], aDepth[2] );
+		SortU16_SSSE3( aDepth[1], aDepth[3] );
+		SortU16_SSSE3( aDepth[1], aDepth[2] );
+
+		__m128i mFew = _mm_cmpeq_epi16( aDepth[2], mInvalid );
+		__m128i mMedian = _mm_or_si128( _mm_and_si128( mFew, aDepth[0] ), _mm_andnot_si128( mFew, aDepth[1] ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 2 ), _mm_add_epi16( mMedian, _mm_set1_epi16( 1 ) ) );
+	}
+	ReduceDepthMedian<2>( pSource, uStride, pTarget, x, iWidth );
+}
+
+/**
+ * 16 pixels per block; maddubs add the column pairs
+ */
+template<int F>
+VIRTUAL_DEVICE_TARGET_SSSE3 void ReduceRowBox8_SSSE3( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	const __m128i mOnes = _mm_set1_epi8( 1 );
+	const __m128i mRound = _mm_set1_epi16( F * F / 2 );
+
+	int x = 0;
+	for( ; x + 16 <= iWidth; x += 16 )
+	{
+		__m128i aSum[4];
+		for( int i = 0; i < F; ++ i )
+		{
+			const unsigned char* pBlock = pSource + x * F + i * 16;
+			aSum[i] = _mm_maddubs_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pBlock ) ), mOnes );
+			for( int r = 1; r < F; ++ r )
+				aSum[i] = _mm_add_epi16( aSum[i], _mm_maddubs_epi16( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pBlock + r * uStride ) ), mOnes ) );
+		}
+
+		__m128i mResult;
+		if( F == 2 )
+		{
+			mResult = _mm_packus_epi16(	_mm_srli_epi16( _mm_add_epi16( aSum[0], mRound ), 2 ),
+										_mm_srli_epi16( _mm_add_epi16( aSum[1], mRound ), 2 ) );
+		}
+		else
+		{
+			mResult = _mm_packus_epi16(	_mm_srli_epi16( _mm_add_epi16( _mm_hadd_epi16( aSum[0], aSum[1] ), mRound ), 4 ),
+										_mm_srli_epi16( _mm_add_epi16( _mm_hadd_epi16( aSum[2], aSum[3] ), mRound ), 4 ) );
+		}
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x ), mResult );
+	}
+	ReduceBox<uint8_t, 1, F>( pSource, uStride, pTarget, x, iWidth );
+}
+
+/**
+ * 8 pixels per block; the rows are added in 16 bits, each pixel is added
+ * with the next one by shifting 3 lanes, then the channels of even pixels
+ * are gathered.
+ */
+VIRTUAL_DEVICE_TARGET_SSSE3 inline void ReduceRowBoxRGB2_SSSE3( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	const char Z = -1;
+	const __m128i mZero		= _mm_setzero_si128();
+	const __m128i mRound	= _mm_set1_epi16( 2 );
+	const __m128i mGather0	= _mm_setr_epi8( 0, 1, 2, 6, 7, 8, 12, 13, 14, Z, Z, Z, Z, Z, Z, Z );
+	const __m128i mGather1	= _mm_setr_epi8( Z, Z, Z, Z, Z, Z, Z, Z, Z, 2, 3, 4, 8, 9, 10, 14 );
+	const __m128i mGather1b	= _mm_setr_epi8( 15, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z );
+	const __m128i mGather2	= _mm_setr_epi8( Z, 0, 4, 5, 6, 10, 11, 12, Z, Z, Z, Z, Z, Z, Z, Z );
+
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		const unsigned char* pRow0 = pSource + x * 6;
+		const unsigned char* pRow1 = pRow0 + uStride;
+
+		__m128i aSum[7];
+		for( int i = 0; i < 3; ++ i )
+		{
+			__m128i mA = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow0 + i * 16 ) );
+			__m128i mB = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow1 + i * 16 ) );
+			aSum[ i * 2 ]		= _mm_add_epi16( _mm_unpacklo_epi8( mA, mZero ), _mm_unpacklo_epi8( mB, mZero ) );
+			aSum[ i * 2 + 1 ]	= _mm_add_epi16( _mm_unpackhi_epi8( mA, mZero ), _mm_unpackhi_epi8( mB, mZero ) );
+		}
+		aSum[6] = mZero;
+
+		__m128i aPacked[3];
+		for( int i = 0; i < 3; ++ i )
+		{
+			__m128i mLow	= _mm_add_epi16( aSum[ i * 2 ], _mm_alignr_epi8( aSum[ i * 2 + 1 ], aSum[ i * 2 ], 6 ) );
+			__m128i mHigh	= _mm_add_epi16( aSum[ i * 2 + 1 ], _mm_alignr_epi8( aSum[ i * 2 + 2 ], aSum[ i * 2 + 1 ], 6 ) );
+			aPacked[i] = _mm_packus_epi16( _mm_srli_epi16( _mm_add_epi16( mLow, mRound ), 2 ), _mm_srli_epi16( _mm_add_epi16( mHigh, mRound ), 2 ) );
+		}
+
+		__m128i mResult0 = _mm_or_si128( _mm_shuffle_epi8( aPacked[0], mGather0 ), _mm_shuffle_epi8( aPacked[1], mGather1 ) );
+		__m128i mResult1 = _mm_or_si128( _mm_shuffle_epi8( aPacked[1], mGather1b ), _mm_shuffle_epi8( aPacked[2], mGather2 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( pTarget + x * 3 ), mResult0 );
+		_mm_storel_epi64( reinterpret_cast<__m128i*>( pTarget + x * 3 + 16 ), mResult1 );
+	}
+	ReduceBox<uint8_t, 3, 2>( pSource, uStride, pTarget, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+#ifdef VIRTUAL_DEVICE_NEON
+#pragma region NEON resize
+
+/**
+ * 4 pixels per block; vertical min of F rows, then pairwise min
+ */
+template<int F>
+void ReduceRowDepthMin_NEON( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	const uint16x8_t mOne = vdupq_n_u16( 1 );
+	OniDepthPixel* pTarget16 = reinterpret_cast<OniDepthPixel*>( pTarget );
+
+	int x = 0;
+	for( ; x + 4 <= iWidth; x += 4 )
+	{
+		uint16x4_t aPart[2];
+		for( int i = 0; i < F / 2; ++ i )
+		{
+			const unsigned char* pBlock = pSource + ( x * F + i * 8 ) * 2;
+			uint16x8_t mMin = vsubq_u16( vld1q_u16( reinterpret_cast<const uint16_t*>( pBlock ) ), mOne );
+			for( int r = 1; r < F; ++ r )
+				mMin = vminq_u16( mMin, vsubq_u16( vld1q_u16( reinterpret_cast<const uint16_t*>( pBlock + r * uStride ) ), mOne ) );
+			aPart[i] = vpmin_u16( vget_low_u16( mMin ), vget_high_u16( mMin ) );
+		}
+
+		uint16x4_t mResult = ( F == 2 ? aPart[0] : vpmin_u16( aPart[0], aPart[1] ) );
+		vst1_u16( pTarget16 + x, vadd_u16( mResult, vget_low_u16( mOne ) ) );
+	}
+	ReduceDepthMin<F>( pSource, uStride, pTarget, x, iWidth );
+}
+
+/**
+ * 8 pixels per block; pairwise add, and rounding narrow shift
+ */
+inline void ReduceRowBox8x2_NEON( const unsigned char* pSource, size_t uStride, unsigned char* pTarget, int iWidth )
+{
+	int x = 0;
+	for( ; x + 8 <= iWidth; x += 8 )
+	{
+		uint16x8_t mSum = vaddq_u16( vpaddlq_u8( vld1q_u8( pSource + x * 2 ) ), vpaddlq_u8( vld1q_u8( pSource + uStride + x * 2 ) ) );
+		vst1_u8( pTarget + x, vrshrn_n_u16( mSum, 2 ) );
+	}
+	ReduceBox<uint8_t, 1, 2>( pSource, uStride, pTarget, x, iWidth );
+}
+
+#pragma endregion
+#endif
+
+/**
+ * Get the block reducer of pixel format, VirtualDecimation mode and block
+ * size; NULL if not supported.
+ */
+inline PixelBlockReducer GetBlockReducer( OniPixelFormat eFormat, VirtualDecimation eMode, int iFactor, VirtualKernelVariant eVariant = GetKernelVariant() )
+{
+	if( iFactor != 2 && iFactor != 4 )
+		return NULL;
+	const int iIndex = ( iFactor == 2 ? 0 : 1 );
+
+	// scalar, SSSE3, AVX2, AVX512, NEON
+	static const PixelBlockReducer s_aDepthMin[2][VIRTUAL_KERNEL_VARIANT_NUM] = {
+		{ ReduceRowDepthMin<2>, VIRTUAL_KERNEL_X86( ReduceRowDepthMin_SSSE3<2> ), NULL, NULL, VIRTUAL_KERNEL_NEON( ReduceRowDepthMin_NEON<2> ) },
+		{ ReduceRowDepthMin<4>, VIRTUAL_KERNEL_X86( ReduceRowDepthMin_SSSE3<4> ), NULL, NULL, VIRTUAL_KERNEL_NEON( ReduceRowDepthMin_NEON<4> ) } };
+	static const PixelBlockReducer s_aDepthMedian[2][VIRTUAL_KERNEL_VARIANT_NUM] = {
+		{ ReduceRowDepthMedian<2>, VIRTUAL_KERNEL_X86( ReduceRowDepthMedian2_SSSE3 ), NULL, NULL, NULL },
+		{ ReduceRowDepthMedian<4>, NULL, NULL, NULL, NULL } };
+	static const PixelBlockReducer s_aDepthAverage[2][VIRTUAL_KERNEL_VARIANT_NUM] = {
+		{ ReduceRowDepthAverage<2>, VIRTUAL_KERNEL_X86( ReduceRowDepthAverage_SSSE3<2> ), NULL, NULL, NULL },
+		{ ReduceRowDepthAverage<4>, VIRTUAL_KERNEL_X86( ReduceRowDepthAverage_SSSE3<4> ), NULL, NULL, NULL } };
+	static const PixelBlockReducer s_aBox8[2][VIRTUAL_KERNEL_VARIANT_NUM] = {
+		{ ReduceRowBox<uint8_t, 1, 2>, VIRTUAL_KERNEL_X86( ReduceRowBox8_SSSE3<2> ), NULL, NULL, VIRTUAL_KERNEL_NEON( ReduceRowBox8x2_NEON ) },
+		{ ReduceRowBox<uint8_t, 1, 4>, VIRTUAL_KERNEL_X86( ReduceRowBox8_SSSE3<4> ), NULL, NULL, NULL } };
+	static const PixelBlockReducer s_aBoxRGB[2][VIRTUAL_KERNEL_VARIANT_NUM] = {
+		{ ReduceRowBox<uint8_t, 3, 2>, VIRTUAL_KERNEL_X86( ReduceRowBoxRGB2_SSSE3 ), NULL, NULL, NULL },
+		{ ReduceRowBox<uint8_t, 3, 4>, NULL, NULL, NULL, NULL } };
+
+	// two pixels share U and V
+	if( eFormat == ONI_PIXEL_FORMAT_YUV422 || eFormat == ONI_PIXEL_FORMAT_YUYV )
+		return NULL;
+
+	bool bDepth = ( eFormat == ONI_PIXEL_FORMAT_DEPTH_1_MM || eFormat == ONI_PIXEL_FORMAT_DEPTH_100_UM );
+	switch( eMode )
+	{
+	case VIRTUAL_DECIMATION_NEAREST:
+		switch( GetPixelSize( eFormat ) )
+		{
+		case 1:	return ( iFactor == 2 ? ReduceRowNearest<uint8_t, 2> : ReduceRowNearest<uint8_t, 4> );
+		case 2:	return ( iFactor == 2 ? ReduceRowNearest<uint16_t, 2> : ReduceRowNearest<uint16_t, 4> );
+		case 3:	return ( iFactor == 2 ? ReduceRowNearest<OniRGB888Pixel, 2> : ReduceRowNearest<OniRGB888Pixel, 4> );
+		default:	return NULL;
+		}
+
+	case VIRTUAL_DECIMATION_MIN:
+		return ( bDepth ? SelectKernel( s_aDepthMin[iIndex], eVariant ) : NULL );
+
+	case VIRTUAL_DECIMATION_MEDIAN:
+		return ( bDepth ? SelectKernel( s_aDepthMedian[iIndex], eVariant ) : NULL );
+
+	case VIRTUAL_DECIMATION_AVERAGE:
+		if( bDepth )
+			return SelectKernel( s_aDepthAverage[iIndex], eVariant );
+		switch( eFormat )
+		{
+		case ONI_PIXEL_FORMAT_GRAY8:	return SelectKernel( s_aBox8[iIndex], eVariant );
+		case ONI_PIXEL_FORMAT_RGB888:	return SelectKernel( s_aBoxRGB[iIndex], eVariant );
+		case ONI_PIXEL_FORMAT_GRAY16:	return ( iFactor == 2 ? ReduceRowBox<uint16_t, 1, 2> : ReduceRowBox<uint16_t, 1, 4> );
+		default:						return NULL;
+		}
+
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * Get the bilinear row kernel of pixel format, NULL if not supported
+ */
+inline PixelBilinearRow GetBilinearRow( OniPixelFormat eFormat )
+{
+	switch( eFormat )
+	{
+	case ONI_PIXEL_FORMAT_RGB888:	return ResizeRowBilinear<uint8_t, 3>;
+	case ONI_PIXEL_FORMAT_GRAY8:	return ResizeRowBilinear<uint8_t, 1>;
+	case ONI_PIXEL_FORMAT_GRAY16:	return ResizeRowBilinear<uint16_t, 1>;
+	default:						return NULL;
+	}
+}
@@ -12,16 +12,34 @@
  */
 
 // C Header
+#include <stdio.h>
 #include <string.h>
 
 // STL Header
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
-// C Time header
-#include <ctime>
+// Thread affinity and timer resolution
+#ifdef _WIN32
+	#include <windows.h>
+	#include <mmsystem.h>
+	#pragma comment( lib, "winmm.lib" )
+#else
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+// thread local storage of POD
+#ifdef _MSC_VER
+	#define VIRTUAL_DEVICE_THREAD_LOCAL	__declspec( thread )
+#else
+	#define VIRTUAL_DEVICE_THREAD_LOCAL	__thread
+#endif
 
 // for debug only
 #include <iostream>
@@ -32,6 +50,14 @@
 
 // VirtualDevice command
 #include "VirtualDevice.h"
+#include "PixelConverter.h"
+#include "PixelDepthFilter.h"
+#include "PixelMirror.h"
+#include "PixelResize.h"
+#include "PixelPointCloud.h"
+#include "PixelRegistration.h"
+#include "PixelRemap.h"
+#include "PixelRGBD.h"
 
 #pragma region inline functions for propertry data
 template<typename _T>
@@ -78,338 +104,5525 @@ bool SetProperty( oni::driver::DriverServices& rService, size_t uSize, const voi
 	return false;
 }
 
+
+
+/**
+ * Get the time of monotonic clock in microsecond
+ */
+inline uint64_t GetHostTimestamp()
+{
+	XnUInt64 uNow = 0;
+	xnOSGetHighResTimeStamp( &uNow );
+	return uNow;
+}
+
+/**
+ * Bind current thread to the CPUs in mask, 0 means no limitation
+ */
+inline bool SetCurrentThreadAffinity( uint64_t uMask )
+{
+#ifdef _WIN32
+	DWORD_PTR uThreadMask = ( uMask == 0 ? DWORD_PTR(-1) : DWORD_PTR( uMask ) );
+	return SetThreadAffinityMask( GetCurrentThread(), uThreadMask ) != 0;
+#else
+	cpu_set_t mCPUs;
+	CPU_ZERO( &mCPUs );
+	for( int i = 0; i < 64 && i < CPU_SETSIZE; ++ i )
+	{
+		if( uMask == 0 || ( uMask >> i ) & 1 )
+			CPU_SET( i, &mCPUs );
+	}
+	return pthread_setaffinity_np( pthread_self(), sizeof(mCPUs), &mCPUs ) == 0;
+#endif
+}
+
 #pragma endregion
 
+/**
+ * Free the objects replaced while other threads may still read them, without
+ * locking the readers.
+ *
+ * Readers are counted by the parity of an epoch; retiring an object flips the
+ * epoch when the readers of the other parity are done, and frees the objects
+ * retired before the previous flip, so the constant reading of other threads
+ * doesn't keep them. The last reader of a parity retries it, so the retired
+ * objects are freed even if there is no more write.
+ */
+template<typename _T>
+class EpochReclaimer
+{
+public:
+	typedef void (*FreeFunction)( _T* pObject );
+
+public:
+	EpochReclaimer( FreeFunction funcFree ) : m_funcFree( funcFree )
+	{
+		xnOSCreateCriticalSection( &m_hLock );
+		m_uEpoch		= 0;
+		m_aReaders[0]	= 0;
+		m_aReaders[1]	= 0;
+		m_bPending		= false;
+	}
+
+	/**
+	 * No one can read the retired objects now
+	 */
+	~EpochReclaimer()
+	{
+		FreeAll( m_vRetired );
+		FreeAll( m_vWaiting );
+		xnOSCloseCriticalSection( &m_hLock );
+	}
+
+	/**
+	 * Count the reader in the parity of current epoch, return the epoch for EndRead()
+	 */
+	unsigned int BeginRead()
+	{
+		unsigned int uEpoch = m_uEpoch.load();
+		m_aReaders[ uEpoch & 1 ].fetch_add( 1 );
+		return uEpoch;
+	}
+
+	void EndRead( unsigned int uEpoch )
+	{
+		if( m_aReaders[ uEpoch & 1 ].fetch_sub( 1 ) == 1 && m_bPending.load() )
+		{
+			xnOSEnterCriticalSection( &m_hLock );
+			Reclaim();
+			xnOSLeaveCriticalSection( &m_hLock );
+		}
+	}
+
+	/**
+	 * Free the object when no reader can see it, it must be replaced already
+	 */
+	void Retire( _T* pObject )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_vRetired.push_back( pObject );
+		Reclaim();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	/**
+	 * The number of retired objects which are not freed yet
+	 */
+	size_t GetRetiredCount()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		size_t uCount = m_vRetired.size() + m_vWaiting.size();
+		xnOSLeaveCriticalSection( &m_hLock );
+		return uCount;
+	}
+
+protected:
+	/**
+	 * Called with the lock held. If the readers of the other parity are done,
+	 * no reader started before the previous flip, so the objects retired
+	 * before it are freed, and the epoch is flipped. The reader which counts
+	 * itself after the check reads the new objects.
+	 */
+	void Reclaim()
+	{
+		unsigned int uEpoch = m_uEpoch.load();
+		if( m_aReaders[ ( uEpoch + 1 ) & 1 ].load() == 0 && !( m_vWaiting.empty() && m_vRetired.empty() ) )
+		{
+			FreeAll( m_vWaiting );
+			m_vWaiting.swap( m_vRetired );
+			m_uEpoch.store( uEpoch + 1 );
+		}
+		m_bPending = !( m_vWaiting.empty() && m_vRetired.empty() );
+	}
+
+	void FreeAll( std::vector<_T*>& vObjects )
+	{
+		for( typename std::vector<_T*>::iterator itObject = vObjects.begin(); itObject != vObjects.end(); ++ itObject )
+			m_funcFree( *itObject );
+		vObjects.clear();
+	}
+
+protected:
+	FreeFunction				m_funcFree;
+	XN_CRITICAL_SECTION_HANDLE	m_hLock;
+	std::atomic<unsigned int>	m_uEpoch;
+	std::atomic<int>			m_aReaders[2];
+	std::vector<_T*>			m_vRetired;		// replaced after the last flip of epoch
+	std::vector<_T*>			m_vWaiting;		// replaced before the last flip, freed at the next one
+	std::atomic<bool>			m_bPending;		// some objects are not freed yet
+
+private:
+	EpochReclaimer( const EpochReclaimer& );
+	void operator=( const EpochReclaimer& );
+};
+
 /**
  * This is a property pool to store any type of property
+ *
+ * Properties are stored in a flat open-addressing table, which never rehash.
+ * Each value is an immutable entry with a version; setting a property
+ * publishes a new entry, so reading only copy the data and never lock or
+ * allocate. The replaced entries are freed by an EpochReclaimer.
+ * The id of a missing property is remembered in another table of the same
+ * kind, so it's only reported to the error logger at the first time, and
+ * reading doesn't take a slot of properties; a repeated miss is a lock-free
+ * probe. After TABLE_SIZE ids are missed, the new ones are not reported.
  */
 class PropertyPool
 {
 public:
-	std::map< int,std::vector<unsigned char> >	m_Data;
+	/**
+	 * An immutable value of property
+	 */
+	struct Entry
+	{
+		int				iSize;
+		unsigned int	uVersion;
+		unsigned char	aData[1];
+	};
+
+	static const int TABLE_SIZE = 256;
 
 public:
-	PropertyPool( oni::driver::DriverServices& rService ) : m_Service( rService )
+	PropertyPool( oni::driver::DriverServices& rService ) : m_Service( rService ), m_Reclaimer( FreeEntry )
 	{
+		xnOSCreateCriticalSection( &m_hLock );
+		for( int i = 0; i < TABLE_SIZE; ++ i )
+		{
+			m_aSlot[i].iState	= SLOT_EMPTY;
+			m_aSlot[i].iKey		= 0;
+			m_aSlot[i].pEntry	= NULL;
+			m_aMissed[i].iState	= SLOT_EMPTY;
+			m_aMissed[i].iKey	= 0;
+			m_aMissed[i].pEntry	= NULL;
+		}
+	}
+
+	~PropertyPool()
+	{
+		for( int i = 0; i < TABLE_SIZE; ++ i )
+			FreeEntry( m_aSlot[i].pEntry.load() );
+		xnOSCloseCriticalSection( &m_hLock );
 	}
 
 	bool GetProperty( int propertyId, void* data, int* pDataSize )
 	{
-		auto itData = m_Data.find( propertyId );
-		if( itData == m_Data.end() )
+		bool bResult = false;
+		unsigned int uEpoch = m_Reclaimer.BeginRead();
+
+		Slot* pSlot = FindSlot( m_aSlot, propertyId, false );
+		const Entry* pEntry = ( pSlot == NULL ? NULL : pSlot->pEntry.load() );
+		if( pEntry == NULL )
 		{
-			//std::cout << "request unsaved property: " << propertyId << std::endl;
-			m_Service.errorLoggerAppend( "Required property '%d' not set.", propertyId );
-			return false;
+			// only report the property which is never required before
+			bool bNew = false;
+			FindSlot( m_aMissed, propertyId, true, &bNew );
+			if( bNew )
+				m_Service.errorLoggerAppend( "Required property '%d' not set.", propertyId );
 		}
-
-		auto vData = itData->second;
-		if( vData.size() == *pDataSize )
+		else if( pEntry->iSize == *pDataSize )
 		{
-			memcpy( data, vData.data(), vData.size() );
-			return true;
+			memcpy( data, pEntry->aData, pEntry->iSize );
+			bResult = true;
+		}
+		else
+		{
+			m_Service.errorLoggerAppend( "Required property '%d' data size not match: '%d != '%d''.", propertyId, pEntry->iSize, *pDataSize );
 		}
 
-		m_Service.errorLoggerAppend( "Required property '%d' data size not match: '%d != '%d''.", propertyId, vData.size(), *pDataSize );
-		return false;
+		m_Reclaimer.EndRead( uEpoch );
+		return bResult;
 	}
 
 	bool SetProperty( int propertyId, const void* data, int iSize )
 	{
-		auto itData = m_Data.find( propertyId );
-		std::vector<unsigned char>* pData = NULL;
-		if( itData == m_Data.end() )
+		bool bResult = false;
+		xnOSEnterCriticalSection( &m_hLock );
+
+		Slot* pSlot = FindSlot( m_aSlot, propertyId, true );
+		if( pSlot == NULL )
 		{
-			pData = &(m_Data[propertyId]);
-			pData->resize( iSize );
+			m_Service.errorLoggerAppend( "Property pool is full, can't set property '%d'", propertyId );
 		}
 		else
 		{
-			m_Service.errorLoggerAppend( "Overwrite property '%d'", propertyId );
-			pData = &(itData->second);
+			Entry* pOld = pSlot->pEntry.load( std::memory_order_relaxed );
+			if( pOld != NULL )
+				m_Service.errorLoggerAppend( "Overwrite property '%d'", propertyId );
+
+			if( pOld != NULL && pOld->iSize != iSize )
+			{
+				m_Service.errorLoggerAppend( "Required property '%d' data size not match: '%d != '%d''.", propertyId, pOld->iSize, iSize );
+			}
+			else
+			{
+				Entry* pEntry = reinterpret_cast<Entry*>( xnOSMalloc( sizeof(Entry) + iSize ) );
+				if( pEntry != NULL )
+				{
+					pEntry->iSize		= iSize;
+					pEntry->uVersion	= ( pOld == NULL ? 1 : pOld->uVersion + 1 );
+					memcpy( pEntry->aData, data, iSize );
+					pSlot->pEntry.store( pEntry );
+
+					if( pOld != NULL )
+						m_Reclaimer.Retire( pOld );
+					bResult = true;
+				}
+			}
 		}
 
-		if( pData->size() == iSize )
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bResult;
+	}
+
+	/**
+	 * The version of property, which changes when it's set; 0 if it's not set
+	 */
+	unsigned int GetVersion( int propertyId )
+	{
+		unsigned int uEpoch = m_Reclaimer.BeginRead();
+		Slot* pSlot = FindSlot( m_aSlot, propertyId, false );
+		const Entry* pEntry = ( pSlot == NULL ? NULL : pSlot->pEntry.load() );
+		unsigned int uVersion = ( pEntry == NULL ? 0 : pEntry->uVersion );
+		m_Reclaimer.EndRead( uEpoch );
+		return uVersion;
+	}
+
+	/**
+	 * Call rFunc( id, entry ) for all properties, should not be called with SetProperty() at the same time
+	 */
+	template<typename _FUNC>
+	void ForEach( _FUNC& rFunc )
+	{
+		for( int i = 0; i < TABLE_SIZE; ++ i )
 		{
-			memcpy( pData->data(), data, pData->size() );
-			return true;
+			const Entry* pEntry = m_aSlot[i].pEntry.load( std::memory_order_acquire );
+			if( pEntry != NULL )
+				rFunc( m_aSlot[i].iKey, *pEntry );
 		}
+	}
 
-		m_Service.errorLoggerAppend( "Required property '%d' data size not match: '%d != '%d''.", propertyId, pData->size(), iSize );
-		return false;
+protected:
+	enum SlotState
+	{
+		SLOT_EMPTY,
+		SLOT_CLAIMED,
+		SLOT_READY
+	};
+
+	struct Slot
+	{
+		std::atomic<int>	iState;
+		int					iKey;
+		std::atomic<Entry*>	pEntry;
+	};
+
+	/**
+	 * Find the slot of the property in aTable with linear probing, insert the
+	 * key if bInsert is true, and set pInserted if it's inserted now.
+	 * An empty slot is claimed by CAS, and the key is published before the state is ready.
+	 */
+	static Slot* FindSlot( Slot (&aTable)[TABLE_SIZE], int propertyId, bool bInsert, bool* pInserted = NULL )
+	{
+		unsigned int uHash = ( static_cast<unsigned int>( propertyId ) * 2654435761u ) >> 24;
+		for( int i = 0; i < TABLE_SIZE; ++ i )
+		{
+			Slot& rSlot = aTable[ ( uHash + i ) % TABLE_SIZE ];
+			int iState = rSlot.iState.load( std::memory_order_acquire );
+			if( iState == SLOT_EMPTY )
+			{
+				if( !bInsert )
+					return NULL;
+
+				if( rSlot.iState.compare_exchange_strong( iState, SLOT_CLAIMED ) )
+				{
+					rSlot.iKey = propertyId;
+					rSlot.iState.store( SLOT_READY, std::memory_order_release );
+					if( pInserted != NULL )
+						*pInserted = true;
+					return &rSlot;
+				}
+			}
+
+			// other thread is writing the key
+			while( iState == SLOT_CLAIMED )
+				iState = rSlot.iState.load( std::memory_order_acquire );
+
+			if( rSlot.iKey == propertyId )
+				return &rSlot;
+		}
+		return NULL;
+	}
+
+	static void FreeEntry( Entry* pEntry )
+	{
+		if( pEntry != NULL )
+			xnOSFree( pEntry );
 	}
 
 protected:
-	oni::driver::DriverServices&				m_Service;
+	oni::driver::DriverServices&	m_Service;
+	XN_CRITICAL_SECTION_HANDLE		m_hLock;
+	Slot							m_aSlot[TABLE_SIZE];
+	Slot							m_aMissed[TABLE_SIZE];	// the ids of missing properties, pEntry is not used
+	EpochReclaimer<Entry>			m_Reclaimer;
 
 private:
-	void operator=( const PropertyPool&);
+	PropertyPool( const PropertyPool& );
+	void operator=( const PropertyPool& );
 };
 
 /**
+ * Record the lifecycle events of frames, and write them as Chrome trace
+ * event JSON file, which can be viewed by chrome://tracing or Perfetto.
  *
+ * Each thread writes events into its own chunks, taken from an arena which
+ * is allocated when the tracing starts; recording only touches the state of
+ * the thread, except taking a new chunk, and never lock. The file is written
+ * when the tracing is stopped, or when the driver shutdown.
+ * It is enabled by environment variable VIRTUAL_DEVICE_TRACE=<file>, or by
+ * device property VIRTUAL_DEVICE_PROPERTY_TRACE_FILE.
  */
-class OpenNIVirtualStream : public oni::driver::StreamBase
+class FrameTracer
 {
 public:
+	enum EEvent
+	{
+		TRACE_ACQUIRE,
+		TRACE_FILL,
+		TRACE_SUBMIT,
+		TRACE_RAISE,
+		TRACE_RELEASE,
+	};
+
+protected:
+	struct SEvent
+	{
+		EEvent			eEvent;
+		int				iStream;
+		int				iFrame;
+		uint64_t		uStart;
+		uint64_t		uDuration;
+		const void*		pBuffer;
+	};
+
+	static const size_t CHUNK_EVENTS	= 1024;
+	static const size_t MAX_CHUNKS		= 256;
+
+	struct SChunk
+	{
+		SChunk*		pNext;
+		size_t		uCount;
+		SEvent		aEvents[CHUNK_EVENTS];
+	};
+
 	/**
-	 * Constructor
+	 * The events of one thread, only modified by the thread. bWriting is set
+	 * while it's recording, so Stop() can wait for it; it's kept after the
+	 * thread exit, until the tracer is destroyed.
 	 */
-	OpenNIVirtualStream( OniSensorType eSeneorType, oni::driver::DriverServices& driverServices ) : oni::driver::StreamBase(), m_rDriverServices(driverServices), m_Properties(driverServices)
+	struct SWriter
 	{
-		m_eSensorType		= eSeneorType;
-		m_bStarted			= false;
-		m_iFrameId			= 0;
+		FrameTracer*		pTracer;
+		uint64_t			uThread;
+		std::atomic<bool>	bWriting;
+		unsigned int		uSession;	// the tracing of the chunks
+		SChunk*				pFirst;
+		SChunk*				pLast;
+	};
 
-		m_bConfigDone				= false;
+public:
+	FrameTracer()
+	{
+		m_bEnabled	= false;
+		m_uSession	= 0;
+		m_uNext		= 0;
+		m_pChunks	= NULL;
+		xnOSCreateCriticalSection( &m_hLock );
+	}
 
-		// default video mode
-		m_mVideoMode.resolutionX	= 320;
-		m_mVideoMode.resolutionY	= 240;
-		m_mVideoMode.fps			= 1;
-		m_mVideoMode.pixelFormat	= ONI_PIXEL_FORMAT_DEPTH_1_MM;
+	~FrameTracer()
+	{
+		Stop();
+		for( size_t i = 0; i < m_vWriters.size(); ++ i )
+			delete m_vWriters[i];
+		delete [] m_pChunks;
+		xnOSCloseCriticalSection( &m_hLock );
+	}
 
-		// default cropping
-		m_mCropping.enabled	= false;
-		m_mCropping.width	= m_mVideoMode.resolutionX;
-		m_mCropping.height	= m_mVideoMode.resolutionY;
-		m_mCropping.originX	= 0;
-		m_mCropping.originY	= 0;
+	bool IsEnabled() const
+	{
+		return m_bEnabled.load( std::memory_order_relaxed );
 	}
 
 	/**
-	 * Start load image
+	 * Start tracing, the events will be written to sFile
 	 */
-	OniStatus start()
+	void Start( const std::string& sFile )
 	{
-		if( m_bConfigDone )
+		xnOSEnterCriticalSection( &m_hLock );
+		if( !m_bEnabled )
 		{
-			m_bStarted = true;
-			return ONI_STATUS_OK;
+			if( m_pChunks == NULL )
+				m_pChunks = new SChunk[MAX_CHUNKS];
+			m_sFile		= sFile;
+			m_uNext		= 0;
+			++m_uSession;
+			m_bEnabled	= true;
 		}
-		m_rDriverServices.errorLoggerAppend( "Please assign VideoMode before start" );
-		return ONI_STATUS_ERROR;
+		xnOSLeaveCriticalSection( &m_hLock );
 	}
 
 	/**
-	 * Stop load image
+	 * Stop tracing and write the file
 	 */
-	void stop()
+	bool Stop()
 	{
-		m_bStarted = false;
+		xnOSEnterCriticalSection( &m_hLock );
+		bool bResult = true;
+		if( m_bEnabled )
+		{
+			// the writers check m_bEnabled after they set bWriting
+			m_bEnabled = false;
+			for( size_t i = 0; i < m_vWriters.size(); ++ i )
+			{
+				while( m_vWriters[i]->bWriting.load() )
+					xnOSSleep( 0 );
+			}
+
+			bResult = WriteFile();
+			m_sFile.clear();
+		}
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bResult;
+	}
+
+	std::string GetFile()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		std::string sFile = m_sFile;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return sFile;
 	}
 
 	/**
-	 * Check if the property is supported
+	 * Get an id of stream which is used in events
 	 */
-	OniBool isPropertySupported( int )
+	int RegisterStream( const std::string& sName )
 	{
-		return true;
+		xnOSEnterCriticalSection( &m_hLock );
+		int iId = int( m_vStreams.size() );
+		m_vStreams.push_back( sName );
+		xnOSLeaveCriticalSection( &m_hLock );
+		return iId;
 	}
 
 	/**
-	 * get property
+	 * Record an event; pBuffer is the frame data, which link the acquire and
+	 * release of the same frame.
 	 */
-	OniStatus getProperty( int propertyId, void* data, int* pDataSize )
+	void Record( EEvent eEvent, int iStream, int iFrame, uint64_t uStart, uint64_t uDuration, const void* pBuffer = NULL )
 	{
-		switch( propertyId )
-		{
-		case ONI_STREAM_PROPERTY_VIDEO_MODE:
-			if( GetProperty( m_rDriverServices, *pDataSize, data, m_mVideoMode ) )
-				return ONI_STATUS_OK;
-			break;
+		if( !m_bEnabled.load( std::memory_order_relaxed ) )
+			return;
 
-		case ONI_STREAM_PROPERTY_CROPPING:
-			if( GetProperty( m_rDriverServices, *pDataSize, data, m_mCropping ) )
-				return ONI_STATUS_OK;
-			break;
+		SWriter* pWriter = s_pWriter;
+		if( pWriter == NULL || pWriter->pTracer != this )
+			pWriter = AddWriter();
 
-		case ONI_STREAM_PROPERTY_STRIDE:
+		pWriter->bWriting.store( true );
+		if( m_bEnabled.load() )
+		{
+			// the chunks of the last tracing are reused by others
+			if( pWriter->uSession != m_uSession )
 			{
-				int iStride = int(m_uStride);
-				if( GetProperty( m_rDriverServices, *pDataSize, data, iStride ) )
-					return ONI_STATUS_OK;
+				pWriter->uSession	= m_uSession;
+				pWriter->pFirst		= NULL;
+				pWriter->pLast		= NULL;
 			}
-			break;
 
-		default:
-			if( m_Properties.GetProperty( propertyId, data, pDataSize ) )
-				return ONI_STATUS_OK;
+			SChunk* pChunk = pWriter->pLast;
+			if( pChunk == NULL || pChunk->uCount == CHUNK_EVENTS )
+				pChunk = TakeChunk( pWriter );
+
+			if( pChunk != NULL )
+			{
+				SEvent& rEvent	= pChunk->aEvents[pChunk->uCount++];
+				rEvent.eEvent		= eEvent;
+				rEvent.iStream		= iStream;
+				rEvent.iFrame		= iFrame;
+				rEvent.uStart		= uStart;
+				rEvent.uDuration	= uDuration;
+				rEvent.pBuffer		= pBuffer;
+			}
 		}
-		//std::cerr << " >>> Request Stream Property: " << propertyId << std::endl;
-		return ONI_STATUS_ERROR;
+		pWriter->bWriting.store( false, std::memory_order_release );
 	}
 
+protected:
 	/**
-	 * set property
+	 * Create the writer of this thread
 	 */
-	OniStatus setProperty( int propertyId, const void* data, int dataSize )
+	SWriter* AddWriter()
 	{
-		switch( propertyId )
-		{
-		case ONI_STREAM_PROPERTY_VIDEO_MODE:
-			if( SetProperty( m_rDriverServices, dataSize, data, m_mVideoMode ) )
-			{
-				switch( m_mVideoMode.pixelFormat )
-				{
-				case ONI_PIXEL_FORMAT_RGB888:
-					m_uStride = m_mVideoMode.resolutionX * sizeof( OniRGB888Pixel );
-					break;
-
-				case ONI_PIXEL_FORMAT_DEPTH_1_MM:
-				case ONI_PIXEL_FORMAT_DEPTH_100_UM:
-					m_uStride = m_mVideoMode.resolutionX * sizeof( OniDepthPixel );
-					break;
+		XN_THREAD_ID uThread;
+		xnOSGetCurrentThreadID( &uThread );
 
-				default:
-					m_rDriverServices.errorLoggerAppend( "Unsupported pixel format: %d", m_mVideoMode.pixelFormat );
-					return ONI_STATUS_ERROR;
-				}
-				
-				m_uDataSize = m_uStride * m_mVideoMode.resolutionY;
+		SWriter* pWriter	= new SWriter();
+		pWriter->pTracer	= this;
+		pWriter->uThread	= (uint64_t)uThread;
+		pWriter->bWriting	= false;
+		pWriter->uSession	= 0;
+		pWriter->pFirst		= NULL;
+		pWriter->pLast		= NULL;
 
-				m_bConfigDone = true;
-				return ONI_STATUS_OK;
-			}
-			break;
+		xnOSEnterCriticalSection( &m_hLock );
+		m_vWriters.push_back( pWriter );
+		xnOSLeaveCriticalSection( &m_hLock );
+		s_pWriter = pWriter;
+		return pWriter;
+	}
 
-		case ONI_STREAM_PROPERTY_CROPPING:
-			if( SetProperty( m_rDriverServices, dataSize, data, m_mCropping ) )
-				return ONI_STATUS_OK;
-			break;
+	/**
+	 * Append a chunk of arena to the writer, NULL if the arena is used up
+	 */
+	SChunk* TakeChunk( SWriter* pWriter )
+	{
+		size_t uIdx = m_uNext.fetch_add( 1, std::memory_order_relaxed );
+		if( uIdx >= MAX_CHUNKS )
+			return NULL;
 
-		default:
-			if( m_Properties.SetProperty( propertyId, data, dataSize ) )
-				return ONI_STATUS_OK;
-		}
-		return ONI_STATUS_ERROR;
+		SChunk* pChunk = &m_pChunks[uIdx];
+		pChunk->pNext	= NULL;
+		pChunk->uCount	= 0;
+		if( pWriter->pLast != NULL )
+			pWriter->pLast->pNext = pChunk;
+		else
+			pWriter->pFirst = pChunk;
+		pWriter->pLast = pChunk;
+		return pChunk;
 	}
 
-	OniStatus invoke( int commandId, void* data, int dataSize )
+	bool WriteFile()
 	{
-		switch( commandId )
+		FILE* pFile = fopen( m_sFile.c_str(), "w" );
+		if( pFile == NULL )
+			return false;
+
+		static const char* aNames[] = { "acquire", "fill", "submit", "raise", "release" };
+
+		// the comma is written before each event except the first one
+		const char* szSep = "";
+		fprintf( pFile, "{\"traceEvents\":[\n" );
+		for( size_t w = 0; w < m_vWriters.size(); ++ w )
 		{
-		case GET_VIRTUAL_STREAM_IMAGE:
-			if( m_bStarted )
+			const SWriter* pWriter = m_vWriters[w];
+			if( pWriter->uSession != m_uSession )
+				continue;
+
+			unsigned long long uThread = (unsigned long long)pWriter->uThread;
+			for( const SChunk* pChunk = pWriter->pFirst; pChunk != NULL; pChunk = pChunk->pNext )
 			{
-				OniFrame** pFrame = PropertyConvert<OniFrame*>( m_rDriverServices, dataSize, data );
-				if( pFrame != NULL )
+				for( size_t i = 0; i < pChunk->uCount; ++ i )
 				{
-					*pFrame = CreateeNewFrame();
-					if( pFrame != NULL )
+					const SEvent& rEvent = pChunk->aEvents[i];
+					const char* szStream = ( rEvent.iStream >= 0 && size_t( rEvent.iStream ) < m_vStreams.size() ) ? m_vStreams[rEvent.iStream].c_str() : "";
+
+					if( rEvent.eEvent == TRACE_RELEASE )
 					{
-						(*pFrame)->croppingEnabled = m_mCropping.enabled;
-						if (m_mCropping.enabled)
-						{
-							(*pFrame)->cropOriginX = m_mCropping.originX;
-							(*pFrame)->cropOriginY = m_mCropping.originY;
-							(*pFrame)->height = m_mCropping.height;
-							(*pFrame)->width = m_mCropping.width;
-						}
-						
-						return ONI_STATUS_OK;
+						// end of the async span begun by TRACE_ACQUIRE
+						fprintf( pFile, "%s{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"e\",\"id\":\"%p\",\"ts\":%llu,\"pid\":1,\"tid\":%llu}\n",
+							szSep, rEvent.pBuffer, (unsigned long long)rEvent.uStart, uThread );
+						szSep = ",";
+						continue;
 					}
+
+					// TRACE_ACQUIRE begins the async span, and has the duration event too
+					if( rEvent.eEvent == TRACE_ACQUIRE )
+					{
+						fprintf( pFile, "%s{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"b\",\"id\":\"%p\",\"ts\":%llu,\"pid\":1,\"tid\":%llu,\"args\":{\"stream\":\"%s\",\"frame\":%d}}\n",
+							szSep, rEvent.pBuffer, (unsigned long long)rEvent.uStart, uThread, szStream, rEvent.iFrame );
+						szSep = ",";
+					}
+					fprintf( pFile, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%llu,\"args\":{\"frame\":%d}}\n",
+						szSep, aNames[rEvent.eEvent], szStream, (unsigned long long)rEvent.uStart, (unsigned long long)rEvent.uDuration, uThread, rEvent.iFrame );
+					szSep = ",";
 				}
 			}
-			else
-			{
-				return ONI_STATUS_ERROR;
-			}
-			break;
+		}
+		fprintf( pFile, "],\"displayTimeUnit\":\"ms\"}\n" );
+		fclose( pFile );
+		return true;
+	}
 
-		case SET_VIRTUAL_STREAM_IMAGE:
-			if( m_bStarted )
-			{
-				OniFrame** pFrame = PropertyConvert<OniFrame*>( m_rDriverServices, dataSize, data );
-				if( pFrame != NULL )
+protected:
+	std::atomic<bool>			m_bEnabled;
+	unsigned int				m_uSession;		// changed by Start() only
+	std::atomic<size_t>			m_uNext;		// the next chunk of arena
+	SChunk*						m_pChunks;
+	std::vector<SWriter*>		m_vWriters;
+	std::string					m_sFile;
+	std::vector<std::string>	m_vStreams;
+	XN_CRITICAL_SECTION_HANDLE	m_hLock;
+
+	static VIRTUAL_DEVICE_THREAD_LOCAL SWriter*	s_pWriter;
+
+private:
+	FrameTracer( const FrameTracer& );
+	void operator=( const FrameTracer& );
+};
+
+VIRTUAL_DEVICE_THREAD_LOCAL FrameTracer::SWriter* FrameTracer::s_pWriter = NULL;
+FrameTracer	g_FrameTracer;
+
+/**
+ * Frame buffer allocator of the virtual stream, which should be set to
+ * OpenNI by oniStreamSetFrameBuffersAllocator().
+ *
+ * It keeps a fixed-size pool of 64-byte aligned buffers, which are given back
+ * to the pool when OpenNI release the last reference of the frame.
+ * It also allows to use the buffer of caller as frame data directly, and tell
+ * the caller when the last reference of the frame is released.
+ * It is reference counted, because the frames may be released after the
+ * stream is destroyed.
+ */
+class FrameBufferAllocator
+{
+protected:
+	struct SExternalBuffer
+	{
+		VirtualFrameReleaseCallback	funcRelease;
+		void*						pCookie;
+	};
+
+	// stored before the data of every buffer allocated here
+	struct SBufferHeader
+	{
+		unsigned int	uGeneration;
+		size_t			uSize;
+	};
+
+	// alignment of data, and the size reserved for SBufferHeader
+	static const size_t BUFFER_ALIGNMENT = 64;
+
+public:
+	FrameBufferAllocator()
+	{
+		m_iRefCount		= 1;
+		m_pPending		= NULL;
+		m_uGeneration	= 0;
+		m_uBufferSize	= 0;
+		m_uPoolSize		= 4;
+		m_uHits			= 0;
+		m_uMisses		= 0;
+		xnOSCreateCriticalSection( &m_hLock );
+	}
+
+	void Release()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		bool bDelete = ( --m_iRefCount == 0 );
+		xnOSLeaveCriticalSection( &m_hLock );
+
+		if( bDelete )
+			delete this;
+	}
+
+	/**
+	 * Drop all pooled buffers, and pre-allocate new ones with given size.
+	 * Buffers still used by frames are freed when they are released.
+	 */
+	void ResetPool( size_t uBufferSize )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		++m_uGeneration;
+		ClearPool();
+		m_uBufferSize = uBufferSize;
+		FillPool();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	/**
+	 * Set the number of buffers kept in pool
+	 */
+	void SetPoolSize( size_t uPoolSize )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_uPoolSize = uPoolSize;
+		while( m_vPool.size() > m_uPoolSize )
+		{
+			FreeBuffer( m_vPool.back() );
+			m_vPool.pop_back();
+		}
+		FillPool();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	size_t GetPoolSize() const
+	{
+		return m_uPoolSize;
+	}
+
+	VirtualFramePoolStats GetStats()
+	{
+		VirtualFramePoolStats mStats;
+		xnOSEnterCriticalSection( &m_hLock );
+		mStats.uHits		= m_uHits;
+		mStats.uMisses		= m_uMisses;
+		mStats.iPoolSize	= int( m_uPoolSize );
+		mStats.iFreeBuffers	= int( m_vPool.size() );
+		xnOSLeaveCriticalSection( &m_hLock );
+		return mStats;
+	}
+
+	/**
+	 * Start to use external buffer, the next buffer allocation of this thread
+	 * will return pData. Must be paired with EndExternal().
+	 */
+	void BeginExternal( const VirtualExternalFrame& rFrame )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_pPending = &rFrame;
+	}
+
+	/**
+	 * Finish BeginExternal(), return if the buffer is used.
+	 */
+	bool EndExternal()
+	{
+		bool bUsed = ( m_pPending == NULL );
+		m_pPending = NULL;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bUsed;
+	}
+
+	static void* ONI_CALLBACK_TYPE Allocate( int iSize, void* pCookie )
+	{
+		return reinterpret_cast<FrameBufferAllocator*>( pCookie )->DoAllocate( iSize );
+	}
+
+	static void ONI_CALLBACK_TYPE Free( void* pData, void* pCookie )
+	{
+		reinterpret_cast<FrameBufferAllocator*>( pCookie )->DoFree( pData );
+	}
+
+protected:
+	~FrameBufferAllocator()
+	{
+		ClearPool();
+		xnOSCloseCriticalSection( &m_hLock );
+	}
+
+	void* DoAllocate( int iSize )
+	{
+		void* pData = NULL;
+
+		xnOSEnterCriticalSection( &m_hLock );
+		if( m_pPending != NULL )
+		{
+			// the lock is held by BeginExternal() of this thread
+			SExternalBuffer& rBuffer = m_mExternal[m_pPending->pData];
+			rBuffer.funcRelease	= m_pPending->funcRelease;
+			rBuffer.pCookie		= m_pPending->pCookie;
+			pData		= m_pPending->pData;
+			m_pPending	= NULL;
+		}
+		else if( size_t( iSize ) <= m_uBufferSize && !m_vPool.empty() )
+		{
+			++m_uHits;
+			pData = m_vPool.back();
+			m_vPool.pop_back();
+		}
+		else
+		{
+			++m_uMisses;
+			pData = AllocateBuffer( size_t( iSize ) > m_uBufferSize ? size_t( iSize ) : m_uBufferSize );
+		}
+
+		if( pData != NULL )
+			++m_iRefCount;
+		xnOSLeaveCriticalSection( &m_hLock );
+
+		return pData;
+	}
+
+	void DoFree( void* pData )
+	{
+		if( g_FrameTracer.IsEnabled() )
+			g_FrameTracer.Record( FrameTracer::TRACE_RELEASE, -1, 0, GetHostTimestamp(), 0, pData );
+
+		bool			bExternal = false;
+		SExternalBuffer	mExternal;
+
+		xnOSEnterCriticalSection( &m_hLock );
+		auto itBuffer = m_mExternal.find( pData );
+		if( itBuffer != m_mExternal.end() )
+		{
+			bExternal = true;
+			mExternal = itBuffer->second;
+			m_mExternal.erase( itBuffer );
+		}
+		else
+		{
+			// give the buffer back to pool if it is still usable
+			const SBufferHeader* pHeader = GetHeader( pData );
+			if( pHeader->uGeneration == m_uGeneration && pHeader->uSize == m_uBufferSize && m_vPool.size() < m_uPoolSize )
+				m_vPool.push_back( pData );
+			else
+				FreeBuffer( pData );
+		}
+		xnOSLeaveCriticalSection( &m_hLock );
+
+		// give the buffer back to the caller
+		if( bExternal && mExternal.funcRelease != NULL )
+			mExternal.funcRelease( pData, mExternal.pCookie );
+
+		Release();
+	}
+
+	void* AllocateBuffer( size_t uSize )
+	{
+		unsigned char* pBuffer = reinterpret_cast<unsigned char*>( xnOSMallocAligned( uSize + BUFFER_ALIGNMENT, BUFFER_ALIGNMENT ) );
+		if( pBuffer == NULL )
+			return NULL;
+
+		SBufferHeader* pHeader = reinterpret_cast<SBufferHeader*>( pBuffer );
+		pHeader->uGeneration	= m_uGeneration;
+		pHeader->uSize			= uSize;
+		return pBuffer + BUFFER_ALIGNMENT;
+	}
+
+	void FreeBuffer( void* pData )
+	{
+		xnOSFreeAligned( GetHeader( pData ) );
+	}
+
+	SBufferHeader* GetHeader( void* pData )
+	{
+		return reinterpret_cast<SBufferHeader*>( reinterpret_cast<unsigned char*>( pData ) - BUFFER_ALIGNMENT );
+	}
+
+	void FillPool()
+	{
+		if( m_uBufferSize == 0 )
+			return;
+
+		while( m_vPool.size() < m_uPoolSize )
+		{
+			void* pData = AllocateBuffer( m_uBufferSize );
+			if( pData == NULL )
+				break;
+
+			// touch the pages now, instead of on the first frame
+			memset( pData, 0, m_uBufferSize );
+			m_vPool.push_back( pData );
+		}
+	}
+
+	void ClearPool()
+	{
+		for( auto itBuffer = m_vPool.begin(); itBuffer != m_vPool.end(); ++ itBuffer )
+			FreeBuffer( *itBuffer );
+		m_vPool.clear();
+	}
+
+protected:
+	int								m_iRefCount;
+	XN_CRITICAL_SECTION_HANDLE		m_hLock;
+	const VirtualExternalFrame*		m_pPending;
+	std::map<void*,SExternalBuffer>	m_mExternal;
+
+	unsigned int					m_uGeneration;
+	size_t							m_uBufferSize;
+	size_t							m_uPoolSize;
+	std::vector<void*>				m_vPool;
+	unsigned long long				m_uHits;
+	unsigned long long				m_uMisses;
+
+private:
+	FrameBufferAllocator( const FrameBufferAllocator& );
+	void operator=( const FrameBufferAllocator& );
+};
+
+/**
+ * Performance counters of a stream.
+ *
+ * All the counters are atomic and only updated with relaxed operations, so
+ * reading them doesn't block the frame flow. The time of GET / SET is kept
+ * in small rings indexed by frame index, to measure the hold time and the
+ * latency without any per-frame allocation.
+ */
+class StreamStatistics
+{
+public:
+	StreamStatistics()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		m_uAcquired		= 0;
+		m_uSubmitted	= 0;
+		m_uRejected		= 0;
+		m_uDropped		= 0;
+		m_uRaised		= 0;
+		m_uRepeated		= 0;
+		m_uHoldTotal	= 0;
+		m_uHoldMax		= 0;
+		m_uLatencyTotal	= 0;
+		m_uLatencyMax	= 0;
+		m_uJitter		= 0;
+		m_uLastSubmit	= 0;
+		m_uLastInterval	= 0;
+		m_uFiltered		= 0;
+		for( int i = 0; i < VIRTUAL_LATENCY_BUCKETS; ++ i )
+			m_aLatency[i] = 0;
+		for( int i = 0; i < VIRTUAL_DEPTH_FILTER_NUM; ++ i )
+			m_aFilterTotal[i] = m_aFilterMax[i] = 0;
+		for( int i = 0; i < TIME_RING_SIZE; ++ i )
+			m_aAcquireTime[i] = m_aSubmitTime[i] = 0;
+	}
+
+	void OnAcquire( int iFrameIndex )
+	{
+		Add( m_uAcquired );
+		m_aAcquireTime[ unsigned( iFrameIndex ) % TIME_RING_SIZE ].store( GetHostTimestamp(), std::memory_order_relaxed );
+	}
+
+	/**
+	 * Record the SET of frame, return current time
+	 */
+	uint64_t OnSubmit( int iFrameIndex )
+	{
+		uint64_t uNow = GetHostTimestamp();
+		Add( m_uSubmitted );
+		m_aSubmitTime[ unsigned( iFrameIndex ) % TIME_RING_SIZE ].store( uNow, std::memory_order_relaxed );
+
+		uint64_t uAcquire = m_aAcquireTime[ unsigned( iFrameIndex ) % TIME_RING_SIZE ].load( std::memory_order_relaxed );
+		if( uAcquire != 0 && uAcquire <= uNow )
+		{
+			Add( m_uHoldTotal, uNow - uAcquire );
+			UpdateMax( m_uHoldMax, uNow - uAcquire );
+		}
+
+		// smoothed jitter of inter-arrival time, as RFC 3550
+		uint64_t uLast = m_uLastSubmit.exchange( uNow, std::memory_order_relaxed );
+		if( uLast != 0 )
+		{
+			int64_t iInterval	= int64_t( uNow - uLast );
+			int64_t iLast		= int64_t( m_uLastInterval.exchange( uint64_t( iInterval ), std::memory_order_relaxed ) );
+			if( iLast != 0 )
+			{
+				int64_t iDiff	= iInterval > iLast ? iInterval - iLast : iLast - iInterval;
+				int64_t iJitter	= int64_t( m_uJitter.load( std::memory_order_relaxed ) );
+				m_uJitter.store( uint64_t( iJitter + ( iDiff - iJitter ) / 16 ), std::memory_order_relaxed );
+			}
+		}
+		return uNow;
+	}
+
+	/**
+	 * Move the recorded times of frame when its index is changed
+	 */
+	void MoveFrame( int iFrameIndex, int iNewIndex )
+	{
+		unsigned uOld = unsigned( iFrameIndex ) % TIME_RING_SIZE, uNew = unsigned( iNewIndex ) % TIME_RING_SIZE;
+		m_aAcquireTime[uNew].store( m_aAcquireTime[uOld].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+		m_aSubmitTime[uNew].store( m_aSubmitTime[uOld].load( std::memory_order_relaxed ), std::memory_order_relaxed );
+	}
+
+	uint64_t GetAcquireTime( int iFrameIndex ) const
+	{
+		return m_aAcquireTime[ unsigned( iFrameIndex ) % TIME_RING_SIZE ].load( std::memory_order_relaxed );
+	}
+
+	void OnReject()
+	{
+		Add( m_uRejected );
+	}
+
+	void OnDrop()
+	{
+		Add( m_uDropped );
+	}
+
+	/**
+	 * Record the frame copied from the last one, latency is counted from now
+	 */
+	void OnRepeat( int iFrameIndex )
+	{
+		Add( m_uRepeated );
+		m_aSubmitTime[ unsigned( iFrameIndex ) % TIME_RING_SIZE ].store( GetHostTimestamp(), std::memory_order_relaxed );
+	}
+
+	/**
+	 * Record the raise of frame, return current time
+	 */
+	uint64_t OnRaise( int iFrameIndex )
+	{
+		uint64_t uNow = GetHostTimestamp();
+		Add( m_uRaised );
+
+		uint64_t uSubmit = m_aSubmitTime[ unsigned( iFrameIndex ) % TIME_RING_SIZE ].load( std::memory_order_relaxed );
+		if( uSubmit != 0 && uSubmit <= uNow )
+		{
+			uint64_t uLatency = uNow - uSubmit;
+			Add( m_uLatencyTotal, uLatency );
+			UpdateMax( m_uLatencyMax, uLatency );
+
+			int iBucket = 0;
+			while( iBucket < VIRTUAL_LATENCY_BUCKETS - 1 && ( uint64_t(1) << iBucket ) <= uLatency )
+				++iBucket;
+			Add( m_aLatency[iBucket] );
+		}
+		return uNow;
+	}
+
+	/**
+	 * Record the time of each depth filter of a frame
+	 */
+	void OnFilter( const uint64_t aTime[VIRTUAL_DEPTH_FILTER_NUM] )
+	{
+		Add( m_uFiltered );
+		for( int i = 0; i < VIRTUAL_DEPTH_FILTER_NUM; ++ i )
+		{
+			Add( m_aFilterTotal[i], aTime[i] );
+			UpdateMax( m_aFilterMax[i], aTime[i] );
+		}
+	}
+
+	void Get( VirtualStreamStatistics& rStats ) const
+	{
+		rStats.uAcquired		= m_uAcquired.load( std::memory_order_relaxed );
+		rStats.uSubmitted		= m_uSubmitted.load( std::memory_order_relaxed );
+		rStats.uRejected		= m_uRejected.load( std::memory_order_relaxed );
+		rStats.uDropped			= m_uDropped.load( std::memory_order_relaxed );
+		rStats.uRaised			= m_uRaised.load( std::memory_order_relaxed );
+		rStats.uRepeated		= m_uRepeated.load( std::memory_order_relaxed );
+		rStats.uHoldTimeTotal	= m_uHoldTotal.load( std::memory_order_relaxed );
+		rStats.uHoldTimeMax		= m_uHoldMax.load( std::memory_order_relaxed );
+		rStats.uLatencyTotal	= m_uLatencyTotal.load( std::memory_order_relaxed );
+		rStats.uLatencyMax		= m_uLatencyMax.load( std::memory_order_relaxed );
+		rStats.uJitter			= m_uJitter.load( std::memory_order_relaxed );
+		for( int i = 0; i < VIRTUAL_LATENCY_BUCKETS; ++ i )
+			rStats.aLatencyHistogram[i] = m_aLatency[i].load( std::memory_order_relaxed );
+		rStats.uFiltered		= m_uFiltered.load( std::memory_order_relaxed );
+		for( int i = 0; i < VIRTUAL_DEPTH_FILTER_NUM; ++ i )
+		{
+			rStats.aFilterTimeTotal[i]	= m_aFilterTotal[i].load( std::memory_order_relaxed );
+			rStats.aFilterTimeMax[i]	= m_aFilterMax[i].load( std::memory_order_relaxed );
+		}
+	}
+
+	/**
+	 * Add the statistics of another stream, used by device
+	 */
+	static void Accumulate( VirtualStreamStatistics& rTotal, const VirtualStreamStatistics& rStats )
+	{
+		rTotal.uAcquired		+= rStats.uAcquired;
+		rTotal.uSubmitted		+= rStats.uSubmitted;
+		rTotal.uRejected		+= rStats.uRejected;
+		rTotal.uDropped			+= rStats.uDropped;
+		rTotal.uRaised			+= rStats.uRaised;
+		rTotal.uRepeated		+= rStats.uRepeated;
+		rTotal.uHoldTimeTotal	+= rStats.uHoldTimeTotal;
+		rTotal.uLatencyTotal	+= rStats.uLatencyTotal;
+		if( rStats.uHoldTimeMax > rTotal.uHoldTimeMax )
+			rTotal.uHoldTimeMax = rStats.uHoldTimeMax;
+		if( rStats.uLatencyMax > rTotal.uLatencyMax )
+			rTotal.uLatencyMax = rStats.uLatencyMax;
+		if( rStats.uJitter > rTotal.uJitter )
+			rTotal.uJitter = rStats.uJitter;
+		for( int i = 0; i < VIRTUAL_LATENCY_BUCKETS; ++ i )
+			rTotal.aLatencyHistogram[i] += rStats.aLatencyHistogram[i];
+		rTotal.uFiltered		+= rStats.uFiltered;
+		for( int i = 0; i < VIRTUAL_DEPTH_FILTER_NUM; ++ i )
+		{
+			rTotal.aFilterTimeTotal[i] += rStats.aFilterTimeTotal[i];
+			if( rStats.aFilterTimeMax[i] > rTotal.aFilterTimeMax[i] )
+				rTotal.aFilterTimeMax[i] = rStats.aFilterTimeMax[i];
+		}
+	}
+
+protected:
+	static void Add( std::atomic<uint64_t>& rCounter, uint64_t uValue = 1 )
+	{
+		rCounter.fetch_add( uValue, std::memory_order_relaxed );
+	}
+
+	static void UpdateMax( std::atomic<uint64_t>& rMax, uint64_t uValue )
+	{
+		uint64_t uMax = rMax.load( std::memory_order_relaxed );
+		while( uValue > uMax && !rMax.compare_exchange_weak( uMax, uValue, std::memory_order_relaxed ) );
+	}
+
+protected:
+	static const int TIME_RING_SIZE = 64;
+
+	std::atomic<uint64_t>	m_uAcquired;
+	std::atomic<uint64_t>	m_uSubmitted;
+	std::atomic<uint64_t>	m_uRejected;
+	std::atomic<uint64_t>	m_uDropped;
+	std::atomic<uint64_t>	m_uRaised;
+	std::atomic<uint64_t>	m_uRepeated;
+	std::atomic<uint64_t>	m_uHoldTotal;
+	std::atomic<uint64_t>	m_uHoldMax;
+	std::atomic<uint64_t>	m_uLatencyTotal;
+	std::atomic<uint64_t>	m_uLatencyMax;
+	std::atomic<uint64_t>	m_uJitter;
+	std::atomic<uint64_t>	m_uLastSubmit;
+	std::atomic<uint64_t>	m_uLastInterval;
+	std::atomic<uint64_t>	m_aLatency[VIRTUAL_LATENCY_BUCKETS];
+	std::atomic<uint64_t>	m_uFiltered;
+	std::atomic<uint64_t>	m_aFilterTotal[VIRTUAL_DEPTH_FILTER_NUM];
+	std::atomic<uint64_t>	m_aFilterMax[VIRTUAL_DEPTH_FILTER_NUM];
+	std::atomic<uint64_t>	m_aAcquireTime[TIME_RING_SIZE];
+	std::atomic<uint64_t>	m_aSubmitTime[TIME_RING_SIZE];
+
+private:
+	StreamStatistics( const StreamStatistics& );
+	void operator=( const StreamStatistics& );
+};
+
+/**
+ * Dispatch frames of a stream in a dedicated thread.
+ *
+ * The producer push frames into a lock-free single-producer / single-consumer
+ * ring and returns immediately; the dispatcher thread send them to OpenNI,
+ * so slow listeners don't block the producer.
+ * When the ring is full, the drop policy decides which frame is dropped, or
+ * let the producer wait for a while.
+ */
+class FrameDispatcher
+{
+public:
+	/**
+	 * The object which receives frames from dispatcher thread
+	 */
+	class Target
+	{
+	public:
+		virtual void DispatchFrame( OniFrame* pFrame ) = 0;
+		virtual void DropFrame( OniFrame* pFrame ) = 0;
+	};
+
+public:
+	FrameDispatcher( Target& rTarget ) : m_rTarget( rTarget )
+	{
+		m_hThread		= NULL;
+		m_hNewFrame		= NULL;
+		m_hFreeSlot		= NULL;
+		m_bRunning		= false;
+		m_iPushing		= 0;
+		m_uAffinity		= 0;
+		m_ePolicy		= VIRTUAL_DROP_NEWEST;
+		m_uBlockTimeout	= 33;
+
+		m_pRing			= NULL;
+		m_uDepth		= 0;
+		m_uHead			= 0;
+		m_uTail			= 0;
+		SetQueueDepth( 4 );
+		ResetStats();
+	}
+
+	~FrameDispatcher()
+	{
+		Stop();
+		delete [] m_pRing;
+	}
+
+	/**
+	 * Set the capacity of queue, only valid when the thread is not running
+	 */
+	bool SetQueueDepth( size_t uDepth )
+	{
+		if( IsRunning() || uDepth == 0 )
+			return false;
+
+		delete [] m_pRing;
+		m_pRing		= new std::atomic<OniFrame*>[uDepth];
+		m_uDepth	= uDepth;
+		m_uHead		= 0;
+		m_uTail		= 0;
+		return true;
+	}
+
+	size_t GetQueueDepth() const
+	{
+		return m_uDepth;
+	}
+
+	/**
+	 * Set the CPU affinity mask of the dispatcher thread, 0 means no limitation
+	 */
+	void SetAffinity( uint64_t uMask )
+	{
+		m_uAffinity = uMask;
+		if( m_hNewFrame != NULL )
+			xnOSSetEvent( m_hNewFrame );
+	}
+
+	uint64_t GetAffinity() const
+	{
+		return m_uAffinity;
+	}
+
+	/**
+	 * Set what to do when the queue is full; for VIRTUAL_DROP_BLOCK, the
+	 * producer waits at most uTimeout ms, then the new frame is dropped.
+	 */
+	void SetDropPolicy( VirtualDropPolicy ePolicy, unsigned int uTimeout )
+	{
+		m_ePolicy		= ePolicy;
+		m_uBlockTimeout	= uTimeout;
+	}
+
+	VirtualDropPolicy GetDropPolicy() const
+	{
+		return m_ePolicy;
+	}
+
+	unsigned int GetBlockTimeout() const
+	{
+		return m_uBlockTimeout;
+	}
+
+	VirtualDispatchStats GetStats() const
+	{
+		VirtualDispatchStats mStats;
+		mStats.uQueued			= m_uQueued.load( std::memory_order_relaxed );
+		mStats.uDropped			= m_uDropped.load( std::memory_order_relaxed );
+		mStats.uBlockedTime		= m_uBlockedTime.load( std::memory_order_relaxed );
+		mStats.iMaxOccupancy	= int( m_uMaxOccupancy.load( std::memory_order_relaxed ) );
+		mStats.iOccupancy		= int( m_uHead.load( std::memory_order_relaxed ) - m_uTail.load( std::memory_order_relaxed ) );
+		return mStats;
+	}
+
+	void ResetStats()
+	{
+		m_uQueued		= 0;
+		m_uDropped		= 0;
+		m_uBlockedTime	= 0;
+		m_uMaxOccupancy	= 0;
+	}
+
+	bool IsRunning() const
+	{
+		return m_hThread != NULL;
+	}
+
+	bool Start()
+	{
+		if( IsRunning() )
+			return true;
+
+		if( xnOSCreateEvent( &m_hNewFrame, FALSE ) != XN_STATUS_OK )
+			return false;
+
+		if( xnOSCreateEvent( &m_hFreeSlot, FALSE ) != XN_STATUS_OK )
+		{
+			xnOSCloseEvent( &m_hNewFrame );
+			m_hNewFrame	= NULL;
+			return false;
+		}
+
+		m_bRunning = true;
+		if( xnOSCreateThread( ThreadProc, this, &m_hThread ) != XN_STATUS_OK )
+		{
+			m_hThread	= NULL;
+			m_bRunning	= false;
+			CloseEvents();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * Stop the thread, the frames not dispatched yet are dropped.
+	 * It waits for the producer in Push(), so the events are not closed
+	 * while they are used, and only this thread drains the queue.
+	 */
+	void Stop()
+	{
+		if( !IsRunning() )
+			return;
+
+		// Push() checks m_bRunning after it's counted in m_iPushing, so no
+		// new push starts after the count is 0; wake up the blocked one
+		m_bRunning = false;
+		while( m_iPushing.load() != 0 )
+		{
+			xnOSSetEvent( m_hFreeSlot );
+			xnOSSleep( 1 );
+		}
+
+		xnOSSetEvent( m_hNewFrame );
+		xnOSWaitForThreadExit( m_hThread, XN_WAIT_INFINITE );
+		xnOSCloseThread( &m_hThread );
+		m_hThread = NULL;
+		CloseEvents();
+
+		OniFrame* pFrame;
+		while( ( pFrame = Pop() ) != NULL )
+			m_rTarget.DropFrame( pFrame );
+	}
+
+	/**
+	 * Queue the frame, called by the producer thread only. The frame is
+	 * owned by dispatcher after this call, except when false is returned
+	 * because the dispatcher is stopped.
+	 */
+	bool Push( OniFrame* pFrame )
+	{
+		// sequentially consistent with Stop(): either it sees this push, or
+		// this push sees it's stopped
+		m_iPushing.fetch_add( 1 );
+		bool bRunning = m_bRunning.load();
+		if( bRunning )
+			PushFrame( pFrame );
+		m_iPushing.fetch_sub( 1, std::memory_order_release );
+		return bRunning;
+	}
+
+protected:
+	/**
+	 * Queue the frame or drop it by the policy, counted in m_iPushing
+	 */
+	void PushFrame( OniFrame* pFrame )
+	{
+		uint64_t uHead = m_uHead.load( std::memory_order_relaxed );
+		if( uHead - m_uTail.load( std::memory_order_acquire ) >= m_uDepth && !MakeFreeSlot( uHead ) )
+		{
+			++m_uDropped;
+			m_rTarget.DropFrame( pFrame );
+			return;
+		}
+
+		m_pRing[ uHead % m_uDepth ].store( pFrame, std::memory_order_relaxed );
+		m_uHead.store( uHead + 1, std::memory_order_release );
+		xnOSSetEvent( m_hNewFrame );
+
+		// only the producer write these
+		++m_uQueued;
+		uint64_t uOccupancy = uHead + 1 - m_uTail.load( std::memory_order_relaxed );
+		if( uOccupancy > m_uMaxOccupancy.load( std::memory_order_relaxed ) )
+			m_uMaxOccupancy.store( uOccupancy, std::memory_order_relaxed );
+	}
+
+	/**
+	 * Make space in the full queue by the drop policy, return false if the
+	 * new frame should be dropped.
+	 */
+	bool MakeFreeSlot( uint64_t uHead )
+	{
+		switch( m_ePolicy )
+		{
+		case VIRTUAL_DROP_OLDEST:
+			{
+				// nothing is dropped if the dispatcher thread takes one first
+				OniFrame* pOldest = PopIfFull( uHead );
+				if( pOldest != NULL )
+				{
+					++m_uDropped;
+					m_rTarget.DropFrame( pOldest );
+				}
+			}
+			return true;
+
+		case VIRTUAL_DROP_BLOCK:
+			{
+				XnUInt64 uStart, uNow;
+				xnOSGetHighResTimeStamp( &uStart );
+				uNow = uStart;
+
+				bool bFree = false;
+				XnUInt64 uTimeout = XnUInt64( m_uBlockTimeout ) * 1000;
+				while( m_bRunning && uNow - uStart < uTimeout )
+				{
+					xnOSWaitEvent( m_hFreeSlot, XnUInt32( ( uTimeout - ( uNow - uStart ) + 999 ) / 1000 ) );
+					if( uHead - m_uTail.load( std::memory_order_acquire ) < m_uDepth )
+					{
+						bFree = true;
+						break;
+					}
+					xnOSGetHighResTimeStamp( &uNow );
+				}
+
+				xnOSGetHighResTimeStamp( &uNow );
+				m_uBlockedTime += uNow - uStart;
+				return bFree;
+			}
+
+		case VIRTUAL_DROP_NEWEST:
+		default:
+			return false;
+		}
+	}
+
+	/**
+	 * Get the oldest frame; the producer may also call this to drop frame,
+	 * so the tail is moved with CAS.
+	 */
+	OniFrame* Pop()
+	{
+		uint64_t uTail = m_uTail.load( std::memory_order_acquire );
+		while( uTail != m_uHead.load( std::memory_order_acquire ) )
+		{
+			OniFrame* pFrame = m_pRing[ uTail % m_uDepth ].load( std::memory_order_relaxed );
+			if( m_uTail.compare_exchange_weak( uTail, uTail + 1, std::memory_order_acq_rel ) )
+				return pFrame;
+		}
+		return NULL;
+	}
+
+	/**
+	 * Get the oldest frame only if the queue is still full, for the
+	 * producer; uHead is the head of producer
+	 */
+	OniFrame* PopIfFull( uint64_t uHead )
+	{
+		uint64_t uTail = m_uTail.load( std::memory_order_acquire );
+		while( uHead - uTail >= m_uDepth )
+		{
+			OniFrame* pFrame = m_pRing[ uTail % m_uDepth ].load( std::memory_order_relaxed );
+			if( m_uTail.compare_exchange_weak( uTail, uTail + 1, std::memory_order_acq_rel ) )
+				return pFrame;
+		}
+		return NULL;
+	}
+
+	void Run()
+	{
+		uint64_t uAffinity = 0;
+		while( m_bRunning )
+		{
+			xnOSWaitEvent( m_hNewFrame, XN_WAIT_INFINITE );
+
+			if( uAffinity != m_uAffinity )
+			{
+				uAffinity = m_uAffinity;
+				SetCurrentThreadAffinity( uAffinity );
+			}
+
+			OniFrame* pFrame;
+			while( m_bRunning && ( pFrame = Pop() ) != NULL )
+			{
+				if( m_ePolicy == VIRTUAL_DROP_BLOCK )
+					xnOSSetEvent( m_hFreeSlot );
+				m_rTarget.DispatchFrame( pFrame );
+			}
+		}
+
+		// wake up the blocked producer
+		xnOSSetEvent( m_hFreeSlot );
+	}
+
+	void CloseEvents()
+	{
+		xnOSCloseEvent( &m_hNewFrame );
+		xnOSCloseEvent( &m_hFreeSlot );
+		m_hNewFrame = NULL;
+		m_hFreeSlot = NULL;
+	}
+
+	static XN_THREAD_PROC ThreadProc( XN_THREAD_PARAM pThreadParam )
+	{
+		reinterpret_cast<FrameDispatcher*>( pThreadParam )->Run();
+		XN_THREAD_PROC_RETURN( XN_STATUS_OK );
+	}
+
+protected:
+	Target&							m_rTarget;
+	XN_THREAD_HANDLE				m_hThread;
+	XN_EVENT_HANDLE					m_hNewFrame;
+	XN_EVENT_HANDLE					m_hFreeSlot;
+	std::atomic<bool>				m_bRunning;
+	std::atomic<int>				m_iPushing;			// the producer in Push(), Stop() waits for it
+	std::atomic<uint64_t>			m_uAffinity;
+	std::atomic<VirtualDropPolicy>	m_ePolicy;
+	std::atomic<unsigned int>		m_uBlockTimeout;
+
+	std::atomic<OniFrame*>*			m_pRing;
+	size_t							m_uDepth;
+	std::atomic<uint64_t>			m_uHead;
+	std::atomic<uint64_t>			m_uTail;
+
+	std::atomic<uint64_t>			m_uQueued;
+	std::atomic<uint64_t>			m_uDropped;
+	std::atomic<uint64_t>			m_uBlockedTime;
+	std::atomic<uint64_t>			m_uMaxOccupancy;
+
+private:
+	FrameDispatcher( const FrameDispatcher& );
+	void operator=( const FrameDispatcher& );
+};
+
+/**
+ * Timer thread to emit frames at a fixed rate.
+ *
+ * The deadlines are counted from the start time, so the error of each wait
+ * doesn't accumulate. If the target is later than a whole period, the missed
+ * ticks are skipped instead of sent in a burst.
+ */
+class FramePacer
+{
+public:
+	/**
+	 * The object which is called by the timer thread
+	 */
+	class Target
+	{
+	public:
+		virtual void OnTick( uint64_t uDeadline ) = 0;
+	};
+
+public:
+	FramePacer( Target& rTarget ) : m_rTarget( rTarget )
+	{
+		m_hThread	= NULL;
+		m_hWakeUp	= NULL;
+		m_bRunning	= false;
+		m_uPeriod	= 1000000;
+	}
+
+	~FramePacer()
+	{
+		Stop();
+	}
+
+	/**
+	 * Set the rate, can be changed when the thread is running
+	 */
+	void SetFPS( int iFPS )
+	{
+		m_uPeriod = ( iFPS > 0 ? 1000000 / iFPS : 1000000 );
+		if( m_hWakeUp != NULL )
+			xnOSSetEvent( m_hWakeUp );
+	}
+
+	uint64_t GetPeriod() const
+	{
+		return m_uPeriod;
+	}
+
+	bool IsRunning() const
+	{
+		return m_hThread != NULL;
+	}
+
+	bool Start()
+	{
+		if( IsRunning() )
+			return true;
+
+		if( xnOSCreateEvent( &m_hWakeUp, FALSE ) != XN_STATUS_OK )
+			return false;
+
+#ifdef _WIN32
+		// the default timer resolution of Windows is about 15 ms
+		timeBeginPeriod( 1 );
+#endif
+
+		m_bRunning = true;
+		if( xnOSCreateThread( ThreadProc, this, &m_hThread ) != XN_STATUS_OK )
+		{
+			m_hThread	= NULL;
+			m_bRunning	= false;
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Stop()
+	{
+		if( !IsRunning() )
+			return;
+
+		m_bRunning = false;
+		xnOSSetEvent( m_hWakeUp );
+		xnOSWaitForThreadExit( m_hThread, XN_WAIT_INFINITE );
+		xnOSCloseThread( &m_hThread );
+		m_hThread = NULL;
+		Close();
+	}
+
+protected:
+	void Run()
+	{
+		uint64_t uPeriod	= m_uPeriod;
+		uint64_t uBase		= GetHostTimestamp();
+		uint64_t uTick		= 0;
+		while( m_bRunning )
+		{
+			// re-start the schedule if the rate is changed
+			if( uPeriod != m_uPeriod )
+			{
+				uPeriod	= m_uPeriod;
+				uBase	= GetHostTimestamp();
+				uTick	= 0;
+			}
+
+			uint64_t uDeadline	= uBase + uTick * uPeriod;
+			uint64_t uNow		= GetHostTimestamp();
+			if( uNow < uDeadline )
+			{
+				// the wait is in ms, so the tick may be up to about 1 ms late
+				uint64_t uRemain = uDeadline - uNow;
+				xnOSWaitEvent( m_hWakeUp, XnUInt32( std::max<uint64_t>( uRemain / 1000, 1 ) ) );
+				continue;
+			}
+
+			m_rTarget.OnTick( uDeadline );
+
+			// skip the ticks which are already passed
+			uint64_t uPassed = ( GetHostTimestamp() - uBase ) / uPeriod;
+			uTick = ( uPassed > uTick ? uPassed : uTick + 1 );
+		}
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		timeEndPeriod( 1 );
+#endif
+		xnOSCloseEvent( &m_hWakeUp );
+		m_hWakeUp = NULL;
+	}
+
+	static XN_THREAD_PROC ThreadProc( XN_THREAD_PARAM pThreadParam )
+	{
+		reinterpret_cast<FramePacer*>( pThreadParam )->Run();
+		XN_THREAD_PROC_RETURN( XN_STATUS_OK );
+	}
+
+protected:
+	Target&					m_rTarget;
+	XN_THREAD_HANDLE		m_hThread;
+	XN_EVENT_HANDLE			m_hWakeUp;
+	std::atomic<bool>		m_bRunning;
+	std::atomic<uint64_t>	m_uPeriod;
+
+private:
+	FramePacer( const FramePacer& );
+	void operator=( const FramePacer& );
+};
+
+/**
+ * Pair the depth and color frames of a device, so both streams send them
+ * with the same frame index (OpenNI depth / color sync matches frames by index).
+ *
+ * A frame set is sent directly. With timestamp matching, a frame is held
+ * until a frame of the other stream with the nearest timestamp arrives;
+ * frames which can't be paired anymore are dropped.
+ */
+class FrameSynchronizer
+{
+public:
+	/**
+	 * The started stream which sends the paired frames
+	 */
+	class Target
+	{
+	public:
+		virtual void EmitMatchedFrame( OniFrame* pFrame, int iFrameIndex ) = 0;
+		virtual void DropFrame( OniFrame* pFrame ) = 0;
+	};
+
+	// slot 0 is depth, 1 is color
+	static const int SLOT_NUM = 2;
+
+public:
+	FrameSynchronizer()
+	{
+		xnOSCreateCriticalSection( &m_hLock );
+		m_eMode			= VIRTUAL_FRAME_SYNC_OFF;
+		m_uTolerance	= 16000;
+		m_iFrameIndex	= 0;
+		for( int i = 0; i < SLOT_NUM; ++ i )
+		{
+			m_apTarget[i]	= NULL;
+			m_auHeld[i]		= 0;
+		}
+	}
+
+	~FrameSynchronizer()
+	{
+		xnOSCloseCriticalSection( &m_hLock );
+	}
+
+	void SetTarget( int iSlot, Target* pTarget )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		DropHeld( iSlot, m_auHeld[iSlot] );
+		m_apTarget[iSlot] = pTarget;
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	void SetMode( VirtualFrameSyncMode eMode )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_eMode = eMode;
+		if( eMode == VIRTUAL_FRAME_SYNC_OFF )
+		{
+			for( int i = 0; i < SLOT_NUM; ++ i )
+				DropHeld( i, m_auHeld[i] );
+		}
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	VirtualFrameSyncMode GetMode() const
+	{
+		return m_eMode;
+	}
+
+	bool IsMatching() const
+	{
+		return m_eMode == VIRTUAL_FRAME_SYNC_TIMESTAMP;
+	}
+
+	void SetTolerance( uint64_t uTolerance )
+	{
+		m_uTolerance = uTolerance;
+	}
+
+	uint64_t GetTolerance() const
+	{
+		return m_uTolerance;
+	}
+
+	/**
+	 * Send a depth and color frame as a pair, fail if any stream is not started
+	 */
+	bool SubmitSet( OniFrame* pDepth, OniFrame* pColor )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		bool bStarted = ( m_apTarget[0] != NULL && m_apTarget[1] != NULL );
+		if( bStarted )
+			EmitPair( pDepth, pColor );
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bStarted;
+	}
+
+	/**
+	 * Pair the frame with the held frame of the other stream which has the
+	 * nearest timestamp, or hold it. Both streams must set frames in the
+	 * order of timestamp. Fail if the stream of slot is stopped meanwhile,
+	 * and the frame is still owned by caller.
+	 */
+	bool Submit( int iSlot, OniFrame* pFrame )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		int iOther = 1 - iSlot;
+		if( m_apTarget[iSlot] == NULL )
+		{
+			xnOSLeaveCriticalSection( &m_hLock );
+			return false;
+		}
+
+		if( m_apTarget[iOther] == NULL )
+		{
+			// the other stream is not started, nothing to pair
+			m_apTarget[iSlot]->EmitMatchedFrame( pFrame, NextFrameIndex( pFrame->frameIndex, 0 ) );
+		}
+		else
+		{
+			size_t uBest = MAX_HELD;
+			uint64_t uBestDiff = 0;
+			for( size_t i = 0; i < m_auHeld[iOther]; ++ i )
+			{
+				uint64_t uOther = m_aaHeld[iOther][i]->timestamp;
+				uint64_t uDiff = ( uOther > pFrame->timestamp ? uOther - pFrame->timestamp : pFrame->timestamp - uOther );
+				if( uDiff <= m_uTolerance && ( uBest == MAX_HELD || uDiff < uBestDiff ) )
+				{
+					uBest		= i;
+					uBestDiff	= uDiff;
+				}
+			}
+
+			if( uBest != MAX_HELD )
+			{
+				// the frames before the pair can't be paired in order anymore
+				OniFrame* pMatched = m_aaHeld[iOther][uBest];
+				DropHeld( iOther, uBest );
+				RemoveHeld( iOther, 1 );
+				DropHeld( iSlot, m_auHeld[iSlot] );
+
+				if( iSlot == 0 )
+					EmitPair( pFrame, pMatched );
+				else
+					EmitPair( pMatched, pFrame );
+			}
+			else
+			{
+				// the held frames of other stream which are too old for this frame won't be paired
+				size_t uOld = 0;
+				while( uOld < m_auHeld[iOther] && m_aaHeld[iOther][uOld]->timestamp + m_uTolerance < pFrame->timestamp )
+					++uOld;
+				DropHeld( iOther, uOld );
+
+				if( m_auHeld[iSlot] == MAX_HELD )
+					DropHeld( iSlot, 1 );
+				m_aaHeld[iSlot][ m_auHeld[iSlot]++ ] = pFrame;
+			}
+		}
+		xnOSLeaveCriticalSection( &m_hLock );
+		return true;
+	}
+
+	/**
+	 * Drop the held frames of a stream
+	 */
+	void Flush( int iSlot )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		DropHeld( iSlot, m_auHeld[iSlot] );
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+protected:
+	void EmitPair( OniFrame* pDepth, OniFrame* pColor )
+	{
+		int iIndex = NextFrameIndex( pDepth->frameIndex, pColor->frameIndex );
+		m_apTarget[0]->EmitMatchedFrame( pDepth, iIndex );
+		m_apTarget[1]->EmitMatchedFrame( pColor, iIndex );
+	}
+
+	/**
+	 * Get the index of next pair, which is increasing for both streams
+	 */
+	int NextFrameIndex( int iIndex1, int iIndex2 )
+	{
+		int iIndex = m_iFrameIndex + 1;
+		if( iIndex1 > iIndex )
+			iIndex = iIndex1;
+		if( iIndex2 > iIndex )
+			iIndex = iIndex2;
+		m_iFrameIndex = iIndex;
+		return iIndex;
+	}
+
+	/**
+	 * Drop the first uCount held frames of the slot
+	 */
+	void DropHeld( int iSlot, size_t uCount )
+	{
+		for( size_t i = 0; i < uCount; ++ i )
+			m_apTarget[iSlot]->DropFrame( m_aaHeld[iSlot][i] );
+		RemoveHeld( iSlot, uCount );
+	}
+
+	void RemoveHeld( int iSlot, size_t uCount )
+	{
+		for( size_t i = uCount; i < m_auHeld[iSlot]; ++ i )
+			m_aaHeld[iSlot][i - uCount] = m_aaHeld[iSlot][i];
+		m_auHeld[iSlot] -= uCount;
+	}
+
+protected:
+	static const size_t MAX_HELD = 4;
+
+	XN_CRITICAL_SECTION_HANDLE			m_hLock;
+	std::atomic<VirtualFrameSyncMode>	m_eMode;
+	std::atomic<uint64_t>				m_uTolerance;
+	int									m_iFrameIndex;
+	Target*								m_apTarget[SLOT_NUM];
+	OniFrame*							m_aaHeld[SLOT_NUM][MAX_HELD];
+	size_t								m_auHeld[SLOT_NUM];
+
+private:
+	FrameSynchronizer( const FrameSynchronizer& );
+	void operator=( const FrameSynchronizer& );
+};
+
+/**
+ * Depth to color registration of a device, applied to the depth frames when
+ * they are set. The table is rebuilt when the calibration, resolution,
+ * cropping window or mirroring changes; the frames are registered in place
+ * through a z-buffer, so the size of frame is not changed.
+ */
+class DepthRegistration
+{
+public:
+	DepthRegistration()
+	{
+		xnOSCreateCriticalSection( &m_hLock );
+		xnOSCreateCriticalSection( &m_hBufferLock );
+		m_bEnabled		= false;
+		m_bDepth		= false;
+		m_bColor		= false;
+		m_bExtrinsics	= false;
+		m_uVersion		= 1;
+		m_uTableVersion	= 0;
+		memset( &m_mTableKey, 0, sizeof(m_mTableKey) );
+		m_funcProject	= GetRegistrationProjector();
+	}
+
+	~DepthRegistration()
+	{
+		xnOSCloseCriticalSection( &m_hLock );
+		xnOSCloseCriticalSection( &m_hBufferLock );
+	}
+
+	/**
+	 * Enable or disable the registration; it can only be enabled with all the calibration
+	 */
+	bool SetEnabled( bool bEnabled )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		bool bResult = ( !bEnabled || ( m_bDepth && m_bColor && m_bExtrinsics ) );
+		if( bResult )
+			m_bEnabled = bEnabled;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bResult;
+	}
+
+	bool IsEnabled() const
+	{
+		return m_bEnabled;
+	}
+
+	static bool IsIntrinsicsValid( const VirtualCameraIntrinsics& rIntrinsics )
+	{
+		return rIntrinsics.iWidth > 0 && rIntrinsics.iHeight > 0 && rIntrinsics.fFx > 0 && rIntrinsics.fFy > 0;
+	}
+
+	void SetIntrinsics( bool bDepth, const VirtualCameraIntrinsics& rIntrinsics )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		( bDepth ? m_mDepth : m_mColor ) = rIntrinsics;
+		( bDepth ? m_bDepth : m_bColor ) = true;
+		++ m_uVersion;
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	bool GetIntrinsics( bool bDepth, VirtualCameraIntrinsics& rIntrinsics )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		bool bResult = ( bDepth ? m_bDepth : m_bColor );
+		if( bResult )
+			rIntrinsics = ( bDepth ? m_mDepth : m_mColor );
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bResult;
+	}
+
+	void SetExtrinsics( const VirtualCameraExtrinsics& rExtrinsics )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_mExtrinsics	= rExtrinsics;
+		m_bExtrinsics	= true;
+		++ m_uVersion;
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	bool GetExtrinsics( VirtualCameraExtrinsics& rExtrinsics )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		bool bResult = m_bExtrinsics;
+		if( bResult )
+			rExtrinsics = m_mExtrinsics;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bResult;
+	}
+
+	/**
+	 * Register the packed depth frame in place; bMirror is set if the frame
+	 * is mirrored, and the registered one is mirrored too. The calibration
+	 * lock is only held to get the table, the frame is registered with the
+	 * lock of buffers, which serializes the frames only.
+	 */
+	void Apply( OniFrame* pFrame, bool bMirror )
+	{
+		if( !m_bEnabled )
+			return;
+
+		// the cropping window in the full size frame
+		TableKey mKey;
+		memset( &mKey, 0, sizeof(mKey) );
+		mKey.iFullWidth		= pFrame->videoMode.resolutionX;
+		mKey.iFullHeight	= pFrame->videoMode.resolutionY;
+		mKey.iOriginX		= ( pFrame->croppingEnabled ? pFrame->cropOriginX : 0 );
+		mKey.iOriginY		= ( pFrame->croppingEnabled ? pFrame->cropOriginY : 0 );
+		mKey.iWidth			= pFrame->width;
+		mKey.iHeight		= pFrame->height;
+		mKey.iMirror		= ( bMirror ? 1 : 0 );
+		std::shared_ptr<const RegistrationTable> pTable = GetTable( mKey );
+		if( pTable == NULL )
+			return;
+		const RegistrationTable& rTable = *pTable;
+
+		// the translation is in millimeter
+		float fUnit = ( pFrame->videoMode.pixelFormat == ONI_PIXEL_FORMAT_DEPTH_100_UM ? 10.0f : 1.0f );
+		float aOffset[3] = { rTable.aOffset[0] * fUnit, rTable.aOffset[1] * fUnit, rTable.aOffset[2] * fUnit };
+
+		xnOSEnterCriticalSection( &m_hBufferLock );
+		int iWidth = pFrame->width, iHeight = pFrame->height;
+
+		// the z-buffer with the dummy pixel of invalid points, it's only reallocated when it grows
+		m_vTarget.resize( size_t( iWidth ) * iHeight + 1 );
+		std::fill( m_vTarget.begin(), m_vTarget.end(), OniDepthPixel( 0 ) );
+		m_vIndex.resize( iWidth );
+		m_vDepth.resize( iWidth );
+
+		unsigned char* pData = static_cast<unsigned char*>( pFrame->data );
+		for( int y = 0; y < iHeight; ++ y )
+		{
+			const OniDepthPixel* pRow = reinterpret_cast<const OniDepthPixel*>( pData + y * pFrame->stride );
+			m_funcProject( pRow, rTable.vColumnX.data(), rTable.vColumnY.data(), rTable.vColumnZ.data(), &rTable.vRow[3 * y], aOffset, iWidth, iWidth, iHeight, m_vIndex.data(), m_vDepth.data() );
+			ScatterRegistration( m_vIndex.data(), m_vDepth.data(), iWidth, m_vTarget.data() );
+		}
+
+		size_t uRowSize = iWidth * sizeof(OniDepthPixel);
+		for( int y = 0; y < iHeight; ++ y )
+			memcpy( pData + y * pFrame->stride, m_vTarget.data() + y * iWidth, uRowSize );
+		xnOSLeaveCriticalSection( &m_hBufferLock );
+	}
+
+protected:
+	struct TableKey
+	{
+		int		iFullWidth;
+		int		iFullHeight;
+		int		iOriginX;
+		int		iOriginY;
+		int		iWidth;
+		int		iHeight;
+		int		iMirror;
+	};
+
+	/**
+	 * Get the table of the window, NULL if the registration is disabled. The
+	 * lock is held to copy the table or the calibration; a new table is built
+	 * without it, and kept if the calibration is not changed meanwhile.
+	 */
+	std::shared_ptr<const RegistrationTable> GetTable( const TableKey& rKey )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		if( !m_bEnabled )
+		{
+			xnOSLeaveCriticalSection( &m_hLock );
+			return NULL;
+		}
+
+		std::shared_ptr<const RegistrationTable> pTable;
+		if( m_uTableVersion == m_uVersion && memcmp( &rKey, &m_mTableKey, sizeof(rKey) ) == 0 )
+			pTable = m_pTable;
+		VirtualCameraIntrinsics	mDepth		= m_mDepth;
+		VirtualCameraIntrinsics	mColor		= m_mColor;
+		VirtualCameraExtrinsics	mExtrinsics	= m_mExtrinsics;
+		unsigned int			uVersion	= m_uVersion;
+		xnOSLeaveCriticalSection( &m_hLock );
+
+		if( pTable == NULL )
+		{
+			RegistrationTable* pNewTable = new RegistrationTable();
+			BuildRegistrationTable( mDepth, mColor, mExtrinsics, rKey.iFullWidth, rKey.iFullHeight, rKey.iOriginX, rKey.iOriginY, rKey.iWidth, rKey.iHeight, rKey.iMirror != 0, *pNewTable );
+			pTable.reset( pNewTable );
+
+			xnOSEnterCriticalSection( &m_hLock );
+			if( m_uVersion == uVersion )
+			{
+				m_pTable		= pTable;
+				m_mTableKey		= rKey;
+				m_uTableVersion	= uVersion;
+			}
+			xnOSLeaveCriticalSection( &m_hLock );
+		}
+		return pTable;
+	}
+
+	XN_CRITICAL_SECTION_HANDLE	m_hLock;
+	std::atomic<bool>			m_bEnabled;
+	VirtualCameraIntrinsics		m_mDepth;
+	VirtualCameraIntrinsics		m_mColor;
+	VirtualCameraExtrinsics		m_mExtrinsics;
+	bool						m_bDepth;
+	bool						m_bColor;
+	bool						m_bExtrinsics;
+	unsigned int				m_uVersion;
+
+	// the table of last frame, which is shared with the frames using it
+	std::shared_ptr<const RegistrationTable>	m_pTable;
+	TableKey					m_mTableKey;
+	unsigned int				m_uTableVersion;
+	RegistrationRowProjector	m_funcProject;
+
+	// the buffers of one frame
+	XN_CRITICAL_SECTION_HANDLE	m_hBufferLock;
+	std::vector<OniDepthPixel>	m_vTarget;
+	std::vector<int>			m_vIndex;
+	std::vector<int>			m_vDepth;
+
+private:
+	DepthRegistration( const DepthRegistration& );
+	void operator=( const DepthRegistration& );
+};
+
+/**
+ * A small pool of threads to run the tiles of a task with the calling thread.
+ * The tiles are taken one by one, so the faster threads take more.
+ */
+class TileWorkers
+{
+public:
+	/**
+	 * The task which is split into tiles
+	 */
+	class Task
+	{
+	public:
+		virtual void RunTile( int iTile, int iTiles ) = 0;
+	};
+
+public:
+	TileWorkers()
+	{
+		m_hDone		= NULL;
+		m_bRunning	= false;
+		m_pTask		= NULL;
+		m_iTiles	= 0;
+		m_iNext		= 0;
+		m_iActive	= 0;
+	}
+
+	~TileWorkers()
+	{
+		Stop();
+	}
+
+	int GetThreads() const
+	{
+		return int( m_vWorker.size() );
+	}
+
+	/**
+	 * Start iThreads threads, the running ones are stopped first
+	 */
+	bool Start( int iThreads )
+	{
+		Stop();
+		if( iThreads <= 0 )
+			return true;
+
+		if( xnOSCreateEvent( &m_hDone, FALSE ) != XN_STATUS_OK )
+		{
+			m_hDone = NULL;
+			return false;
+		}
+
+		m_bRunning = true;
+		m_vWorker.resize( iThreads );
+		for( Worker& rWorker : m_vWorker )
+		{
+			rWorker.pOwner	= this;
+			rWorker.hThread	= NULL;
+			rWorker.hWakeUp	= NULL;
+		}
+		for( Worker& rWorker : m_vWorker )
+		{
+			if( xnOSCreateEvent( &rWorker.hWakeUp, FALSE ) != XN_STATUS_OK )
+			{
+				rWorker.hWakeUp = NULL;
+				Stop();
+				return false;
+			}
+			if( xnOSCreateThread( ThreadProc, &rWorker, &rWorker.hThread ) != XN_STATUS_OK )
+			{
+				rWorker.hThread = NULL;
+				Stop();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Stop()
+	{
+		m_bRunning = false;
+		for( Worker& rWorker : m_vWorker )
+		{
+			if( rWorker.hThread != NULL )
+			{
+				xnOSSetEvent( rWorker.hWakeUp );
+				xnOSWaitForThreadExit( rWorker.hThread, XN_WAIT_INFINITE );
+				xnOSCloseThread( &rWorker.hThread );
+			}
+			if( rWorker.hWakeUp != NULL )
+				xnOSCloseEvent( &rWorker.hWakeUp );
+		}
+		m_vWorker.clear();
+
+		if( m_hDone != NULL )
+		{
+			xnOSCloseEvent( &m_hDone );
+			m_hDone = NULL;
+		}
+	}
+
+	/**
+	 * Run all the tiles of rTask, and return after they are done
+	 */
+	void Run( Task& rTask, int iTiles )
+	{
+		m_pTask		= &rTask;
+		m_iTiles	= iTiles;
+		m_iNext		= 0;
+		if( m_vWorker.empty() || iTiles <= 1 )
+		{
+			RunTiles();
+			return;
+		}
+
+		m_iActive = int( m_vWorker.size() );
+		for( Worker& rWorker : m_vWorker )
+			xnOSSetEvent( rWorker.hWakeUp );
+		RunTiles();
+
+		// m_hDone may be left set by the last run, so check the counter
+		while( m_iActive.load() != 0 )
+			xnOSWaitEvent( m_hDone, XN_WAIT_INFINITE );
+	}
+
+protected:
+	struct Worker
+	{
+		TileWorkers*		pOwner;
+		XN_THREAD_HANDLE	hThread;
+		XN_EVENT_HANDLE		hWakeUp;
+	};
+
+	void RunTiles()
+	{
+		int iTile;
+		while( ( iTile = m_iNext++ ) < m_iTiles )
+			m_pTask->RunTile( iTile, m_iTiles );
+	}
+
+	void Run( Worker& rWorker )
+	{
+		while( true )
+		{
+			xnOSWaitEvent( rWorker.hWakeUp, XN_WAIT_INFINITE );
+			if( !m_bRunning )
+				break;
+
+			RunTiles();
+			if( --m_iActive == 0 )
+				xnOSSetEvent( m_hDone );
+		}
+	}
+
+	static XN_THREAD_PROC ThreadProc( XN_THREAD_PARAM pThreadParam )
+	{
+		Worker* pWorker = reinterpret_cast<Worker*>( pThreadParam );
+		pWorker->pOwner->Run( *pWorker );
+		XN_THREAD_PROC_RETURN( XN_STATUS_OK );
+	}
+
+protected:
+	std::vector<Worker>	m_vWorker;
+	XN_EVENT_HANDLE		m_hDone;
+	std::atomic<bool>	m_bRunning;
+	Task*				m_pTask;
+	int					m_iTiles;
+	std::atomic<int>	m_iNext;
+	std::atomic<int>	m_iActive;
+
+private:
+	TileWorkers( const TileWorkers& );
+	void operator=( const TileWorkers& );
+};
+
+/**
+ * The post-processing filters of depth frames, see
+ * VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER. Each filter pass is split
+ * into bands of rows for TileWorkers, and the passes ping-pong between two
+ * buffers; the last one writes into the frame.
+ */
+class DepthFilterChain : protected TileWorkers::Task
+{
+public:
+	DepthFilterChain()
+	{
+		xnOSCreateCriticalSection( &m_hLock );
+		m_bEnabled					= false;
+		m_iThreads					= 0;
+		m_mFlyingPixel.iThreshold	= 0;
+		m_mFlyingPixel.iNeighbors	= 4;
+		m_mSpatial.iIterations		= 0;
+		m_mSpatial.iDelta			= 20;
+		m_mTemporal.fAlpha			= 0;
+		m_mTemporal.iDelta			= 20;
+		m_mTemporal.iPersistence	= 3;
+		m_mHoleFill.iMode			= VIRTUAL_HOLE_FILL_OFF;
+		m_mHoleFill.iIterations		= 1;
+		memset( &m_mHistoryKey, 0, sizeof(m_mHistoryKey) );
+	}
+
+	~DepthFilterChain()
+	{
+		m_Workers.Stop();
+		xnOSCloseCriticalSection( &m_hLock );
+	}
+
+	bool IsEnabled() const
+	{
+		return m_bEnabled;
+	}
+
+	void SetFlyingPixel( const VirtualFlyingPixelFilter& rFilter )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_mFlyingPixel = rFilter;
+		UpdateEnabled();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	void SetSpatial( const VirtualSpatialFilter& rFilter )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_mSpatial = rFilter;
+		UpdateEnabled();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	/**
+	 * Set the temporal filter, the history restarts
+	 */
+	void SetTemporal( const VirtualTemporalFilter& rFilter )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_mTemporal = rFilter;
+		memset( &m_mHistoryKey, 0, sizeof(m_mHistoryKey) );
+		UpdateEnabled();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	void SetHoleFill( const VirtualHoleFillFilter& rFilter )
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_mHoleFill = rFilter;
+		UpdateEnabled();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	VirtualFlyingPixelFilter GetFlyingPixel()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		VirtualFlyingPixelFilter mFilter = m_mFlyingPixel;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return mFilter;
+	}
+
+	VirtualSpatialFilter GetSpatial()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		VirtualSpatialFilter mFilter = m_mSpatial;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return mFilter;
+	}
+
+	VirtualTemporalFilter GetTemporal()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		VirtualTemporalFilter mFilter = m_mTemporal;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return mFilter;
+	}
+
+	VirtualHoleFillFilter GetHoleFill()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		VirtualHoleFillFilter mFilter = m_mHoleFill;
+		xnOSLeaveCriticalSection( &m_hLock );
+		return mFilter;
+	}
+
+	/**
+	 * Set the number of extra threads, used after the next Start()
+	 */
+	void SetThreads( int iThreads )
+	{
+		m_iThreads = iThreads;
+	}
+
+	int GetThreads() const
+	{
+		return m_iThreads;
+	}
+
+	/**
+	 * Start the threads and restart the temporal history, called when the stream is started
+	 */
+	bool Start()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		memset( &m_mHistoryKey, 0, sizeof(m_mHistoryKey) );
+		bool bResult = m_Workers.Start( m_iThreads );
+		xnOSLeaveCriticalSection( &m_hLock );
+		return bResult;
+	}
+
+	void Stop()
+	{
+		xnOSEnterCriticalSection( &m_hLock );
+		m_Workers.Stop();
+		xnOSLeaveCriticalSection( &m_hLock );
+	}
+
+	/**
+	 * Filter the depth frame in place, the time (us) of each filter is
+	 * written to aTime; return false if the frame is not filtered.
+	 */
+	bool Apply( OniFrame* pFrame, uint64_t aTime[VIRTUAL_DEPTH_FILTER_NUM] )
+	{
+		if( !IsDepthFormat( pFrame->videoMode.pixelFormat ) || pFrame->width <= 0 || pFrame->height <= 0 )
+			return false;
+
+		xnOSEnterCriticalSection( &m_hLock );
+		if( !m_bEnabled )
+		{
+			xnOSLeaveCriticalSection( &m_hLock );
+			return false;
+		}
+
+		int iWidth = pFrame->width, iHeight = pFrame->height;
+		size_t uSize = size_t( iWidth ) * iHeight;
+		m_vFront.resize( uSize );
+		m_vBack.resize( uSize );
+		m_vZero.assign( iWidth, 0 );
+
+		// restart the history when the pixels are not the same ones
+		HistoryKey mKey;
+		memset( &mKey, 0, sizeof(mKey) );
+		mKey.iFullWidth		= pFrame->videoMode.resolutionX;
+		mKey.iFullHeight	= pFrame->videoMode.resolutionY;
+		mKey.iOriginX		= ( pFrame->croppingEnabled ? pFrame->cropOriginX : 0 );
+		mKey.iOriginY		= ( pFrame->croppingEnabled ? pFrame->cropOriginY : 0 );
+		mKey.iWidth			= iWidth;
+		mKey.iHeight		= iHeight;
+		mKey.iFormat		= pFrame->videoMode.pixelFormat;
+		if( m_mTemporal.fAlpha > 0 && memcmp( &mKey, &m_mHistoryKey, sizeof(mKey) ) != 0 )
+		{
+			m_vState.assign( uSize, 0.0f );
+			m_vAge.assign( uSize, 0 );
+			m_mHistoryKey = mKey;
+		}
+
+		// the passes in order, and the filter of each
+		Pass aPass[ 2 + 2 * VIRTUAL_FILTER_MAX_ITERATIONS ];
+		int aFilter[ 2 + 2 * VIRTUAL_FILTER_MAX_ITERATIONS ];
+		int iPasses = 0;
+		if( m_mFlyingPixel.iThreshold > 0 )
+		{
+			aFilter[iPasses]	= VIRTUAL_DEPTH_FILTER_FLYING_PIXEL;
+			aPass[iPasses++]	= Pass( GetFlyingPixelFilter(), m_mFlyingPixel.iThreshold, m_mFlyingPixel.iNeighbors );
+		}
+		for( int i = 0; i < m_mSpatial.iIterations; ++ i )
+		{
+			aFilter[iPasses]	= VIRTUAL_DEPTH_FILTER_SPATIAL;
+			aPass[iPasses++]	= Pass( GetSpatialFilter(), m_mSpatial.iDelta, 0 );
+		}
+		if( m_mTemporal.fAlpha > 0 )
+		{
+			aFilter[iPasses]	= VIRTUAL_DEPTH_FILTER_TEMPORAL;
+			aPass[iPasses++]	= Pass( GetTemporalFilter() );
+		}
+		if( m_mHoleFill.iMode != VIRTUAL_HOLE_FILL_OFF )
+		{
+			for( int i = 0; i < m_mHoleFill.iIterations; ++ i )
+			{
+				aFilter[iPasses]	= VIRTUAL_DEPTH_FILTER_HOLE_FILL;
+				aPass[iPasses++]	= Pass( GetHoleFillFilter( m_mHoleFill.iMode == VIRTUAL_HOLE_FILL_FARTHEST ), 0, 0 );
+			}
+		}
+
+		Plane mFrame( pFrame->data, pFrame->stride );
+		Plane mFront( m_vFront.data(), iWidth * sizeof(OniDepthPixel) );
+		Plane mBack( m_vBack.data(), iWidth * sizeof(OniDepthPixel) );
+		Plane mSource = mFrame;
+
+		for( int i = 0; i < VIRTUAL_DEPTH_FILTER_NUM; ++ i )
+			aTime[i] = 0;
+
+		int iTiles = m_Workers.GetThreads() + 1;
+		for( int i = 0; i < iPasses; ++ i )
+		{
+			// the temporal filter can work in place, the others can't
+			bool bTemporal = ( aPass[i].funcTemporal != NULL );
+			bool bLast = ( i + 1 == iPasses );
+			Plane mTarget = ( mSource.pData == mFront.pData ? mBack : mFront );
+			if( bLast && ( bTemporal || mSource.pData != mFrame.pData ) )
+				mTarget = mFrame;
+
+			m_mPass			= aPass[i];
+			m_mPass.mSource	= mSource;
+			m_mPass.mTarget	= mTarget;
+			m_mPass.iWidth	= iWidth;
+			m_mPass.iHeight	= iHeight;
+
+			uint64_t uStart = GetHostTimestamp();
+			m_Workers.Run( *this, std::min( iTiles, iHeight ) );
+			aTime[ aFilter[i] ] += GetHostTimestamp() - uStart;
+			mSource = mTarget;
+		}
+
+		// a single neighborhood pass can't write into the frame
+		if( mSource.pData != mFrame.pData )
+		{
+			size_t uRowSize = iWidth * sizeof(OniDepthPixel);
+			for( int y = 0; y < iHeight; ++ y )
+				memcpy( mFrame.Row( y ), mSource.Row( y ), uRowSize );
+		}
+		xnOSLeaveCriticalSection( &m_hLock );
+		return true;
+	}
+
+protected:
+	struct HistoryKey
+	{
+		int		iFullWidth;
+		int		iFullHeight;
+		int		iOriginX;
+		int		iOriginY;
+		int		iWidth;
+		int		iHeight;
+		int		iFormat;
+	};
+
+	struct Plane
+	{
+		Plane( void* pPlane = NULL, size_t uPlaneStride = 0 )
+		{
+			pData	= static_cast<unsigned char*>( pPlane );
+			uStride	= uPlaneStride;
+		}
+
+		OniDepthPixel* Row( int y ) const
+		{
+			return reinterpret_cast<OniDepthPixel*>( pData + y * uStride );
+		}
+
+		unsigned char*	pData;
+		size_t			uStride;
+	};
+
+	/**
+	 * One pass of a filter, funcNeighborhood or funcTemporal is set
+	 */
+	struct Pass
+	{
+		Pass( DepthNeighborhoodRow funcRow = NULL, int iPassDelta = 0, int iPassCount = 0 )
+		{
+			funcNeighborhood	= funcRow;
+			funcTemporal		= NULL;
+			iDelta				= iPassDelta;
+			iCount				= iPassCount;
+			iWidth				= 0;
+			iHeight				= 0;
+		}
+
+		Pass( DepthTemporalRow funcRow )
+		{
+			funcNeighborhood	= NULL;
+			funcTemporal		= funcRow;
+			iDelta				= 0;
+			iCount				= 0;
+			iWidth				= 0;
+			iHeight				= 0;
+		}
+
+		DepthNeighborhoodRow	funcNeighborhood;
+		DepthTemporalRow		funcTemporal;
+		int						iDelta;
+		int						iCount;
+		Plane					mSource;
+		Plane					mTarget;
+		int						iWidth;
+		int						iHeight;
+	};
+
+	void UpdateEnabled()
+	{
+		m_bEnabled = ( m_mFlyingPixel.iThreshold > 0 || m_mSpatial.iIterations > 0 || m_mTemporal.fAlpha > 0 || m_mHoleFill.iMode != VIRTUAL_HOLE_FILL_OFF );
+	}
+
+	/**
+	 * Filter a band of rows of the current pass
+	 */
+	void RunTile( int iTile, int iTiles )
+	{
+		const Pass& rPass = m_mPass;
+		int iBegin	= int( int64_t( rPass.iHeight ) * iTile / iTiles );
+		int iEnd	= int( int64_t( rPass.iHeight ) * ( iTile + 1 ) / iTiles );
+		if( rPass.funcTemporal != NULL )
+		{
+			float fAlpha = m_mTemporal.fAlpha;
+			for( int y = iBegin; y < iEnd; ++ y )
+			{
+				size_t uOffset = size_t( y ) * rPass.iWidth;
+				rPass.funcTemporal( rPass.mSource.Row( y ), m_vState.data() + uOffset, m_vAge.data() + uOffset, rPass.mTarget.Row( y ), rPass.iWidth, fAlpha, m_mTemporal.iDelta, m_mTemporal.iPersistence );
+			}
+			return;
+		}
+
+		const OniDepthPixel* pZero = m_vZero.data();
+		for( int y = iBegin; y < iEnd; ++ y )
+		{
+			const OniDepthPixel* pAbove = ( y > 0 ? rPass.mSource.Row( y - 1 ) : pZero );
+			const OniDepthPixel* pBelow = ( y + 1 < rPass.iHeight ? rPass.mSource.Row( y + 1 ) : pZero );
+			rPass.funcNeighborhood( pAbove, rPass.mSource.Row( y ), pBelow, rPass.mTarget.Row( y ), rPass.iWidth, rPass.iDelta, rPass.iCount );
+		}
+	}
+
+protected:
+	XN_CRITICAL_SECTION_HANDLE	m_hLock;
+	std::atomic<bool>			m_bEnabled;
+	std::atomic<int>			m_iThreads;
+	VirtualFlyingPixelFilter	m_mFlyingPixel;
+	VirtualSpatialFilter		m_mSpatial;
+	VirtualTemporalFilter		m_mTemporal;
+	VirtualHoleFillFilter		m_mHoleFill;
+	TileWorkers					m_Workers;
+
+	// the buffers of one frame, and the history of temporal filter
+	std::vector<OniDepthPixel>	m_vFront;
+	std::vector<OniDepthPixel>	m_vBack;
+	std::vector<OniDepthPixel>	m_vZero;
+	std::vector<float>			m_vState;
+	std::vector<unsigned char>	m_vAge;
+	HistoryKey					m_mHistoryKey;
+	Pass						m_mPass;
+
+private:
+	DepthFilterChain( const DepthFilterChain& );
+	void operator=( const DepthFilterChain& );
+};
+
+/**
+ * The configuration of stream which is used to create and send frames.
+ * It's never modified after published, setProperty() publish a new one; so
+ * the producer thread get a consistent snapshot with one atomic load. A
+ * replaced one is freed by an EpochReclaimer when no ConfigReader can see it.
+ */
+struct StreamConfig
+{
+	OniVideoMode			mVideoMode;
+	OniCropping				mCropping;
+	size_t					uStride;
+	size_t					uDataSize;
+	size_t					uRequiredStride;	// set by ONI_STREAM_PROPERTY_STRIDE, 0 for packed rows
+	bool					bPackedOutput;
+	VirtualInputFormat		eInputFormat;
+	PixelRowConverter		funcConvert;		// NULL if the input is native
+	DepthRowConverter		funcDepthUnit;		// from the other depth unit, NULL if not depth
+	bool					bMirroring;
+	PixelRowMirror			funcMirror;			// NULL if mirroring is disabled
+	VirtualResolution		mSourceResolution;	// set by VIRTUAL_STREAM_PROPERTY_SOURCE_RESOLUTION, 0 for the video mode
+	VirtualDecimation		eDecimation;
+	OniVideoMode			mInputMode;			// the video mode of frames set by producer
+	VirtualLensDistortion	mDistortion;		// set by VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION
+	PixelRemapRow			funcUndistort;		// NULL if the distortion is disabled
+	std::shared_ptr<const RemapTable>	pUndistortion;	// shared by the snapshots of the same distortion
+	bool					bResize;
+	int						iDecimationFactor;
+	PixelBlockReducer		funcReduce;			// NULL if not reduced by blocks
+	PixelBilinearRow		funcBilinear;		// NULL if not resized bilinearly
+	BilinearTable			mBilinearColumns;
+	BilinearTable			mBilinearRows;
+	int						iPyramidLevels;		// set by VIRTUAL_STREAM_PROPERTY_PYRAMID_LEVELS
+	PixelBlockReducer		funcPyramid;		// NULL if there is no pyramid
+	size_t					uPyramidSize;		// size of VirtualFramePyramid and the levels after the frame data
+	size_t					uInputPixelSize;	// pixel size of the frames set by producer
+	VirtualTimestampMode	eTimestampMode;
+	VirtualTimestampMapping	mTimestampMapping;
+};
+
+/**
+ *
+ */
+class OpenNIVirtualStream : public oni::driver::StreamBase, protected FrameDispatcher::Target, protected FramePacer::Target, protected FrameSynchronizer::Target
+{
+public:
+	/**
+	 * The stream which builds its frames from the frames of this stream; it's
+	 * called on the thread which sends the frame, before the frame is released.
+	 */
+	class DerivedTarget
+	{
+	public:
+		virtual void OnSourceFrame( OpenNIVirtualStream* pSource, OniFrame* pFrame ) = 0;
+	};
+
+	/**
+	 * Read the current configuration snapshot, which is not freed while the reader lives
+	 */
+	class ConfigReader
+	{
+	public:
+		ConfigReader( const OpenNIVirtualStream& rStream ) : m_rReclaimer( rStream.m_ConfigReclaimer )
+		{
+			m_uEpoch	= m_rReclaimer.BeginRead();
+			m_pConfig	= rStream.m_pConfig.load();
+		}
+
+		~ConfigReader()
+		{
+			m_rReclaimer.EndRead( m_uEpoch );
+		}
+
+		const StreamConfig* Get() const
+		{
+			return m_pConfig;
+		}
+
+		const StreamConfig* operator->() const
+		{
+			return m_pConfig;
+		}
+
+	protected:
+		EpochReclaimer<const StreamConfig>&	m_rReclaimer;
+		unsigned int						m_uEpoch;
+		const StreamConfig*					m_pConfig;
+
+	private:
+		ConfigReader( const ConfigReader& );
+		void operator=( const ConfigReader& );
+	};
+
+	/**
+	 * Constructor
+	 */
+	OpenNIVirtualStream( OniSensorType eSeneorType, const std::string& sName, oni::driver::DriverServices& driverServices ) : oni::driver::StreamBase(), m_ConfigReclaimer(FreeConfig), m_rDriverServices(driverServices), m_Properties(driverServices), m_Dispatcher(*this), m_Pacer(*this)
+	{
+		m_iTraceId			= g_FrameTracer.RegisterStream( sName );
+		m_eSensorType		= eSeneorType;
+		m_bStarted			= false;
+		m_iFrameId			= 0;
+
+		m_bConfigDone				= false;
+		m_bAsyncDispatch			= false;
+
+		// paced emission
+		m_bPacedEmission			= false;
+		m_mProducer.funcProduce		= NULL;
+		m_mProducer.pCookie			= NULL;
+		m_pPendingFrame				= NULL;
+		m_pLastFrame				= NULL;
+
+		// depth / color pairing
+		m_pFrameSync				= NULL;
+		m_iSyncSlot					= 0;
+		m_pRegistration				= NULL;
+
+		StreamConfig* pConfig = new StreamConfig();
+		pConfig->uStride			= 0;
+		pConfig->uDataSize			= 0;
+		pConfig->uRequiredStride	= 0;
+		pConfig->bPackedOutput		= false;
+		pConfig->eInputFormat		= VIRTUAL_INPUT_NATIVE;
+		pConfig->funcConvert		= NULL;
+		pConfig->funcDepthUnit		= NULL;
+		pConfig->bMirroring			= false;
+		pConfig->funcMirror			= NULL;
+		pConfig->mSourceResolution.iResolutionX	= 0;
+		pConfig->mSourceResolution.iResolutionY	= 0;
+		pConfig->eDecimation		= VIRTUAL_DECIMATION_AVERAGE;
+		pConfig->bResize			= false;
+		pConfig->iDecimationFactor	= 0;
+		pConfig->funcReduce			= NULL;
+		pConfig->funcBilinear		= NULL;
+		pConfig->funcUndistort		= NULL;
+		memset( &pConfig->mDistortion, 0, sizeof( pConfig->mDistortion ) );
+		pConfig->iPyramidLevels		= 0;
+		pConfig->funcPyramid		= NULL;
+		pConfig->uPyramidSize		= 0;
+		pConfig->uInputPixelSize	= 0;
+
+		// timestamp
+		pConfig->eTimestampMode					= VIRTUAL_TIMESTAMP_HOST;
+		pConfig->mTimestampMapping.dScale		= 1.0;
+		pConfig->mTimestampMapping.iOffset		= 0;
+		pConfig->mTimestampMapping.bAutoOffset	= FALSE;
+		m_iTimestampOffset						= 0;
+		m_bOffsetValid							= false;
+
+		// default video mode
+		pConfig->mVideoMode.resolutionX	= 320;
+		pConfig->mVideoMode.resolutionY	= 240;
+		pConfig->mVideoMode.fps			= 1;
+		pConfig->mVideoMode.pixelFormat	= ONI_PIXEL_FORMAT_DEPTH_1_MM;
+		pConfig->mInputMode				= pConfig->mVideoMode;
+
+		// default cropping
+		pConfig->mCropping.enabled	= false;
+		pConfig->mCropping.width	= pConfig->mVideoMode.resolutionX;
+		pConfig->mCropping.height	= pConfig->mVideoMode.resolutionY;
+		pConfig->mCropping.originX	= 0;
+		pConfig->mCropping.originY	= 0;
+
+		xnOSCreateCriticalSection( &m_hConfigLock );
+		xnOSCreateCriticalSection( &m_hDerivedLock );
+		m_iDerivedNum	= 0;
+		m_pConfig		= pConfig;
+		m_pAllocator	= new FrameBufferAllocator();
+	}
+
+	/**
+	 * Destructor
+	 */
+	~OpenNIVirtualStream()
+	{
+		if( m_pFrameSync != NULL )
+			m_pFrameSync->SetTarget( m_iSyncSlot, NULL );
+		StopPacer();
+		m_Dispatcher.Stop();
+		m_pAllocator->Release();
+		delete m_pConfig.load();
+		xnOSCloseCriticalSection( &m_hConfigLock );
+		xnOSCloseCriticalSection( &m_hDerivedLock );
+	}
+
+	/**
+	 * Start load image
+	 */
+	OniStatus start()
+	{
+		if( m_bConfigDone )
+		{
+			if( m_bAsyncDispatch && !m_Dispatcher.Start() )
+			{
+				m_rDriverServices.errorLoggerAppend( "Can't start frame dispatcher thread" );
+				return ONI_STATUS_ERROR;
+			}
+
+			if( m_bPacedEmission )
+			{
+				m_Pacer.SetFPS( ConfigReader( *this )->mVideoMode.fps );
+				if( !m_Pacer.Start() )
+				{
+					m_Dispatcher.Stop();
+					m_rDriverServices.errorLoggerAppend( "Can't start frame pacer thread" );
+					return ONI_STATUS_ERROR;
+				}
+			}
+
+			if( !m_Filters.Start() )
+			{
+				StopPacer();
+				m_Dispatcher.Stop();
+				m_rDriverServices.errorLoggerAppend( "Can't start depth filter threads" );
+				return ONI_STATUS_ERROR;
+			}
+
+			if( m_pFrameSync != NULL )
+				m_pFrameSync->SetTarget( m_iSyncSlot, this );
+
+			m_bStarted = true;
+			return ONI_STATUS_OK;
+		}
+		m_rDriverServices.errorLoggerAppend( "Please assign VideoMode before start" );
+		return ONI_STATUS_ERROR;
+	}
+
+	/**
+	 * Stop load image
+	 */
+	void stop()
+	{
+		m_bStarted = false;
+		if( m_pFrameSync != NULL )
+			m_pFrameSync->SetTarget( m_iSyncSlot, NULL );
+		StopPacer();
+		m_Dispatcher.Stop();
+		m_Filters.Stop();
+	}
+
+	/**
+	 * Size of frame buffer, which include the padding of stride
+	 */
+	int getRequiredFrameSize()
+	{
+		size_t uDataSize = ConfigReader( *this )->uDataSize;
+		if( uDataSize == 0 )
+			return getServices().getDefaultRequiredFrameSize();
+		return int( uDataSize );
+	}
+
+	/**
+	 * Check if the property is supported
+	 */
+	OniBool isPropertySupported( int )
+	{
+		return true;
+	}
+
+	/**
+	 * get property
+	 */
+	OniStatus getProperty( int propertyId, void* data, int* pDataSize )
+	{
+		switch( propertyId )
+		{
+		case ONI_STREAM_PROPERTY_VIDEO_MODE:
+			{
+				OniVideoMode mVideoMode = ConfigReader( *this )->mVideoMode;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mVideoMode ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case ONI_STREAM_PROPERTY_CROPPING:
+			{
+				OniCropping mCropping = ConfigReader( *this )->mCropping;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mCropping ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case ONI_STREAM_PROPERTY_STRIDE:
+			{
+				int iStride = int( ConfigReader( *this )->uStride );
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iStride ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_INPUT_FORMAT:
+			{
+				int iFormat = ConfigReader( *this )->eInputFormat;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iFormat ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_SOURCE_RESOLUTION:
+			{
+				VirtualResolution mSource = ConfigReader( *this )->mSourceResolution;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mSource ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DECIMATION:
+			{
+				int iDecimation = ConfigReader( *this )->eDecimation;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iDecimation ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_PYRAMID_LEVELS:
+			{
+				int iLevels = ConfigReader( *this )->iPyramidLevels;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iLevels ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION:
+			{
+				VirtualLensDistortion mDistortion = ConfigReader( *this )->mDistortion;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mDistortion ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER:
+			{
+				VirtualFlyingPixelFilter mFilter = m_Filters.GetFlyingPixel();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mFilter ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_SPATIAL_FILTER:
+			{
+				VirtualSpatialFilter mFilter = m_Filters.GetSpatial();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mFilter ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_TEMPORAL_FILTER:
+			{
+				VirtualTemporalFilter mFilter = m_Filters.GetTemporal();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mFilter ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_HOLE_FILL_FILTER:
+			{
+				VirtualHoleFillFilter mFilter = m_Filters.GetHoleFill();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mFilter ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FILTER_THREADS:
+			{
+				int iThreads = m_Filters.GetThreads();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iThreads ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_PACKED_OUTPUT:
+			{
+				OniBool bPacked = ConfigReader( *this )->bPackedOutput;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, bPacked ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FRAME_ALLOCATOR:
+			{
+				VirtualFrameAllocator mAllocator;
+				mAllocator.funcAlloc	= FrameBufferAllocator::Allocate;
+				mAllocator.funcFree		= FrameBufferAllocator::Free;
+				mAllocator.pCookie		= m_pAllocator;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mAllocator ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FRAME_POOL_SIZE:
+			{
+				int iPoolSize = int( m_pAllocator->GetPoolSize() );
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iPoolSize ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FRAME_POOL_STATS:
+			{
+				VirtualFramePoolStats mStats = m_pAllocator->GetStats();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mStats ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_ASYNC_DISPATCH:
+			{
+				OniBool bAsync = m_bAsyncDispatch;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, bAsync ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_QUEUE_DEPTH:
+			{
+				int iDepth = int( m_Dispatcher.GetQueueDepth() );
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iDepth ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_AFFINITY:
+			{
+				uint64_t uMask = m_Dispatcher.GetAffinity();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, uMask ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_DROP_POLICY:
+			{
+				int iPolicy = m_Dispatcher.GetDropPolicy();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iPolicy ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_BLOCK_TIMEOUT:
+			{
+				int iTimeout = int( m_Dispatcher.GetBlockTimeout() );
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iTimeout ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_STATS:
+			{
+				VirtualDispatchStats mStats = m_Dispatcher.GetStats();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mStats ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_STATISTICS:
+			{
+				VirtualStreamStatistics* pStats = PropertyConvert<VirtualStreamStatistics>( m_rDriverServices, *pDataSize, data );
+				if( pStats != NULL )
+				{
+					m_Statistics.Get( *pStats );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MODE:
+			{
+				int iMode = ConfigReader( *this )->eTimestampMode;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iMode ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MAPPING:
+			{
+				VirtualTimestampMapping mMapping = ConfigReader( *this )->mTimestampMapping;
+				mMapping.iOffset = m_iTimestampOffset;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mMapping ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_PACED_EMISSION:
+			{
+				OniBool bPaced = m_bPacedEmission;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, bPaced ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FRAME_PRODUCER:
+			if( GetProperty( m_rDriverServices, *pDataSize, data, m_mProducer ) )
+				return ONI_STATUS_OK;
+			break;
+
+		default:
+			if( m_Properties.GetProperty( propertyId, data, pDataSize ) )
+				return ONI_STATUS_OK;
+		}
+		//std::cerr << " >>> Request Stream Property: " << propertyId << std::endl;
+		return ONI_STATUS_ERROR;
+	}
+
+	/**
+	 * set property
+	 */
+	OniStatus setProperty( int propertyId, const void* data, int dataSize )
+	{
+		switch( propertyId )
+		{
+		case ONI_STREAM_PROPERTY_VIDEO_MODE:
+			{
+				OniVideoMode mVideoMode;
+				if( SetProperty( m_rDriverServices, dataSize, data, mVideoMode ) )
+				{
+					if( GetPixelSize( mVideoMode.pixelFormat ) == 0 )
+					{
+						m_rDriverServices.errorLoggerAppend( "Unsupported pixel format: %d", mVideoMode.pixelFormat );
+						return ONI_STATUS_ERROR;
+					}
+
+					StreamConfig mConfig = BeginConfig();
+					size_t uDataSize = mConfig.uDataSize;
+					mConfig.mVideoMode = mVideoMode;
+					if( !IsResizeValid( mConfig.mSourceResolution, mConfig.eDecimation, mVideoMode ) )
+					{
+						m_rDriverServices.errorLoggerAppend( "Source resolution %dx%d can't be reduced to the video mode, use the video mode", mConfig.mSourceResolution.iResolutionX, mConfig.mSourceResolution.iResolutionY );
+						mConfig.mSourceResolution.iResolutionX = 0;
+						mConfig.mSourceResolution.iResolutionY = 0;
+					}
+					if( !IsInputFormatValid( mConfig.eInputFormat, GetInputMode( mConfig.mSourceResolution, mVideoMode ) ) )
+					{
+						m_rDriverServices.errorLoggerAppend( "Input format %d can't be converted to pixel format %d, use native input", mConfig.eInputFormat, mVideoMode.pixelFormat );
+						mConfig.eInputFormat = VIRTUAL_INPUT_NATIVE;
+					}
+					if( !IsPyramidValid( mConfig.iPyramidLevels, mConfig.eDecimation, mVideoMode ) )
+					{
+						m_rDriverServices.errorLoggerAppend( "Pixel format %d can't build the pyramid, disable it", mVideoMode.pixelFormat );
+						mConfig.iPyramidLevels = 0;
+					}
+					if( !IsUndistortionValid( mConfig.mDistortion, mVideoMode ) )
+					{
+						m_rDriverServices.errorLoggerAppend( "Pixel format %d can't be undistorted, disable it", mVideoMode.pixelFormat );
+						memset( &mConfig.mDistortion, 0, sizeof( mConfig.mDistortion ) );
+					}
+					UpdateFrameLayout( mConfig );
+					if( mConfig.uDataSize != uDataSize )
+					{
+						// the frames in flight are allocated from the pool of the old size
+						if( m_bStarted )
+						{
+							CancelConfig();
+							m_rDriverServices.errorLoggerAppend( "Video mode %dx%d of pixel format %d changes the frame size, it can only be changed when the stream is stopped", mVideoMode.resolutionX, mVideoMode.resolutionY, mVideoMode.pixelFormat );
+							return ONI_STATUS_ERROR;
+						}
+						m_pAllocator->ResetPool( mConfig.uDataSize );
+					}
+					CommitConfig( mConfig );
+
+					m_Pacer.SetFPS( mVideoMode.fps );
+					m_bConfigDone = true;
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case ONI_STREAM_PROPERTY_STRIDE:
+			{
+				int iStride = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iStride ) )
+				{
+					if( m_bStarted )
+					{
+						m_rDriverServices.errorLoggerAppend( "Stride can only be changed when the stream is stopped" );
+						return ONI_STATUS_ERROR;
+					}
+
+					StreamConfig mConfig = BeginConfig();
+					if( iStride == 0 || size_t( iStride ) >= mConfig.mInputMode.resolutionX * mConfig.uInputPixelSize )
+					{
+						mConfig.uRequiredStride = size_t( iStride );
+						UpdateFrameSize( mConfig );
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Stride %d is smaller than the row of video mode", iStride );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_INPUT_FORMAT:
+			{
+				int iFormat = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iFormat ) )
+				{
+					if( m_bStarted )
+					{
+						m_rDriverServices.errorLoggerAppend( "Input format can only be changed when the stream is stopped" );
+						return ONI_STATUS_ERROR;
+					}
+
+					StreamConfig mConfig = BeginConfig();
+					if( IsInputFormatValid( VirtualInputFormat( iFormat ), mConfig.mInputMode ) )
+					{
+						mConfig.eInputFormat = VirtualInputFormat( iFormat );
+						UpdateFrameSize( mConfig );
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Input format %d can't be converted to the video mode", iFormat );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_SOURCE_RESOLUTION:
+			{
+				VirtualResolution mSource;
+				if( SetProperty( m_rDriverServices, dataSize, data, mSource ) )
+				{
+					if( m_bStarted )
+					{
+						m_rDriverServices.errorLoggerAppend( "Source resolution can only be changed when the stream is stopped" );
+						return ONI_STATUS_ERROR;
+					}
+
+					StreamConfig mConfig = BeginConfig();
+					if( IsResizeValid( mSource, mConfig.eDecimation, mConfig.mVideoMode ) &&
+						IsInputFormatValid( mConfig.eInputFormat, GetInputMode( mSource, mConfig.mVideoMode ) ) )
+					{
+						mConfig.mSourceResolution = mSource;
+						UpdateFrameSize( mConfig );
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Source resolution %dx%d can't be reduced to the video mode", mSource.iResolutionX, mSource.iResolutionY );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DECIMATION:
+			{
+				int iDecimation = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iDecimation ) )
+				{
+					StreamConfig mConfig = BeginConfig();
+					if( IsResizeValid( mConfig.mSourceResolution, VirtualDecimation( iDecimation ), mConfig.mVideoMode ) &&
+						IsPyramidValid( mConfig.iPyramidLevels, VirtualDecimation( iDecimation ), mConfig.mVideoMode ) )
+					{
+						mConfig.eDecimation = VirtualDecimation( iDecimation );
+						UpdateFrameSize( mConfig );
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Decimation %d can't reduce the source resolution to the video mode or the pyramid", iDecimation );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_PYRAMID_LEVELS:
+			{
+				int iLevels = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iLevels ) )
+				{
+					if( m_bStarted )
+					{
+						m_rDriverServices.errorLoggerAppend( "Pyramid levels can only be changed when the stream is stopped" );
+						return ONI_STATUS_ERROR;
+					}
+
+					StreamConfig mConfig = BeginConfig();
+					if( IsPyramidValid( iLevels, mConfig.eDecimation, mConfig.mVideoMode ) )
+					{
+						mConfig.iPyramidLevels = iLevels;
+						UpdateFrameSize( mConfig );
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Can't build %d pyramid levels of pixel format %d", iLevels, mConfig.mVideoMode.pixelFormat );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION:
+			{
+				VirtualLensDistortion mDistortion;
+				if( SetProperty( m_rDriverServices, dataSize, data, mDistortion ) )
+				{
+					StreamConfig mConfig = BeginConfig();
+					if( IsUndistortionValid( mDistortion, mConfig.mVideoMode ) )
+					{
+						mConfig.mDistortion = mDistortion;
+						UpdateFrameSize( mConfig );
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Lens distortion can't be applied to pixel format %d", mConfig.mVideoMode.pixelFormat );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER:
+			{
+				VirtualFlyingPixelFilter mFilter;
+				if( SetProperty( m_rDriverServices, dataSize, data, mFilter ) && IsDepthFilterAllowed( mFilter.iThreshold > 0 ) )
+				{
+					if( mFilter.iThreshold >= 0 && mFilter.iNeighbors >= 1 && mFilter.iNeighbors <= 8 )
+					{
+						m_Filters.SetFlyingPixel( mFilter );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Invalid flying pixel filter: threshold %d, %d neighbors", mFilter.iThreshold, mFilter.iNeighbors );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_SPATIAL_FILTER:
+			{
+				VirtualSpatialFilter mFilter;
+				if( SetProperty( m_rDriverServices, dataSize, data, mFilter ) && IsDepthFilterAllowed( mFilter.iIterations > 0 ) )
+				{
+					if( mFilter.iIterations >= 0 && mFilter.iIterations <= VIRTUAL_FILTER_MAX_ITERATIONS && mFilter.iDelta >= 0 )
+					{
+						m_Filters.SetSpatial( mFilter );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Invalid spatial filter: %d iterations, delta %d", mFilter.iIterations, mFilter.iDelta );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_TEMPORAL_FILTER:
+			{
+				VirtualTemporalFilter mFilter;
+				if( SetProperty( m_rDriverServices, dataSize, data, mFilter ) && IsDepthFilterAllowed( mFilter.fAlpha > 0 ) )
+				{
+					if( mFilter.fAlpha >= 0 && mFilter.fAlpha <= 1 && mFilter.iDelta >= 0 && mFilter.iPersistence >= 0 && mFilter.iPersistence <= 255 )
+					{
+						m_Filters.SetTemporal( mFilter );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Invalid temporal filter: alpha %f, delta %d, persistence %d", mFilter.fAlpha, mFilter.iDelta, mFilter.iPersistence );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_HOLE_FILL_FILTER:
+			{
+				VirtualHoleFillFilter mFilter;
+				if( SetProperty( m_rDriverServices, dataSize, data, mFilter ) && IsDepthFilterAllowed( mFilter.iMode != VIRTUAL_HOLE_FILL_OFF ) )
+				{
+					if( mFilter.iMode >= VIRTUAL_HOLE_FILL_OFF && mFilter.iMode <= VIRTUAL_HOLE_FILL_NEAREST && mFilter.iIterations >= 1 && mFilter.iIterations <= VIRTUAL_FILTER_MAX_ITERATIONS )
+					{
+						m_Filters.SetHoleFill( mFilter );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Invalid hole fill filter: mode %d, %d iterations", mFilter.iMode, mFilter.iIterations );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FILTER_THREADS:
+			{
+				int iThreads = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iThreads ) )
+				{
+					if( m_bStarted )
+						m_rDriverServices.errorLoggerAppend( "Filter threads can only be changed when the stream is stopped" );
+					else if( iThreads < 0 || iThreads > VIRTUAL_FILTER_MAX_THREADS )
+						m_rDriverServices.errorLoggerAppend( "Filter threads %d is out of range", iThreads );
+					else
+					{
+						m_Filters.SetThreads( iThreads );
+						return ONI_STATUS_OK;
+					}
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_PACKED_OUTPUT:
+			{
+				OniBool bPacked = FALSE;
+				if( SetProperty( m_rDriverServices, dataSize, data, bPacked ) )
+				{
+					StreamConfig mConfig = BeginConfig();
+					mConfig.bPackedOutput = ( bPacked != FALSE );
+					CommitConfig( mConfig );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case ONI_STREAM_PROPERTY_CROPPING:
+			{
+				OniCropping mCropping;
+				if( SetProperty( m_rDriverServices, dataSize, data, mCropping ) )
+				{
+					StreamConfig mConfig = BeginConfig();
+					if( !mCropping.enabled || IsCroppingValid( mCropping, mConfig.mVideoMode ) )
+					{
+						mConfig.mCropping = mCropping;
+						CommitConfig( mConfig );
+						return ONI_STATUS_OK;
+					}
+					CancelConfig();
+					m_rDriverServices.errorLoggerAppend( "Cropping (%d, %d) %dx%d is out of the video mode", mCropping.originX, mCropping.originY, mCropping.width, mCropping.height );
+				}
+			}
+			break;
+
+		case ONI_STREAM_PROPERTY_MIRRORING:
+			{
+				OniBool bMirroring = FALSE;
+				if( SetProperty( m_rDriverServices, dataSize, data, bMirroring ) )
+				{
+					StreamConfig mConfig = BeginConfig();
+					mConfig.bMirroring = ( bMirroring != FALSE );
+					UpdateFrameSize( mConfig );
+					CommitConfig( mConfig );
+
+					// the pool keep the value for GET and notification
+					m_Properties.SetProperty( propertyId, data, dataSize );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FRAME_POOL_SIZE:
+			{
+				int iPoolSize = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iPoolSize ) )
+				{
+					if( iPoolSize >= 0 )
+					{
+						m_pAllocator->SetPoolSize( iPoolSize );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Invalid frame pool size: %d", iPoolSize );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_ASYNC_DISPATCH:
+			{
+				OniBool bAsync = FALSE;
+				if( SetProperty( m_rDriverServices, dataSize, data, bAsync ) )
+				{
+					if( !m_bStarted )
+					{
+						m_bAsyncDispatch = ( bAsync != FALSE );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Asynchronous dispatch can only be changed when the stream is stopped" );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_QUEUE_DEPTH:
+			{
+				int iDepth = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iDepth ) )
+				{
+					if( iDepth > 0 && m_Dispatcher.SetQueueDepth( iDepth ) )
+						return ONI_STATUS_OK;
+					m_rDriverServices.errorLoggerAppend( "Can't set dispatch queue depth to %d, the stream must be stopped", iDepth );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_AFFINITY:
+			{
+				uint64_t uMask = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, uMask ) )
+				{
+					m_Dispatcher.SetAffinity( uMask );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_DROP_POLICY:
+			{
+				int iPolicy = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iPolicy ) )
+				{
+					switch( iPolicy )
+					{
+					case VIRTUAL_DROP_NEWEST:
+					case VIRTUAL_DROP_OLDEST:
+					case VIRTUAL_DROP_BLOCK:
+						m_Dispatcher.SetDropPolicy( VirtualDropPolicy( iPolicy ), m_Dispatcher.GetBlockTimeout() );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Unknown drop policy: %d", iPolicy );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_DISPATCH_BLOCK_TIMEOUT:
+			{
+				int iTimeout = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iTimeout ) && iTimeout >= 0 )
+				{
+					m_Dispatcher.SetDropPolicy( m_Dispatcher.GetDropPolicy(), iTimeout );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MODE:
+			{
+				int iMode = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iMode ) )
+				{
+					switch( iMode )
+					{
+					case VIRTUAL_TIMESTAMP_HOST:
+					case VIRTUAL_TIMESTAMP_PRODUCER:
+					case VIRTUAL_TIMESTAMP_PRODUCER_MAPPED:
+						{
+							StreamConfig mConfig = BeginConfig();
+							mConfig.eTimestampMode = VirtualTimestampMode( iMode );
+							CommitConfig( mConfig );
+						}
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Unknown timestamp mode: %d", iMode );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MAPPING:
+			{
+				VirtualTimestampMapping mMapping;
+				if( SetProperty( m_rDriverServices, dataSize, data, mMapping ) )
+				{
+					StreamConfig mConfig = BeginConfig();
+					mConfig.mTimestampMapping = mMapping;
+					m_iTimestampOffset	= mMapping.iOffset;
+					m_bOffsetValid		= false;
+					CommitConfig( mConfig );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_PACED_EMISSION:
+			{
+				OniBool bPaced = FALSE;
+				if( SetProperty( m_rDriverServices, dataSize, data, bPaced ) )
+				{
+					if( !m_bStarted )
+					{
+						m_bPacedEmission = ( bPaced != FALSE );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Paced emission can only be changed when the stream is stopped" );
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_FRAME_PRODUCER:
+			{
+				VirtualFrameProducer mProducer;
+				if( SetProperty( m_rDriverServices, dataSize, data, mProducer ) )
+				{
+					if( !m_bStarted )
+					{
+						m_mProducer = mProducer;
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Frame producer can only be changed when the stream is stopped" );
+				}
+			}
+			break;
+
+		default:
+			if( m_Properties.SetProperty( propertyId, data, dataSize ) )
+				return ONI_STATUS_OK;
+		}
+		return ONI_STATUS_ERROR;
+	}
+
+	OniStatus invoke( int commandId, void* data, int dataSize )
+	{
+		switch( commandId )
+		{
+		case GET_VIRTUAL_STREAM_IMAGE:
+			if( m_bStarted )
+			{
+				OniFrame** pFrame = PropertyConvert<OniFrame*>( m_rDriverServices, dataSize, data );
+				if( pFrame != NULL )
+				{
+					// always full size, it's cropped when set
+					*pFrame = CreateeNewFrame( ConfigReader( *this ).Get() );
+					if( *pFrame != NULL )
+						return ONI_STATUS_OK;
+				}
+			}
+			else
+			{
+				return ONI_STATUS_ERROR;
+			}
+			break;
+
+		case SET_VIRTUAL_STREAM_IMAGE:
+			if( m_bStarted )
+			{
+				OniFrame** pFrame = PropertyConvert<OniFrame*>( m_rDriverServices, dataSize, data );
+				if( pFrame != NULL )
+				{
+					if( SendNewFrame( ConfigReader( *this ).Get(), *pFrame ) )
+						return ONI_STATUS_OK;
+				}
+			}
+			else
+			{
+				return ONI_STATUS_ERROR;
+			}
+			break;
+
+		case SET_VIRTUAL_STREAM_EXTERNAL_IMAGE:
+			if( m_bStarted )
+			{
+				VirtualExternalFrame* pExternal = PropertyConvert<VirtualExternalFrame>( m_rDriverServices, dataSize, data );
+				if( pExternal != NULL )
+				{
+					// after the frame is created, the buffer is owned by the frame
+					ConfigReader mConfig( *this );
+					OniFrame* pFrame = CreateeExternalFrame( mConfig.Get(), *pExternal );
+					if( pFrame == NULL )
+						return ONI_STATUS_BAD_PARAMETER;
+
+					// a rejected frame is released, so funcRelease is called already
+					if( SendNewFrame( mConfig.Get(), pFrame ) )
+						return ONI_STATUS_OK;
+					return ONI_STATUS_ERROR;
+				}
+			}
+			else
+			{
+				return ONI_STATUS_ERROR;
+			}
+			break;
+		}
+		return ONI_STATUS_NOT_IMPLEMENTED;
+	}
+
+	OniBool isCommandSupported( int commandId )
+	{
+		switch( commandId )
+		{
+		case GET_VIRTUAL_STREAM_IMAGE:
+		case SET_VIRTUAL_STREAM_IMAGE:
+		case SET_VIRTUAL_STREAM_EXTERNAL_IMAGE:
+			return true;
+			break;
+		}
+
+		return FALSE;
+	}
+
+	/**
+	 * Get the performance counters of this stream
+	 */
+	void GetStatistics( VirtualStreamStatistics& rStats ) const
+	{
+		m_Statistics.Get( rStats );
+	}
+
+	/**
+	 * Send the frames of this stream to the derived stream too
+	 */
+	void AddDerived( DerivedTarget* pTarget )
+	{
+		xnOSEnterCriticalSection( &m_hDerivedLock );
+		m_vDerived.push_back( pTarget );
+		m_iDerivedNum = int( m_vDerived.size() );
+		xnOSLeaveCriticalSection( &m_hDerivedLock );
+	}
+
+	/**
+	 * Stop sending frames to the derived stream; it's not called after return
+	 */
+	void RemoveDerived( DerivedTarget* pTarget )
+	{
+		xnOSEnterCriticalSection( &m_hDerivedLock );
+		m_vDerived.erase( std::remove( m_vDerived.begin(), m_vDerived.end(), pTarget ), m_vDerived.end() );
+		m_iDerivedNum = int( m_vDerived.size() );
+		xnOSLeaveCriticalSection( &m_hDerivedLock );
+	}
+
+	/**
+	 * Keep the frame got in DerivedTarget::OnSourceFrame(), must be released by ReleaseFrame()
+	 */
+	void HoldFrame( OniFrame* pFrame )
+	{
+		getServices().addFrameRef( pFrame );
+	}
+
+	void ReleaseFrame( OniFrame* pFrame )
+	{
+		getServices().releaseFrame( pFrame );
+	}
+
+	/**
+	 * The version of a property stored in pool, which changes when it's set; 0 if it's not set
+	 */
+	unsigned int GetPropertyVersion( int propertyId )
+	{
+		return m_Properties.GetVersion( propertyId );
+	}
+
+	/**
+	 * Set the synchronizer of device, and the slot of this stream in it
+	 */
+	void SetFrameSync( FrameSynchronizer* pFrameSync, int iSlot )
+	{
+		m_pFrameSync	= pFrameSync;
+		m_iSyncSlot		= iSlot;
+	}
+
+	/**
+	 * Set the depth registration of device, for depth stream only
+	 */
+	void SetRegistration( DepthRegistration* pRegistration )
+	{
+		m_pRegistration = pRegistration;
+	}
+
+	/**
+	 * Check if the frame matches the current video mode; depth of the other
+	 * unit is accepted, and converted when it's set.
+	 */
+	static bool IsFrameValid( const StreamConfig* pConfig, const OniFrame* pFrame )
+	{
+		const OniVideoMode& rVideoMode = pConfig->mInputMode;
+		bool bFormatValid = pFrame->videoMode.pixelFormat == rVideoMode.pixelFormat ||
+							( pConfig->funcDepthUnit != NULL && IsDepthFormat( pFrame->videoMode.pixelFormat ) );
+		if( !bFormatValid ||
+			pFrame->videoMode.resolutionX != rVideoMode.resolutionX ||
+			pFrame->videoMode.resolutionY != rVideoMode.resolutionY )
+			return false;
+
+		// the producer may change the stride of frame, the rows must be in buffer
+		size_t uRowSize = pFrame->width * pConfig->uInputPixelSize;
+		if( IsPyramidInPlace( pConfig ) && AlignPyramid( size_t( pFrame->stride ) * pFrame->height ) + pConfig->uPyramidSize > size_t( pFrame->dataSize ) )
+			return false;
+		return	size_t( pFrame->stride ) >= uRowSize &&
+				size_t( pFrame->stride ) * ( pFrame->height - 1 ) + uRowSize <= size_t( pFrame->dataSize );
+	}
+
+	/**
+	 * Check if the pyramid is built in the buffer of producer, which is not converted or resized to a new frame
+	 */
+	static bool IsPyramidInPlace( const StreamConfig* pConfig )
+	{
+		return pConfig->uPyramidSize > 0 && pConfig->funcConvert == NULL && pConfig->funcUndistort == NULL && !pConfig->bResize;
+	}
+
+	/**
+	 * Release the frame which is not accepted
+	 */
+	void RejectFrame( OniFrame* pFrame )
+	{
+		m_Statistics.OnReject();
+		getServices().releaseFrame( pFrame );
+	}
+
+	/**
+	 * Get the timestamp of a frame set by the timestamp mode of this stream
+	 */
+	uint64_t GetFrameSetTimestamp( const StreamConfig* pConfig, uint64_t uTimestamp )
+	{
+		switch( pConfig->eTimestampMode )
+		{
+		case VIRTUAL_TIMESTAMP_PRODUCER:
+			return uTimestamp;
+
+		case VIRTUAL_TIMESTAMP_PRODUCER_MAPPED:
+			return MapTimestamp( pConfig->mTimestampMapping, uTimestamp );
+
+		case VIRTUAL_TIMESTAMP_HOST:
+		default:
+			return GetHostTimestamp();
+		}
+	}
+
+	/**
+	 * Record the SET of a frame in frame set, it's sent by the synchronizer
+	 * later. Return the frame to send, which may be a converted one; NULL if
+	 * the frame is dropped.
+	 */
+	OniFrame* PrepareSetFrame( const StreamConfig* pConfig, OniFrame* pFrame, uint64_t uTimestamp )
+	{
+		pFrame->timestamp = uTimestamp;
+
+		uint64_t uStart = m_Statistics.OnSubmit( pFrame->frameIndex );
+		if( g_FrameTracer.IsEnabled() )
+		{
+			uint64_t uAcquire = m_Statistics.GetAcquireTime( pFrame->frameIndex );
+			g_FrameTracer.Record( FrameTracer::TRACE_FILL, m_iTraceId, pFrame->frameIndex, uAcquire, uStart - uAcquire );
+		}
+
+		bool bMirrored = false;
+		pFrame = ConvertFrame( pConfig, pFrame, bMirrored );
+		if( pFrame != NULL )
+			pFrame = UndistortFrame( pConfig, pFrame, bMirrored );
+		if( pFrame != NULL )
+			pFrame = ResizeFrame( pConfig, pFrame, bMirrored );
+		if( pFrame != NULL )
+		{
+			PackFrame( pConfig, pFrame, !bMirrored );
+			if( m_pRegistration != NULL && m_pRegistration->IsEnabled() )
+				m_pRegistration->Apply( pFrame, pConfig->bMirroring );
+			FilterFrame( pConfig, pFrame );
+			BuildPyramid( pConfig, pFrame );
+		}
+		return pFrame;
+	}
+
+	void notifyAllProperties()
+	{
+		struct SNotify
+		{
+			OpenNIVirtualStream* pStream;
+			void operator()( int propertyId, const PropertyPool::Entry& rEntry )
+			{
+				pStream->raisePropertyChanged( propertyId, rEntry.aData, rEntry.iSize );
+			}
+		} mNotify = { this };
+		m_Properties.ForEach( mNotify );
+	}
+
+protected:
+	/**
+	 * Lock the configuration and get a copy to modify, must be followed by CommitConfig()
+	 */
+	StreamConfig BeginConfig()
+	{
+		xnOSEnterCriticalSection( &m_hConfigLock );
+		return *m_pConfig.load();
+	}
+
+	/**
+	 * Compute the frame size of the config, and re-build the frame buffer pool if it's changed
+	 */
+	void UpdateFrameSize( StreamConfig& rConfig )
+	{
+		size_t uDataSize = rConfig.uDataSize;
+		UpdateFrameLayout( rConfig );
+		if( rConfig.uDataSize != uDataSize )
+			m_pAllocator->ResetPool( rConfig.uDataSize );
+	}
+
+	/**
+	 * Compute the stride and frame size of the video mode, and the required stride if it's not smaller
+	 */
+	static void UpdateFrameLayout( StreamConfig& rConfig )
+	{
+		const OniVideoMode& rVideoMode = rConfig.mVideoMode;
+		UpdateResize( rConfig );
+		UpdateUndistortion( rConfig );
+		UpdatePyramid( rConfig );
+
+		// the frames are in source resolution until they are resized
+		const OniVideoMode& rInputMode = rConfig.mInputMode;
+		size_t uOutputSize = rInputMode.resolutionX * GetPixelSize( rVideoMode.pixelFormat ) * rInputMode.resolutionY;
+
+		// GET give the frame of input format, the converted frame use the same pool
+		rConfig.funcConvert		= GetPixelConverter( rConfig.eInputFormat, rVideoMode.pixelFormat );
+		rConfig.funcDepthUnit	= GetDepthConverter( rVideoMode.pixelFormat );
+		rConfig.funcMirror		= ( rConfig.bMirroring ? GetMirrorKernel( rVideoMode.pixelFormat ) : NULL );
+		rConfig.uInputPixelSize	= ( rConfig.funcConvert != NULL ? GetInputPixelSize( rConfig.eInputFormat ) : GetPixelSize( rVideoMode.pixelFormat ) );
+		rConfig.uStride			= rInputMode.resolutionX * rConfig.uInputPixelSize;
+		if( rConfig.uRequiredStride > rConfig.uStride )
+			rConfig.uStride = rConfig.uRequiredStride;
+
+		size_t uDataSize = rConfig.uStride * rInputMode.resolutionY;
+		if( uDataSize < uOutputSize )
+			uDataSize = uOutputSize;
+		if( rConfig.uPyramidSize > 0 )
+			uDataSize = AlignPyramid( uDataSize ) + rConfig.uPyramidSize;
+		rConfig.uDataSize = uDataSize;
+	}
+
+	/**
+	 * Check if the input format can be converted to the video mode
+	 */
+	static bool IsInputFormatValid( VirtualInputFormat eInput, const OniVideoMode& rVideoMode )
+	{
+		if( eInput == VIRTUAL_INPUT_NATIVE )
+			return true;
+
+		// two pixels share U and V
+		if( ( eInput == VIRTUAL_INPUT_YUYV || eInput == VIRTUAL_INPUT_UYVY ) && rVideoMode.resolutionX % 2 != 0 )
+			return false;
+		return GetPixelConverter( eInput, rVideoMode.pixelFormat ) != NULL;
+	}
+
+	/**
+	 * The video mode of frames set by producer, in source resolution
+	 */
+	static OniVideoMode GetInputMode( const VirtualResolution& rSource, const OniVideoMode& rVideoMode )
+	{
+		OniVideoMode mInputMode = rVideoMode;
+		if( rSource.iResolutionX > 0 && rSource.iResolutionY > 0 )
+		{
+			mInputMode.resolutionX = rSource.iResolutionX;
+			mInputMode.resolutionY = rSource.iResolutionY;
+		}
+		return mInputMode;
+	}
+
+	/**
+	 * Check if the source resolution can be reduced to the video mode by the decimation mode
+	 */
+	static bool IsResizeValid( const VirtualResolution& rSource, VirtualDecimation eDecimation, const OniVideoMode& rVideoMode )
+	{
+		if( rSource.iResolutionX == 0 && rSource.iResolutionY == 0 )
+			return true;
+		if( rSource.iResolutionX == rVideoMode.resolutionX && rSource.iResolutionY == rVideoMode.resolutionY )
+			return true;
+		if( rSource.iResolutionX < rVideoMode.resolutionX || rSource.iResolutionY < rVideoMode.resolutionY )
+			return false;
+
+		if( eDecimation == VIRTUAL_DECIMATION_BILINEAR )
+			return GetBilinearRow( rVideoMode.pixelFormat ) != NULL;
+
+		int iFactor = GetDecimationFactor( rSource.iResolutionX, rVideoMode.resolutionX );
+		return	iFactor == GetDecimationFactor( rSource.iResolutionY, rVideoMode.resolutionY ) &&
+				GetBlockReducer( rVideoMode.pixelFormat, eDecimation, iFactor ) != NULL;
+	}
+
+	/**
+	 * Select the resize kernel and build the tables for source resolution
+	 */
+	static void UpdateResize( StreamConfig& rConfig )
+	{
+		const OniVideoMode& rVideoMode = rConfig.mVideoMode;
+		rConfig.mInputMode			= GetInputMode( rConfig.mSourceResolution, rVideoMode );
+		rConfig.bResize				= ( rConfig.mInputMode.resolutionX != rVideoMode.resolutionX || rConfig.mInputMode.resolutionY != rVideoMode.resolutionY );
+		rConfig.iDecimationFactor	= 0;
+		rConfig.funcReduce			= NULL;
+		rConfig.funcBilinear		= NULL;
+		if( !rConfig.bResize )
+			return;
+
+		if( rConfig.eDecimation == VIRTUAL_DECIMATION_BILINEAR )
+		{
+			rConfig.funcBilinear = GetBilinearRow( rVideoMode.pixelFormat );
+			BuildBilinearTable( rConfig.mInputMode.resolutionX, rVideoMode.resolutionX, rConfig.mBilinearColumns );
+			BuildBilinearTable( rConfig.mInputMode.resolutionY, rVideoMode.resolutionY, rConfig.mBilinearRows );
+		}
+		else
+		{
+			rConfig.iDecimationFactor	= GetDecimationFactor( rConfig.mInputMode.resolutionX, rVideoMode.resolutionX );
+			rConfig.funcReduce			= GetBlockReducer( rVideoMode.pixelFormat, rConfig.eDecimation, rConfig.iDecimationFactor );
+		}
+	}
+
+	/**
+	 * Check if the distortion can be applied to the video mode
+	 */
+	static bool IsUndistortionValid( const VirtualLensDistortion& rDistortion, const OniVideoMode& rVideoMode )
+	{
+		if( !IsDistortionEnabled( rDistortion ) )
+			return true;
+
+		const VirtualCameraIntrinsics& rCamera = rDistortion.mIntrinsics;
+		return	rCamera.iWidth > 0 && rCamera.iHeight > 0 && rCamera.fFx > 0 && rCamera.fFy > 0 &&
+				GetRemapKernel( rVideoMode.pixelFormat ) != NULL;
+	}
+
+	/**
+	 * Select the remap kernel and build the table for source resolution; the
+	 * table of the previous snapshot is kept if nothing is changed
+	 */
+	static void UpdateUndistortion( StreamConfig& rConfig )
+	{
+		rConfig.funcUndistort = NULL;
+		if( !IsDistortionEnabled( rConfig.mDistortion ) )
+		{
+			rConfig.pUndistortion.reset();
+			return;
+		}
+
+		const OniVideoMode& rInputMode = rConfig.mInputMode;
+		bool bBilinear = !IsDepthFormat( rConfig.mVideoMode.pixelFormat );
+		if( rConfig.pUndistortion == NULL || !IsRemapTableOf( *rConfig.pUndistortion, rConfig.mDistortion, rInputMode.resolutionX, rInputMode.resolutionY, bBilinear ) )
+		{
+			std::shared_ptr<RemapTable> pTable = std::make_shared<RemapTable>();
+			BuildRemapTable( rConfig.mDistortion, rInputMode.resolutionX, rInputMode.resolutionY, bBilinear, *pTable );
+			rConfig.pUndistortion = pTable;
+		}
+		rConfig.funcUndistort = GetRemapKernel( rConfig.mVideoMode.pixelFormat );
+	}
+
+	/**
+	 * Check if the pyramid levels can be built for the video mode by the decimation mode
+	 */
+	static bool IsPyramidValid( int iLevels, VirtualDecimation eDecimation, const OniVideoMode& rVideoMode )
+	{
+		if( iLevels == 0 )
+			return true;
+		if( iLevels < 0 || iLevels > VIRTUAL_PYRAMID_MAX_LEVELS )
+			return false;
+		return GetBlockReducer( rVideoMode.pixelFormat, GetPyramidDecimation( eDecimation ), 2 ) != NULL;
+	}
+
+	/**
+	 * The pyramid is reduced by 2x2 blocks, which bilinear is the same as average
+	 */
+	static VirtualDecimation GetPyramidDecimation( VirtualDecimation eDecimation )
+	{
+		return ( eDecimation == VIRTUAL_DECIMATION_BILINEAR ? VIRTUAL_DECIMATION_AVERAGE : eDecimation );
+	}
+
+	/**
+	 * Offset of VirtualFramePyramid or level after the data, see VIRTUAL_FRAME_PYRAMID
+	 */
+	static size_t AlignPyramid( size_t uSize )
+	{
+		return ( uSize + VIRTUAL_PYRAMID_ALIGNMENT - 1 ) & ~size_t( VIRTUAL_PYRAMID_ALIGNMENT - 1 );
+	}
+
+	/**
+	 * Select the pyramid kernel and compute the size of the levels of video mode
+	 */
+	static void UpdatePyramid( StreamConfig& rConfig )
+	{
+		const OniVideoMode& rVideoMode = rConfig.mVideoMode;
+		rConfig.funcPyramid		= NULL;
+		rConfig.uPyramidSize	= 0;
+		if( rConfig.iPyramidLevels == 0 )
+			return;
+
+		rConfig.funcPyramid		= GetBlockReducer( rVideoMode.pixelFormat, GetPyramidDecimation( rConfig.eDecimation ), 2 );
+		rConfig.uPyramidSize	= AlignPyramid( sizeof( VirtualFramePyramid ) );
+
+		size_t uPixelSize = GetPixelSize( rVideoMode.pixelFormat );
+		int iWidth = rVideoMode.resolutionX, iHeight = rVideoMode.resolutionY;
+		for( int i = 0; i < rConfig.iPyramidLevels && iWidth >= 2 && iHeight >= 2; ++ i )
+		{
+			iWidth /= 2;
+			iHeight /= 2;
+			rConfig.uPyramidSize += AlignPyramid( iWidth * uPixelSize * iHeight );
+		}
+	}
+
+	/**
+	 * Unlock the configuration without change
+	 */
+	void CancelConfig()
+	{
+		xnOSLeaveCriticalSection( &m_hConfigLock );
+	}
+
+	/**
+	 * Publish the modified configuration and unlock. The replaced snapshot
+	 * may still be used by the producer thread, it's freed when no reader
+	 * can see it.
+	 */
+	void CommitConfig( const StreamConfig& rConfig )
+	{
+		const StreamConfig* pOld = m_pConfig.load();
+		m_pConfig.store( new StreamConfig( rConfig ) );
+		m_ConfigReclaimer.Retire( pOld );
+		xnOSLeaveCriticalSection( &m_hConfigLock );
+	}
+
+	static void FreeConfig( const StreamConfig* pConfig )
+	{
+		delete pConfig;
+	}
+
+	/**
+	 * Acquire a frame of the input mode; the frames copied by the pacer set
+	 * bRepeat, they are counted by OnRepeat() instead of acquired ones
+	 */
+	OniFrame* CreateeNewFrame( const StreamConfig* pConfig, bool bRepeat = false )
+	{
+		uint64_t uStart = GetHostTimestamp();
+		OniFrame* pFrame = getServices().acquireFrame();
+		if( pFrame != NULL )
+		{
+			// update metadata
+			pFrame->frameIndex		= ++m_iFrameId;
+			pFrame->videoMode		= pConfig->mInputMode;
+			pFrame->width			= pConfig->mInputMode.resolutionX;
+			pFrame->height			= pConfig->mInputMode.resolutionY;
+			pFrame->cropOriginX		= pFrame->cropOriginY = 0;
+			pFrame->croppingEnabled	= FALSE;
+			pFrame->sensorType		= m_eSensorType;
+			pFrame->stride			= int( pConfig->uStride );
+
+			pFrame->timestamp		= GetHostTimestamp();
+
+			if( !bRepeat )
+				m_Statistics.OnAcquire( pFrame->frameIndex );
+			if( g_FrameTracer.IsEnabled() )
+				g_FrameTracer.Record( FrameTracer::TRACE_ACQUIRE, m_iTraceId, pFrame->frameIndex, uStart, GetHostTimestamp() - uStart, pFrame->data );
+		}
+		return pFrame;
+	}
+
+	/**
+	 * Create a new frame which use the buffer of caller as data
+	 */
+	OniFrame* CreateeExternalFrame( const StreamConfig* pConfig, const VirtualExternalFrame& rExternal )
+	{
+		const OniVideoMode& rVideoMode = pConfig->mInputMode;
+
+		// the last row don't need the padding
+		size_t uRowSize		= rVideoMode.resolutionX * pConfig->uInputPixelSize;
+		size_t uStride		= ( rExternal.iStride > 0 ? size_t( rExternal.iStride ) : pConfig->uStride );
+		size_t uFrameSize	= uStride * ( rVideoMode.resolutionY - 1 ) + uRowSize;
+		if( uStride < uRowSize )
+		{
+			m_rDriverServices.errorLoggerAppend( "The stride of external buffer is smaller than row: %d < %d", int( uStride ), int( uRowSize ) );
+			return NULL;
+		}
+		if( rExternal.pData == NULL || size_t( rExternal.iDataSize ) < uFrameSize )
+		{
+			m_rDriverServices.errorLoggerAppend( "The external buffer is smaller than frame: %d < %d", rExternal.iDataSize, int( uFrameSize ) );
+			return NULL;
+		}
+		if( IsPyramidInPlace( pConfig ) && size_t( rExternal.iDataSize ) < AlignPyramid( uStride * rVideoMode.resolutionY ) + pConfig->uPyramidSize )
+		{
+			m_rDriverServices.errorLoggerAppend( "The external buffer has no space for the pyramid: %d < %d", rExternal.iDataSize, int( AlignPyramid( uStride * rVideoMode.resolutionY ) + pConfig->uPyramidSize ) );
+			return NULL;
+		}
+
+		m_pAllocator->BeginExternal( rExternal );
+		OniFrame* pFrame = CreateeNewFrame( pConfig );
+		bool bUsed = m_pAllocator->EndExternal();
+
+		if( pFrame != NULL && !bUsed )
+		{
+			// OpenNI allocate the frame buffer by itself
+			getServices().releaseFrame( pFrame );
+			m_rDriverServices.errorLoggerAppend( "Please set VIRTUAL_STREAM_PROPERTY_FRAME_ALLOCATOR to the stream before use external buffer" );
+			return NULL;
+		}
+
+		if( pFrame != NULL )
+		{
+			pFrame->stride		= int( uStride );
+			pFrame->dataSize	= rExternal.iDataSize;
+			if( pConfig->eTimestampMode != VIRTUAL_TIMESTAMP_HOST )
+				pFrame->timestamp = rExternal.uTimestamp;
+		}
+		return pFrame;
+	}
+
+	bool SendNewFrame( const StreamConfig* pConfig, OniFrame* pFrame )
+	{
+		// the frame may be released in SubmitFrame()
+		int iFrameIndex = pFrame->frameIndex;
+		uint64_t uStart = m_Statistics.OnSubmit( iFrameIndex );
+		if( g_FrameTracer.IsEnabled() )
+		{
+			uint64_t uAcquire = m_Statistics.GetAcquireTime( iFrameIndex );
+			g_FrameTracer.Record( FrameTracer::TRACE_FILL, m_iTraceId, iFrameIndex, uAcquire, uStart - uAcquire );
+		}
+
+		bool bResult = SubmitFrame( pConfig, pFrame );
+
+		if( g_FrameTracer.IsEnabled() )
+			g_FrameTracer.Record( FrameTracer::TRACE_SUBMIT, m_iTraceId, iFrameIndex, uStart, GetHostTimestamp() - uStart );
+		return bResult;
+	}
+
+	/**
+	 * Check the frame, and send or queue it; the whole frame is processed
+	 * with the same configuration snapshot
+	 */
+	bool SubmitFrame( const StreamConfig* pConfig, OniFrame* pFrame )
+	{
+		if( IsFrameValid( pConfig, pFrame ) )
+		{
+			if( pConfig->eTimestampMode == VIRTUAL_TIMESTAMP_PRODUCER_MAPPED )
+				pFrame->timestamp = MapTimestamp( pConfig->mTimestampMapping, pFrame->timestamp );
+
+			bool bMirrored = false;
+			pFrame = ConvertFrame( pConfig, pFrame, bMirrored );
+			if( pFrame != NULL )
+				pFrame = UndistortFrame( pConfig, pFrame, bMirrored );
+			if( pFrame != NULL )
+				pFrame = ResizeFrame( pConfig, pFrame, bMirrored );
+			if( pFrame == NULL )
+				return false;
+			PackFrame( pConfig, pFrame, !bMirrored );
+			if( m_pRegistration != NULL && m_pRegistration->IsEnabled() )
+				m_pRegistration->Apply( pFrame, pConfig->bMirroring );
+			FilterFrame( pConfig, pFrame );
+			BuildPyramid( pConfig, pFrame );
+
+			if( m_pFrameSync != NULL && m_pFrameSync->IsMatching() )
+			{
+				// sent when paired with a frame of the other stream
+				if( !m_pFrameSync->Submit( m_iSyncSlot, pFrame ) )
+					DropFrame( pFrame );
+			}
+			else if( m_Pacer.IsRunning() )
+			{
+				// keep the latest one for the next tick
+				OniFrame* pReplaced = m_pPendingFrame.exchange( pFrame );
+				if( pReplaced != NULL )
+					DropFrame( pReplaced );
+			}
+			else
+			{
+				EmitFrame( pFrame );
+			}
+			return true;
+		}
+		RejectFrame( pFrame );
+		return false;
+	}
+
+	/**
+	 * Convert the frame of input format to a new frame of the video mode, and
+	 * release the input one. The frame of native format is returned directly,
+	 * and depth of the other unit is converted in place. The converted rows
+	 * are mirrored while they are still in cache, and rMirrored is set; the
+	 * frame to undistort or resize is mirrored after that.
+	 */
+	OniFrame* ConvertFrame( const StreamConfig* pConfig, OniFrame* pFrame, bool& rMirrored )
+	{
+		PixelRowMirror funcMirror = ( pConfig->bResize || pConfig->funcUndistort != NULL ? NULL : pConfig->funcMirror );
+		rMirrored = false;
+		if( pFrame->videoMode.pixelFormat != pConfig->mVideoMode.pixelFormat && pConfig->funcDepthUnit != NULL )
+		{
+			unsigned char* pRow = static_cast<unsigned char*>( pFrame->data );
+			for( int y = 0; y < pFrame->height; ++ y, pRow += pFrame->stride )
+			{
+				pConfig->funcDepthUnit( reinterpret_cast<OniDepthPixel*>( pRow ), reinterpret_cast<OniDepthPixel*>( pRow ), pFrame->width );
+				if( funcMirror != NULL )
+					funcMirror( pRow, pRow, pFrame->width );
+			}
+			pFrame->videoMode.pixelFormat = pConfig->mVideoMode.pixelFormat;
+			rMirrored = ( funcMirror != NULL );
+			return pFrame;
+		}
+
+		if( pConfig->funcConvert == NULL )
+			return pFrame;
+
+		OniFrame* pTarget = getServices().acquireFrame();
+		if( pTarget == NULL )
+		{
+			DropFrame( pFrame );
+			return NULL;
+		}
+
+		size_t uRowSize = pFrame->width * GetPixelSize( pFrame->videoMode.pixelFormat );
+		const unsigned char* pSource = static_cast<const unsigned char*>( pFrame->data );
+		unsigned char* pRow = static_cast<unsigned char*>( pTarget->data );
+		for( int y = 0; y < pFrame->height; ++ y )
+		{
+			pConfig->funcConvert( pSource, pRow, pFrame->width );
+			if( funcMirror != NULL )
+				funcMirror( pRow, pRow, pFrame->width );
+			pSource	+= pFrame->stride;
+			pRow	+= uRowSize;
+		}
+		rMirrored = ( funcMirror != NULL );
+
+		pTarget->frameIndex			= pFrame->frameIndex;
+		pTarget->videoMode			= pFrame->videoMode;
+		pTarget->sensorType			= pFrame->sensorType;
+		pTarget->timestamp			= pFrame->timestamp;
+		pTarget->width				= pFrame->width;
+		pTarget->height				= pFrame->height;
+		pTarget->croppingEnabled	= pFrame->croppingEnabled;
+		pTarget->cropOriginX		= pFrame->cropOriginX;
+		pTarget->cropOriginY		= pFrame->cropOriginY;
+		pTarget->stride				= int( uRowSize );
+		pTarget->dataSize			= int( uRowSize * pFrame->height );
+
+		getServices().releaseFrame( pFrame );
+		return pTarget;
+	}
+
+	/**
+	 * Undistort the frame to a new frame by the remap table, and release the
+	 * source one. The table is of the full input frame, so the cropping of
+	 * producer is the window in it. The rows are mirrored while they are
+	 * still in cache if the frame is not resized, and rMirrored is set.
+	 */
+	OniFrame* UndistortFrame( const StreamConfig* pConfig, OniFrame* pFrame, bool& rMirrored )
+	{
+		if( pConfig->funcUndistort == NULL )
+			return pFrame;
+
+		// the window is in the mirrored image, the table is not mirrored
+		const RemapTable& rTable = *pConfig->pUndistortion;
+		int iOriginX = 0, iOriginY = 0;
+		if( pFrame->croppingEnabled )
+		{
+			iOriginX = ( pConfig->bMirroring ? rTable.iWidth - pFrame->cropOriginX - pFrame->width : pFrame->cropOriginX );
+			iOriginY = pFrame->cropOriginY;
+		}
+		if( iOriginX < 0 || iOriginY < 0 || iOriginX + pFrame->width > rTable.iWidth || iOriginY + pFrame->height > rTable.iHeight )
+		{
+			DropFrame( pFrame );
+			return NULL;
+		}
+
+		OniFrame* pTarget = getServices().acquireFrame();
+		if( pTarget == NULL )
+		{
+			DropFrame( pFrame );
+			return NULL;
+		}
+
+		PixelRowMirror funcMirror = ( pConfig->bResize ? NULL : pConfig->funcMirror );
+		size_t uRowSize = pFrame->width * GetPixelSize( pFrame->videoMode.pixelFormat );
+		const unsigned char* pSource = static_cast<const unsigned char*>( pFrame->data );
+		unsigned char* pRow = static_cast<unsigned char*>( pTarget->data );
+		for( int y = 0; y < pFrame->height; ++ y, pRow += uRowSize )
+		{
+			size_t uEntry = size_t( iOriginY + y ) * rTable.iWidth + iOriginX;
+			pConfig->funcUndistort( pSource, size_t( pFrame->stride ), pFrame->width, pFrame->height, iOriginX, iOriginY,
+									&rTable.vX[uEntry], &rTable.vY[uEntry], &rTable.vFraction[uEntry], pRow, pFrame->width );
+			if( funcMirror != NULL )
+				funcMirror( pRow, pRow, pFrame->width );
+		}
+		rMirrored = ( funcMirror != NULL );
+
+		pTarget->frameIndex			= pFrame->frameIndex;
+		pTarget->videoMode			= pFrame->videoMode;
+		pTarget->sensorType			= pFrame->sensorType;
+		pTarget->timestamp			= pFrame->timestamp;
+		pTarget->width				= pFrame->width;
+		pTarget->height				= pFrame->height;
+		pTarget->croppingEnabled	= pFrame->croppingEnabled;
+		pTarget->cropOriginX		= pFrame->cropOriginX;
+		pTarget->cropOriginY		= pFrame->cropOriginY;
+		pTarget->stride				= int( uRowSize );
+		pTarget->dataSize			= int( uRowSize * pFrame->height );
+
+		getServices().releaseFrame( pFrame );
+		return pTarget;
+	}
+
+	/**
+	 * Reduce the frame of source resolution to a new frame of the video mode,
+	 * and release the source one. The rows are mirrored while they are still
+	 * in cache, and rMirrored is set. The cropping of producer is not kept.
+	 */
+	OniFrame* ResizeFrame( const StreamConfig* pConfig, OniFrame* pFrame, bool& rMirrored )
+	{
+		if( !pConfig->bResize )
+			return pFrame;
+		if( pConfig->funcReduce == NULL && pConfig->funcBilinear == NULL )
+		{
+			DropFrame( pFrame );
+			return NULL;
+		}
+
+		OniFrame* pTarget = getServices().acquireFrame();
+		if( pTarget == NULL )
+		{
+			DropFrame( pFrame );
+			return NULL;
+		}
+
+		const OniVideoMode& rVideoMode = pConfig->mVideoMode;
+		const unsigned char* pSource = static_cast<const unsigned char*>( pFrame->data );
+		size_t uSourceStride = size_t( pFrame->stride );
+		size_t uRowSize = rVideoMode.resolutionX * GetPixelSize( rVideoMode.pixelFormat );
+		unsigned char* pRow = static_cast<unsigned char*>( pTarget->data );
+		for( int y = 0; y < rVideoMode.resolutionY; ++ y, pRow += uRowSize )
+		{
+			if( pConfig->funcReduce != NULL )
+			{
+				pConfig->funcReduce( pSource + y * pConfig->iDecimationFactor * uSourceStride, uSourceStride, pRow, rVideoMode.resolutionX );
+			}
+			else
+			{
+				const BilinearTable& rRows = pConfig->mBilinearRows;
+				pConfig->funcBilinear( pSource + rRows.vFirst[y] * uSourceStride, pSource + rRows.vSecond[y] * uSourceStride, rRows.vWeight[y], pConfig->mBilinearColumns, pRow, rVideoMode.resolutionX );
+			}
+			if( pConfig->funcMirror != NULL )
+				pConfig->funcMirror( pRow, pRow, rVideoMode.resolutionX );
+		}
+		rMirrored = ( pConfig->funcMirror != NULL );
+
+		pTarget->frameIndex			= pFrame->frameIndex;
+		pTarget->videoMode			= rVideoMode;
+		pTarget->sensorType			= pFrame->sensorType;
+		pTarget->timestamp			= pFrame->timestamp;
+		pTarget->width				= rVideoMode.resolutionX;
+		pTarget->height				= rVideoMode.resolutionY;
+		pTarget->croppingEnabled	= FALSE;
+		pTarget->cropOriginX		= 0;
+		pTarget->cropOriginY		= 0;
+		pTarget->stride				= int( uRowSize );
+		pTarget->dataSize			= int( uRowSize * rVideoMode.resolutionY );
+
+		getServices().releaseFrame( pFrame );
+		return pTarget;
+	}
+
+	/**
+	 * Check if the cropping window is inside the video mode
+	 */
+	static bool IsCroppingValid( const OniCropping& rCropping, const OniVideoMode& rVideoMode )
+	{
+		return	rCropping.originX >= 0 && rCropping.originY >= 0 && rCropping.width > 0 && rCropping.height > 0 &&
+				rCropping.originX + rCropping.width <= rVideoMode.resolutionX &&
+				rCropping.originY + rCropping.height <= rVideoMode.resolutionY;
+	}
+
+	/**
+	 * Crop the full size frame if cropping is enabled, or remove the padding
+	 * of rows if packed output is enabled. The rows are moved to the begin of
+	 * buffer in place, so the frame is tightly packed, and the consumers only
+	 * read the window. The frame which is already cropped by producer is not
+	 * cropped again.
+	 * If mirroring is enabled, the cropping window is in mirrored image, and
+	 * the rows are mirrored when they are moved if bMirror is set; or in
+	 * place if there is nothing to move.
+	 */
+	void PackFrame( const StreamConfig* pConfig, OniFrame* pFrame, bool bMirror )
+	{
+		size_t uPixelSize = GetPixelSize( pFrame->videoMode.pixelFormat );
+		PixelRowMirror funcMirror = ( bMirror ? pConfig->funcMirror : NULL );
+
+		OniCropping mWindow = pConfig->mCropping;
+		if( mWindow.enabled && !pFrame->croppingEnabled && IsCroppingValid( mWindow, pFrame->videoMode ) )
+		{
+			pFrame->croppingEnabled	= TRUE;
+			pFrame->cropOriginX		= mWindow.originX;
+			pFrame->cropOriginY		= mWindow.originY;
+			// the rows mirrored by the earlier passes are cropped as they are
+			if( funcMirror != NULL )
+				mWindow.originX = pFrame->width - mWindow.originX - mWindow.width;
+		}
+		else if( pConfig->bPackedOutput && size_t( pFrame->stride ) != pFrame->width * uPixelSize )
+		{
+			mWindow.originX	= 0;
+			mWindow.originY	= 0;
+			mWindow.width	= pFrame->width;
+			mWindow.height	= pFrame->height;
+		}
+		else
+		{
+			if( funcMirror != NULL )
+			{
+				unsigned char* pRow = static_cast<unsigned char*>( pFrame->data );
+				for( int y = 0; y < pFrame->height; ++ y, pRow += pFrame->stride )
+					funcMirror( pRow, pRow, pFrame->width );
+			}
+			return;
+		}
+
+		size_t uRowSize = mWindow.width * uPixelSize;
+		const unsigned char* pSource = static_cast<const unsigned char*>( pFrame->data ) + mWindow.originY * pFrame->stride + mWindow.originX * uPixelSize;
+		unsigned char* pTarget = static_cast<unsigned char*>( pFrame->data );
+
+		// the target row is never after the source row, copy forward
+		for( int y = 0; y < mWindow.height; ++ y )
+		{
+			if( funcMirror == NULL )
+			{
+				if( pTarget != pSource )
+					memmove( pTarget, pSource, uRowSize );
+			}
+			else if( pTarget == pSource || pTarget + uRowSize <= pSource )
+			{
+				funcMirror( pSource, pTarget, mWindow.width );
+			}
+			else
+			{
+				// the kernel can't mirror to a partly overlapped row
+				memmove( pTarget, pSource, uRowSize );
+				funcMirror( pTarget, pTarget, mWindow.width );
+			}
+			pTarget += uRowSize;
+			pSource += pFrame->stride;
+		}
+
+		pFrame->width		= mWindow.width;
+		pFrame->height		= mWindow.height;
+		pFrame->stride		= int( uRowSize );
+		pFrame->dataSize	= int( uRowSize * mWindow.height );
+	}
+
+	/**
+	 * Apply the depth filters to the packed frame, and record the time
+	 */
+	void FilterFrame( const StreamConfig* pConfig, OniFrame* pFrame )
+	{
+		uint64_t aTime[VIRTUAL_DEPTH_FILTER_NUM];
+		if( !IsDepthFormat( pConfig->mVideoMode.pixelFormat ) )
+			return;
+		if( m_Filters.IsEnabled() && m_Filters.Apply( pFrame, aTime ) )
+			m_Statistics.OnFilter( aTime );
+	}
+
+	/**
+	 * Check if a depth filter can be set; bEnabled is set if the filter is
+	 * enabled, which is only allowed for depth stream
+	 */
+	bool IsDepthFilterAllowed( bool bEnabled )
+	{
+		if( !bEnabled || IsDepthFormat( ConfigReader( *this )->mVideoMode.pixelFormat ) )
+			return true;
+		m_rDriverServices.errorLoggerAppend( "Depth filters can only be applied to depth stream" );
+		return false;
+	}
+
+	/**
+	 * Build the pyramid levels after the frame data, see VirtualFramePyramid.
+	 * The data size is set to the rows, so the pyramid is at a known offset
+	 * even if the producer gave the size of whole buffer.
+	 */
+	void BuildPyramid( const StreamConfig* pConfig, OniFrame* pFrame )
+	{
+		if( pConfig->funcPyramid == NULL )
+			return;
+
+		size_t uPixelSize = GetPixelSize( pFrame->videoMode.pixelFormat );
+		pFrame->dataSize = pFrame->stride * pFrame->height;
+
+		unsigned char* pData = static_cast<unsigned char*>( pFrame->data );
+		size_t uOffset = AlignPyramid( pFrame->dataSize );
+		VirtualFramePyramid* pPyramid = reinterpret_cast<VirtualFramePyramid*>( pData + uOffset );
+		uOffset += AlignPyramid( sizeof( VirtualFramePyramid ) );
+
+		const unsigned char* pSource = pData;
+		size_t uSourceStride = size_t( pFrame->stride );
+		int iWidth = pFrame->width, iHeight = pFrame->height;
+
+		pPyramid->iLevels = 0;
+		for( int i = 0; i < pConfig->iPyramidLevels && iWidth >= 2 && iHeight >= 2; ++ i )
+		{
+			iWidth /= 2;
+			iHeight /= 2;
+
+			VirtualPyramidLevel& rLevel = pPyramid->aLevels[i];
+			rLevel.iWidth	= iWidth;
+			rLevel.iHeight	= iHeight;
+			rLevel.iStride	= int( iWidth * uPixelSize );
+			rLevel.iOffset	= int( uOffset );
+
+			unsigned char* pTarget = pData + uOffset;
+			for( int y = 0; y < iHeight; ++ y )
+				pConfig->funcPyramid( pSource + 2 * y * uSourceStride, uSourceStride, pTarget + y * rLevel.iStride, iWidth );
+
+			pSource			= pTarget;
+			uSourceStride	= size_t( rLevel.iStride );
+			uOffset			+= AlignPyramid( size_t( rLevel.iStride ) * iHeight );
+			++ pPyramid->iLevels;
+		}
+	}
+
+	/**
+	 * Convert the timestamp of producer clock to host clock.
+	 * With auto offset, the offset is the minimal observed difference of
+	 * host and producer time, which slowly increase to follow clock drift.
+	 */
+	uint64_t MapTimestamp( const VirtualTimestampMapping& rMapping, uint64_t uTimestamp )
+	{
+		int64_t iScaled = int64_t( double( uTimestamp ) * rMapping.dScale );
+		if( rMapping.bAutoOffset )
+		{
+			int64_t iDiff	= int64_t( GetHostTimestamp() ) - iScaled;
+			int64_t iOffset	= m_iTimestampOffset.load( std::memory_order_relaxed );
+			if( !m_bOffsetValid || iDiff < iOffset + 1 )
+				iOffset = iDiff;
+			else
+				iOffset += 1;
+			m_bOffsetValid = true;
+			m_iTimestampOffset.store( iOffset, std::memory_order_relaxed );
+		}
+		return uint64_t( iScaled + m_iTimestampOffset.load( std::memory_order_relaxed ) );
+	}
+
+	/**
+	 * Send the frame directly or by dispatcher thread
+	 */
+	void EmitFrame( OniFrame* pFrame )
+	{
+		// Push() fails if the dispatcher is not running, or stopped meanwhile
+		if( !m_Dispatcher.Push( pFrame ) )
+			DispatchFrame( pFrame );
+	}
+
+	/**
+	 * Called by synchronizer, send the frame with the index of the pair
+	 */
+	void EmitMatchedFrame( OniFrame* pFrame, int iFrameIndex )
+	{
+		m_Statistics.MoveFrame( pFrame->frameIndex, iFrameIndex );
+		pFrame->frameIndex = iFrameIndex;
+
+		// the frames got later should have larger index
+		int iFrameId = m_iFrameId.load();
+		while( iFrameId < iFrameIndex && !m_iFrameId.compare_exchange_weak( iFrameId, iFrameIndex ) );
+
+		EmitFrame( pFrame );
+	}
+
+	/**
+	 * Called by pacer thread, send the latest frame, a produced one, or a
+	 * copy of the last one.
+	 */
+	void OnTick( uint64_t uDeadline )
+	{
+		ConfigReader mConfig( *this );
+		const StreamConfig* pConfig = mConfig.Get();
+		if( m_mProducer.funcProduce != NULL && m_pPendingFrame.load() == NULL )
+		{
+			// the frame goes the same way as SET_VIRTUAL_STREAM_IMAGE
+			OniFrame* pFrame = CreateeNewFrame( pConfig );
+			if( pFrame != NULL )
+			{
+				if( m_mProducer.funcProduce( pFrame, m_mProducer.pCookie ) )
+					SendNewFrame( pConfig, pFrame );
+				else
+					getServices().releaseFrame( pFrame );
+			}
+		}
+
+		OniFrame* pFrame = m_pPendingFrame.exchange( NULL );
+		if( pFrame == NULL && m_pLastFrame != NULL )
+			pFrame = RepeatFrame( pConfig, m_pLastFrame );
+		if( pFrame == NULL )
+			return;
+
+		if( pConfig->eTimestampMode == VIRTUAL_TIMESTAMP_HOST )
+			pFrame->timestamp = uDeadline;
+
+		// hold the frame to send it again if the producer is late
+		getServices().addFrameRef( pFrame );
+		if( m_pLastFrame != NULL )
+			getServices().releaseFrame( m_pLastFrame );
+		m_pLastFrame = pFrame;
+
+		EmitFrame( pFrame );
+	}
+
+	/**
+	 * Create a new frame with the content of given frame
+	 */
+	OniFrame* RepeatFrame( const StreamConfig* pConfig, const OniFrame* pSource )
+	{
+		if( pSource->videoMode.pixelFormat != pConfig->mVideoMode.pixelFormat ||
+			pSource->videoMode.resolutionX != pConfig->mVideoMode.resolutionX ||
+			pSource->videoMode.resolutionY != pConfig->mVideoMode.resolutionY )
+			return NULL;
+
+		// the pyramid is copied with the data
+		size_t uCopySize = size_t( pSource->dataSize );
+		if( pConfig->uPyramidSize > 0 )
+			uCopySize = AlignPyramid( uCopySize ) + pConfig->uPyramidSize;
+
+		OniFrame* pFrame = CreateeNewFrame( pConfig, true );
+		if( pFrame != NULL )
+		{
+			if( size_t( pFrame->dataSize ) < uCopySize )
+			{
+				getServices().releaseFrame( pFrame );
+				return NULL;
+			}
+
+			memcpy( pFrame->data, pSource->data, uCopySize );
+			pFrame->videoMode		= pSource->videoMode;
+			pFrame->dataSize		= pSource->dataSize;
+			pFrame->width			= pSource->width;
+			pFrame->height			= pSource->height;
+			pFrame->croppingEnabled	= pSource->croppingEnabled;
+			pFrame->cropOriginX		= pSource->cropOriginX;
+			pFrame->cropOriginY		= pSource->cropOriginY;
+			pFrame->stride			= pSource->stride;
+			pFrame->timestamp		= pSource->timestamp + m_Pacer.GetPeriod();
+			m_Statistics.OnRepeat( pFrame->frameIndex );
+		}
+		return pFrame;
+	}
+
+	/**
+	 * Stop the pacer thread, and release the frames it holds
+	 */
+	void StopPacer()
+	{
+		m_Pacer.Stop();
+
+		OniFrame* pFrame = m_pPendingFrame.exchange( NULL );
+		if( pFrame != NULL )
+			DropFrame( pFrame );
+
+		if( m_pLastFrame != NULL )
+		{
+			getServices().releaseFrame( m_pLastFrame );
+			m_pLastFrame = NULL;
+		}
+	}
+
+	/**
+	 * Send the frame to OpenNI, and release it
+	 */
+	void DispatchFrame( OniFrame* pFrame )
+	{
+		uint64_t uStart = m_Statistics.OnRaise( pFrame->frameIndex );
+		int iFrameIndex = pFrame->frameIndex;
+		raiseNewFrame( pFrame );
+		if( m_iDerivedNum.load() > 0 )
+			SendToDerived( pFrame );
+		getServices().releaseFrame( pFrame );
+
+		if( g_FrameTracer.IsEnabled() )
+			g_FrameTracer.Record( FrameTracer::TRACE_RAISE, m_iTraceId, iFrameIndex, uStart, GetHostTimestamp() - uStart );
+	}
+
+	/**
+	 * Give the sent frame to the derived streams
+	 */
+	void SendToDerived( OniFrame* pFrame )
+	{
+		xnOSEnterCriticalSection( &m_hDerivedLock );
+		for( auto itTarget = m_vDerived.begin(); itTarget != m_vDerived.end(); ++ itTarget )
+			(*itTarget)->OnSourceFrame( this, pFrame );
+		xnOSLeaveCriticalSection( &m_hDerivedLock );
+	}
+
+	/**
+	 * Release the frame which won't be sent
+	 */
+	void DropFrame( OniFrame* pFrame )
+	{
+		m_Statistics.OnDrop();
+		getServices().releaseFrame( pFrame );
+	}
+
+protected:
+	std::atomic<bool>	m_bStarted;
+	bool			m_bConfigDone;
+	bool			m_bAsyncDispatch;
+	bool			m_bPacedEmission;
+
+	VirtualFrameProducer	m_mProducer;
+	std::atomic<OniFrame*>	m_pPendingFrame;
+	OniFrame*				m_pLastFrame;
+
+	FrameSynchronizer*		m_pFrameSync;
+	int						m_iSyncSlot;
+	DepthRegistration*		m_pRegistration;
+
+	std::vector<DerivedTarget*>	m_vDerived;
+	std::atomic<int>			m_iDerivedNum;
+	XN_CRITICAL_SECTION_HANDLE	m_hDerivedLock;
+
+	std::atomic<const StreamConfig*>			m_pConfig;			// read by ConfigReader
+	mutable EpochReclaimer<const StreamConfig>	m_ConfigReclaimer;	// frees the replaced snapshots
+	XN_CRITICAL_SECTION_HANDLE					m_hConfigLock;
+
+	std::atomic<int64_t>	m_iTimestampOffset;
+	std::atomic<bool>		m_bOffsetValid;
+
+	OniSensorType		m_eSensorType;
+	std::atomic<int>	m_iFrameId;
+
+	oni::driver::DriverServices&	m_rDriverServices;
+	PropertyPool					m_Properties;
+	FrameBufferAllocator*			m_pAllocator;
+	FrameDispatcher					m_Dispatcher;
+	FramePacer						m_Pacer;
+	StreamStatistics				m_Statistics;
+	DepthFilterChain				m_Filters;
+	int								m_iTraceId;
+
+private:
+	OpenNIVirtualStream( const OpenNIVirtualStream& );
+	void operator=( const OpenNIVirtualStream& );
+};
+
+/**
+ * The stream which builds its frames from the frames of the depth and color
+ * streams of device, when they are sent; so the repeated or synchronized
+ * frames are used too. It can hold the latest frame of each source.
+ */
+class OpenNIVirtualDerivedStream : public oni::driver::StreamBase, protected OpenNIVirtualStream::DerivedTarget
+{
+public:
+	/**
+	 * Constructor
+	 */
+	OpenNIVirtualDerivedStream( oni::driver::DriverServices& driverServices ) : oni::driver::StreamBase(), m_rDriverServices(driverServices), m_Properties(driverServices)
+	{
+		m_pDepthStream	= NULL;
+		m_pColorStream	= NULL;
+		m_bStarted		= false;
+		for( int i = 0; i < SLOT_NUM; ++ i )
+			m_apHeld[i] = NULL;
+
+		xnOSCreateCriticalSection( &m_hHeldLock );
+	}
+
+	/**
+	 * Destructor, the derived class must stop first
+	 */
+	virtual ~OpenNIVirtualDerivedStream()
+	{
+		xnOSCloseCriticalSection( &m_hHeldLock );
+	}
+
+	/**
+	 * Set the depth and color streams of device, which may be NULL; called
+	 * when they are created or destroyed.
+	 */
+	void SetSources( OpenNIVirtualStream* pDepthStream, OpenNIVirtualStream* pColorStream )
+	{
+		if( m_bStarted )
+			Detach();
+		m_pDepthStream = pDepthStream;
+		m_pColorStream = pColorStream;
+		if( m_bStarted )
+			Attach();
+	}
+
+	/**
+	 * Start building frames, needs the depth stream (and color stream)
+	 */
+	OniStatus start()
+	{
+		if( m_pDepthStream == NULL || ( NeedColor() && m_pColorStream == NULL ) )
+		{
+			m_rDriverServices.errorLoggerAppend( NeedColor() ? "The stream needs the depth and color streams of device" : "The stream needs the depth stream of device" );
+			return ONI_STATUS_ERROR;
+		}
+
+		if( !m_bStarted )
+			Attach();
+		m_bStarted = true;
+		return ONI_STATUS_OK;
+	}
+
+	/**
+	 * Stop building frames
+	 */
+	void stop()
+	{
+		if( m_bStarted )
+			Detach();
+		m_bStarted = false;
+	}
+
+	OniBool isPropertySupported( int )
+	{
+		return true;
+	}
+
+protected:
+	// slot of held frames
+	static const int SLOT_DEPTH	= 0;
+	static const int SLOT_COLOR	= 1;
+	static const int SLOT_NUM	= 2;
+
+	/**
+	 * If the frames of color stream are used, and if it must exist
+	 */
+	virtual bool UseColor() const = 0;
+	virtual bool NeedColor() const
+	{
+		return false;
+	}
+
+	/**
+	 * Send the frames of depth (and color) stream here
+	 */
+	void Attach()
+	{
+		if( m_pDepthStream != NULL )
+			m_pDepthStream->AddDerived( this );
+		if( m_pColorStream != NULL && UseColor() )
+			m_pColorStream->AddDerived( this );
+	}
+
+	/**
+	 * Stop getting frames, and release the held frames
+	 */
+	void Detach()
+	{
+		for( int i = 0; i < SLOT_NUM; ++ i )
+		{
+			OpenNIVirtualStream* pSource = GetSource( i );
+			if( pSource != NULL )
+			{
+				pSource->RemoveDerived( this );
+				if( m_apHeld[i] != NULL )
+					pSource->ReleaseFrame( m_apHeld[i] );
+			}
+			m_apHeld[i] = NULL;
+		}
+	}
+
+	OpenNIVirtualStream* GetSource( int iSlot ) const
+	{
+		return ( iSlot == SLOT_DEPTH ? m_pDepthStream : m_pColorStream );
+	}
+
+	bool GetDepthVideoMode( OniVideoMode& rVideoMode )
+	{
+		int iSize = sizeof( rVideoMode );
+		return m_pDepthStream != NULL && m_pDepthStream->getProperty( ONI_STREAM_PROPERTY_VIDEO_MODE, &rVideoMode, &iSize ) == ONI_STATUS_OK;
+	}
+
+	/**
+	 * Hold the frame as the latest one of slot, and release the last one
+	 */
+	void HoldLatest( int iSlot, OniFrame* pFrame )
+	{
+		OpenNIVirtualStream* pSource = GetSource( iSlot );
+		pSource->HoldFrame( pFrame );
+		xnOSEnterCriticalSection( &m_hHeldLock );
+		OniFrame* pLast = m_apHeld[iSlot];
+		m_apHeld[iSlot] = pFrame;
+		xnOSLeaveCriticalSection( &m_hHeldLock );
+		if( pLast != NULL )
+			pSource->ReleaseFrame( pLast );
+	}
+
+	/**
+	 * The held frame of slot with a new reference, which must be released
+	 * by GetSource( iSlot )->ReleaseFrame(); NULL if there is none
+	 */
+	OniFrame* GetHeld( int iSlot )
+	{
+		xnOSEnterCriticalSection( &m_hHeldLock );
+		OniFrame* pFrame = m_apHeld[iSlot];
+		if( pFrame != NULL )
+			GetSource( iSlot )->HoldFrame( pFrame );
+		xnOSLeaveCriticalSection( &m_hHeldLock );
+		return pFrame;
+	}
+
+protected:
+	std::atomic<bool>		m_bStarted;
+	OpenNIVirtualStream*	m_pDepthStream;
+	OpenNIVirtualStream*	m_pColorStream;
+
+	OniFrame*					m_apHeld[SLOT_NUM];
+	XN_CRITICAL_SECTION_HANDLE	m_hHeldLock;
+
+	oni::driver::DriverServices&	m_rDriverServices;
+	PropertyPool					m_Properties;
+
+private:
+	OpenNIVirtualDerivedStream( const OpenNIVirtualDerivedStream& );
+	void operator=( const OpenNIVirtualDerivedStream& );
+};
+
+/**
+ * The point cloud stream of VIRTUAL_SENSOR_POINT_CLOUD. It builds a frame
+ * when the depth stream of the device sends one; for XYZRGB, it holds the
+ * latest frame of color stream.
+ */
+class OpenNIVirtualPointStream : public OpenNIVirtualDerivedStream
+{
+public:
+	/**
+	 * Constructor
+	 */
+	OpenNIVirtualPointStream( oni::driver::DriverServices& driverServices ) : OpenNIVirtualDerivedStream(driverServices)
+	{
+		m_eFormat		= VIRTUAL_PIXEL_FORMAT_POINT_XYZ;
+		m_bCompact		= true;
+
+		// the rays are built for the first frame
+		m_iRayWidth				= 0;
+		m_iRayHeight			= 0;
+		m_uHorizontalVersion	= 0;
+		m_uVerticalVersion		= 0;
+	}
+
+	/**
+	 * Destructor
+	 */
+	~OpenNIVirtualPointStream()
+	{
+		stop();
+	}
+
+	/**
+	 * Size of the points of depth video mode
+	 */
+	int getRequiredFrameSize()
+	{
+		OniVideoMode mVideoMode;
+		if( !GetDepthVideoMode( mVideoMode ) )
+			return getServices().getDefaultRequiredFrameSize();
+		return int( mVideoMode.resolutionX * GetPointSize( m_eFormat ) * mVideoMode.resolutionY + POINT_ROW_PADDING );
+	}
+
+	/**
+	 * get property
+	 */
+	OniStatus getProperty( int propertyId, void* data, int* pDataSize )
+	{
+		switch( propertyId )
+		{
+		case ONI_STREAM_PROPERTY_VIDEO_MODE:
+			{
+				OniVideoMode mVideoMode;
+				if( !GetDepthVideoMode( mVideoMode ) )
+				{
+					mVideoMode.resolutionX	= 0;
+					mVideoMode.resolutionY	= 0;
+					mVideoMode.fps			= 0;
+				}
+				mVideoMode.pixelFormat = m_eFormat;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mVideoMode ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case ONI_STREAM_PROPERTY_HORIZONTAL_FOV:
+		case ONI_STREAM_PROPERTY_VERTICAL_FOV:
+			if( m_pDepthStream != NULL )
+				return m_pDepthStream->getProperty( propertyId, data, pDataSize );
+			m_rDriverServices.errorLoggerAppend( "Point cloud stream needs the depth stream of device" );
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_POINT_COMPACT:
+			{
+				OniBool bCompact = m_bCompact.load();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, bCompact ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		default:
+			if( m_Properties.GetProperty( propertyId, data, pDataSize ) )
+				return ONI_STATUS_OK;
+		}
+		return ONI_STATUS_ERROR;
+	}
+
+	/**
+	 * set property
+	 */
+	OniStatus setProperty( int propertyId, const void* data, int dataSize )
+	{
+		switch( propertyId )
+		{
+		case ONI_STREAM_PROPERTY_VIDEO_MODE:
+			{
+				// the resolution and fps follow the depth stream
+				OniVideoMode mVideoMode;
+				if( SetProperty( m_rDriverServices, dataSize, data, mVideoMode ) )
+				{
+					if( m_bStarted )
+					{
+						m_rDriverServices.errorLoggerAppend( "Point format can only be changed when the stream is stopped" );
+						return ONI_STATUS_ERROR;
+					}
+					if( GetPointProjector( mVideoMode.pixelFormat ) == NULL )
+					{
+						m_rDriverServices.errorLoggerAppend( "Unsupported point format: %d", mVideoMode.pixelFormat );
+						return ONI_STATUS_ERROR;
+					}
+					m_eFormat = mVideoMode.pixelFormat;
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_STREAM_PROPERTY_POINT_COMPACT:
+			{
+				OniBool bCompact = TRUE;
+				if( SetProperty( m_rDriverServices, dataSize, data, bCompact ) )
+				{
+					m_bCompact = ( bCompact != FALSE );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		default:
+			if( m_Properties.SetProperty( propertyId, data, dataSize ) )
+				return ONI_STATUS_OK;
+		}
+		return ONI_STATUS_ERROR;
+	}
+
+protected:
+	bool UseColor() const
+	{
+		return m_eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB;
+	}
+
+	/**
+	 * Called when the depth or color stream sends a frame
+	 */
+	void OnSourceFrame( OpenNIVirtualStream* pSource, OniFrame* pFrame )
+	{
+		if( pSource == m_pColorStream )
+		{
+			HoldLatest( SLOT_COLOR, pFrame );
+		}
+		else if( pSource == m_pDepthStream )
+		{
+			SendPoints( pFrame );
+		}
+	}
+
+	/**
+	 * Rebuild the rays if the resolution or FOV of depth stream is changed
+	 */
+	bool UpdateRays( const OniVideoMode& rVideoMode )
+	{
+		unsigned int uHorizontal	= m_pDepthStream->GetPropertyVersion( ONI_STREAM_PROPERTY_HORIZONTAL_FOV );
+		unsigned int uVertical		= m_pDepthStream->GetPropertyVersion( ONI_STREAM_PROPERTY_VERTICAL_FOV );
+		if( uHorizontal == m_uHorizontalVersion && uVertical == m_uVerticalVersion &&
+			rVideoMode.resolutionX == m_iRayWidth && rVideoMode.resolutionY == m_iRayHeight )
+			return m_iRayWidth > 0;
+
+		float fHorizontal = 0, fVertical = 0;
+		int iSize = sizeof( float );
+		if( m_pDepthStream->getProperty( ONI_STREAM_PROPERTY_HORIZONTAL_FOV, &fHorizontal, &iSize ) != ONI_STATUS_OK ||
+			m_pDepthStream->getProperty( ONI_STREAM_PROPERTY_VERTICAL_FOV, &fVertical, &iSize ) != ONI_STATUS_OK )
+			return false;
+
+		BuildPointRays( rVideoMode.resolutionX, rVideoMode.resolutionY, fHorizontal, fVertical, m_mRays );
+		m_iRayWidth				= rVideoMode.resolutionX;
+		m_iRayHeight			= rVideoMode.resolutionY;
+		m_uHorizontalVersion	= uHorizontal;
+		m_uVerticalVersion		= uVertical;
+		return true;
+	}
+
+	/**
+	 * Build the points of depth frame, and send them
+	 */
+	void SendPoints( const OniFrame* pDepth )
+	{
+		if( !IsDepthFormat( pDepth->videoMode.pixelFormat ) || !UpdateRays( pDepth->videoMode ) )
+			return;
+
+		OniPixelFormat eFormat = m_eFormat;
+		size_t uPointSize = GetPointSize( eFormat );
+		OniFrame* pFrame = getServices().acquireFrame();
+		if( pFrame == NULL )
+			return;
+		if( size_t( pFrame->dataSize ) < pDepth->width * uPointSize * pDepth->height + POINT_ROW_PADDING )
+		{
+			getServices().releaseFrame( pFrame );
+			return;
+		}
+
+		// the color frame must have the same pixels
+		OniFrame* pColor = NULL;
+		if( eFormat == VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB )
+		{
+			pColor = GetHeld( SLOT_COLOR );
+			if( pColor != NULL && ( pColor->videoMode.pixelFormat != ONI_PIXEL_FORMAT_RGB888 ||
+				pColor->width != pDepth->width || pColor->height != pDepth->height ||
+				pColor->cropOriginX != pDepth->cropOriginX || pColor->cropOriginY != pDepth->cropOriginY ) )
+			{
+				m_pColorStream->ReleaseFrame( pColor );
+				pColor = NULL;
+			}
+		}
+
+		PointRowProjector funcProject = GetPointProjector( eFormat );
+		float fScale = ( pDepth->videoMode.pixelFormat == ONI_PIXEL_FORMAT_DEPTH_100_UM ? 0.1f : 1.0f );
+		bool bCompact = m_bCompact.load();
+		int iOriginX = ( pDepth->croppingEnabled ? pDepth->cropOriginX : 0 );
+		int iOriginY = ( pDepth->croppingEnabled ? pDepth->cropOriginY : 0 );
+
+		unsigned char* pTarget = static_cast<unsigned char*>( pFrame->data );
+		int iCount = 0;
+		for( int y = 0; y < pDepth->height; ++ y )
+		{
+			const OniDepthPixel* pRow = reinterpret_cast<const OniDepthPixel*>( static_cast<const unsigned char*>( pDepth->data ) + y * pDepth->stride );
+			const OniRGB888Pixel* pColorRow = ( pColor == NULL ? NULL : reinterpret_cast<const OniRGB888Pixel*>( static_cast<const unsigned char*>( pColor->data ) + y * pColor->stride ) );
+			iCount += funcProject( pRow, pColorRow, m_mRays.vRayX.data() + iOriginX, m_mRays.vRayY[iOriginY + y], fScale, pTarget + iCount * uPointSize, pDepth->width, bCompact );
+		}
+		if( pColor != NULL )
+			m_pColorStream->ReleaseFrame( pColor );
+
+		// the compacted points are one row
+		pFrame->frameIndex				= pDepth->frameIndex;
+		pFrame->timestamp				= pDepth->timestamp;
+		pFrame->sensorType				= VIRTUAL_SENSOR_POINT_CLOUD;
+		pFrame->videoMode				= pDepth->videoMode;
+		pFrame->videoMode.pixelFormat	= eFormat;
+		pFrame->croppingEnabled			= pDepth->croppingEnabled;
+		pFrame->cropOriginX				= pDepth->cropOriginX;
+		pFrame->cropOriginY				= pDepth->cropOriginY;
+		pFrame->width					= ( bCompact ? iCount : pDepth->width );
+		pFrame->height					= ( bCompact ? 1 : pDepth->height );
+		pFrame->stride					= int( pFrame->width * uPointSize );
+		pFrame->dataSize				= int( iCount * uPointSize );
+
+		raiseNewFrame( pFrame );
+		getServices().releaseFrame( pFrame );
+	}
+
+protected:
+	OniPixelFormat			m_eFormat;
+	std::atomic<bool>		m_bCompact;
+
+	// the rays of depth video mode, only used by the thread which sends depth frames
+	PointRayTable			m_mRays;
+	int						m_iRayWidth;
+	int						m_iRayHeight;
+	unsigned int			m_uHorizontalVersion;
+	unsigned int			m_uVerticalVersion;
+
+private:
+	OpenNIVirtualPointStream( const OpenNIVirtualPointStream& );
+	void operator=( const OpenNIVirtualPointStream& );
+};
+
+/**
+ * The RGB-D stream of VIRTUAL_SENSOR_RGBD. The depth and color frames of
+ * the same frame index are paired; the frame which comes first is held
+ * until the other one comes, or a newer frame replaces it.
+ */
+class OpenNIVirtualRGBDStream : public OpenNIVirtualDerivedStream
+{
+public:
+	/**
+	 * Constructor
+	 */
+	OpenNIVirtualRGBDStream( oni::driver::DriverServices& driverServices ) : OpenNIVirtualDerivedStream(driverServices)
+	{
+	}
+
+	/**
+	 * Destructor
+	 */
+	~OpenNIVirtualRGBDStream()
+	{
+		stop();
+	}
+
+	/**
+	 * Size of the pixels of depth video mode
+	 */
+	int getRequiredFrameSize()
+	{
+		OniVideoMode mVideoMode;
+		if( !GetDepthVideoMode( mVideoMode ) )
+			return getServices().getDefaultRequiredFrameSize();
+		return int( mVideoMode.resolutionX * sizeof( VirtualRGBDPixel ) * mVideoMode.resolutionY );
+	}
+
+	/**
+	 * get property
+	 */
+	OniStatus getProperty( int propertyId, void* data, int* pDataSize )
+	{
+		switch( propertyId )
+		{
+		case ONI_STREAM_PROPERTY_VIDEO_MODE:
+			{
+				OniVideoMode mVideoMode;
+				if( !GetDepthVideoMode( mVideoMode ) )
 				{
-					if( SendNewFrame( *pFrame ) )
-						return ONI_STATUS_OK;
+					mVideoMode.resolutionX	= 0;
+					mVideoMode.resolutionY	= 0;
+					mVideoMode.fps			= 0;
 				}
+				mVideoMode.pixelFormat = VIRTUAL_PIXEL_FORMAT_RGBD;
+				if( GetProperty( m_rDriverServices, *pDataSize, data, mVideoMode ) )
+					return ONI_STATUS_OK;
 			}
-			else
-			{
-				return ONI_STATUS_ERROR;
-			}
 			break;
+
+		case ONI_STREAM_PROPERTY_HORIZONTAL_FOV:
+		case ONI_STREAM_PROPERTY_VERTICAL_FOV:
+			if( m_pDepthStream != NULL )
+				return m_pDepthStream->getProperty( propertyId, data, pDataSize );
+			m_rDriverServices.errorLoggerAppend( "RGB-D stream needs the depth stream of device" );
+			break;
+
+		default:
+			if( m_Properties.GetProperty( propertyId, data, pDataSize ) )
+				return ONI_STATUS_OK;
 		}
-		return ONI_STATUS_NOT_IMPLEMENTED;
+		return ONI_STATUS_ERROR;
 	}
 
-	OniBool isCommandSupported( int commandId )
+	/**
+	 * set property
+	 */
+	OniStatus setProperty( int propertyId, const void* data, int dataSize )
 	{
-		switch( commandId )
+		switch( propertyId )
 		{
-		case GET_VIRTUAL_STREAM_IMAGE:
-		case SET_VIRTUAL_STREAM_IMAGE:
-			return true;
+		case ONI_STREAM_PROPERTY_VIDEO_MODE:
+			{
+				// the resolution and fps follow the depth stream
+				OniVideoMode mVideoMode;
+				if( SetProperty( m_rDriverServices, dataSize, data, mVideoMode ) )
+				{
+					if( mVideoMode.pixelFormat != VIRTUAL_PIXEL_FORMAT_RGBD )
+					{
+						m_rDriverServices.errorLoggerAppend( "Unsupported RGB-D format: %d", mVideoMode.pixelFormat );
+						return ONI_STATUS_ERROR;
+					}
+					return ONI_STATUS_OK;
+				}
+			}
 			break;
+
+		default:
+			if( m_Properties.SetProperty( propertyId, data, dataSize ) )
+				return ONI_STATUS_OK;
 		}
+		return ONI_STATUS_ERROR;
+	}
 
-		return FALSE;
+protected:
+	bool UseColor() const
+	{
+		return true;
 	}
 
-	void notifyAllProperties()
+	bool NeedColor() const
 	{
-		for( std::map< int,std::vector<unsigned char> >::iterator itProp = m_Properties.m_Data.begin(); itProp != m_Properties.m_Data.end(); ++ itProp )
-			raisePropertyChanged( itProp->first, itProp->second.data(), itProp->second.size() );
+		return true;
 	}
 
-protected:
-	OniFrame* CreateeNewFrame()
+	/**
+	 * Called when the depth or color stream sends a frame; pair it with the
+	 * held frame of the other stream, or hold it
+	 */
+	void OnSourceFrame( OpenNIVirtualStream* pSource, OniFrame* pFrame )
 	{
-		OniFrame* pFrame = getServices().acquireFrame();
-		if( pFrame != NULL )
+		int iSlot = ( pSource == m_pDepthStream ? SLOT_DEPTH : SLOT_COLOR );
+		int iOther = SLOT_NUM - 1 - iSlot;
+
+		OniFrame* pPaired = NULL;
+		OniFrame* pLast = NULL;
+		xnOSEnterCriticalSection( &m_hHeldLock );
+		if( m_apHeld[iOther] != NULL && m_apHeld[iOther]->frameIndex == pFrame->frameIndex )
 		{
-			// update metadata
-			pFrame->frameIndex		= ++m_iFrameId;
-			pFrame->videoMode		= m_mVideoMode;
-			pFrame->width			= m_mVideoMode.resolutionX;
-			pFrame->height			= m_mVideoMode.resolutionY;
-			pFrame->cropOriginX		= pFrame->cropOriginY = 0;
-			pFrame->croppingEnabled	= FALSE;
-			pFrame->sensorType		= m_eSensorType;
-			pFrame->stride			= int( m_uStride );
+			pPaired = m_apHeld[iOther];
+			m_apHeld[iOther] = NULL;
+		}
+		else
+		{
+			pSource->HoldFrame( pFrame );
+			pLast = m_apHeld[iSlot];
+			m_apHeld[iSlot] = pFrame;
+		}
+		xnOSLeaveCriticalSection( &m_hHeldLock );
 
-			time_t	tNow;
-			time( &tNow );
-			pFrame->timestamp		= tNow;
+		if( pLast != NULL )
+			pSource->ReleaseFrame( pLast );
+		if( pPaired != NULL )
+		{
+			if( iSlot == SLOT_DEPTH )
+				SendRGBD( pFrame, pPaired );
+			else
+				SendRGBD( pPaired, pFrame );
+			GetSource( iOther )->ReleaseFrame( pPaired );
 		}
-		return pFrame;
 	}
 
-	bool SendNewFrame( OniFrame* pFrame )
+	/**
+	 * Interleave the pair of frames, and send it; the pair is skipped if
+	 * the frames have different pixels
+	 */
+	void SendRGBD( const OniFrame* pDepth, const OniFrame* pColor )
 	{
-		if( pFrame->videoMode.pixelFormat == m_mVideoMode.pixelFormat &&
-			pFrame->videoMode.resolutionX == m_mVideoMode.resolutionX &&
-			pFrame->videoMode.resolutionY == m_mVideoMode.resolutionY )
+		if( !IsDepthFormat( pDepth->videoMode.pixelFormat ) || pColor->videoMode.pixelFormat != ONI_PIXEL_FORMAT_RGB888 ||
+			pColor->width != pDepth->width || pColor->height != pDepth->height || pColor->croppingEnabled != pDepth->croppingEnabled ||
+			pColor->cropOriginX != pDepth->cropOriginX || pColor->cropOriginY != pDepth->cropOriginY )
+			return;
+
+		OniFrame* pFrame = getServices().acquireFrame();
+		if( pFrame == NULL )
+			return;
+		int iStride = int( pDepth->width * sizeof( VirtualRGBDPixel ) );
+		if( pFrame->dataSize < iStride * pDepth->height )
 		{
-			raiseNewFrame( pFrame );
 			getServices().releaseFrame( pFrame );
-			return true;
+			return;
 		}
-		getServices().releaseFrame( pFrame );
-		return false;
-	}
-
-protected:
-	bool			m_bStarted;
-	bool			m_bConfigDone;
 
-	OniSensorType	m_eSensorType;
-	OniVideoMode	m_mVideoMode;
-	OniCropping		m_mCropping;
+		RGBDRowInterleaver funcInterleave = GetRGBDInterleaver();
+		unsigned char* pTarget = static_cast<unsigned char*>( pFrame->data );
+		for( int y = 0; y < pDepth->height; ++ y )
+		{
+			funcInterleave( reinterpret_cast<const OniDepthPixel*>( static_cast<const unsigned char*>( pDepth->data ) + y * pDepth->stride ),
+				reinterpret_cast<const OniRGB888Pixel*>( static_cast<const unsigned char*>( pColor->data ) + y * pColor->stride ),
+				reinterpret_cast<VirtualRGBDPixel*>( pTarget + y * iStride ), pDepth->width );
+		}
 
-	int				m_iFrameId;
-	size_t			m_uDataSize;
-	size_t			m_uStride;
+		pFrame->frameIndex				= pDepth->frameIndex;
+		pFrame->timestamp				= pDepth->timestamp;
+		pFrame->sensorType				= VIRTUAL_SENSOR_RGBD;
+		pFrame->videoMode				= pDepth->videoMode;
+		pFrame->videoMode.pixelFormat	= VIRTUAL_PIXEL_FORMAT_RGBD;
+		pFrame->croppingEnabled			= pDepth->croppingEnabled;
+		pFrame->cropOriginX				= pDepth->cropOriginX;
+		pFrame->cropOriginY				= pDepth->cropOriginY;
+		pFrame->width					= pDepth->width;
+		pFrame->height					= pDepth->height;
+		pFrame->stride					= iStride;
+		pFrame->dataSize				= iStride * pDepth->height;
 
-	oni::driver::DriverServices&	m_rDriverServices;
-	PropertyPool					m_Properties;
+		raiseNewFrame( pFrame );
+		getServices().releaseFrame( pFrame );
+	}
 
 private:
-	OpenNIVirtualStream( const OpenNIVirtualStream& );
-	void operator=( const OpenNIVirtualStream& );
+	OpenNIVirtualRGBDStream( const OpenNIVirtualRGBDStream& );
+	void operator=( const OpenNIVirtualRGBDStream& );
 };
 
 /**
@@ -447,6 +5660,39 @@ public:
 		m_aSensor[1].pSupportedVideoModes[0].fps			= 1;
 		m_aSensor[1].pSupportedVideoModes[0].pixelFormat	= ONI_PIXEL_FORMAT_RGB888;
 
+		// set IR sensor
+		m_aStream[2] = NULL;
+		m_aSensor[2].sensorType = ONI_SENSOR_IR;
+		m_aSensor[2].numSupportedVideoModes	= 1;
+		// set dummy supported video mode
+		m_aSensor[2].pSupportedVideoModes	= new OniVideoMode[1];
+		m_aSensor[2].pSupportedVideoModes[0].resolutionX	= 1;
+		m_aSensor[2].pSupportedVideoModes[0].resolutionY	= 1;
+		m_aSensor[2].pSupportedVideoModes[0].fps			= 1;
+		m_aSensor[2].pSupportedVideoModes[0].pixelFormat	= ONI_PIXEL_FORMAT_GRAY16;
+
+		// set point cloud sensor, which is built from depth
+		m_pPointStream = NULL;
+		m_aSensor[3].sensorType = VIRTUAL_SENSOR_POINT_CLOUD;
+		m_aSensor[3].numSupportedVideoModes	= 1;
+		// set dummy supported video mode
+		m_aSensor[3].pSupportedVideoModes	= new OniVideoMode[1];
+		m_aSensor[3].pSupportedVideoModes[0].resolutionX	= 1;
+		m_aSensor[3].pSupportedVideoModes[0].resolutionY	= 1;
+		m_aSensor[3].pSupportedVideoModes[0].fps			= 1;
+		m_aSensor[3].pSupportedVideoModes[0].pixelFormat	= VIRTUAL_PIXEL_FORMAT_POINT_XYZ;
+
+		// set RGB-D sensor, which is built from depth and color
+		m_pRGBDStream = NULL;
+		m_aSensor[4].sensorType = VIRTUAL_SENSOR_RGBD;
+		m_aSensor[4].numSupportedVideoModes	= 1;
+		// set dummy supported video mode
+		m_aSensor[4].pSupportedVideoModes	= new OniVideoMode[1];
+		m_aSensor[4].pSupportedVideoModes[0].resolutionX	= 1;
+		m_aSensor[4].pSupportedVideoModes[0].resolutionY	= 1;
+		m_aSensor[4].pSupportedVideoModes[0].fps			= 1;
+		m_aSensor[4].pSupportedVideoModes[0].pixelFormat	= VIRTUAL_PIXEL_FORMAT_RGBD;
+
 		m_bCreated = true;
 	}
 
@@ -471,11 +5717,42 @@ public:
 	 */
 	oni::driver::StreamBase* createStream( OniSensorType sensorType )
 	{
+		if( sensorType == VIRTUAL_SENSOR_POINT_CLOUD )
+		{
+			if( m_pPointStream == NULL )
+			{
+				m_pPointStream = new OpenNIVirtualPointStream( m_rDriverServices );
+				m_pPointStream->SetSources( m_aStream[0], m_aStream[1] );
+			}
+			return m_pPointStream;
+		}
+		if( sensorType == VIRTUAL_SENSOR_RGBD )
+		{
+			if( m_pRGBDStream == NULL )
+			{
+				m_pRGBDStream = new OpenNIVirtualRGBDStream( m_rDriverServices );
+				m_pRGBDStream->SetSources( m_aStream[0], m_aStream[1] );
+			}
+			return m_pRGBDStream;
+		}
+
 		size_t idx = GetSensorIdx( sensorType );
 		if( idx < m_aStream.size() )
 		{
 			if( m_aStream[idx] == NULL )
-				m_aStream[idx] = new OpenNIVirtualStream( sensorType, m_rDriverServices );
+			{
+				const char* aName[] = { "/depth", "/color", "/ir" };
+				std::string sName = std::string( m_pInfo->name ) + aName[idx];
+				m_aStream[idx] = new OpenNIVirtualStream( sensorType, sName, m_rDriverServices );
+
+				// only depth and color are paired
+				if( int( idx ) < FrameSynchronizer::SLOT_NUM )
+					m_aStream[idx]->SetFrameSync( &m_FrameSync, int( idx ) );
+				if( idx == 0 )
+					m_aStream[idx]->SetRegistration( &m_Registration );
+
+				SetDerivedSources();
+			}
 			return m_aStream[idx];
 		}
 
@@ -488,11 +5765,26 @@ public:
 	 */
 	void destroyStream( oni::driver::StreamBase* pStream )
 	{
+		if( pStream == m_pPointStream )
+		{
+			m_pPointStream = NULL;
+			delete pStream;
+			return;
+		}
+		if( pStream == m_pRGBDStream )
+		{
+			m_pRGBDStream = NULL;
+			delete pStream;
+			return;
+		}
+
 		for( auto itStream = m_aStream.begin(); itStream != m_aStream.end(); ++ itStream )
 		{
 			if( *itStream == pStream )
 			{
+				// the derived streams may hold its frame
 				*itStream = NULL;
+				SetDerivedSources();
 				delete pStream;
 				break;
 			}
@@ -520,6 +5812,92 @@ public:
 			}
 			break;
 
+		case VIRTUAL_DEVICE_PROPERTY_TRACE_FILE:
+			{
+				std::string sFile = g_FrameTracer.GetFile();
+				if( int( sFile.size() ) < *pDataSize )
+				{
+					strncpy( reinterpret_cast<char*>( data ), sFile.c_str(), *pDataSize );
+					*pDataSize = int( sFile.size() ) + 1;
+					return ONI_STATUS_OK;
+				}
+				m_rDriverServices.errorLoggerAppend( "The buffer is too small for trace file name" );
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_STATISTICS:
+			{
+				VirtualStreamStatistics* pTotal = PropertyConvert<VirtualStreamStatistics>( m_rDriverServices, *pDataSize, data );
+				if( pTotal != NULL )
+				{
+					memset( pTotal, 0, sizeof(VirtualStreamStatistics) );
+					for( auto itStream = m_aStream.begin(); itStream != m_aStream.end(); ++ itStream )
+					{
+						if( *itStream != NULL )
+						{
+							VirtualStreamStatistics mStats;
+							(*itStream)->GetStatistics( mStats );
+							StreamStatistics::Accumulate( *pTotal, mStats );
+						}
+					}
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC:
+			{
+				int iMode = m_FrameSync.GetMode();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iMode ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC_TOLERANCE:
+			{
+				int iTolerance = int( m_FrameSync.GetTolerance() );
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iTolerance ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_KERNEL_VARIANT:
+			{
+				int iVariant = GetKernelVariant();
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iVariant ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION:
+			{
+				int iMode = ( m_Registration.IsEnabled() ? ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR : ONI_IMAGE_REGISTRATION_OFF );
+				if( GetProperty( m_rDriverServices, *pDataSize, data, iMode ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS:
+		case VIRTUAL_DEVICE_PROPERTY_COLOR_INTRINSICS:
+			{
+				VirtualCameraIntrinsics mIntrinsics;
+				if( !m_Registration.GetIntrinsics( propertyId == VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS, mIntrinsics ) )
+					m_rDriverServices.errorLoggerAppend( "The intrinsics are not set" );
+				else if( GetProperty( m_rDriverServices, *pDataSize, data, mIntrinsics ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_DEPTH_TO_COLOR:
+			{
+				VirtualCameraExtrinsics mExtrinsics;
+				if( !m_Registration.GetExtrinsics( mExtrinsics ) )
+					m_rDriverServices.errorLoggerAppend( "The extrinsics are not set" );
+				else if( GetProperty( m_rDriverServices, *pDataSize, data, mExtrinsics ) )
+					return ONI_STATUS_OK;
+			}
+			break;
+
 		default:
 			m_rDriverServices.errorLoggerAppend( "Unknown property: %d\n", propertyId );
 			std::cerr << " >>> Request Device Property: " << propertyId << std::endl;
@@ -528,6 +5906,173 @@ public:
 		return ONI_STATUS_ERROR;
 	}
 
+	/**
+	 * set Property
+	 */
+	OniStatus setProperty( int propertyId, const void* data, int dataSize )
+	{
+		switch( propertyId )
+		{
+		case VIRTUAL_DEVICE_PROPERTY_TRACE_FILE:
+			{
+				// empty string stop tracing and write the file
+				std::string sFile( reinterpret_cast<const char*>( data ), strnlen( reinterpret_cast<const char*>( data ), dataSize ) );
+				if( !g_FrameTracer.Stop() )
+					m_rDriverServices.errorLoggerAppend( "Can't write trace file" );
+
+				if( !sFile.empty() )
+					g_FrameTracer.Start( sFile );
+				return ONI_STATUS_OK;
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC:
+			{
+				int iMode = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iMode ) )
+				{
+					switch( iMode )
+					{
+					case VIRTUAL_FRAME_SYNC_OFF:
+					case VIRTUAL_FRAME_SYNC_TIMESTAMP:
+						m_FrameSync.SetMode( VirtualFrameSyncMode( iMode ) );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Unknown frame sync mode: %d", iMode );
+				}
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC_TOLERANCE:
+			{
+				int iTolerance = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iTolerance ) && iTolerance >= 0 )
+				{
+					m_FrameSync.SetTolerance( iTolerance );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		case ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION:
+			{
+				int iMode = 0;
+				if( SetProperty( m_rDriverServices, dataSize, data, iMode ) )
+				{
+					if( !isImageRegistrationModeSupported( OniImageRegistrationMode( iMode ) ) )
+					{
+						m_rDriverServices.errorLoggerAppend( "Unknown image registration mode: %d", iMode );
+						return ONI_STATUS_BAD_PARAMETER;
+					}
+					if( m_Registration.SetEnabled( iMode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR ) )
+						return ONI_STATUS_OK;
+					m_rDriverServices.errorLoggerAppend( "Image registration needs the intrinsics of depth and color, and the extrinsics" );
+				}
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS:
+		case VIRTUAL_DEVICE_PROPERTY_COLOR_INTRINSICS:
+			{
+				VirtualCameraIntrinsics mIntrinsics;
+				if( SetProperty( m_rDriverServices, dataSize, data, mIntrinsics ) )
+				{
+					if( DepthRegistration::IsIntrinsicsValid( mIntrinsics ) )
+					{
+						m_Registration.SetIntrinsics( propertyId == VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS, mIntrinsics );
+						return ONI_STATUS_OK;
+					}
+					m_rDriverServices.errorLoggerAppend( "Invalid intrinsics: %dx%d, f = ( %f, %f )", mIntrinsics.iWidth, mIntrinsics.iHeight, mIntrinsics.fFx, mIntrinsics.fFy );
+					return ONI_STATUS_BAD_PARAMETER;
+				}
+			}
+			break;
+
+		case VIRTUAL_DEVICE_PROPERTY_DEPTH_TO_COLOR:
+			{
+				VirtualCameraExtrinsics mExtrinsics;
+				if( SetProperty( m_rDriverServices, dataSize, data, mExtrinsics ) )
+				{
+					m_Registration.SetExtrinsics( mExtrinsics );
+					return ONI_STATUS_OK;
+				}
+			}
+			break;
+
+		default:
+			m_rDriverServices.errorLoggerAppend( "Unknown property: %d\n", propertyId );
+			return ONI_STATUS_NOT_IMPLEMENTED;
+		}
+		return ONI_STATUS_ERROR;
+	}
+
+	/**
+	 * invoke command
+	 */
+	OniStatus invoke( int commandId, void* data, int dataSize )
+	{
+		switch( commandId )
+		{
+		case SET_VIRTUAL_DEVICE_FRAME_SET:
+			{
+				VirtualFrameSet* pSet = PropertyConvert<VirtualFrameSet>( m_rDriverServices, dataSize, data );
+				if( pSet != NULL && pSet->pDepth != NULL && pSet->pColor != NULL )
+				{
+					OpenNIVirtualStream* pDepthStream = m_aStream[0];
+					OpenNIVirtualStream* pColorStream = m_aStream[1];
+					if( pDepthStream == NULL || pColorStream == NULL )
+					{
+						// the frame can only come from the existed stream
+						if( pDepthStream != NULL )
+							pDepthStream->RejectFrame( pSet->pDepth );
+						if( pColorStream != NULL )
+							pColorStream->RejectFrame( pSet->pColor );
+						m_rDriverServices.errorLoggerAppend( "Frame set needs both depth and color streams" );
+						return ONI_STATUS_ERROR;
+					}
+
+					// both frames are processed with the snapshots they are checked with
+					OpenNIVirtualStream::ConfigReader mDepthConfig( *pDepthStream ), mColorConfig( *pColorStream );
+					if( !OpenNIVirtualStream::IsFrameValid( mDepthConfig.Get(), pSet->pDepth ) || !OpenNIVirtualStream::IsFrameValid( mColorConfig.Get(), pSet->pColor ) )
+					{
+						pDepthStream->RejectFrame( pSet->pDepth );
+						pColorStream->RejectFrame( pSet->pColor );
+						m_rDriverServices.errorLoggerAppend( "The frames of frame set don't match the video modes" );
+						return ONI_STATUS_BAD_PARAMETER;
+					}
+
+					uint64_t uTimestamp = pDepthStream->GetFrameSetTimestamp( mDepthConfig.Get(), pSet->uTimestamp );
+					OniFrame* pDepth = pDepthStream->PrepareSetFrame( mDepthConfig.Get(), pSet->pDepth, uTimestamp );
+					OniFrame* pColor = pColorStream->PrepareSetFrame( mColorConfig.Get(), pSet->pColor, uTimestamp );
+					if( pDepth != NULL && pColor != NULL && m_FrameSync.SubmitSet( pDepth, pColor ) )
+						return ONI_STATUS_OK;
+
+					if( pDepth != NULL )
+						pDepthStream->RejectFrame( pDepth );
+					if( pColor != NULL )
+						pColorStream->RejectFrame( pColor );
+					m_rDriverServices.errorLoggerAppend( "Frame set needs both depth and color streams started" );
+					return ONI_STATUS_ERROR;
+				}
+			}
+			break;
+		}
+		return ONI_STATUS_NOT_IMPLEMENTED;
+	}
+
+	OniBool isCommandSupported( int commandId )
+	{
+		return commandId == SET_VIRTUAL_DEVICE_FRAME_SET;
+	}
+
+	/**
+	 * Depth to color registration is done in driver, see VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS
+	 */
+	OniBool isImageRegistrationModeSupported( OniImageRegistrationMode mode )
+	{
+		return mode == ONI_IMAGE_REGISTRATION_OFF || mode == ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR;
+	}
+
 	/**
 	 * make sure if this device is created
 	 */
@@ -537,6 +6082,17 @@ public:
 	}
 
 protected:
+	/**
+	 * Give the depth and color streams to the streams built from them
+	 */
+	void SetDerivedSources()
+	{
+		if( m_pPointStream != NULL )
+			m_pPointStream->SetSources( m_aStream[0], m_aStream[1] );
+		if( m_pRGBDStream != NULL )
+			m_pRGBDStream->SetSources( m_aStream[0], m_aStream[1] );
+	}
+
 	size_t GetSensorIdx( OniSensorType sensorType )
 	{
 		switch( sensorType )
@@ -546,6 +6102,9 @@ protected:
 
 		case ONI_SENSOR_COLOR:
 			return 1;
+
+		case ONI_SENSOR_IR:
+			return 2;
 		}
 		return 100;
 	}
@@ -556,8 +6115,12 @@ private:
 
 	bool			m_bCreated;
 	OniDeviceInfo*	m_pInfo;
-	std::array<OniSensorInfo,2>			m_aSensor;
-	std::array<OpenNIVirtualStream*,2>	m_aStream;
+	std::array<OniSensorInfo,5>			m_aSensor;
+	std::array<OpenNIVirtualStream*,3>	m_aStream;
+	OpenNIVirtualPointStream*			m_pPointStream;
+	OpenNIVirtualRGBDStream*			m_pRGBDStream;
+	FrameSynchronizer					m_FrameSync;
+	DepthRegistration					m_Registration;
 	oni::driver::DriverServices&		m_rDriverServices;
 };
 
@@ -585,6 +6148,14 @@ public:
 							oni::driver::DeviceStateChangedCallback deviceStateChangedCallback,
 							void* pCookie )
 	{
+		// enable frame tracing by environment variable
+		XnChar szTraceFile[XN_FILE_MAX_PATH];
+		if( xnOSGetEnvironmentVariable( "VIRTUAL_DEVICE_TRACE", szTraceFile, sizeof(szTraceFile) ) == XN_STATUS_OK && szTraceFile[0] != '\0' )
+			g_FrameTracer.Start( szTraceFile );
+
+		// choose the pixel kernels for this CPU once
+		GetKernelVariant();
+
 		return oni::driver::DriverBase::initialize( connectedCallback, disconnectedCallback, deviceStateChangedCallback, pCookie );
 	}
 
@@ -685,6 +6256,8 @@ public:
 	 */
 	void shutdown()
 	{
+		g_FrameTracer.Stop();
+
 		for( auto itDevice = m_mDevices.begin(); itDevice != m_mDevices.end(); ++ itDevice )
 		{
 			auto& rDeviceData = itDevice->second;
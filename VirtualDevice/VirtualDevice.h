@@ -8,6 +8,550 @@
 
 #pragma once
 
+// OpenNI Header
+#include "OniCTypes.h"
+
 // definition of customized property
-#define GET_VIRTUAL_STREAM_IMAGE	100000
-#define SET_VIRTUAL_STREAM_IMAGE	100001
+#define GET_VIRTUAL_STREAM_IMAGE			100000
+#define SET_VIRTUAL_STREAM_IMAGE			100001
+#define SET_VIRTUAL_STREAM_EXTERNAL_IMAGE	100002
+// When ONI_STREAM_PROPERTY_CROPPING is enabled, the frame got by GET is still
+// full size; it's cropped to a tightly packed frame of the window in place
+// when it's set, unless the producer set croppingEnabled of the frame.
+// A depth stream also accepts the frame of the other depth unit: set
+// videoMode.pixelFormat of the frame to ONI_PIXEL_FORMAT_DEPTH_100_UM (or
+// DEPTH_1_MM) before set it, and it's converted to the video mode in place.
+// When ONI_STREAM_PROPERTY_MIRRORING is enabled, the frame is flipped when
+// it's set, so the producer always fill the unmirrored image; the cropping
+// window is in the mirrored image.
+// The buffer of SET_VIRTUAL_STREAM_EXTERNAL_IMAGE is modified the same way:
+// depth of the other unit is converted in it; unless the frame is converted
+// to another format, undistorted or resized to a new frame, it's also
+// mirrored, cropped, registered, filtered and gets the pyramid in the buffer
+// of caller, so the stride and dataSize of frame may change.
+
+// device command to send a depth and a color frame as one set (VirtualFrameSet)
+#define SET_VIRTUAL_DEVICE_FRAME_SET		100003
+
+// performance counters (VirtualStreamStatistics, read only) of a stream,
+// and the sum of all streams of a device
+#define VIRTUAL_STREAM_PROPERTY_STATISTICS	100010
+#define VIRTUAL_DEVICE_PROPERTY_STATISTICS	100011
+
+// file name (char string) to write the frame lifecycle trace in Chrome trace
+// event format; set an empty string to stop tracing and write the file.
+// Tracing can also be enabled by environment variable VIRTUAL_DEVICE_TRACE.
+#define VIRTUAL_DEVICE_PROPERTY_TRACE_FILE	100012
+
+// pairing of depth and color frames set from different threads:
+// FRAME_SYNC is int (VirtualFrameSyncMode), FRAME_SYNC_TOLERANCE is the max
+// difference of timestamps (int, microsecond) of a pair, default 16000.
+#define VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC				100013
+#define VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC_TOLERANCE	100014
+
+// pixel kernel implementation (int, VirtualKernelVariant, read only) chosen
+// for the CPU when the driver is loaded. Kernels without this variant use the
+// nearest one below it (AVX512 > AVX2 > SSSE3 > SCALAR, NEON > SCALAR).
+// It can be limited by environment variable VIRTUAL_DEVICE_KERNEL, which is
+// the name of variant, e.g. "scalar".
+#define VIRTUAL_DEVICE_PROPERTY_KERNEL_VARIANT		100015
+
+// calibration of ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION, which can only be
+// set to ONI_IMAGE_REGISTRATION_DEPTH_TO_COLOR after all of them are given.
+// The intrinsics (VirtualCameraIntrinsics) are scaled to the resolution of
+// frames; the extrinsics (VirtualCameraExtrinsics) move depth camera
+// coordinates to color camera. The registered depth frame keeps its size,
+// and its pixels match the color frame scaled to the same size.
+#define VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS	100016
+#define VIRTUAL_DEVICE_PROPERTY_COLOR_INTRINSICS	100017
+#define VIRTUAL_DEVICE_PROPERTY_DEPTH_TO_COLOR		100018
+
+// definition of customized stream property
+// ASYNC_DISPATCH (OniBool) and DISPATCH_QUEUE_DEPTH (int) can only be set when
+// the stream is stopped; with async dispatch, only one thread may set frames.
+// DISPATCH_AFFINITY is the CPU mask (uint64_t) of the dispatcher thread.
+// DISPATCH_DROP_POLICY (int, VirtualDropPolicy) decides what to do when the
+// queue is full; DISPATCH_BLOCK_TIMEOUT (int, ms) is used by VIRTUAL_DROP_BLOCK.
+// TIMESTAMP_MODE (int, VirtualTimestampMode) decides the source of frame timestamp.
+// PACED_EMISSION (OniBool) and FRAME_PRODUCER (VirtualFrameProducer) can only
+// be set when the stream is stopped; see VirtualFrameProducer.
+#define VIRTUAL_STREAM_PROPERTY_FRAME_ALLOCATOR		100100
+#define VIRTUAL_STREAM_PROPERTY_FRAME_POOL_SIZE		100101
+#define VIRTUAL_STREAM_PROPERTY_FRAME_POOL_STATS	100102
+#define VIRTUAL_STREAM_PROPERTY_ASYNC_DISPATCH		100103
+#define VIRTUAL_STREAM_PROPERTY_DISPATCH_QUEUE_DEPTH	100104
+#define VIRTUAL_STREAM_PROPERTY_DISPATCH_AFFINITY	100105
+#define VIRTUAL_STREAM_PROPERTY_DISPATCH_DROP_POLICY	100106
+#define VIRTUAL_STREAM_PROPERTY_DISPATCH_BLOCK_TIMEOUT	100107
+#define VIRTUAL_STREAM_PROPERTY_DISPATCH_STATS		100108
+#define VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MODE		100109
+#define VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MAPPING	100110
+#define VIRTUAL_STREAM_PROPERTY_PACED_EMISSION		100111
+#define VIRTUAL_STREAM_PROPERTY_FRAME_PRODUCER		100112
+
+// ONI_STREAM_PROPERTY_STRIDE can be set (int, bytes, only when the stream is
+// stopped) to the row size of a padded producer buffer, 0 for packed rows.
+// Frames of GET use it, and the producer may also change the stride of a
+// frame before set it (see VirtualExternalFrame::iStride). The stride is kept
+// to the consumers, unless PACKED_OUTPUT (OniBool) is enabled, which move the
+// rows of padded frame together in place when it's set.
+#define VIRTUAL_STREAM_PROPERTY_PACKED_OUTPUT		100113
+
+// pixel layout (int, VirtualInputFormat) of the frames set by producer, can
+// only be set when the stream is stopped. GET give a frame of this layout,
+// and it's converted to the pixel format of video mode when it's set.
+#define VIRTUAL_STREAM_PROPERTY_INPUT_FORMAT		100114
+
+// resolution (VirtualResolution) of the frames set by producer, can only be
+// set when the stream is stopped; 0 for the resolution of video mode. GET
+// give a frame of this size, and it's reduced to the video mode when it's
+// set, by DECIMATION (int, VirtualDecimation, default AVERAGE). The source
+// must be 2 or 4 times the video mode in both axes, except for bilinear,
+// which takes any larger size. Cropping of the producer is not kept.
+#define VIRTUAL_STREAM_PROPERTY_SOURCE_RESOLUTION	100115
+#define VIRTUAL_STREAM_PROPERTY_DECIMATION			100116
+
+// number of pyramid levels (int, 0 to VIRTUAL_PYRAMID_MAX_LEVELS, default 0)
+// built once for each frame when it's set; can only be set when the stream is
+// stopped. Each level is half of the previous one, reduced by 2x2 blocks with
+// the DECIMATION mode (AVERAGE for BILINEAR), so depth levels only use valid
+// depths. The levels are stored after the frame data in the same buffer, see
+// VirtualFramePyramid; external buffers must have the required frame size.
+#define VIRTUAL_STREAM_PROPERTY_PYRAMID_LEVELS		100117
+
+// sensor type of the point cloud stream, which builds its frames from the
+// depth frames (and color frames for XYZRGB) of the same device when they
+// are sent; the rays come from the FOV properties of depth stream. OpenNI
+// keeps the sensors of a device in a small array indexed by type.
+#define VIRTUAL_SENSOR_POINT_CLOUD	OniSensorType( 8 )
+
+// pixel formats of point cloud stream, VirtualPointXYZ / VirtualPointXYZRGB in
+// millimeter; the resolution and fps follow the depth stream. For XYZRGB, the
+// color frame must have the same size as depth frame, or the color is 0.
+#define VIRTUAL_PIXEL_FORMAT_POINT_XYZ		OniPixelFormat( 400 )
+#define VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB	OniPixelFormat( 401 )
+
+// skip the points of invalid depth (OniBool, default TRUE), then the frame is
+// one row of the valid points; otherwise it has the size of depth frame, and
+// the invalid points are 0.
+#define VIRTUAL_STREAM_PROPERTY_POINT_COMPACT		100118
+
+// sensor type of the RGB-D stream, which interleaves the depth and color
+// frames of the same device with the same frame index, so it needs frame
+// sync (VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC) or SET_VIRTUAL_DEVICE_FRAME_SET;
+// the frames must have the same size and cropping, and the depth should be
+// registered to color (ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION). The resolution
+// and fps follow the depth stream, the frame index and timestamp are of depth.
+#define VIRTUAL_SENSOR_RGBD		OniSensorType( 9 )
+
+// pixel format of RGB-D stream, VirtualRGBDPixel
+#define VIRTUAL_PIXEL_FORMAT_RGBD	OniPixelFormat( 402 )
+
+// lens distortion (VirtualLensDistortion) of the stream; the frames are
+// undistorted when they are set, before they are resized, mirrored, cropped
+// or registered. Depth takes the nearest pixel and the other formats are
+// bilinear, the pixels out of source are 0. All 0 coefficients disable it;
+// YUV422 formats can't be undistorted.
+#define VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION		100119
+
+// post-processing filters of depth stream, applied in SET after the frame is
+// registered, in the order of VirtualDepthFilter; each one is disabled by
+// default, see the structures for the values. FILTER_THREADS (int, 0 to
+// VIRTUAL_FILTER_MAX_THREADS, can only be set when the stream is stopped)
+// is the number of extra threads filtering the bands of a frame with the
+// thread which sets it. The temporal history restarts when the stream is
+// started or the frame size is changed.
+#define VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER	100120
+#define VIRTUAL_STREAM_PROPERTY_SPATIAL_FILTER		100121
+#define VIRTUAL_STREAM_PROPERTY_TEMPORAL_FILTER		100122
+#define VIRTUAL_STREAM_PROPERTY_HOLE_FILL_FILTER	100123
+#define VIRTUAL_STREAM_PROPERTY_FILTER_THREADS		100124
+
+/**
+ * Callback to give the buffer of SET_VIRTUAL_STREAM_EXTERNAL_IMAGE back to
+ * the caller, after all the consumers released the frame.
+ */
+typedef void (ONI_CALLBACK_TYPE* VirtualFrameReleaseCallback)( void* pData, void* pCookie );
+
+/**
+ * Data of SET_VIRTUAL_STREAM_EXTERNAL_IMAGE.
+ * The driver wrap pData as the frame data directly, without copy, so it's
+ * modified in place like the frames got by GET (see
+ * SET_VIRTUAL_STREAM_EXTERNAL_IMAGE).
+ * Once the frame is created, funcRelease will be called exactly once when
+ * the frame is released: invoke() return OK if the frame is sent, or ERROR
+ * if it's rejected (and funcRelease is called before return). If the buffer
+ * can't be used, invoke() return BAD_PARAMETER and it's still owned by the
+ * caller.
+ */
+struct VirtualExternalFrame
+{
+	void*						pData;
+	int							iDataSize;
+	VirtualFrameReleaseCallback	funcRelease;
+	void*						pCookie;
+	uint64_t					uTimestamp;		// used if timestamp mode is not VIRTUAL_TIMESTAMP_HOST
+	int							iStride;		// row size of pData in bytes, 0 for the stride of stream
+};
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_FRAME_ALLOCATOR (read only).
+ * Pass these to oniStreamSetFrameBuffersAllocator() before start the stream,
+ * to let the driver manage the frame buffers; this is required by
+ * SET_VIRTUAL_STREAM_EXTERNAL_IMAGE.
+ */
+struct VirtualFrameAllocator
+{
+	OniFrameAllocBufferCallback	funcAlloc;
+	OniFrameFreeBufferCallback	funcFree;
+	void*						pCookie;
+};
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_FRAME_POOL_STATS (read only).
+ * The frame buffer pool only work with VIRTUAL_STREAM_PROPERTY_FRAME_ALLOCATOR;
+ * the number of pooled buffers is set by VIRTUAL_STREAM_PROPERTY_FRAME_POOL_SIZE (int).
+ */
+struct VirtualFramePoolStats
+{
+	uint64_t	uHits;
+	uint64_t	uMisses;
+	int			iPoolSize;
+	int			iFreeBuffers;
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_DISPATCH_DROP_POLICY
+ */
+enum VirtualDropPolicy
+{
+	VIRTUAL_DROP_NEWEST	= 0,	// drop the frame being set
+	VIRTUAL_DROP_OLDEST	= 1,	// drop the oldest frame in queue
+	VIRTUAL_DROP_BLOCK	= 2,	// wait until timeout, then drop the frame being set
+};
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_DISPATCH_STATS (read only).
+ */
+struct VirtualDispatchStats
+{
+	uint64_t	uQueued;
+	uint64_t	uDropped;
+	uint64_t	uBlockedTime;	// in microsecond
+	int			iMaxOccupancy;
+	int			iOccupancy;
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MODE
+ */
+enum VirtualTimestampMode
+{
+	VIRTUAL_TIMESTAMP_HOST				= 0,	// monotonic host clock in microsecond, stamped by GET_VIRTUAL_STREAM_IMAGE
+	VIRTUAL_TIMESTAMP_PRODUCER			= 1,	// OniFrame::timestamp written by the producer, unchanged
+	VIRTUAL_TIMESTAMP_PRODUCER_MAPPED	= 2,	// producer timestamp converted to host clock by VirtualTimestampMapping
+};
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_TIMESTAMP_MAPPING.
+ * host time = producer time * dScale + iOffset, in microsecond.
+ * With bAutoOffset, iOffset is estimated from the time the frames arrive,
+ * and reading this property gives the current estimation.
+ */
+struct VirtualTimestampMapping
+{
+	double		dScale;
+	int64_t		iOffset;
+	OniBool		bAutoOffset;
+};
+
+/**
+ * Callback to fill the frame for paced emission; return FALSE if there is no
+ * new data, then the last frame is sent again.
+ */
+typedef OniBool (ONI_CALLBACK_TYPE* VirtualFrameProducerCallback)( OniFrame* pFrame, void* pCookie );
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_FRAME_PRODUCER.
+ * With VIRTUAL_STREAM_PROPERTY_PACED_EMISSION, the driver sends frames at the
+ * fps of video mode by its own timer. For each tick, the latest frame set by
+ * SET_VIRTUAL_STREAM_IMAGE is used; if there is none, funcProduce is called
+ * from the timer thread (if not NULL); if there is still no frame, the last
+ * frame is copied and sent again. funcProduce may be NULL.
+ */
+struct VirtualFrameProducer
+{
+	VirtualFrameProducerCallback	funcProduce;
+	void*							pCookie;
+};
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_STATISTICS and VIRTUAL_DEVICE_PROPERTY_STATISTICS.
+ * Times are in microsecond. Hold time is from GET_VIRTUAL_STREAM_IMAGE to
+ * SET_VIRTUAL_STREAM_IMAGE; latency is from SET to raising the frame to OpenNI.
+ * aLatencyHistogram[i] counts latency in [2^(i-1), 2^i) us, the last one
+ * counts all larger values. uJitter is the smoothed variation of the
+ * interval between SET calls. uRepeated counts the frames sent again by paced
+ * emission, which are not counted in uAcquired. For device, the max values
+ * and jitter are the maximum of all streams.
+ * uFiltered counts the frames through the depth filters, and the filter
+ * times (us) are indexed by VirtualDepthFilter.
+ */
+#define VIRTUAL_LATENCY_BUCKETS	20
+#define VIRTUAL_DEPTH_FILTER_NUM	4
+
+struct VirtualStreamStatistics
+{
+	uint64_t	uAcquired;
+	uint64_t	uSubmitted;
+	uint64_t	uRejected;
+	uint64_t	uDropped;
+	uint64_t	uRaised;
+	uint64_t	uRepeated;
+	uint64_t	uHoldTimeTotal;
+	uint64_t	uHoldTimeMax;
+	uint64_t	uLatencyTotal;
+	uint64_t	uLatencyMax;
+	uint64_t	uJitter;
+	uint64_t	aLatencyHistogram[VIRTUAL_LATENCY_BUCKETS];
+	uint64_t	uFiltered;
+	uint64_t	aFilterTimeTotal[VIRTUAL_DEPTH_FILTER_NUM];
+	uint64_t	aFilterTimeMax[VIRTUAL_DEPTH_FILTER_NUM];
+};
+
+/**
+ * Data of SET_VIRTUAL_DEVICE_FRAME_SET, invoked on the device.
+ * Both frames are got by GET_VIRTUAL_STREAM_IMAGE of the depth and color
+ * streams. They are sent back-to-back with the same frame index and
+ * timestamp; uTimestamp is used if the timestamp mode of depth stream is
+ * not VIRTUAL_TIMESTAMP_HOST. The frames are owned by driver after invoke,
+ * even if it fails.
+ */
+struct VirtualFrameSet
+{
+	OniFrame*	pDepth;
+	OniFrame*	pColor;
+	uint64_t	uTimestamp;
+};
+
+/**
+ * Value of VIRTUAL_DEVICE_PROPERTY_FRAME_SYNC
+ */
+enum VirtualFrameSyncMode
+{
+	VIRTUAL_FRAME_SYNC_OFF			= 0,	// streams send frames independently
+	VIRTUAL_FRAME_SYNC_TIMESTAMP	= 1,	// hold frames until paired with the nearest timestamp, unpaired frames are dropped
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_INPUT_FORMAT; the converted formats need
+ * the video mode of ONI_PIXEL_FORMAT_RGB888, and YUV needs even width.
+ */
+enum VirtualInputFormat
+{
+	VIRTUAL_INPUT_NATIVE	= 0,	// the pixel format of video mode
+	VIRTUAL_INPUT_YUYV		= 1,	// Y0 U Y1 V
+	VIRTUAL_INPUT_UYVY		= 2,	// U Y0 V Y1
+	VIRTUAL_INPUT_BGR		= 3,	// B G R
+	VIRTUAL_INPUT_BGRA		= 4,	// B G R A, alpha is dropped
+};
+
+/**
+ * Value of VIRTUAL_DEVICE_PROPERTY_KERNEL_VARIANT
+ */
+enum VirtualKernelVariant
+{
+	VIRTUAL_KERNEL_SCALAR	= 0,	// portable C++, the reference of the others
+	VIRTUAL_KERNEL_SSSE3	= 1,
+	VIRTUAL_KERNEL_AVX2		= 2,
+	VIRTUAL_KERNEL_AVX512	= 3,	// AVX-512 F and BW
+	VIRTUAL_KERNEL_NEON		= 4,
+};
+
+/**
+ * Data of VIRTUAL_STREAM_PROPERTY_SOURCE_RESOLUTION
+ */
+struct VirtualResolution
+{
+	int	iResolutionX;
+	int	iResolutionY;
+};
+
+/**
+ * Data of a level of VirtualFramePyramid; iOffset is from OniFrame::data
+ */
+struct VirtualPyramidLevel
+{
+	int	iWidth;
+	int	iHeight;
+	int	iStride;
+	int	iOffset;
+};
+
+/**
+ * The pyramid of a frame, at VIRTUAL_FRAME_PYRAMID( pFrame ) if the stream
+ * has VIRTUAL_STREAM_PROPERTY_PYRAMID_LEVELS. aLevels[0] is the half size of
+ * the frame; a level smaller than 1x1 is not built, so iLevels may be less
+ * than the property.
+ */
+#define VIRTUAL_PYRAMID_MAX_LEVELS	6
+#define VIRTUAL_PYRAMID_ALIGNMENT	64
+#define VIRTUAL_FRAME_PYRAMID( pFrame )	reinterpret_cast<const VirtualFramePyramid*>( static_cast<const char*>( ( pFrame )->data ) + ( ( ( pFrame )->dataSize + VIRTUAL_PYRAMID_ALIGNMENT - 1 ) & ~( VIRTUAL_PYRAMID_ALIGNMENT - 1 ) ) )
+
+struct VirtualFramePyramid
+{
+	int					iLevels;
+	VirtualPyramidLevel	aLevels[VIRTUAL_PYRAMID_MAX_LEVELS];
+};
+
+/**
+ * Value of VIRTUAL_DEVICE_PROPERTY_DEPTH_INTRINSICS and COLOR_INTRINSICS,
+ * the pinhole camera of the given resolution, in pixel
+ */
+struct VirtualCameraIntrinsics
+{
+	int		iWidth;
+	int		iHeight;
+	float	fFx;
+	float	fFy;
+	float	fCx;
+	float	fCy;
+};
+
+/**
+ * Value of VIRTUAL_DEVICE_PROPERTY_DEPTH_TO_COLOR; color = R * depth + t,
+ * R is row-major and t is in millimeter
+ */
+struct VirtualCameraExtrinsics
+{
+	float	aRotation[9];
+	float	aTranslation[3];
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_LENS_DISTORTION, the radial (k) and
+ * tangential (p) coefficients of the OpenCV model; the intrinsics are scaled
+ * to the source resolution of frames
+ */
+struct VirtualLensDistortion
+{
+	VirtualCameraIntrinsics	mIntrinsics;
+	float	fK1;
+	float	fK2;
+	float	fP1;
+	float	fP2;
+	float	fK3;
+};
+
+/**
+ * The depth filters, in the order they are applied
+ */
+enum VirtualDepthFilter
+{
+	VIRTUAL_DEPTH_FILTER_FLYING_PIXEL	= 0,
+	VIRTUAL_DEPTH_FILTER_SPATIAL		= 1,
+	VIRTUAL_DEPTH_FILTER_TEMPORAL		= 2,
+	VIRTUAL_DEPTH_FILTER_HOLE_FILL		= 3,
+};
+
+#define VIRTUAL_FILTER_MAX_ITERATIONS	8
+#define VIRTUAL_FILTER_MAX_THREADS		16
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_FLYING_PIXEL_FILTER; a depth is removed
+ * when at least iNeighbors (1 to 8) of its 8 valid neighbors differ from it
+ * by more than iThreshold, in the unit of stream. 0 threshold disables it.
+ */
+struct VirtualFlyingPixelFilter
+{
+	int	iThreshold;
+	int	iNeighbors;
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_SPATIAL_FILTER; each depth is the mean of
+ * itself and the 3x3 neighbors within iDelta of it, so the edges larger than
+ * iDelta are kept. It's repeated iIterations times, 0 disables it.
+ */
+struct VirtualSpatialFilter
+{
+	int	iIterations;
+	int	iDelta;
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_TEMPORAL_FILTER; a depth within iDelta of
+ * the smoothed one is blended as smoothed += fAlpha * ( depth - smoothed ),
+ * otherwise the smoothing restarts from it. A missing depth keeps the
+ * smoothed one for iPersistence (0 to 255) frames. fAlpha is in (0, 1],
+ * 0 disables it.
+ */
+struct VirtualTemporalFilter
+{
+	float	fAlpha;
+	int		iDelta;
+	int		iPersistence;
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_HOLE_FILL_FILTER; a missing depth takes
+ * the farthest (safe for background) or nearest valid one of its 8
+ * neighbors, repeated iIterations (1 to VIRTUAL_FILTER_MAX_ITERATIONS)
+ * times to fill larger holes.
+ */
+enum VirtualHoleFillMode
+{
+	VIRTUAL_HOLE_FILL_OFF		= 0,
+	VIRTUAL_HOLE_FILL_FARTHEST	= 1,
+	VIRTUAL_HOLE_FILL_NEAREST	= 2,
+};
+
+struct VirtualHoleFillFilter
+{
+	int	iMode;		// VirtualHoleFillMode
+	int	iIterations;
+};
+
+/**
+ * Pixels of VIRTUAL_PIXEL_FORMAT_POINT_XYZ and VIRTUAL_PIXEL_FORMAT_POINT_XYZRGB
+ */
+struct VirtualPointXYZ
+{
+	float	fX;
+	float	fY;
+	float	fZ;
+};
+
+struct VirtualPointXYZRGB
+{
+	float			fX;
+	float			fY;
+	float			fZ;
+	OniRGB888Pixel	mColor;
+	unsigned char	uReserved;
+};
+
+/**
+ * Pixel of VIRTUAL_PIXEL_FORMAT_RGBD, 6 bytes; uDepth is in the unit of the
+ * depth stream
+ */
+struct VirtualRGBDPixel
+{
+	OniRGB888Pixel	mColor;
+	unsigned char	uReserved;
+	OniDepthPixel	uDepth;
+};
+
+/**
+ * Value of VIRTUAL_STREAM_PROPERTY_DECIMATION; the depth modes ignore the
+ * invalid (0) depth, and give 0 only if the whole block is invalid. YUV
+ * formats are not supported.
+ */
+enum VirtualDecimation
+{
+	VIRTUAL_DECIMATION_NEAREST	= 0,	// the top-left pixel of block
+	VIRTUAL_DECIMATION_MIN		= 1,	// depth only, the nearest valid depth
+	VIRTUAL_DECIMATION_MEDIAN	= 2,	// depth only, the median (the lower one for even count) of valid depths
+	VIRTUAL_DECIMATION_AVERAGE	= 3,	// the mean of valid depths, or of color channels
+	VIRTUAL_DECIMATION_BILINEAR	= 4,	// color and gray only, any ratio
+};